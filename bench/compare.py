@@ -0,0 +1,46 @@
+import argparse
+import json
+
+
+def load(path):
+    meta, rows = {}, {}
+    with open(path, encoding="utf-8") as f:
+        for line in f:
+            line = line.strip()
+            if not line:
+                continue
+            obj = json.loads(line)
+            if "meta" in obj:
+                meta = obj["meta"]
+            else:
+                rows[(obj["bench"], obj["param"])] = obj
+    return meta, rows
+
+
+def main():
+    ap = argparse.ArgumentParser(description="Compare two microbench runs (JSON lines).")
+    ap.add_argument("base")
+    ap.add_argument("new")
+    ap.add_argument("--threshold", type=float, default=0.05,
+                    help="relative change reported as faster/slower (default 0.05)")
+    args = ap.parse_args()
+
+    base_meta, base = load(args.base)
+    new_meta, new = load(args.new)
+    print(f"base: {base_meta.get('label') or args.base}  new: {new_meta.get('label') or args.new}")
+    print(f"{'bench':<18} {'param':<28} {'base':>12} {'new':>12} {'change':>8}")
+
+    for key in sorted(set(base) & set(new)):
+        b, n = base[key], new[key]
+        change = n["median"] / b["median"] - 1 if b["median"] else 0.0
+        # Within the runs' own spread, a difference is not a change.
+        noise = max(args.threshold, 2 * (b["stddev"] / b["median"] + n["stddev"] / n["median"]))
+        verdict = "" if abs(change) < noise else ("faster" if change > 0 else "slower")
+        print(f"{key[0]:<18} {key[1]:<28} {b['median']:>12.4g} {n['median']:>12.4g} {change:>+7.1%} {verdict}")
+
+    for key in sorted(set(base) ^ set(new)):
+        print(f"{key[0]:<18} {key[1]:<28} only in {'base' if key in base else 'new'}")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,212 @@
+#pragma once
+// Synthetic Russian-like corpus and query log, reproducible from a seed and a
+// handful of fitted parameters (see tests/zipf.py), for benchmarks that must
+// run without MongoDB.
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <istream>
+#include <ostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../engine/b_idx.h"
+
+struct CorpusParams {
+    uint64_t seed = 42;
+    double zipfS = 1.0;       // term frequency ~ rank^-s
+    double heapsK = 40;       // distinct terms after n tokens ~ K * n^beta
+    double heapsBeta = 0.55;
+    double lenMu = 5.3;       // log of document length in tokens ~ N(mu, sigma)
+    double lenSigma = 0.7;
+    size_t sources = 24;
+    int64_t startTime = 1700000000;
+    int64_t meanGapSec = 30;
+};
+
+// Rejection-inversion sampling of Zipf(s) over ranks 1..n (Hörmann and
+// Derflinger), O(1) per draw without a table.
+class ZipfSampler {
+public:
+    ZipfSampler(uint64_t n, double s) : n_(std::max<uint64_t>(1, n)), s_(s) {
+        hX1_ = hIntegral(1.5) - 1.0;
+        hN_ = hIntegral((double)n_ + 0.5);
+        thr_ = 2.0 - hIntegralInverse(hIntegral(2.5) - h(2.0));
+    }
+
+    template <class Rng>
+    uint64_t operator()(Rng& rng) const {
+        std::uniform_real_distribution<double> u01(0.0, 1.0);
+        for (;;) {
+            double u = hN_ + u01(rng) * (hX1_ - hN_);
+            double x = hIntegralInverse(u);
+            uint64_t k = (uint64_t)std::min<double>((double)n_, std::max(1.0, std::floor(x + 0.5)));
+            if ((double)k - x <= thr_ || u >= hIntegral((double)k + 0.5) - h((double)k)) return k;
+        }
+    }
+
+    uint64_t size() const { return n_; }
+
+private:
+    uint64_t n_;
+    double s_, hX1_, hN_, thr_;
+
+    double h(double x) const { return std::exp(-s_ * std::log(x)); }
+    double hIntegral(double x) const {
+        double lx = std::log(x);
+        return helper2((1.0 - s_) * lx) * lx;
+    }
+    double hIntegralInverse(double x) const {
+        double t = std::max(-1.0, x * (1.0 - s_));
+        return std::exp(helper1(t) * x);
+    }
+    // log1p(x) / x and expm1(x) / x, continuous at 0.
+    static double helper1(double x) { return std::abs(x) > 1e-8 ? std::log1p(x) / x : 1.0 - x * (0.5 - x / 3.0); }
+    static double helper2(double x) { return std::abs(x) > 1e-8 ? std::expm1(x) / x : 1.0 + x * 0.5 * (1.0 + x / 3.0); }
+};
+
+inline constexpr uint64_t kCorpusHeadWords = 40;
+
+// Word of a vocabulary rank: real function words at the head, then
+// consonant-final pseudo-stems built from CV syllables, shortest first, so
+// frequent words are short and every rank has its own stem.
+inline std::string corpusWord(uint64_t rank) {
+    static const char* kHead[] = {
+        "и", "в", "не", "на", "что", "с", "по", "как", "это", "из", "за", "от", "к", "о", "для", "у",
+        "его", "но", "также", "при", "он", "до", "после", "все", "году", "уже", "года", "было", "может",
+        "который", "время", "так", "только", "будет", "более", "между", "однако", "если", "или", "их"};
+    static const char* kCons[] = {"б", "в", "г", "д", "ж", "з", "к", "л", "м", "н",
+                                  "п", "р", "с", "т", "ф", "х", "ц", "ш"};
+    static const char* kVow[] = {"а", "е", "и", "о", "у", "ы", "я", "ю"};
+    static_assert(sizeof(kHead) / sizeof(kHead[0]) == kCorpusHeadWords, "head size");
+    const uint64_t nCons = sizeof(kCons) / sizeof(kCons[0]), nVow = sizeof(kVow) / sizeof(kVow[0]);
+    const uint64_t nSyl = nCons * nVow;
+
+    if (rank <= kCorpusHeadWords) return kHead[rank - 1];
+    uint64_t i = rank - kCorpusHeadWords - 1;
+    std::string w;
+    const char* last = kCons[i % nCons];
+    i /= nCons;
+    // Bijective numbering: all one-syllable stems, then all two-syllable ones...
+    uint64_t len = 1, block = nSyl;
+    while (i >= block) { i -= block; block *= nSyl; len++; }
+    for (uint64_t k = 0; k < len; k++, i /= nSyl) {
+        w += kCons[(i % nSyl) / nVow];
+        w += kVow[(i % nSyl) % nVow];
+    }
+    return w + last;
+}
+
+// Case endings the stemmer folds back onto the stem.
+inline const char* corpusEnding(uint32_t r) {
+    static const char* kEnd[] = {"", "", "", "а", "у", "ом", "е", "ы", "ов", "ами", "ах", "ой"};
+    return kEnd[r % (sizeof(kEnd) / sizeof(kEnd[0]))];
+}
+
+class CorpusGenerator {
+public:
+    // Sized for `docs` documents: the vocabulary is what Heaps' law predicts
+    // for their expected total token count.
+    CorpusGenerator(const CorpusParams& p, size_t docs)
+        : p_(p), rng_(p.seed), words_(vocabularySize(p, docs), p.zipfS), sources_(p.sources, 1.0),
+          len_(p.lenMu, p.lenSigma), gap_(1.0 / std::max<int64_t>(1, p.meanGapSec)), time_(p.startTime) {}
+
+    static uint64_t vocabularySize(const CorpusParams& p, size_t docs) {
+        double tokens = (double)docs * std::exp(p.lenMu + p.lenSigma * p.lenSigma / 2);
+        return std::max<uint64_t>(kCorpusHeadWords + 1, (uint64_t)(p.heapsK * std::pow(std::max(1.0, tokens), p.heapsBeta)));
+    }
+    uint64_t vocabulary() const { return words_.size(); }
+
+    Document next() {
+        Document d;
+        d.id = nextId_++;
+        uint64_t src = sources_(rng_);
+        static const char* kSections[] = {"politics", "economy", "world", "society", "sport", "tech", "culture"};
+        d.source = "src" + std::to_string(src);
+        d.key = "https://" + d.source + ".ru/" + kSections[rng_() % 7] + "/" + std::to_string(d.id);
+        time_ += (int64_t)gap_(rng_);
+        d.fetchedAt = time_;
+
+        size_t n = (size_t)std::min(20000.0, std::max(10.0, len_(rng_)));
+        d.text.reserve(n * 10);
+        for (size_t i = 0, sentence = 0; i < n; i++) {
+            if (sentence == 0) sentence = 6 + rng_() % 15;
+            d.text += word(words_(rng_));
+            d.text += --sentence == 0 ? ". " : (rng_() % 12 == 0 ? ", " : " ");
+        }
+        return d;
+    }
+
+    // Term and operator mix of a search log: mostly one or two content words,
+    // some OR / NOT / grouping and an occasional source filter.
+    std::string query() {
+        auto w = [&] {
+            uint64_t r;
+            do r = words_(rng_); while (r <= kCorpusHeadWords);
+            return word(r);
+        };
+        uint32_t pick = rng_() % 100;
+        if (pick < 40) return w();
+        if (pick < 65) return w() + " " + w();
+        if (pick < 75) return w() + " " + w() + " " + w();
+        if (pick < 83) return w() + " OR " + w();
+        if (pick < 90) return w() + " AND NOT " + w();
+        if (pick < 95) return "(" + w() + " OR " + w() + ") " + w();
+        return w() + " source:src" + std::to_string(sources_(rng_));
+    }
+
+private:
+    CorpusParams p_;
+    std::mt19937_64 rng_;
+    ZipfSampler words_;
+    ZipfSampler sources_;
+    std::lognormal_distribution<double> len_;
+    std::exponential_distribution<double> gap_;
+    int64_t time_;
+    int nextId_ = 0;
+
+    std::string word(uint64_t rank) {
+        std::string w = corpusWord(rank);
+        if (rank > kCorpusHeadWords) w += corpusEnding((uint32_t)rng_());
+        return w;
+    }
+};
+
+// Corpus dump: one document per line, `id \t url \t source \t fetched_at \t text`.
+inline void writeDocument(std::ostream& out, const Document& d) {
+    out << d.id << '\t' << d.key << '\t' << d.source << '\t' << d.fetchedAt << '\t' << d.text << '\n';
+}
+
+inline bool readDocument(std::istream& in, Document& d) {
+    std::string line;
+    while (std::getline(in, line)) {
+        size_t a = line.find('\t'), b = line.find('\t', a + 1), c = line.find('\t', b + 1), e = line.find('\t', c + 1);
+        if (e == std::string::npos) continue;
+        d.id = std::atoi(line.c_str());
+        d.key = line.substr(a + 1, b - a - 1);
+        d.source = line.substr(b + 1, c - b - 1);
+        d.fetchedAt = std::atoll(line.c_str() + c + 1);
+        d.text = line.substr(e + 1);
+        return true;
+    }
+    return false;
+}
+
+// Consumes one generator flag at argv[i] (and its value); false if a is not one.
+inline bool parseCorpusOption(const std::string& a, int& i, int argc, char** argv, CorpusParams& p) {
+    if (i + 1 >= argc) return false;
+    if (a == "--seed") p.seed = std::strtoull(argv[++i], nullptr, 10);
+    else if (a == "--zipf-s") p.zipfS = std::atof(argv[++i]);
+    else if (a == "--heaps-k") p.heapsK = std::atof(argv[++i]);
+    else if (a == "--heaps-beta") p.heapsBeta = std::atof(argv[++i]);
+    else if (a == "--len-mu") p.lenMu = std::atof(argv[++i]);
+    else if (a == "--len-sigma") p.lenSigma = std::atof(argv[++i]);
+    else if (a == "--sources") p.sources = std::max(1, std::atoi(argv[++i]));
+    else return false;
+    return true;
+}
+
+inline const char* kCorpusUsage =
+    "       [--seed N] [--zipf-s S] [--heaps-k K] [--heaps-beta B] [--len-mu M] [--len-sigma S] [--sources N]\n";
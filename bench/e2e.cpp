@@ -0,0 +1,190 @@
+// End-to-end scaling benchmark on a synthetic (or dumped) corpus: for each
+// corpus size, indexes the documents, serializes the index and replays a
+// query log. Each size runs in its own child process so peak RSS is its own.
+// One JSON object per size is written to stdout (or --out FILE).
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <streambuf>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "corpus.h"
+#include "../engine/b_srch.h"
+#include "../engine/trace.h"
+#include "../engine/perf_counters.h"
+
+struct Options {
+    std::vector<size_t> sizes{100000, 1000000, 10000000};
+    size_t queries = 2000;
+    std::string corpus;    // dump from gen_corpus instead of generating
+    std::string queryLog;
+    std::string label;
+    std::string out;
+    bool perf = false;     // hardware counters per stage; adds a few syscalls per doc
+    CorpusParams params;
+};
+
+// Counts what save() writes without keeping it.
+class CountingBuf : public std::streambuf {
+public:
+    size_t bytes = 0;
+
+protected:
+    std::streamsize xsputn(const char*, std::streamsize n) override { bytes += (size_t)n; return n; }
+    int_type overflow(int_type c) override { if (c != traits_type::eof()) bytes++; return c; }
+};
+
+using Clock = std::chrono::steady_clock;
+
+static double since(Clock::time_point t0) { return std::chrono::duration<double>(Clock::now() - t0).count(); }
+
+static std::vector<std::string> loadQueries(const Options& o, size_t docs) {
+    std::vector<std::string> qs;
+    if (!o.queryLog.empty()) {
+        std::ifstream in(o.queryLog);
+        std::string line;
+        while (qs.size() < o.queries && std::getline(in, line))
+            if (!line.empty()) qs.push_back(line);
+        return qs;
+    }
+    CorpusParams qp = o.params;
+    qp.seed = o.params.seed + 1;
+    CorpusGenerator gen(qp, docs);
+    for (size_t i = 0; i < o.queries; i++) qs.push_back(gen.query());
+    return qs;
+}
+
+static void runSize(const Options& o, size_t target, std::ostream& out) {
+    CorpusGenerator gen(o.params, target);
+    std::ifstream dump;
+    if (!o.corpus.empty()) dump.open(o.corpus, std::ios::binary);
+
+    PerfStages::reset();
+    PerfStages::enable(o.perf);
+    if (o.perf && !PerfCounters::thread().available())
+        std::cerr << "perf counters unavailable (" << PerfCounters::thread().error() << "), reporting wall time only\n";
+    BooleanIndex index;
+    double genSec = 0, buildSec = 0;
+    size_t docs = 0;
+    Document d;
+    for (; docs < target; docs++) {
+        auto t0 = Clock::now();
+        if (dump.is_open()) {
+            if (!readDocument(dump, d)) break;
+        } else {
+            d = gen.next();
+        }
+        genSec += since(t0);
+        t0 = Clock::now();
+        index.addDocument(d);
+        buildSec += since(t0);
+        if ((docs + 1) % 100000 == 0) std::cerr << "Indexed docs: " << docs + 1 << "\r" << std::flush;
+    }
+    auto t0 = Clock::now();
+    index.finalize();
+    double finalizeSec = since(t0);
+
+    CountingBuf counter;
+    std::ostream sink(&counter);
+    index.save(sink);
+
+    auto queries = loadQueries(o, docs);
+    BooleanSearch search(index);
+    size_t hits = 0;
+    PerfStages::enable(false);
+    for (const auto& q : queries) hits += search.search(q).size();  // warm-up pass
+    PerfStages::enable(o.perf);
+    std::vector<double> ms;
+    for (const auto& q : queries) {
+        t0 = Clock::now();
+        auto r = search.search(q);
+        ms.push_back(since(t0) * 1e3);
+    }
+    std::sort(ms.begin(), ms.end());
+    auto pct = [&](double p) { return ms.empty() ? 0.0 : ms[std::min(ms.size() - 1, (size_t)(p * ms.size()))]; };
+
+    rusage ru{};
+    getrusage(RUSAGE_SELF, &ru);
+    out << "{\"label\":\"" << o.label << "\",\"docs\":" << docs << ",\"vocabulary\":" << gen.vocabulary()
+        << ",\"terms\":" << index.termsCount() << ",\"gen_sec\":" << genSec << ",\"build_sec\":" << buildSec + finalizeSec
+        << ",\"finalize_sec\":" << finalizeSec << ",\"docs_per_sec\":" << docs / std::max(1e-9, buildSec + finalizeSec)
+        << ",\"peak_rss_mb\":" << ru.ru_maxrss / 1024.0 << ",\"index_bytes\":" << counter.bytes
+        << ",\"queries\":" << ms.size() << ",\"mean_hits\":" << (ms.empty() ? 0.0 : (double)hits / ms.size())
+        << ",\"p50_ms\":" << pct(0.50) << ",\"p90_ms\":" << pct(0.90) << ",\"p99_ms\":" << pct(0.99)
+        << ",\"max_ms\":" << (ms.empty() ? 0.0 : ms.back());
+    if (o.perf && !PerfCounters::thread().available()) {
+        out << ",\"perf\":null";
+    } else if (o.perf) {
+        // Per document for the build stages, per query for query evaluation.
+        out << ",\"perf\":{";
+        for (int st = 0; st < (int)PerfStage::COUNT; st++) {
+            auto stage = (PerfStage)st;
+            double per = stage == PerfStage::QUERY ? ms.size() : docs;
+            out << (st ? "," : "") << "\"" << PerfStages::name(stage) << "\":"
+                << PerfStages::total(stage).json(std::max(1.0, per));
+        }
+        out << "}";
+    }
+    out << "}\n";
+    out.flush();
+    std::cerr << "\n" << docs << " docs: build " << buildSec + finalizeSec << " s, peak RSS " << ru.ru_maxrss / 1024
+              << " MB, index " << counter.bytes / (1 << 20) << " MB, p50 " << pct(0.5) << " ms, p99 " << pct(0.99) << " ms\n";
+}
+
+static void usage(const char* prog) {
+    std::cerr << "Usage: " << prog << " [--docs N[,N...]] [--queries N] [--corpus FILE] [--query-log FILE]\n"
+              << "       [--label TEXT] [--out FILE] [--perf]\n" << kCorpusUsage;
+}
+
+int main(int argc, char** argv) {
+    Options o;
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        if (parseCorpusOption(a, i, argc, argv, o.params)) continue;
+        if (a == "--docs" && i + 1 < argc) {
+            o.sizes.clear();
+            std::stringstream ss(argv[++i]);
+            std::string n;
+            while (std::getline(ss, n, ',')) o.sizes.push_back(std::stoull(n));
+        }
+        else if (a == "--queries" && i + 1 < argc) o.queries = std::stoull(argv[++i]);
+        else if (a == "--corpus" && i + 1 < argc) o.corpus = argv[++i];
+        else if (a == "--query-log" && i + 1 < argc) o.queryLog = argv[++i];
+        else if (a == "--label" && i + 1 < argc) o.label = argv[++i];
+        else if (a == "--out" && i + 1 < argc) o.out = argv[++i];
+        else if (a == "--perf") o.perf = true;
+        else { usage(argv[0]); return 1; }
+    }
+
+    std::ofstream file;
+    if (!o.out.empty()) file.open(o.out);
+    std::ostream& out = o.out.empty() ? std::cout : file;
+    out.flush();
+
+    int failed = 0;
+    for (size_t n : o.sizes) {
+        pid_t pid = fork();
+        if (pid < 0) { std::cerr << "fork failed\n"; return 1; }
+        if (pid == 0) {
+            Tracer::startFromEnv("." + std::to_string(n));
+            runSize(o, n, out);
+            Tracer::stop();
+            _exit(0);
+        }
+        int status = 0;
+        waitpid(pid, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            std::cerr << n << " docs: run failed (" << (WIFSIGNALED(status) ? "killed by signal" : "error")
+                      << ", likely out of memory)\n";
+            failed++;
+        }
+    }
+    return failed ? 1 : 0;
+}
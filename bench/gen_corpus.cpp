@@ -0,0 +1,62 @@
+// Writes a synthetic corpus dump and a matching query log (see corpus.h).
+// --out-corpus writes the same documents as an engine corpus file instead,
+// for offline builds with `engine --corpus FILE`.
+
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "corpus.h"
+#include "../engine/corpus_file.h"
+
+static void usage(const char* prog) {
+    std::cerr << "Usage: " << prog << " --docs N (--out-docs FILE | --out-corpus FILE [--compress])\n"
+              << "       [--queries N --out-queries FILE]\n" << kCorpusUsage;
+}
+
+int main(int argc, char** argv) {
+    CorpusParams p;
+    size_t docs = 0, queries = 0;
+    std::string docsPath, corpusPath, queriesPath;
+    bool compress = false;
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        if (parseCorpusOption(a, i, argc, argv, p)) continue;
+        if (a == "--docs" && i + 1 < argc) docs = std::stoull(argv[++i]);
+        else if (a == "--queries" && i + 1 < argc) queries = std::stoull(argv[++i]);
+        else if (a == "--out-docs" && i + 1 < argc) docsPath = argv[++i];
+        else if (a == "--out-corpus" && i + 1 < argc) corpusPath = argv[++i];
+        else if (a == "--compress") compress = true;
+        else if (a == "--out-queries" && i + 1 < argc) queriesPath = argv[++i];
+        else { usage(argv[0]); return 1; }
+    }
+    if (docs == 0 || docsPath.empty() == corpusPath.empty() || (queries && queriesPath.empty())) { usage(argv[0]); return 1; }
+
+    CorpusGenerator gen(p, docs);
+    std::ofstream out;
+    CorpusWriter corpus;
+    if (!docsPath.empty()) out.open(docsPath, std::ios::binary);
+    else if (!corpus.open(corpusPath, compress)) { std::cerr << "cannot write " << corpusPath << "\n"; return 1; }
+    for (size_t i = 0; i < docs; i++) {
+        Document d = gen.next();
+        if (out.is_open()) writeDocument(out, d);
+        else corpus.add({d.key, d.text, d.source, d.fetchedAt});
+        if ((i + 1) % 100000 == 0) std::cerr << "Generated docs: " << i + 1 << "\r" << std::flush;
+    }
+    if (out.is_open() ? !out.flush() : !corpus.finish()) {
+        std::cerr << "\ncannot write " << (out.is_open() ? docsPath : corpusPath) << "\n";
+        return 1;
+    }
+
+    // A separate stream, so the log does not depend on how many docs were drawn.
+    if (queries) {
+        CorpusParams qp = p;
+        qp.seed = p.seed + 1;
+        CorpusGenerator qgen(qp, docs);
+        std::ofstream qout(queriesPath);
+        for (size_t i = 0; i < queries; i++) qout << qgen.query() << '\n';
+    }
+
+    std::cerr << "\n" << docs << " docs, vocabulary " << gen.vocabulary() << " words, " << queries << " queries\n";
+    return 0;
+}
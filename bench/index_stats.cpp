@@ -0,0 +1,107 @@
+// Statistics of a built index: term and posting-length distribution, top
+// terms, Zipf and Heaps fits, hash table probing and memory by structure.
+// Reads a WAL checkpoint directory, or indexes a corpus dump or a synthetic
+// corpus first. Prints a summary to stderr, JSON to stdout (or --json FILE)
+// and, with --csv PREFIX, one PREFIX<table>.csv per table for plotting.
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "corpus.h"
+#include "../engine/index_stats.h"
+#include "../engine/segments.h"
+#include "../engine/wal.h"
+
+static void usage(const char* prog) {
+    std::cerr << "Usage: " << prog << " (--checkpoint DIR | --corpus FILE | --docs N) [--top N]\n"
+              << "       [--zipf-fit R_MIN,R_MAX] [--json FILE] [--csv PREFIX]\n" << kCorpusUsage;
+}
+
+int main(int argc, char** argv) {
+    CorpusParams params;
+    IndexStatsOptions opt;
+    std::string checkpoint, corpus, jsonPath, csvPrefix;
+    size_t docs = 0;
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        if (parseCorpusOption(a, i, argc, argv, params)) continue;
+        if (a == "--checkpoint" && i + 1 < argc) checkpoint = argv[++i];
+        else if (a == "--corpus" && i + 1 < argc) corpus = argv[++i];
+        else if (a == "--docs" && i + 1 < argc) docs = std::stoull(argv[++i]);
+        else if (a == "--top" && i + 1 < argc) opt.top = std::stoull(argv[++i]);
+        else if (a == "--zipf-fit" && i + 1 < argc) {
+            std::string v = argv[++i];
+            size_t comma = v.find(',');
+            if (comma == std::string::npos) { usage(argv[0]); return 1; }
+            opt.zipfRMin = std::stoull(v.substr(0, comma));
+            opt.zipfRMax = std::stoull(v.substr(comma + 1));
+        }
+        else if (a == "--json" && i + 1 < argc) jsonPath = argv[++i];
+        else if (a == "--csv" && i + 1 < argc) csvPrefix = argv[++i];
+        else { usage(argv[0]); return 1; }
+    }
+    if (checkpoint.empty() && corpus.empty() && docs == 0) { usage(argv[0]); return 1; }
+
+    auto t0 = std::chrono::steady_clock::now();
+    std::shared_ptr<SegmentSet> set;
+    BooleanIndex built;
+    std::vector<const BooleanIndex*> indexes;
+    size_t urlBytes = 0, docBytes = 0;
+    if (!checkpoint.empty()) {
+        uint64_t lsn = 0;
+        int64_t mark = 0;
+        if (!loadCheckpoint(checkpoint, set, lsn, mark)) {
+            std::cerr << "cannot load checkpoint from " << checkpoint << "\n";
+            return 1;
+        }
+        for (const auto& s : set->segs) {
+            indexes.push_back(&s.seg->index);
+            urlBytes += s.seg->urls.bytes();
+            docBytes += s.seg->docs.bytes();
+        }
+    } else {
+        std::ifstream dump;
+        if (!corpus.empty()) {
+            dump.open(corpus, std::ios::binary);
+            if (!dump) { std::cerr << "cannot open " << corpus << "\n"; return 1; }
+        }
+        std::unique_ptr<CorpusGenerator> gen;
+        if (!dump.is_open()) gen = std::make_unique<CorpusGenerator>(params, docs);
+        Document d;
+        for (size_t n = 0; docs == 0 || n < docs; n++) {
+            if (!gen) { if (!readDocument(dump, d)) break; }
+            else d = gen->next();
+            built.addDocument(d);
+            if ((n + 1) % 100000 == 0) std::cerr << "Indexed docs: " << n + 1 << "\r" << std::flush;
+        }
+        built.finalize();
+        indexes.push_back(&built);
+    }
+    auto t1 = std::chrono::steady_clock::now();
+
+    IndexStats st = computeIndexStats(indexes, opt);
+    st.urlBytes = urlBytes;
+    st.docBytes = docBytes;
+    auto t2 = std::chrono::steady_clock::now();
+    std::cerr << st.text() << "load " << std::chrono::duration<double>(t1 - t0).count() << " s, stats "
+              << std::chrono::duration<double>(t2 - t1).count() << " s\n";
+
+    if (jsonPath.empty()) std::cout << st.json() << "\n";
+    else {
+        std::ofstream out(jsonPath);
+        out << st.json() << "\n";
+        if (!out.flush()) { std::cerr << "cannot write " << jsonPath << "\n"; return 1; }
+    }
+    if (!csvPrefix.empty()) {
+        for (const auto& t : st.csv()) {
+            std::ofstream out(csvPrefix + t.first + ".csv");
+            out << t.second;
+            if (!out.flush()) { std::cerr << "cannot write " << csvPrefix << t.first << ".csv\n"; return 1; }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,292 @@
+// Microbenchmarks for the indexing and query kernels.
+//
+// Every case is warmed up, then timed over --reps repetitions of a fixed
+// batch; the process is pinned to one CPU. One JSON object per case is
+// written to stdout (or --out FILE), preceded by a "meta" line, so runs
+// from different commits can be compared with bench/compare.py.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include <sched.h>
+#include <unistd.h>
+
+#include "../engine/tokenizer.h"
+#include "../engine/stemmer.h"
+#include "../engine/hashtable.h"
+#include "../engine/b_srch.h"
+
+struct Options {
+    int reps = 15;
+    int warmupMs = 200;
+    int cpu = 0;            // -1: do not pin
+    std::string textFile;   // UTF-8 corpus; a built-in news sample otherwise
+    std::string filter;     // run only cases whose name contains this
+    std::string label;      // e.g. the commit id, copied into the meta line
+    std::string out;
+};
+
+struct Case {
+    std::string name;
+    std::string param;
+    std::string unit;       // what `items` counts, per second
+    double items;           // processed per run
+    std::function<void()> run;
+};
+
+static volatile size_t g_sink;
+
+static const char* kSample =
+    "Правительство России утвердило новые правила экспорта нефти и нефтепродуктов, "
+    "сообщила пресс-служба кабмина во вторник. Согласно документу, квоты будут "
+    "пересматриваться ежеквартально с учётом ситуации на мировом рынке. "
+    "Цены на газ в Европе в среду снизились на 4,5% на фоне прогнозов тёплой погоды; "
+    "фьючерсы на хабе TTF торговались около 35 евро за мегаватт-час. "
+    "Центральный банк сохранил ключевую ставку на уровне 16% годовых, отметив, что "
+    "инфляционное давление постепенно ослабевает, а кредитная активность замедляется. "
+    "«Мы видим признаки стабилизации», — заявила глава регулятора на пресс-конференции. "
+    "В Санкт-Петербурге открылся международный экономический форум, в котором "
+    "участвуют делегации из более чем ста стран. Акции «Газпрома» на Московской бирже "
+    "выросли на 2,3%, индекс МосБиржи прибавил 0,8%. Минфин разместил облигации "
+    "федерального займа на 25 млрд рублей при спросе свыше 60 млрд. "
+    "Эксперты ожидают, что курс рубля к доллару в ближайшие недели останется в "
+    "диапазоне 88–92 рублей, однако санкционные риски сохраняются. ";
+
+static std::string loadText(const Options& o, size_t minBytes) {
+    std::string text;
+    if (!o.textFile.empty()) {
+        std::ifstream in(o.textFile, std::ios::binary);
+        std::stringstream ss;
+        ss << in.rdbuf();
+        text = ss.str();
+    }
+    if (text.empty()) {
+        while (text.size() < minBytes) text += kSample;
+    }
+    return text;
+}
+
+static void pinCpu(int cpu) {
+    if (cpu < 0) return;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) != 0) std::cerr << "cannot pin to cpu " << cpu << "\n";
+}
+
+static std::string jsonEscape(const std::string& s) {
+    std::string out;
+    for (char c : s) {
+        if (c == '"' || c == '\\') out += '\\';
+        out += c;
+    }
+    return out;
+}
+
+static void measure(const Options& o, const Case& c, std::ostream& out) {
+    using Clock = std::chrono::steady_clock;
+    auto warmEnd = Clock::now() + std::chrono::milliseconds(o.warmupMs);
+    do c.run(); while (Clock::now() < warmEnd);
+
+    std::vector<double> rate;
+    for (int r = 0; r < o.reps; r++) {
+        auto t0 = Clock::now();
+        c.run();
+        double sec = std::chrono::duration<double>(Clock::now() - t0).count();
+        rate.push_back(c.items / sec);
+    }
+    std::sort(rate.begin(), rate.end());
+    double mean = 0, var = 0;
+    for (double x : rate) mean += x;
+    mean /= rate.size();
+    for (double x : rate) var += (x - mean) * (x - mean);
+    double median = rate[rate.size() / 2];
+
+    out << "{\"bench\":\"" << c.name << "\",\"param\":\"" << jsonEscape(c.param) << "\",\"unit\":\"" << c.unit
+        << "/s\",\"median\":" << median << ",\"min\":" << rate.front() << ",\"max\":" << rate.back()
+        << ",\"stddev\":" << std::sqrt(var / rate.size()) << ",\"reps\":" << rate.size() << "}\n";
+    out.flush();
+    std::cerr << c.name << " " << c.param << ": " << median << " " << c.unit << "/s\n";
+}
+
+// ---------------------------------------------------------------- cases
+
+static void tokenizerCases(const Options& o, std::vector<Case>& cases) {
+    auto text = std::make_shared<std::string>(loadText(o, 4 << 20));
+    double mb = (double)text->size() / (1 << 20);
+    cases.push_back({"tokenize", std::to_string(text->size()) + " bytes", "MB", mb, [text] {
+        g_sink = g_sink + Tokenizer::tokenize(*text).size();
+    }});
+}
+
+static void stemmerCases(const Options& o, std::vector<Case>& cases) {
+    auto text = loadText(o, 4 << 20);
+    std::unordered_set<std::string> seen;
+    auto vocab = std::make_shared<std::vector<std::string>>();
+    for (auto& t : Tokenizer::tokenize(text))
+        if (seen.insert(t).second) vocab->push_back(t);
+    cases.push_back({"stem", std::to_string(vocab->size()) + " distinct tokens", "stems",
+                     (double)vocab->size(), [vocab] {
+        size_t n = 0;
+        for (const auto& t : *vocab) n += Stemmer::stem(t).size();
+        g_sink = g_sink + n;
+    }});
+}
+
+// Keys shaped like stems: 3-12 Cyrillic letters.
+static std::vector<std::string> makeKeys(size_t n, uint32_t seed) {
+    std::mt19937 rng(seed);
+    std::unordered_set<std::string> seen;
+    std::vector<std::string> keys;
+    while (keys.size() < n) {
+        std::string k;
+        for (int i = 0, len = 3 + (int)(rng() % 10); i < len; i++) {
+            uint32_t cp = 0x430 + rng() % 32;
+            k += (char)(0xC0 | (cp >> 6));
+            k += (char)(0x80 | (cp & 0x3F));
+        }
+        if (seen.insert(k).second) keys.push_back(std::move(k));
+    }
+    return keys;
+}
+
+static void hashTableCases(const Options&, std::vector<Case>& cases) {
+    for (size_t cap : {size_t(1) << 12, size_t(1) << 16, size_t(1) << 20}) {
+        for (double load : {0.25, 0.5, 0.69}) {  // the table grows past 0.70
+            size_t n = (size_t)(cap * load);
+            auto keys = std::make_shared<std::vector<std::string>>(makeKeys(2 * n, (uint32_t)cap));
+            std::string param = "cap=" + std::to_string(cap) + " load=" + std::to_string(load).substr(0, 4);
+
+            cases.push_back({"hashtable_insert", param, "ops", (double)n, [keys, cap, n] {
+                HashTable t(cap);
+                for (size_t i = 0; i < n; i++) t.getOrInsert((*keys)[i]).push_back((int)i);
+                g_sink = g_sink + t.size();
+            }});
+
+            // In document-sized groups, as addTerms() inserts.
+            const size_t kGroup = 256;
+            cases.push_back({"hashtable_insert_batch", param, "ops", (double)n, [keys, cap, n, kGroup] {
+                HashTable t(cap);
+                std::vector<std::vector<int>*> out(kGroup);
+                for (size_t i = 0; i < n; i += kGroup) {
+                    size_t m = std::min(kGroup, n - i);
+                    t.getOrInsertBatch(keys->data() + i, m, out.data());
+                    for (size_t k = 0; k < m; k++) out[k]->push_back((int)(i + k));
+                }
+                g_sink = g_sink + t.size();
+            }});
+
+            auto table = std::make_shared<HashTable>(cap);
+            for (size_t i = 0; i < n; i++) table->getOrInsert((*keys)[i]);
+            // Half the probes hit, half miss.
+            cases.push_back({"hashtable_find", param, "ops", (double)n, [keys, table, n] {
+                size_t hits = 0;
+                for (size_t i = 0; i < n; i++) hits += table->find((*keys)[(i & 1) ? i : n + i]) != nullptr;
+                g_sink = g_sink + hits;
+            }});
+            auto probes = std::make_shared<std::vector<const std::string*>>(n);
+            for (size_t i = 0; i < n; i++) (*probes)[i] = &(*keys)[(i & 1) ? i : n + i];
+            cases.push_back({"hashtable_find_batch", param, "ops", (double)n, [probes, table, n, kGroup] {
+                std::vector<const std::vector<int>*> out(kGroup);
+                size_t hits = 0;
+                for (size_t i = 0; i < n; i += kGroup) {
+                    size_t m = std::min(kGroup, n - i);
+                    table->findBatch(probes->data() + i, m, out.data());
+                    for (size_t k = 0; k < m; k++) hits += out[k] != nullptr;
+                }
+                g_sink = g_sink + hits;
+            }});
+        }
+    }
+}
+
+static std::vector<int> randomList(size_t n, int universe, std::mt19937& rng) {
+    std::vector<int> v;
+    v.reserve(n);
+    std::uniform_int_distribution<int> d(0, universe - 1);
+    for (size_t i = 0; i < n; i++) v.push_back(d(rng));
+    std::sort(v.begin(), v.end());
+    v.erase(std::unique(v.begin(), v.end()), v.end());
+    return v;
+}
+
+static void setOpCases(const Options&, std::vector<Case>& cases) {
+    const int universe = 1 << 22;
+    std::mt19937 rng(7);
+    for (size_t big : {size_t(1) << 14, size_t(1) << 18, size_t(1) << 21}) {
+        for (size_t ratio : {1, 16, 256}) {  // |big| / |small|
+            auto a = std::make_shared<std::vector<int>>(randomList(big, universe, rng));
+            auto b = std::make_shared<std::vector<int>>(randomList(std::max<size_t>(1, big / ratio), universe, rng));
+            double items = (double)(a->size() + b->size());
+            std::string param = "n=" + std::to_string(big) + " ratio=" + std::to_string(ratio);
+            cases.push_back({"op_and", param, "postings", items, [a, b] {
+                g_sink = g_sink + BooleanSearch::opAnd(*a, *b).size();
+            }});
+            cases.push_back({"op_or", param, "postings", items, [a, b] {
+                g_sink = g_sink + BooleanSearch::opOr(*a, *b).size();
+            }});
+            cases.push_back({"op_not", param, "postings", items, [a, b] {
+                g_sink = g_sink + BooleanSearch::opNot(*a, *b).size();
+            }});
+        }
+    }
+}
+
+static void usage(const char* prog) {
+    std::cerr << "Usage: " << prog << " [--reps N] [--warmup-ms MS] [--cpu N|-1] [--text FILE]\n"
+              << "       [--filter NAME] [--label TEXT] [--out FILE]\n";
+}
+
+int main(int argc, char** argv) {
+    Options o;
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        if (a == "--reps" && i + 1 < argc) o.reps = std::max(1, std::atoi(argv[++i]));
+        else if (a == "--warmup-ms" && i + 1 < argc) o.warmupMs = std::atoi(argv[++i]);
+        else if (a == "--cpu" && i + 1 < argc) o.cpu = std::atoi(argv[++i]);
+        else if (a == "--text" && i + 1 < argc) o.textFile = argv[++i];
+        else if (a == "--filter" && i + 1 < argc) o.filter = argv[++i];
+        else if (a == "--label" && i + 1 < argc) o.label = argv[++i];
+        else if (a == "--out" && i + 1 < argc) o.out = argv[++i];
+        else { usage(argv[0]); return 1; }
+    }
+    pinCpu(o.cpu);
+
+    std::ofstream file;
+    if (!o.out.empty()) file.open(o.out);
+    std::ostream& out = o.out.empty() ? std::cout : file;
+    out << "{\"meta\":{\"label\":\"" << jsonEscape(o.label) << "\",\"cpu\":" << o.cpu << ",\"reps\":" << o.reps
+        << ",\"warmup_ms\":" << o.warmupMs << ",\"compiler\":\"" << jsonEscape(__VERSION__) << "\"}}\n";
+
+    struct Group {
+        std::vector<std::string> names;
+        void (*make)(const Options&, std::vector<Case>&);
+    };
+    const Group groups[] = {
+        {{"tokenize"}, tokenizerCases},
+        {{"stem"}, stemmerCases},
+        {{"hashtable_insert", "hashtable_insert_batch", "hashtable_find", "hashtable_find_batch"}, hashTableCases},
+        {{"op_and", "op_or", "op_not"}, setOpCases},
+    };
+    for (const auto& g : groups) {
+        // Inputs are built only for groups the filter selects.
+        if (std::none_of(g.names.begin(), g.names.end(),
+                         [&](const std::string& n) { return n.find(o.filter) != std::string::npos; }))
+            continue;
+        std::vector<Case> cases;
+        g.make(o, cases);
+        for (const auto& c : cases)
+            if (o.filter.empty() || c.name.find(o.filter) != std::string::npos) measure(o, c, out);
+    }
+    return 0;
+}
@@ -1,42 +1,318 @@
 #include "b_idx.h"
 #include "Tokenizer.h"
 #include "Stemmer.h"
+#include "metrics.h"
+#include "trace.h"
+#include "perf_counters.h"
 #include <algorithm>
+#include <istream>
+#include <ostream>
+#include <cstdint>
+#include <cctype>
 
-void BooleanIndex::addDocument(const Document& doc) {
-    docs_count_ = std::max(docs_count_, (size_t)(doc.id + 1));
-    all_docs_.push_back(doc.id);
-
+std::vector<std::string> BooleanIndex::extractTerms(std::string_view text) {
+    static Counter& bytes = Metrics::get().counter("engine_tokenized_bytes_total", "Bytes of text tokenized and stemmed");
+    static Counter& nanos = Metrics::get().counter("engine_build_stage_seconds_total{stage=\"tokenize\"}",
+                                                   "Time spent per index build stage", 1e-9);
+    ScopedTimer timer(nanos);
+    TraceSpan span("extractTerms", "index", Tracer::sample());
+    span.arg("bytes", (int64_t)text.size());
+    bytes.add(text.size());
     std::vector<std::string> terms;
     terms.reserve(2048);
 
-    auto tokens = Tokenizer::tokenize(doc.text);
-    for (const auto& t : tokens) {
-        std::string term = Stemmer::stem(t);
-        if (term.size() < 2) continue;   
-        terms.push_back(std::move(term));
+    std::vector<std::string> tokens;
+    {
+        TraceSpan phase("tokenize", "index", span.active());
+        PerfScope perf(PerfStage::TOKENIZE);
+        tokens = Tokenizer::tokenize(text);
+    }
+    {
+        TraceSpan phase("stem", "index", span.active());
+        PerfScope perf(PerfStage::STEM);
+        for (const auto& t : tokens) {
+            std::string term = Stemmer::stem(t);
+            if (term.size() < 2) continue;   
+            terms.push_back(std::move(term));
+        }
     }
 
+    TraceSpan phase("sortTerms", "index", span.active());
     std::sort(terms.begin(), terms.end());
     terms.erase(std::unique(terms.begin(), terms.end()), terms.end());
+    return terms;
+}
 
-    for (const auto& term : terms) {
-        table_.getOrInsert(term).push_back(doc.id);
-    }
+void BooleanIndex::addTerms(int id, const std::vector<std::string>& terms) {
+    static Counter& docs = Metrics::get().counter("engine_docs_indexed_total", "Documents added to an index");
+    static Counter& postings = Metrics::get().counter("engine_postings_indexed_total", "Postings added to an index");
+    TraceSpan span("addTerms", "index", Tracer::sample());
+    span.arg("terms", (int64_t)terms.size());
+    PerfScope perf(PerfStage::INSERT);
+    docs.add();
+    postings.add(terms.size());
+    docs_count_ = std::max(docs_count_, (size_t)(id + 1));
+    all_docs_.push_back(id);
+
+    thread_local std::vector<std::vector<int>*> lists;
+    lists.resize(terms.size());
+    table_.getOrInsertBatch(terms.data(), terms.size(), lists.data());
+    for (auto* lst : lists) lst->push_back(id);
+}
+
+std::string BooleanIndex::normalizeFilter(std::string_view field, std::string_view value) {
+    std::string key(field);
+    key += ':';
+    for (char c : value) key += (char)std::tolower((unsigned char)c);
+    if (field == "host" && key.compare(5, 4, "www.") == 0) key.erase(5, 4);
+    return key;
+}
+
+void BooleanIndex::addAttributes(int id, std::string_view url, std::string_view source) {
+    if (!source.empty()) table_.getOrInsert(normalizeFilter("source", source)).push_back(id);
+
+    size_t p = url.find("://");
+    if (p == std::string_view::npos) return;
+    url.remove_prefix(p + 3);
+    size_t slash = url.find('/');
+    std::string_view host = url.substr(0, slash);
+    host = host.substr(0, host.find(':'));
+    if (host.empty()) return;
+    table_.getOrInsert(normalizeFilter("host", host)).push_back(id);
+
+    if (slash == std::string_view::npos) return;
+    std::string_view path = url.substr(slash + 1);
+    std::string_view section = path.substr(0, path.find_first_of("/?#"));
+    if (!section.empty()) table_.getOrInsert(normalizeFilter("section", section)).push_back(id);
 }
 
 void BooleanIndex::finalize() {
-    std::sort(all_docs_.begin(), all_docs_.end());
-    all_docs_.erase(std::unique(all_docs_.begin(), all_docs_.end()), all_docs_.end());
+    auto& m = Metrics::get();
+    const char* help = "Time spent per index build stage";
+    static Counter& sortNs = m.counter("engine_build_stage_seconds_total{stage=\"sort\"}", help, 1e-9);
+    static Counter& timesNs = m.counter("engine_build_stage_seconds_total{stage=\"times\"}", help, 1e-9);
+    static Counter& bitmapsNs = m.counter("engine_build_stage_seconds_total{stage=\"bitmaps\"}", help, 1e-9);
+    static Counter& lexiconNs = m.counter("engine_build_stage_seconds_total{stage=\"lexicon\"}", help, 1e-9);
+    static Counter& sampleNs = m.counter("engine_build_stage_seconds_total{stage=\"sample\"}", help, 1e-9);
+
+    TraceSpan span("finalize", "index");
+    PerfScope perf(PerfStage::FINALIZE);
+    span.arg("terms", (int64_t)table_.size());
+    {
+        ScopedTimer t(sortNs);
+        TraceSpan ts("sort", "index");
+        std::sort(all_docs_.begin(), all_docs_.end());
+        all_docs_.erase(std::unique(all_docs_.begin(), all_docs_.end()), all_docs_.end());
+
+        table_.forEach([&](const std::string&, std::vector<int>& lst) {
+            std::sort(lst.begin(), lst.end());
+            lst.erase(std::unique(lst.begin(), lst.end()), lst.end());
+        });
+    }
+
+    { ScopedTimer t(timesNs); TraceSpan ts("buildTimes", "index"); buildTimes(); }
+    { ScopedTimer t(bitmapsNs); TraceSpan ts("buildBitmaps", "index"); buildBitmaps(); }
+    { ScopedTimer t(lexiconNs); TraceSpan ts("buildLexicon", "index"); buildLexicon(); }
+    { ScopedTimer t(sampleNs); TraceSpan ts("buildSample", "index"); buildSample(); }
+}
+
+size_t BooleanIndex::postingsCount() const {
+    size_t n = 0;
+    table_.forEach([&](const std::string&, const std::vector<int>& lst) { n += lst.size(); });
+    return n;
+}
+
+IndexMemory BooleanIndex::memory() const {
+    IndexMemory m;
+    m.postings = all_docs_.capacity() * sizeof(int);
+    table_.forEach([&](const std::string&, const std::vector<int>& lst) { m.postings += lst.capacity() * sizeof(int); });
+    m.table = table_.bytes();
+    m.bitmaps = all_bitmap_.capacity() * 8;
+    for (const auto& d : dense_) m.bitmaps += d.first.capacity() + d.second.capacity() * 8 + 64;
+    m.times = times_.capacity() * sizeof(uint32_t) + pending_times_.capacity() * sizeof(pending_times_[0]);
+    if (lexicon_) m.lexicon = lexicon_->bytes();
+    if (sample_) {
+        auto s = sample_->memory();
+        m.sample = s.total() - s.lexicon;
+    }
+    return m;
+}
+
+void BooleanIndex::buildTimes() {
+    if (pending_times_.empty()) return;
+    std::sort(pending_times_.begin(), pending_times_.end());
+    time_base_ = pending_times_.front().second;
+    for (const auto& p : pending_times_) time_base_ = std::min(time_base_, p.second);
+
+    times_.assign(all_docs_.size(), 0);
+    auto pos = all_docs_.begin();
+    for (const auto& p : pending_times_) {
+        pos = std::lower_bound(pos, all_docs_.end(), p.first);
+        if (pos == all_docs_.end()) break;
+        if (*pos != p.first) continue;
+        times_[pos - all_docs_.begin()] = (uint32_t)std::min<int64_t>(p.second - time_base_, UINT32_MAX);
+    }
+    time_ordered_ = std::is_sorted(times_.begin(), times_.end());
+    pending_times_.clear();
+    pending_times_.shrink_to_fit();
+}
+
+int64_t BooleanIndex::timeOf(int id) const {
+    auto it = std::lower_bound(all_docs_.begin(), all_docs_.end(), id);
+    if (times_.empty() || it == all_docs_.end() || *it != id) return -1;
+    return timeAt((size_t)(it - all_docs_.begin()));
+}
+
+std::pair<int, int> BooleanIndex::idRangeForTime(int64_t from, int64_t to) const {
+    if (all_docs_.empty()) return {0, 0};
+    auto first = [&](int64_t t) {
+        if (t <= time_base_) return times_.begin();
+        if (t > time_base_ + (int64_t)UINT32_MAX) return times_.end();
+        return std::lower_bound(times_.begin(), times_.end(), (uint32_t)(t - time_base_));
+    };
+    auto idAt = [&](std::vector<uint32_t>::const_iterator it) {
+        return it == times_.end() ? all_docs_.back() + 1 : all_docs_[(size_t)(it - times_.begin())];
+    };
+    return {idAt(first(from)), idAt(first(to))};
+}
+
+static void setBits(std::vector<uint64_t>& bits, const std::vector<int>& ids, int base) {
+    for (int id : ids) {
+        size_t i = (size_t)(id - base);
+        bits[i >> 6] |= 1ull << (i & 63);
+    }
+}
 
-    table_.forEach([&](const std::string&, std::vector<int>& lst) {
-        std::sort(lst.begin(), lst.end());
-        lst.erase(std::unique(lst.begin(), lst.end()), lst.end());
+void BooleanIndex::buildBitmaps() {
+    dense_.clear();
+    all_bitmap_.clear();
+    if (all_docs_.empty()) return;
+
+    int base = bitmapBase();
+    size_t words = (size_t)(all_docs_.back() - base) / 64 + 1;
+    all_bitmap_.assign(words, 0);
+    setBits(all_bitmap_, all_docs_, base);
+
+    size_t minDf = std::max<size_t>(1, all_docs_.size() / kDenseRatio);
+    table_.forEach([&](const std::string& term, const std::vector<int>& lst) {
+        if (lst.size() < minDf) return;
+        auto& bits = dense_[term];
+        bits.assign(words, 0);
+        setBits(bits, lst, base);
+    });
+}
+
+void BooleanIndex::buildLexicon() {
+    std::vector<std::pair<std::string_view, uint32_t>> terms;
+    terms.reserve(table_.size());
+    table_.forEach([&](const std::string& term, const std::vector<int>& lst) {
+        if (!isFilterKey(term)) terms.push_back({term, (uint32_t)lst.size()});
+    });
+    lexicon_ = std::make_shared<const TermLexicon>(std::move(terms));
+}
+
+bool BooleanIndex::inSample(int id) {
+    static_assert(kSampleRate == 64, "keeps ids whose top 6 hash bits are zero");
+    uint32_t h = (uint32_t)id * 2654435761u;
+    return (h >> 26) == 0;
+}
+
+void BooleanIndex::buildSample() {
+    sample_.reset();
+    if (all_docs_.size() < kSampleRate) return;
+
+    sample_ = std::make_unique<BooleanIndex>(std::max<size_t>(8, table_.size() / 4));
+    for (int id : all_docs_) if (inSample(id)) sample_->all_docs_.push_back(id);
+    sample_->docs_count_ = docs_count_;
+    sample_->lexicon_ = lexicon_;
+    if (hasTimes()) {
+        for (size_t i = 0; i < all_docs_.size(); i++)
+            if (inSample(all_docs_[i])) sample_->times_.push_back(times_[i]);
+        sample_->time_base_ = time_base_;
+        sample_->time_ordered_ = time_ordered_;
+    }
+    table_.forEach([&](const std::string& term, const std::vector<int>& lst) {
+        std::vector<int>* dst = nullptr;
+        for (int id : lst) {
+            if (!inSample(id)) continue;
+            if (!dst) dst = &sample_->table_.getOrInsert(term);
+            dst->push_back(id);
+        }
     });
+    sample_->buildBitmaps();
 }
 
+const std::vector<uint64_t>* BooleanIndex::bitmap(const std::string& term) const {
+    auto it = dense_.find(term);
+    return it == dense_.end() ? nullptr : &it->second;
+}
+
+static const std::vector<int> g_noPostings;
+
 const std::vector<int>& BooleanIndex::postings(const std::string& term) const {
-    static const std::vector<int> empty;
     if (auto p = table_.find(term)) return *p;
-    return empty;
-}
\ No newline at end of file
+    return g_noPostings;
+}
+
+void BooleanIndex::postings(const std::string* const* terms, size_t n, const std::vector<int>** out) const {
+    table_.findBatch(terms, n, out);
+    for (size_t i = 0; i < n; i++)
+        if (!out[i]) out[i] = &g_noPostings;
+}
+
+template <class T>
+static void putRaw(std::ostream& out, const T& v) { out.write((const char*)&v, sizeof(T)); }
+
+template <class T>
+static bool getRaw(std::istream& in, T& v) { return (bool)in.read((char*)&v, sizeof(T)); }
+
+static void putInts(std::ostream& out, const std::vector<int>& v) {
+    putRaw(out, (uint64_t)v.size());
+    out.write((const char*)v.data(), (std::streamsize)(v.size() * sizeof(int)));
+}
+
+static bool getInts(std::istream& in, std::vector<int>& v) {
+    uint64_t n = 0;
+    if (!getRaw(in, n)) return false;
+    v.resize(n);
+    return (bool)in.read((char*)v.data(), (std::streamsize)(n * sizeof(int)));
+}
+
+void BooleanIndex::save(std::ostream& out) const {
+    putRaw(out, (uint64_t)docs_count_);
+    putInts(out, all_docs_);
+    putRaw(out, (uint64_t)table_.size());
+    table_.forEach([&](const std::string& term, const std::vector<int>& lst) {
+        putRaw(out, (uint32_t)term.size());
+        out.write(term.data(), (std::streamsize)term.size());
+        putInts(out, lst);
+    });
+    putRaw(out, time_base_);
+    putRaw(out, (uint64_t)times_.size());
+    out.write((const char*)times_.data(), (std::streamsize)(times_.size() * sizeof(uint32_t)));
+}
+
+bool BooleanIndex::load(std::istream& in) {
+    uint64_t docs = 0, terms = 0;
+    if (!getRaw(in, docs) || !getInts(in, all_docs_) || !getRaw(in, terms)) return false;
+    docs_count_ = (size_t)docs;
+    table_ = HashTable((size_t)terms * 2);
+
+    std::string term;
+    for (uint64_t i = 0; i < terms; i++) {
+        uint32_t len = 0;
+        if (!getRaw(in, len)) return false;
+        term.resize(len);
+        if (!in.read(&term[0], len)) return false;
+        if (!getInts(in, table_.getOrInsert(term))) return false;
+    }
+    uint64_t nt = 0;
+    if (!getRaw(in, time_base_) || !getRaw(in, nt)) return false;
+    times_.resize(nt);
+    if (!in.read((char*)times_.data(), (std::streamsize)(nt * sizeof(uint32_t)))) return false;
+    time_ordered_ = std::is_sorted(times_.begin(), times_.end());
+    buildBitmaps();
+    buildLexicon();
+    buildSample();
+    return true;
+}
@@ -1,29 +1,156 @@
 #pragma once
 #include <string>
 #include <vector>
+#include <iosfwd>
+#include <memory>
+#include <unordered_map>
+#include <cstdint>
+#include <string_view>
+#include <algorithm>
 #include "HashTable.h"
+#include "lexicon.h"
 
 struct Document {
     int id;
     std::string key;   
     std::string text;  
+    std::string source;
+    int64_t fetchedAt; // unix seconds, 0 if unknown
+    Document(int id = 0, std::string key = {}, std::string text = {}, std::string source = {}, int64_t fetchedAt = 0)
+        : id(id), key(std::move(key)), text(std::move(text)), source(std::move(source)), fetchedAt(fetchedAt) {}
+};
+
+// Approximate heap bytes of an index, by structure.
+struct IndexMemory {
+    size_t postings = 0;  // posting lists and the doc list
+    size_t table = 0;     // term hash table slots and keys
+    size_t bitmaps = 0;
+    size_t times = 0;
+    size_t lexicon = 0;
+    size_t sample = 0;    // the coordinated sample, lexicon excluded (shared)
+    size_t total() const { return postings + table + bitmaps + times + lexicon + sample; }
 };
 
 class BooleanIndex {
 public:
     BooleanIndex() = default;
+    explicit BooleanIndex(size_t tableCap) : table_(tableCap) {}
+
+    void addDocument(const Document& doc) {
+        addDocument(doc.id, doc.text);
+        addAttributes(doc.id, doc.key, doc.source);
+        if (doc.fetchedAt) setTime(doc.id, doc.fetchedAt);
+    }
+    void addDocument(int id, std::string_view text) { addTerms(id, extractTerms(text)); }
+    // Sorted distinct stems of text, as addDocument() indexes them.
+    static std::vector<std::string> extractTerms(std::string_view text);
+    void addTerms(int id, const std::vector<std::string>& terms);
+
+    // Low-cardinality attributes (source, URL host and first path section) are
+    // posting lists under "field:value" keys, which no stemmed term can collide
+    // with since the tokenizer splits on ':'. Like terms, only dense ones get a bitmap.
+    void addAttributes(int id, std::string_view url, std::string_view source);
+    static bool isFilterKey(const std::string& key) { return key.find(':') != std::string::npos; }
+    static std::string normalizeFilter(std::string_view field, std::string_view value);
+
+    // Per-document timestamps, kept after finalize() as u32 seconds since
+    // timeBase() aligned with allDocs(). When ids were assigned in time order
+    // the column is sorted and a time range maps to a doc-id range.
+    void setTime(int id, int64_t t) { pending_times_.push_back({id, t}); }
+    bool hasTimes() const { return !times_.empty(); }
+    bool timeOrdered() const { return time_ordered_; }
+    int64_t timeBase() const { return time_base_; }
+    int64_t timeAt(size_t pos) const { return time_base_ + times_[pos]; }
+    int64_t timeOf(int id) const; // -1 if unknown
+    // Ids of docs with from <= time < to as [lo, hi); requires timeOrdered().
+    std::pair<int, int> idRangeForTime(int64_t from, int64_t to) const;
+
+    // Ready sorted lists, e.g. the slice of a disk index one query needs.
+    void addList(const std::string& term, std::vector<int> ids) { table_.getOrInsert(term) = std::move(ids); }
+    void setAllDocs(std::vector<int> ids, size_t docsCount) { all_docs_ = std::move(ids); docs_count_ = docsCount; }
+    // Time column aligned with allDocs(), in the form times() returns it.
+    void setTimes(int64_t base, std::vector<uint32_t> times) {
+        time_base_ = base;
+        times_ = std::move(times);
+        time_ordered_ = std::is_sorted(times_.begin(), times_.end());
+    }
+    const std::vector<uint32_t>& times() const { return times_; }
 
-    void addDocument(const Document& doc);
     void finalize();
 
+    // Appends other's postings; other's ids must all be greater than ours.
+    template <class Keep>
+    void append(const BooleanIndex& other, Keep&& keep);
+
     const std::vector<int>& postings(const std::string& term) const;
+    // postings() of n terms at once, with their hash probes overlapped.
+    void postings(const std::string* const* terms, size_t n, const std::vector<int>** out) const;
     const std::vector<int>& allDocs() const { return all_docs_; }
 
+    // Posting lists holding at least 1/kDenseRatio of all docs also get a
+    // bitmap over [bitmapBase(), bitmapBase() + 64 * words); built by finalize().
+    static constexpr size_t kDenseRatio = 16;
+    const std::vector<uint64_t>* bitmap(const std::string& term) const;
+    const std::vector<uint64_t>& allBitmap() const { return all_bitmap_; }
+    int bitmapBase() const { return all_docs_.empty() ? 0 : all_docs_.front(); }
+
+    // Coordinated sample of the index: the same hash-selected 1/kSampleRate of
+    // doc ids for every term, so boolean plans can run on it unchanged.
+    static constexpr uint32_t kSampleRate = 64;
+    static bool inSample(int id);
+    const BooleanIndex* sample() const { return sample_.get(); }
+
+    // Sorted terms (filter keys excluded) with their df; built by finalize()
+    // and shared with the sample.
+    const TermLexicon* lexicon() const { return lexicon_.get(); }
+
     size_t docsCount() const { return docs_count_; }
     size_t termsCount() const { return table_.size(); }
+    size_t postingsCount() const;
+    IndexMemory memory() const;
+    HashTable::ProbeStats tableStats() const { return table_.probeStats(); }
+    template <class F>
+    void forEachList(F&& f) const { table_.forEach(f); }
+
+    void save(std::ostream& out) const;
+    bool load(std::istream& in);
 
 private:
     size_t docs_count_ = 0;
     std::vector<int> all_docs_;
     HashTable table_;
-};
\ No newline at end of file
+
+    std::vector<uint64_t> all_bitmap_;
+    std::unordered_map<std::string, std::vector<uint64_t>> dense_;
+    std::unique_ptr<BooleanIndex> sample_;
+    std::shared_ptr<const TermLexicon> lexicon_;
+
+    std::vector<uint32_t> times_;
+    int64_t time_base_ = 0;
+    bool time_ordered_ = false;
+    std::vector<std::pair<int, int64_t>> pending_times_;
+
+    void buildTimes();
+    void buildBitmaps();
+    void buildSample();
+    void buildLexicon();
+};
+
+template <class Keep>
+void BooleanIndex::append(const BooleanIndex& other, Keep&& keep) {
+    for (size_t i = 0; i < other.all_docs_.size(); i++) {
+        int id = other.all_docs_[i];
+        if (!keep(id)) continue;
+        all_docs_.push_back(id);
+        if (other.hasTimes()) setTime(id, other.timeAt(i));
+        docs_count_ = std::max(docs_count_, (size_t)(id + 1));
+    }
+    other.table_.forEach([&](const std::string& term, const std::vector<int>& lst) {
+        std::vector<int>* dst = nullptr;
+        for (int id : lst) {
+            if (!keep(id)) continue;
+            if (!dst) dst = &table_.getOrInsert(term);
+            dst->push_back(id);
+        }
+    });
+}
\ No newline at end of file
@@ -1,42 +1,91 @@
 #include "b_srch.h"
 #include "Tokenizer.h"
 #include "Stemmer.h"
+#include "trace.h"
+#include "perf_counters.h"
 #include <algorithm>
 #include <cctype>
+#include <charconv>
+#include <thread>
+#include <cmath>
+#include <chrono>
+#include <cstdio>
+#include <type_traits>
 
 bool BooleanSearch::isOp(TokType t){ return t==TokType::AND||t==TokType::OR||t==TokType::NOT; }
 int  BooleanSearch::prec(TokType t){ return (t==TokType::NOT)?3:(t==TokType::AND)?2:(t==TokType::OR)?1:0; }
 
-std::vector<int> BooleanSearch::opAnd(const std::vector<int>& a, const std::vector<int>& b){
-    std::vector<int> out; out.reserve(std::min(a.size(), b.size()));
-    size_t i=0,j=0;
-    while(i<a.size()&&j<b.size()){
-        if(a[i]==b[j]){ out.push_back(a[i]); i++; j++; }
-        else if(a[i]<b[j]) i++; else j++;
+BooleanSearch::BooleanSearch(const BooleanIndex& idx)
+    : idx_(idx), threads_(std::max(1u, std::thread::hardware_concurrency())) {}
+
+void BooleanSearch::opAnd(Span a, Span b, std::vector<int>& out){
+    out.reserve(std::min(a.size(), b.size()));
+    const int *i=a.b, *j=b.b;
+    while(i<a.e&&j<b.e){
+        if(*i==*j){ out.push_back(*i); i++; j++; }
+        else if(*i<*j) i++; else j++;
+    }
+}
+void BooleanSearch::opOr(Span a, Span b, std::vector<int>& out){
+    out.reserve(a.size()+b.size());
+    const int *i=a.b, *j=b.b;
+    while(i<a.e||j<b.e){
+        if(j==b.e||(i<a.e&&*i<*j)) out.push_back(*i++);
+        else if(i==a.e||*j<*i) out.push_back(*j++);
+        else { out.push_back(*i); i++; j++; }
+    }
+}
+void BooleanSearch::opNot(Span u, Span b, std::vector<int>& out){
+    out.reserve(u.size());
+    const int *i=u.b, *j=b.b;
+    while(i<u.e){
+        if(j==b.e||*i<*j) out.push_back(*i++);
+        else if(*i==*j){ i++; j++; }
+        else j++;
+    }
+}
+
+size_t BooleanSearch::countAnd(Span a, Span b){
+    if(a.size()>b.size()) std::swap(a, b);
+    size_t n=0;
+    // A short list against a long one: gallop through the long one.
+    if(a.size()*32 < b.size()){
+        const int* j=b.b;
+        for(const int* i=a.b;i<a.e && j<b.e;i++){
+            size_t step=1;
+            while(j+step<b.e && j[step]<*i) step<<=1;
+            j=std::lower_bound(j+step/2, j+std::min(step+1, b.size()-(size_t)(j-b.b)), *i);
+            if(j<b.e && *j==*i){ n++; j++; }
+        }
+        return n;
     }
+    const int *i=a.b, *j=b.b;
+    while(i<a.e&&j<b.e){
+        if(*i==*j){ n++; i++; j++; }
+        else if(*i<*j) i++; else j++;
+    }
+    return n;
+}
+
+std::vector<int> BooleanSearch::opAnd(const std::vector<int>& a, const std::vector<int>& b){
+    std::vector<int> out; opAnd(Span{a.data(),a.data()+a.size()}, Span{b.data(),b.data()+b.size()}, out);
     return out;
 }
 std::vector<int> BooleanSearch::opOr(const std::vector<int>& a, const std::vector<int>& b){
-    std::vector<int> out; out.reserve(a.size()+b.size());
-    size_t i=0,j=0;
-    while(i<a.size()||j<b.size()){
-        if(j==b.size()||(i<a.size()&&a[i]<b[j])) out.push_back(a[i++]);
-        else if(i==a.size()||b[j]<a[i]) out.push_back(b[j++]);
-        else { out.push_back(a[i]); i++; j++; }
-    }
+    std::vector<int> out; opOr(Span{a.data(),a.data()+a.size()}, Span{b.data(),b.data()+b.size()}, out);
     return out;
 }
 std::vector<int> BooleanSearch::opNot(const std::vector<int>& u, const std::vector<int>& b){
-    std::vector<int> out; out.reserve(u.size());
-    size_t i=0,j=0;
-    while(i<u.size()){
-        if(j==b.size()||u[i]<b[j]) out.push_back(u[i++]);
-        else if(u[i]==b[j]){ i++; j++; }
-        else j++;
-    }
+    std::vector<int> out; opNot(Span{u.data(),u.data()+u.size()}, Span{b.data(),b.data()+b.size()}, out);
     return out;
 }
 
+BooleanSearch::Span BooleanSearch::slice(const std::vector<int>& v, int lo, int hi){
+    const int* b = std::lower_bound(v.data(), v.data()+v.size(), lo);
+    const int* e = std::lower_bound(b, v.data()+v.size(), hi);
+    return {b, e};
+}
+
 static bool isAsciiWord(const std::string& s){
     if(s.empty()) return false;
     for(unsigned char c: s) if(!(c<128 && std::isalpha(c))) return false;
@@ -47,12 +96,69 @@ static std::string upperAscii(std::string s){
     return s;
 }
 
-std::vector<BooleanSearch::Tok> BooleanSearch::lex(const std::string& q) const {
+static bool isFilterField(const std::string& f){
+    return f=="source" || f=="host" || f=="section";
+}
+
+// Unix seconds, or UTC YYYY-MM-DD[THH:MM[:SS]].
+static bool parseTime(const std::string& s, int64_t& t){
+    if(!s.empty() && std::all_of(s.begin(), s.end(), [](unsigned char c){ return std::isdigit(c); })){
+        auto r = std::from_chars(s.data(), s.data()+s.size(), t);
+        return r.ec==std::errc();
+    }
+    int y=0, m=0, d=0, hh=0, mm=0, ss=0;
+    int n = std::sscanf(s.c_str(), "%4d-%2d-%2dT%2d:%2d:%2d", &y, &m, &d, &hh, &mm, &ss);
+    if(n<3 || m<1 || m>12 || d<1 || d>31) return false;
+    y -= m<=2;
+    int64_t era = (y>=0 ? y : y-399) / 400;
+    int64_t yoe = y - era*400;
+    int64_t doy = (153*(m + (m>2 ? -3 : 9)) + 2)/5 + d - 1;
+    int64_t doe = yoe*365 + yoe/4 - yoe/100 + doy;
+    t = (era*146097 + doe - 719468)*86400 + hh*3600 + mm*60 + ss;
+    return true;
+}
+
+std::vector<BooleanSearch::Tok> BooleanSearch::lex(const std::string& q) {
     std::vector<Tok> raw;
     std::string buf;
 
     auto flush = [&](){
         if(buf.empty()) return;
+        size_t colon = buf.find(':');
+        if(colon!=std::string::npos && colon+1<buf.size()){
+            std::string field = buf.substr(0, colon);
+            for(char& c: field) c=(char)std::tolower((unsigned char)c);
+            if(isFilterField(field)){
+                raw.push_back({TokType::FILTER, BooleanIndex::normalizeFilter(field, std::string_view(buf).substr(colon+1))});
+                buf.clear();
+                return;
+            }
+            int64_t t = 0;
+            if((field=="after" || field=="before") && parseTime(buf.substr(colon+1), t)){
+                if(field=="after") raw.push_back({TokType::RANGE, {}, t, INT64_MAX});
+                else raw.push_back({TokType::RANGE, {}, INT64_MIN, t});
+                buf.clear();
+                return;
+            }
+        }
+        size_t tilde = buf.rfind('~');
+        if(tilde!=std::string::npos && tilde>0 &&
+           (tilde+1==buf.size() || (tilde+2==buf.size() && (buf[tilde+1]=='1' || buf[tilde+1]=='2')))){
+            int64_t dist = tilde+1==buf.size() ? 2 : buf[tilde+1]-'0';
+            for(auto& t: Tokenizer::tokenize(buf.substr(0, tilde))){
+                auto term = Stemmer::stem(t);
+                if(!term.empty()) raw.push_back({TokType::FUZZY, term, dist, 0, buf});
+            }
+            buf.clear();
+            return;
+        }
+        if(buf.size()>2 && buf.front()=='*' && buf.back()=='*'){
+            std::string infix;
+            for(auto& t: Tokenizer::tokenize(buf.substr(1, buf.size()-2))) infix += t;
+            if(!infix.empty()) raw.push_back({TokType::PATTERN, infix, 0, 0, buf});
+            buf.clear();
+            return;
+        }
         if(isAsciiWord(buf)){
             auto up = upperAscii(buf);
             if(up=="AND"){ raw.push_back({TokType::AND,{}}); buf.clear(); return; }
@@ -62,12 +168,23 @@ std::vector<BooleanSearch::Tok> BooleanSearch::lex(const std::string& q) const {
         auto toks = Tokenizer::tokenize(buf);
         for(auto& t: toks){
             auto term = Stemmer::stem(t);
-            if(!term.empty()) raw.push_back({TokType::TERM, term});
+            if(!term.empty()) raw.push_back({TokType::TERM, term, 0, 0, t});
         }
         buf.clear();
     };
 
-    for(char c: q){
+    for(size_t i=0;i<q.size();i++){
+        char c = q[i];
+        if(c=='/' && buf.empty()){
+            // /regex/ runs to the next unescaped slash and may hold spaces and parentheses.
+            std::string re;
+            size_t j = i+1;
+            for(; j<q.size() && q[j]!='/'; j++){
+                if(q[j]=='\\' && j+1<q.size() && q[j+1]=='/') j++;
+                re.push_back(q[j]);
+            }
+            if(j<q.size() && !re.empty()){ raw.push_back({TokType::PATTERN, re, 1, 0, q.substr(i, j-i+1)}); i = j; continue; }
+        }
         if(c=='('){ flush(); raw.push_back({TokType::LPAREN,{}}); }
         else if(c==')'){ flush(); raw.push_back({TokType::RPAREN,{}}); }
         else if(std::isspace((unsigned char)c)) flush();
@@ -80,18 +197,65 @@ std::vector<BooleanSearch::Tok> BooleanSearch::lex(const std::string& q) const {
         norm.push_back(raw[i]);
         if(i+1<raw.size()){
             auto a=raw[i].type, b=raw[i+1].type;
-            bool left  = (a==TokType::TERM || a==TokType::RPAREN);
-            bool right = (b==TokType::TERM || b==TokType::LPAREN || b==TokType::NOT);
+            bool left  = (isOperand(a) || a==TokType::RPAREN);
+            bool right = (isOperand(b) || b==TokType::LPAREN || b==TokType::NOT);
             if(left && right) norm.push_back({TokType::AND,{}});
         }
     }
     return norm;
 }
 
+// Each FUZZY or PATTERN token becomes a parenthesized OR of its matches; with
+// none it stays a TERM for its own text, which then matches nothing or itself.
+std::vector<BooleanSearch::Tok> BooleanSearch::expandTerms(std::vector<Tok> toks, const TermLexicon* lex) {
+    if(std::none_of(toks.begin(), toks.end(), [](const Tok& t){ return t.type==TokType::FUZZY || t.type==TokType::PATTERN; }))
+        return toks;
+    std::vector<Tok> out;
+    for(auto& tk: toks){
+        if(tk.type!=TokType::FUZZY && tk.type!=TokType::PATTERN){ out.push_back(std::move(tk)); continue; }
+        std::vector<TermLexicon::Match> m;
+        if(lex && tk.type==TokType::FUZZY) m = lex->fuzzy(tk.val, (int)tk.from, kMaxFuzzyExpansions);
+        else if(lex && tk.from) m = lex->matching(tk.val, kMaxPatternExpansions);
+        else if(lex) m = lex->containing(tk.val, kMaxPatternExpansions);
+        if(m.empty()){ out.push_back({TokType::TERM, tk.val, 0, 0, tk.text}); continue; }
+        out.push_back({TokType::LPAREN, {}});
+        for(size_t i=0;i<m.size();i++){
+            if(i) out.push_back({TokType::OR, {}});
+            out.push_back({TokType::TERM, std::move(m[i].term), 0, 0, tk.text});
+        }
+        out.push_back({TokType::RPAREN, {}});
+    }
+    return out;
+}
+
+std::string BooleanSearch::completionPrefix(const std::string& input) {
+    if(input.empty() || std::isspace((unsigned char)input.back())) return {};
+    auto toks = Tokenizer::tokenize(input.substr(input.find_last_of(" \t(")+1));
+    return toks.empty() ? std::string() : toks.back();
+}
+
+std::vector<std::string> BooleanSearch::queryTerms(const std::string& query) {
+    std::vector<std::string> out;
+    for(auto& tk: lex(query)) if(tk.type==TokType::TERM || tk.type==TokType::FUZZY) out.push_back(tk.val);
+    return out;
+}
+
+std::vector<std::string> BooleanSearch::queryKeys(const std::string& query, bool& needsAll, const TermLexicon* lexicon) {
+    std::vector<std::string> out;
+    needsAll = false;
+    for(auto& tk: expandTerms(lex(query), lexicon)){
+        if(tk.type==TokType::TERM || tk.type==TokType::FILTER) out.push_back(tk.val);
+        else if(tk.type==TokType::NOT || tk.type==TokType::RANGE) needsAll = true;
+    }
+    std::sort(out.begin(), out.end());
+    out.erase(std::unique(out.begin(), out.end()), out.end());
+    return out;
+}
+
 std::vector<BooleanSearch::Tok> BooleanSearch::toRpn(const std::vector<Tok>& toks) const {
     std::vector<Tok> out, st;
     for(auto& tk: toks){
-        if(tk.type==TokType::TERM) out.push_back(tk);
+        if(isOperand(tk.type)) out.push_back(tk);
         else if(isOp(tk.type)){
             while(!st.empty() && isOp(st.back().type) &&
                   (prec(st.back().type)>prec(tk.type) ||
@@ -109,32 +273,605 @@ std::vector<BooleanSearch::Tok> BooleanSearch::toRpn(const std::vector<Tok>& tok
     return out;
 }
 
-std::vector<int> BooleanSearch::evalRpn(const std::vector<Tok>& rpn) const {
-    std::vector<std::vector<int>> st;
+BooleanSearch::Plan BooleanSearch::plan(const std::string& q, std::vector<Tok>* tokens) const {
+    TraceSpan span("plan", "query");
+    Plan p;
+    auto toks = expandTerms(lex(q), idx_.lexicon());
+    if(tokens) *tokens = toks;
+
+    int depth = 0;
+    bool topOr = false;
+    for(auto& tk: toks){
+        if(tk.type==TokType::LPAREN) depth++;
+        else if(tk.type==TokType::RPAREN) depth--;
+        else if(tk.type==TokType::OR && depth==0) topOr = true;
+    }
+    if(topOr){ p.rpn = toRpn(toks); return p; }
+
+    std::vector<bool> drop(toks.size(), false);
+    std::vector<const std::string*> filters;
+    std::vector<const Tok*> ranges;
+    depth = 0;
+    for(size_t i=0;i<toks.size();i++){
+        auto t = toks[i].type;
+        if(t==TokType::LPAREN) depth++;
+        else if(t==TokType::RPAREN) depth--;
+        if((t!=TokType::FILTER && t!=TokType::RANGE) || depth!=0 || (i>0 && toks[i-1].type==TokType::NOT)) continue;
+        if(t==TokType::FILTER) filters.push_back(&toks[i].val);
+        else ranges.push_back(&toks[i]);
+        drop[i] = true;
+        if(i>0 && toks[i-1].type==TokType::AND && !drop[i-1]) drop[i-1] = true;
+        else if(i+1<toks.size() && toks[i+1].type==TokType::AND) drop[i+1] = true;
+    }
+    if(filters.empty() && ranges.empty()){ p.rpn = toRpn(toks); return p; }
+
+    for(auto* r: ranges){
+        if(idx_.timeOrdered()){
+            auto ids = idx_.idRangeForTime(r->from, r->to);
+            p.ranged = true;
+            p.lo = std::max(p.lo, ids.first);
+            p.hi = std::min(p.hi, ids.second);
+            continue;
+        }
+        // Without time order every doc's timestamp has to be checked.
+        if(!p.masked){ p.masked = true; p.mask = idx_.allBitmap(); }
+        Mask bits(p.mask.size(), 0);
+        for(int id: timeRangeIds(*r, INT_MIN, INT_MAX)){
+            size_t b = (size_t)(id - idx_.bitmapBase());
+            bits[b>>6] |= 1ull << (b&63);
+        }
+        for(size_t w=0;w<p.mask.size();w++) p.mask[w] &= bits[w];
+    }
+
+    if(!filters.empty() && !p.masked){ p.masked = true; p.mask = idx_.allBitmap(); }
+    for(auto* f: filters){
+        const Mask* bm = idx_.bitmap(*f);
+        Mask bits;
+        if(!bm){
+            bits.assign(p.mask.size(), 0);
+            for(int id: idx_.postings(*f)){ size_t b=(size_t)(id-idx_.bitmapBase()); bits[b>>6] |= 1ull<<(b&63); }
+            bm = &bits;
+        }
+        for(size_t w=0;w<p.mask.size();w++) p.mask[w] &= (*bm)[w];
+    }
+
+    std::vector<Tok> rest;
+    for(size_t i=0;i<toks.size();i++) if(!drop[i]) rest.push_back(std::move(toks[i]));
+    p.rpn = toRpn(rest);
+    return p;
+}
+
+// Ids in [lo, hi) whose timestamp falls in tk's range; none if the index has no timestamps.
+std::vector<int> BooleanSearch::timeRangeIds(const Tok& tk, int lo, int hi) const {
+    const auto& all = idx_.allDocs();
+    if(!idx_.hasTimes()) return {};
+    if(idx_.timeOrdered()){
+        auto r = idx_.idRangeForTime(tk.from, tk.to);
+        Span s = slice(all, std::max(lo, r.first), std::min(hi, r.second));
+        return std::vector<int>(s.b, s.e);
+    }
+    std::vector<int> out;
+    Span s = slice(all, lo, hi);
+    for(const int* i=s.b;i<s.e;i++){
+        int64_t t = idx_.timeAt((size_t)(i - all.data()));
+        if(t>=tk.from && t<tk.to) out.push_back(*i);
+    }
+    return out;
+}
+
+// Evaluates rpn restricted to doc ids in [lo, hi). Posting lists are entered
+// by binary search and read in place; only operator results are materialized.
+// With a mask, every list read is first pruned to the ids set in it.
+std::vector<int> BooleanSearch::evalRange(const std::vector<Tok>& rpn, int lo, int hi, const Mask* mask,
+                                          QueryProfile* prof) const {
+    TraceSpan span("evalRange", "query");
+    span.arg("lo", lo);
+    span.arg("hi", hi);
+    PerfScope perf(PerfStage::QUERY);
+    int base = idx_.bitmapBase();
+    auto keep = [&](Span s){
+        std::vector<int> out;
+        for(const int* i=s.b;i<s.e;i++){
+            size_t b = (size_t)(*i-base);
+            if(((*mask)[b>>6] >> (b&63)) & 1) out.push_back(*i);
+        }
+        return out;
+    };
+    if(rpn.empty()){
+        Span all = slice(idx_.allDocs(), lo, hi);
+        return mask ? keep(all) : std::vector<int>(all.b, all.e);
+    }
+
+    struct Val { Span s; std::vector<int> own; };
+    std::vector<Val> st;
+    auto push = [&](std::vector<int>&& v){
+        st.push_back({{nullptr,nullptr}, std::move(v)});
+        st.back().s = {st.back().own.data(), st.back().own.data()+st.back().own.size()};
+    };
+    auto pop = [&](){
+        Val v = std::move(st.back()); st.pop_back();
+        if(!v.own.empty()) v.s = {v.own.data(), v.own.data()+v.own.size()};
+        return v;
+    };
+
+    auto lists = operandLists(rpn);
+    using Clock = std::chrono::steady_clock;
+    for(size_t k=0;k<rpn.size();k++){
+        auto& tk = rpn[k];
+        Clock::time_point t0;
+        PerfSample c0;
+        std::vector<size_t> in;
+        size_t scratch = 0;
+        if(prof){
+            c0 = PerfCounters::thread().read();
+            t0 = Clock::now();
+            if(tk.type==TokType::NOT) in = {slice(idx_.allDocs(), lo, hi).size(), st.empty() ? 0 : st.back().s.size()};
+            else if(isOp(tk.type) && st.size()>=2) in = {st[st.size()-2].s.size(), st.back().s.size()};
+        }
+        if(tk.type==TokType::RANGE){
+            auto ids = timeRangeIds(tk, lo, hi);
+            if(mask){ scratch = ids.capacity(); push(keep({ids.data(), ids.data()+ids.size()})); }
+            else push(std::move(ids));
+        } else if(isOperand(tk.type)){
+            Span s = slice(*lists[k], lo, hi);
+            if(prof) in = {s.size()};
+            if(mask) push(keep(s)); else st.push_back({s, {}});
+        } else if(tk.type==TokType::NOT){
+            Val a = st.empty()?Val{{nullptr,nullptr},{}}:pop();
+            std::vector<int> out, u;
+            Span us = slice(idx_.allDocs(), lo, hi);
+            if(mask){ u = keep(us); us = {u.data(), u.data()+u.size()}; }
+            opNot(us, a.s, out);
+            scratch = u.capacity();
+            push(std::move(out));
+        } else if(tk.type==TokType::AND || tk.type==TokType::OR){
+            if(st.size()<2) push({});
+            else {
+                Val b=pop(); Val a=pop();
+                std::vector<int> out;
+                if(tk.type==TokType::AND) opAnd(a.s,b.s,out); else opOr(a.s,b.s,out);
+                push(std::move(out));
+            }
+        }
+        if(prof && k<prof->steps.size() && !st.empty()){
+            auto& step = prof->steps[k];
+            step.ms = std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+            step.perf = PerfCounters::thread().read() - c0;
+            step.in = std::move(in);
+            step.out = st.back().s.size();
+            step.bytes = (st.back().own.capacity() + scratch) * sizeof(int);
+        }
+    }
+    if(st.empty()) return {};
+    Val r = pop();
+    if(!r.own.empty() || r.s.b==r.s.e) return std::move(r.own);
+    return std::vector<int>(r.s.b, r.s.e);
+}
+
+size_t BooleanSearch::estimateCost(const std::vector<Tok>& rpn) const {
+    size_t cost = 0;
+    auto lists = operandLists(rpn);
+    for(size_t k=0;k<rpn.size();k++){
+        if(lists[k]) cost += lists[k]->size();
+        else if(rpn[k].type==TokType::NOT) cost += idx_.allDocs().size();
+    }
+    return cost;
+}
+
+// Expanded fuzzy and pattern terms put up to 1000 operands in one query.
+std::vector<const std::vector<int>*> BooleanSearch::operandLists(const std::vector<Tok>& rpn) const {
+    std::vector<const std::string*> keys;
+    std::vector<size_t> at;
+    for(size_t k=0;k<rpn.size();k++){
+        if(!isOperand(rpn[k].type) || rpn[k].type==TokType::RANGE) continue;
+        keys.push_back(&rpn[k].val);
+        at.push_back(k);
+    }
+    std::vector<const std::vector<int>*> found(keys.size()), lists(rpn.size(), nullptr);
+    idx_.postings(keys.data(), keys.size(), found.data());
+    for(size_t i=0;i<at.size();i++) lists[at[i]] = found[i];
+    return lists;
+}
+
+std::vector<int> BooleanSearch::evalRpn(const std::vector<Tok>& rpn, const Mask* mask, int lo, int hi) const {
+    const auto& all = idx_.allDocs();
+    if(all.empty()) return {};
+    lo = std::max(lo, all.front());
+    hi = std::min(hi, all.back()+1);
+    if(lo>=hi) return {};
+
+    TraceSpan span("evalRpn", "query");
+    span.arg("tokens", (int64_t)rpn.size());
+    unsigned parts = threads_;
+    if(parts<2 || estimateCost(rpn)<parallelMinCost_) return evalRange(rpn, lo, hi, mask);
+
+    Span docs = slice(all, lo, hi);
+    parts = (unsigned)std::min<size_t>(parts, docs.size());
+    if(parts<2) return evalRange(rpn, lo, hi, mask);
+    std::vector<int> bounds(parts+1);
+    for(unsigned p=0;p<parts;p++) bounds[p] = docs.b[docs.size()*p/parts];
+    bounds[0] = lo;
+    bounds[parts] = hi;
+
+    std::vector<std::vector<int>> partial(parts);
+    std::vector<std::thread> th;
+    for(unsigned p=1;p<parts;p++)
+        th.emplace_back([&,p]{ partial[p] = evalRange(rpn, bounds[p], bounds[p+1], mask); });
+    partial[0] = evalRange(rpn, bounds[0], bounds[1], mask);
+    for(auto& t: th) t.join();
+
+    size_t total = 0;
+    for(auto& v: partial) total += v.size();
+    std::vector<int> out; out.reserve(total);
+    for(auto& v: partial) out.insert(out.end(), v.begin(), v.end());
+    return out;
+}
+
+std::vector<int> BooleanSearch::search(const std::string& query) const {
+    auto p = plan(query);
+    if(p.empty()) return {};
+    return evalRpn(p.rpn, p.maskPtr(), p.lo, p.hi);
+}
+
+static const char* tokName(int t){
+    static const char* k[] = {"TERM", "FILTER", "RANGE", "FUZZY", "PATTERN", "AND", "OR", "NOT", "(", ")"};
+    return k[t];
+}
+
+static std::string rangeText(int64_t from, int64_t to){
+    if(from==INT64_MIN) return "before:" + std::to_string(to);
+    if(to==INT64_MAX) return "after:" + std::to_string(from);
+    return "time:[" + std::to_string(from) + "," + std::to_string(to) + ")";
+}
+
+void BooleanSearch::describe(const Plan& p, const std::vector<Tok>& toks, QueryProfile& prof) const {
+    for(auto& tk: toks){
+        if(tk.type==TokType::RANGE) prof.tokens.push_back(rangeText(tk.from, tk.to));
+        else if(isOperand(tk.type)) prof.tokens.push_back(tk.val);
+        else prof.tokens.push_back(tokName((int)tk.type));
+    }
+    size_t docs = idx_.allDocs().size();
+    prof.masked = p.masked;
+    if(p.masked){
+        prof.maskDocs = 0;
+        for(uint64_t w: p.mask) prof.maskDocs += (size_t)__builtin_popcountll(w);
+        docs = prof.maskDocs;
+    }
+    prof.ranged = p.ranged;
+    prof.lo = p.lo;
+    prof.hi = p.hi;
+    if(p.ranged) docs = std::min(docs, p.lo<p.hi ? slice(idx_.allDocs(), p.lo, p.hi).size() : 0);
+    prof.cost = estimateCost(p.rpn);
+    prof.parts = threads_>=2 && prof.cost>=parallelMinCost_ ? threads_ : 1;
+
+    // Bounds: a list is cut by the mask or range, AND keeps the smaller input,
+    // OR at most both, NOT at most every doc.
+    std::vector<int> st;
+    for(auto& tk: p.rpn){
+        QueryProfile::Step s;
+        s.op = tokName((int)tk.type);
+        if(tk.type==TokType::RANGE){
+            s.term = rangeText(tk.from, tk.to);
+            s.kernel = idx_.timeOrdered() ? "time-id-range" : "time-scan";
+            s.out = docs;
+        } else if(isOperand(tk.type)){
+            s.term = tk.val;
+            s.text = tk.text;
+            s.postings = idx_.postings(tk.val).size();
+            s.kernel = p.masked ? "slice+mask-filter" : "slice";
+            s.out = std::min(s.postings, docs);
+        } else {
+            int n = tk.type==TokType::NOT ? 1 : 2;
+            if((int)st.size()>=n){
+                s.args.assign(st.end()-n, st.end());
+                st.resize(st.size()-n);
+            }
+            for(int a: s.args) s.in.push_back(prof.steps[a].out);
+            if(tk.type==TokType::NOT){
+                s.kernel = p.masked ? "mask-filter+merge-not" : "merge-not";
+                s.in.insert(s.in.begin(), docs);
+                s.out = docs;
+            } else if(tk.type==TokType::AND){
+                s.kernel = "merge-and";
+                s.out = s.in.size()==2 ? std::min(s.in[0], s.in[1]) : 0;
+            } else {
+                s.kernel = "merge-or";
+                s.out = s.in.size()==2 ? std::min(docs, s.in[0]+s.in[1]) : 0;
+            }
+        }
+        st.push_back((int)prof.steps.size());
+        prof.steps.push_back(std::move(s));
+    }
+}
+
+QueryProfile BooleanSearch::explain(const std::string& query) const {
+    QueryProfile prof;
+    prof.query = query;
+    auto t0 = std::chrono::steady_clock::now();
+    std::vector<Tok> toks;
+    auto p = plan(query, &toks);
+    prof.planMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+    describe(p, toks, prof);
+    return prof;
+}
+
+std::vector<int> BooleanSearch::profile(const std::string& query, QueryProfile& prof) const {
+    prof = QueryProfile();
+    prof.query = query;
+    prof.executed = true;
+    auto t0 = std::chrono::steady_clock::now();
+    std::vector<Tok> toks;
+    auto p = plan(query, &toks);
+    prof.planMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+    describe(p, toks, prof);
+
+    PerfSample c0 = PerfCounters::thread().read();
+    t0 = std::chrono::steady_clock::now();
+    std::vector<int> hits;
+    const auto& all = idx_.allDocs();
+    if(!p.empty() && !all.empty()){
+        int lo = std::max(p.lo, all.front()), hi = std::min(p.hi, all.back()+1);
+        if(lo<hi) hits = evalRange(p.rpn, lo, hi, p.maskPtr(), &prof);
+    }
+    prof.evalMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+    prof.evalPerf = PerfCounters::thread().read() - c0;
+    prof.results = hits.size();
+    return hits;
+}
+
+static void textStep(const QueryProfile& prof, int k, int depth, std::string& out){
+    const auto& s = prof.steps[k];
+    char num[64];
+    out.append((size_t)depth*2 + 2, ' ');
+    out += s.op;
+    if(!s.term.empty()) out += " " + s.term;
+    if(!s.text.empty() && s.text!=s.term) out += " (" + s.text + ")";
+    out += "  [" + s.kernel + "]";
+    if(s.op=="TERM" || s.op=="FILTER") out += " postings=" + std::to_string(s.postings);
+    if(!s.in.empty()){
+        out += " in=";
+        for(size_t i=0;i<s.in.size();i++) out += (i ? "," : "") + std::to_string(s.in[i]);
+    }
+    out += (prof.executed ? " out=" : " out<=") + std::to_string(s.out);
+    if(prof.executed){
+        std::snprintf(num, sizeof(num), "  %.3f ms  %zu B", s.ms, s.bytes);
+        out += num;
+        if(s.perf.any()) out += "  " + s.perf.text();
+    }
+    out += "\n";
+    for(int a: s.args) textStep(prof, a, depth+1, out);
+}
+
+std::string QueryProfile::text() const {
+    std::string out = (executed ? "PROFILE " : "EXPLAIN ") + query + "\n  tokens:";
+    for(auto& t: tokens) out += " " + t;
+    out += "\n  rpn:";
+    for(auto& s: steps) out += " " + (s.term.empty() ? s.op : s.term);
+    out += "\n";
+    if(masked) out += "  filters: bitmap mask over " + std::to_string(maskDocs) + " docs\n";
+    if(ranged) out += "  time: doc ids [" + std::to_string(lo) + ", " + std::to_string(hi) + ")\n";
+    out += "  cost: " + std::to_string(cost) + " postings, " + std::to_string(parts) + " part(s)\n";
+    if(!steps.empty()) textStep(*this, (int)steps.size()-1, 0, out);
+    char num[96];
+    if(executed) std::snprintf(num, sizeof(num), "  results: %zu  plan %.3f ms  eval %.3f ms\n", results, planMs, evalMs);
+    else std::snprintf(num, sizeof(num), "  plan %.3f ms\n", planMs);
+    out += num;
+    if(executed && evalPerf.any()) out += "  counters: " + evalPerf.text() + "\n";
+    return out;
+}
+
+static std::string jsonStr(const std::string& s){
+    std::string out = "\"";
+    for(unsigned char c: s){
+        if(c=='"' || c=='\\'){ out += '\\'; out += (char)c; }
+        else if(c<0x20){ char b[8]; std::snprintf(b, sizeof(b), "\\u%04x", c); out += b; }
+        else out += (char)c;
+    }
+    return out + "\"";
+}
+
+template <class T>
+static std::string jsonList(const std::vector<T>& v){
+    std::string out = "[";
+    for(size_t i=0;i<v.size();i++){
+        if(i) out += ",";
+        if constexpr (std::is_same_v<T, std::string>) out += jsonStr(v[i]); else out += std::to_string(v[i]);
+    }
+    return out + "]";
+}
+
+std::string QueryProfile::json() const {
+    char num[64];
+    auto dbl = [&](double x){ std::snprintf(num, sizeof(num), "%.6g", x); return std::string(num); };
+    std::string out = "{\"query\":" + jsonStr(query) + ",\"executed\":" + (executed ? "true" : "false") +
+        ",\"tokens\":" + jsonList(tokens) + ",\"masked\":" + (masked ? "true" : "false") +
+        ",\"mask_docs\":" + std::to_string(maskDocs) + ",\"ranged\":" + (ranged ? "true" : "false");
+    if(ranged) out += ",\"lo\":" + std::to_string(lo) + ",\"hi\":" + std::to_string(hi);
+    out += ",\"cost\":" + std::to_string(cost) + ",\"parts\":" + std::to_string(parts) + ",\"steps\":[";
+    for(size_t k=0;k<steps.size();k++){
+        const auto& s = steps[k];
+        if(k) out += ",";
+        out += "{\"id\":" + std::to_string(k) + ",\"op\":" + jsonStr(s.op) + ",\"term\":" + jsonStr(s.term) +
+               ",\"text\":" + jsonStr(s.text) + ",\"kernel\":" + jsonStr(s.kernel) + ",\"args\":" + jsonList(s.args) +
+               ",\"in\":" + jsonList(s.in) + ",\"postings\":" + std::to_string(s.postings) +
+               ",\"out\":" + std::to_string(s.out);
+        if(executed) out += ",\"ms\":" + dbl(s.ms) + ",\"bytes\":" + std::to_string(s.bytes) + ",\"perf\":" + s.perf.json();
+        out += "}";
+    }
+    out += "],\"plan_ms\":" + dbl(planMs);
+    if(executed) out += ",\"eval_ms\":" + dbl(evalMs) + ",\"results\":" + std::to_string(results) +
+                        ",\"perf\":" + evalPerf.json();
+    return out + "}";
+}
+
+std::vector<int> BooleanSearch::searchNewest(const std::string& query, size_t n,
+                                             const std::function<bool(int)>& keep) const {
+    auto p = plan(query);
+    const auto& all = idx_.allDocs();
+    std::vector<int> out;
+    if(n==0 || all.empty() || p.empty()) return out;
+
+    if(!idx_.timeOrdered()){
+        for(int id: evalRpn(p.rpn, p.maskPtr(), p.lo, p.hi)) if(!keep || keep(id)) out.push_back(id);
+        auto newer = [&](int a, int b){
+            int64_t ta = idx_.timeOf(a), tb = idx_.timeOf(b);
+            return ta!=tb ? ta>tb : a>b;
+        };
+        size_t k = std::min(n, out.size());
+        std::partial_sort(out.begin(), out.begin()+k, out.end(), newer);
+        out.resize(k);
+        return out;
+    }
+
+    // Higher ids are newer: evaluate windows [from, hi) right to left, each
+    // twice as wide as the last, and stop as soon as n hits are collected.
+    Span docs = slice(all, p.lo, p.hi);
+    size_t end = docs.size(), width = std::max<size_t>(64, 4*n);
+    while(end>0 && out.size()<n){
+        size_t begin = end>width ? end-width : 0;
+        int hi = end==docs.size() ? std::min(p.hi, all.back()+1) : docs.b[end];
+        auto hits = evalRange(p.rpn, docs.b[begin], hi, p.maskPtr());
+        for(auto it=hits.rbegin(); it!=hits.rend() && out.size()<n; ++it)
+            if(!keep || keep(*it)) out.push_back(*it);
+        end = begin;
+        width *= 2;
+    }
+    return out;
+}
+
+// Index where the operand ending just before `end` starts, or npos if the
+// rpn is malformed.
+size_t BooleanSearch::operandStart(const std::vector<Tok>& rpn, size_t end){
+    int need=1;
+    for(size_t i=end;i-->0;){
+        auto t=rpn[i].type;
+        if(t==TokType::AND||t==TokType::OR) need+=1;
+        else if(isOperand(t)) need-=1;
+        if(need==0) return i;
+    }
+    return std::string::npos;
+}
+
+// Word-parallel evaluation over bitmaps; dense terms use the bitmaps built at
+// finalize(), sparse ones are rasterized.
+size_t BooleanSearch::countBitmap(const std::vector<Tok>& rpn, const Mask* mask) const {
+    const auto& all = idx_.allBitmap();
+    int base = idx_.bitmapBase();
+    size_t words = all.size();
+
+    std::vector<std::vector<uint64_t>> st;
     for(auto& tk: rpn){
-        if(tk.type==TokType::TERM){
-            st.push_back(idx_.postings(tk.val));
+        if(tk.type==TokType::RANGE){
+            std::vector<uint64_t> bits(words, 0);
+            for(int id: timeRangeIds(tk, INT_MIN, INT_MAX)){ size_t i=(size_t)(id-base); bits[i>>6] |= 1ull<<(i&63); }
+            st.push_back(std::move(bits));
+        } else if(isOperand(tk.type)){
+            if(auto bm = idx_.bitmap(tk.val)){ st.push_back(*bm); continue; }
+            std::vector<uint64_t> bits(words, 0);
+            for(int id: idx_.postings(tk.val)){ size_t i=(size_t)(id-base); bits[i>>6] |= 1ull<<(i&63); }
+            st.push_back(std::move(bits));
         } else if(tk.type==TokType::NOT){
-            auto a = st.empty()?std::vector<int>{}:std::move(st.back());
+            std::vector<uint64_t> a = st.empty()?std::vector<uint64_t>(words,0):std::move(st.back());
             if(!st.empty()) st.pop_back();
-            st.push_back(opNot(idx_.allDocs(), a));
-        } else if(tk.type==TokType::AND){
-            if(st.size()<2){ st.push_back({}); continue; }
-            auto b=std::move(st.back()); st.pop_back();
-            auto a=std::move(st.back()); st.pop_back();
-            st.push_back(opAnd(a,b));
-        } else if(tk.type==TokType::OR){
-            if(st.size()<2){ st.push_back({}); continue; }
+            for(size_t w=0;w<words;w++) a[w] = all[w] & ~a[w];
+            st.push_back(std::move(a));
+        } else if(tk.type==TokType::AND || tk.type==TokType::OR){
+            if(st.size()<2){ st.push_back(std::vector<uint64_t>(words,0)); continue; }
             auto b=std::move(st.back()); st.pop_back();
-            auto a=std::move(st.back()); st.pop_back();
-            st.push_back(opOr(a,b));
+            auto& a=st.back();
+            if(tk.type==TokType::AND) for(size_t w=0;w<words;w++) a[w] &= b[w];
+            else for(size_t w=0;w<words;w++) a[w] |= b[w];
         }
     }
-    return st.empty()?std::vector<int>{}:std::move(st.back());
+    if(mask){
+        if(st.empty()) st.push_back(*mask);
+        else for(size_t w=0;w<words;w++) st.back()[w] &= (*mask)[w];
+    }
+    size_t n=0;
+    if(!st.empty()) for(uint64_t w: st.back()) n += (size_t)__builtin_popcountll(w);
+    return n;
 }
 
-std::vector<int> BooleanSearch::search(const std::string& query) const {
-    auto toks = lex(query);
-    auto rpn  = toRpn(toks);
-    return evalRpn(rpn);
-}
\ No newline at end of file
+// Operand [b, e) of the root: a posting list read in place when it is a
+// single term or filter, else the evaluated subexpression. NOTs around it are
+// peeled off into neg.
+void BooleanSearch::countOperand(const std::vector<Tok>& rpn, size_t b, size_t e, CountOperand& out) const {
+    while(e-b>1 && rpn[e-1].type==TokType::NOT){ out.neg = !out.neg; e--; }
+    if(e-b==1 && (rpn[b].type==TokType::TERM || rpn[b].type==TokType::FILTER)){
+        const auto& p = idx_.postings(rpn[b].val);
+        out.s = {p.data(), p.data()+p.size()};
+        return;
+    }
+    out.own = evalRpn(std::vector<Tok>(rpn.begin()+b, rpn.begin()+e));
+    out.s = {out.own.data(), out.own.data()+out.own.size()};
+}
+
+// Counts the root operator by merging its operands without writing output;
+// a negated operand x is counted through |p AND x| instead of built.
+size_t BooleanSearch::countRpn(const std::vector<Tok>& rpn) const {
+    if(rpn.empty()) return 0;
+    const auto& all = idx_.allDocs();
+    Span u{all.data(), all.data()+all.size()};
+    auto size = [&](const CountOperand& o){ return o.neg ? all.size() - countAnd(u, o.s) : o.s.size(); };
+
+    size_t n = rpn.size();
+    auto op = rpn.back().type;
+    if(op!=TokType::AND && op!=TokType::OR){
+        if(operandStart(rpn, n)!=0) return evalRpn(rpn).size();
+        CountOperand x;
+        countOperand(rpn, 0, n, x);
+        return size(x);
+    }
+    size_t rs = operandStart(rpn, n-1);
+    if(rs==std::string::npos || rs==0 || operandStart(rpn, rs)!=0) return evalRpn(rpn).size();
+
+    CountOperand l, r;
+    countOperand(rpn, 0, rs, l);
+    countOperand(rpn, rs, n-1, r);
+    if(l.neg && r.neg) return evalRpn(rpn).size();
+    if(!l.neg && !r.neg){
+        size_t both = countAnd(l.s, r.s);
+        return op==TokType::AND ? both : l.s.size()+r.s.size()-both;
+    }
+    const CountOperand& p = l.neg ? r : l;
+    const CountOperand& x = l.neg ? l : r;
+    size_t both = countAnd(p.s, x.s);
+    return op==TokType::AND ? p.s.size()-both : size(x)+both;
+}
+
+size_t BooleanSearch::count(const std::string& query) const {
+    auto p = plan(query);
+    const auto& rpn = p.rpn;
+    if(idx_.allDocs().empty() || p.empty()) return 0;
+    if(p.ranged){
+        if(rpn.empty() && !p.masked) return p.lo<p.hi ? slice(idx_.allDocs(), p.lo, p.hi).size() : 0;
+        return evalRpn(rpn, p.maskPtr(), p.lo, p.hi).size();
+    }
+    if(p.masked && rpn.empty()) return countBitmap(rpn, &p.mask);
+    bool nestedRange = std::any_of(rpn.begin(), rpn.end(), [](const Tok& t){ return t.type==TokType::RANGE; });
+
+    // Bitmap evaluation touches every word once per token; merging touches
+    // every posting. Pick whichever is cheaper.
+    size_t bitmapCost = (rpn.size() + p.masked) * idx_.allBitmap().size();
+    bool bitmap = bitmapCost < estimateCost(rpn);
+    if(p.masked || nestedRange) return bitmap ? countBitmap(rpn, p.maskPtr()) : evalRpn(rpn, p.maskPtr()).size();
+    return bitmap ? countBitmap(rpn) : countRpn(rpn);
+}
+
+CountEstimate BooleanSearch::estimate(const std::string& query) const {
+    CountEstimate e;
+    const BooleanIndex* s = idx_.sample();
+    if(!s || s->allDocs().empty()){
+        e.value = e.lo = e.hi = (double)count(query);
+        e.exact = true;
+        return e;
+    }
+
+    double p = (double)s->allDocs().size() / (double)idx_.allDocs().size();
+    double k = (double)BooleanSearch(*s).count(query);
+    double sd = std::sqrt(std::max(k, 1.0) * (1.0 - p)) / p;
+    e.value = k / p;
+    e.lo = std::max(0.0, e.value - 1.96 * sd);
+    e.hi = std::min((double)idx_.allDocs().size(), e.value + 1.96 * sd);
+    return e;
+}
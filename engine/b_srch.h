@@ -1,27 +1,166 @@
 #pragma once
 #include <string>
 #include <vector>
+#include <functional>
+#include <climits>
 #include "b_idx.h"
+#include "perf_counters.h"
+
+struct CountEstimate {
+    double value = 0;
+    double lo = 0;   // ~95% confidence bounds
+    double hi = 0;
+    bool exact = false;
+};
+
+// What EXPLAIN and PROFILE report for one query on one index. There is one
+// step per RPN token; an operator's inputs are the steps listed in args and
+// the last step is the root. in/out are upper bounds until executed.
+struct QueryProfile {
+    struct Step {
+        std::string op;        // TERM, FILTER, RANGE, AND, OR, NOT
+        std::string term;      // stem or filter key
+        std::string text;      // query word the stem came from
+        std::string kernel;
+        std::vector<int> args;
+        std::vector<size_t> in;
+        size_t postings = 0;   // full list length, for TERM and FILTER
+        size_t out = 0;
+        double ms = 0;
+        size_t bytes = 0;      // allocated for the step's result
+        PerfSample perf;       // hardware counters, when available
+    };
+
+    std::string query;
+    std::vector<std::string> tokens;  // after lexing and term expansion
+    std::vector<Step> steps;
+    bool masked = false;              // top-level filters pre-intersected into a bitmap
+    size_t maskDocs = 0;
+    bool ranged = false;              // time filters narrowed the doc-id range
+    int lo = 0, hi = 0;
+    size_t cost = 0;                  // postings touched, decides the parallel split
+    unsigned parts = 1;               // doc-id ranges search() would evaluate on
+    bool executed = false;
+    size_t results = 0;
+    double planMs = 0, evalMs = 0;
+    PerfSample evalPerf;
+
+    std::string text() const;
+    std::string json() const;
+};
 
 class BooleanSearch {
 public:
-    explicit BooleanSearch(const BooleanIndex& idx) : idx_(idx) {}
+    explicit BooleanSearch(const BooleanIndex& idx);
     std::vector<int> search(const std::string& query) const;
 
+    // Up to n matches, newest first. On a time-ordered index postings are read
+    // backwards in growing doc-id windows until n hits are found.
+    std::vector<int> searchNewest(const std::string& query, size_t n,
+                                  const std::function<bool(int)>& keep = nullptr) const;
+
+    // EXPLAIN: the plan with each step's kernel and input bounds, not run.
+    QueryProfile explain(const std::string& query) const;
+    // PROFILE: runs the plan on one thread, timing every step. Without a
+    // profile the evaluation only tests a null pointer per step.
+    std::vector<int> profile(const std::string& query, QueryProfile& prof) const;
+
+    // Number of matches, without materializing the final result list.
+    size_t count(const std::string& query) const;
+    // Estimate from the index's coordinated doc sample; exact if there is none.
+    CountEstimate estimate(const std::string& query) const;
+
+    // Stems of the query's terms, for highlighting.
+    static std::vector<std::string> queryTerms(const std::string& query);
+    // The word being typed at the end of input, normalized like indexed text
+    // but not stemmed, for looking up completions.
+    static std::string completionPrefix(const std::string& input);
+    // Posting list keys the query reads (stems and filter keys); needsAll is
+    // set when the result also depends on the full doc list (NOT, time ranges).
+    // `term~N`, `/regex/` and `*infix*` are expanded through lex, if given.
+    static std::vector<std::string> queryKeys(const std::string& query, bool& needsAll,
+                                              const TermLexicon* lex = nullptr);
+
+    // `term~1` / `term~2` (`term~` is ~2) match up to this many dictionary
+    // terms within that edit distance of the stem, closest and most frequent first.
+    static constexpr size_t kMaxFuzzyExpansions = 50;
+    // `/regex/` (matched against whole stems) and `*infix*` match up to this
+    // many dictionary terms, most frequent first.
+    static constexpr size_t kMaxPatternExpansions = 1000;
+
+    // Queries whose estimated cost (postings touched) reaches minCost are split
+    // into doc-id ranges evaluated on up to `threads` threads.
+    void setParallel(unsigned threads, size_t minCost) { threads_ = threads; parallelMinCost_ = minCost; }
+
+    // Merge kernels over sorted id lists (also driven directly by bench/).
+    static std::vector<int> opAnd(const std::vector<int>& a, const std::vector<int>& b);
+    static std::vector<int> opOr (const std::vector<int>& a, const std::vector<int>& b);
+    static std::vector<int> opNot(const std::vector<int>& universe, const std::vector<int>& b);
+
 private:
     const BooleanIndex& idx_;
+    unsigned threads_;
+    size_t parallelMinCost_ = 1u << 21;
+
+    // FILTER is a `source:`/`host:`/`section:` restriction; val is the
+    // normalized attribute key. RANGE is `after:`/`before:`, matching docs
+    // with from <= time < to. FUZZY is `term~N` with the stem in val and N in
+    // from; PATTERN is `/regex/` (from 1) or `*infix*` (from 0) with the
+    // pattern in val. Both are replaced by an OR of dictionary terms before planning.
+    // text keeps the query word a term was made from, for EXPLAIN.
+    enum class TokType { TERM, FILTER, RANGE, FUZZY, PATTERN, AND, OR, NOT, LPAREN, RPAREN };
+    struct Tok {
+        TokType type;
+        std::string val;
+        int64_t from, to;
+        std::string text;
+        Tok(TokType type, std::string val = {}, int64_t from = 0, int64_t to = 0, std::string text = {})
+            : type(type), val(std::move(val)), from(from), to(to), text(std::move(text)) {}
+    };
+    using Mask = std::vector<uint64_t>;
 
-    enum class TokType { TERM, AND, OR, NOT, LPAREN, RPAREN };
-    struct Tok { TokType type; std::string val; };
+    // Filters ANDed at the top level are pulled out of the expression and
+    // intersected into a doc bitmap applied to every posting list read; time
+    // ranges on a time-ordered index narrow the doc-id range [lo, hi) instead.
+    struct Plan {
+        std::vector<Tok> rpn;
+        Mask mask;
+        bool masked = false;
+        bool ranged = false;
+        int lo = INT_MIN, hi = INT_MAX;
+        const Mask* maskPtr() const { return masked ? &mask : nullptr; }
+        bool empty() const { return rpn.empty() && !masked && !ranged; }
+    };
 
-    std::vector<Tok> lex(const std::string& q) const;
+    static std::vector<Tok> lex(const std::string& q);
+    static std::vector<Tok> expandTerms(std::vector<Tok> toks, const TermLexicon* lex);
+    Plan plan(const std::string& q, std::vector<Tok>* toks = nullptr) const;
+    void describe(const Plan& p, const std::vector<Tok>& toks, QueryProfile& prof) const;
     std::vector<Tok> toRpn(const std::vector<Tok>& toks) const;
-    std::vector<int> evalRpn(const std::vector<Tok>& rpn) const;
+    std::vector<int> evalRpn(const std::vector<Tok>& rpn, const Mask* mask = nullptr,
+                             int lo = INT_MIN, int hi = INT_MAX) const;
+    std::vector<int> timeRangeIds(const Tok& tk, int lo, int hi) const;
+    std::vector<int> evalRange(const std::vector<Tok>& rpn, int lo, int hi, const Mask* mask,
+                               QueryProfile* prof = nullptr) const;
+    size_t estimateCost(const std::vector<Tok>& rpn) const;
+    // Posting list of every term and filter operand, null elsewhere.
+    std::vector<const std::vector<int>*> operandLists(const std::vector<Tok>& rpn) const;
+    struct Span { const int* b; const int* e; size_t size() const { return (size_t)(e - b); } };
+    struct CountOperand { Span s{nullptr, nullptr}; std::vector<int> own; bool neg = false; };
+    void countOperand(const std::vector<Tok>& rpn, size_t b, size_t e, CountOperand& out) const;
+    size_t countRpn(const std::vector<Tok>& rpn) const;
+    size_t countBitmap(const std::vector<Tok>& rpn, const Mask* mask = nullptr) const;
+    static size_t operandStart(const std::vector<Tok>& rpn, size_t end);
+
+    static Span slice(const std::vector<int>& v, int lo, int hi);
 
     static bool isOp(TokType t);
+    static bool isOperand(TokType t) { return t==TokType::TERM || t==TokType::FILTER || t==TokType::RANGE ||
+                                                  t==TokType::FUZZY || t==TokType::PATTERN; }
     static int prec(TokType t);
 
-    static std::vector<int> opAnd(const std::vector<int>& a, const std::vector<int>& b);
-    static std::vector<int> opOr (const std::vector<int>& a, const std::vector<int>& b);
-    static std::vector<int> opNot(const std::vector<int>& universe, const std::vector<int>& b);
+    static void opAnd(Span a, Span b, std::vector<int>& out);
+    static void opOr (Span a, Span b, std::vector<int>& out);
+    static void opNot(Span u, Span b, std::vector<int>& out);
+    static size_t countAnd(Span a, Span b);
 };
\ No newline at end of file
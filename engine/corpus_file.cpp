@@ -0,0 +1,273 @@
+#include "corpus_file.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <zstd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char kCorpusMagic[8] = {'I', 'S', 'C', 'O', 'R', 'P', '0', '1'};
+static const size_t kTrailerBytes = 3 * sizeof(uint64_t) + sizeof(kCorpusMagic);
+static const size_t kRecordHeader = 3 * sizeof(uint32_t) + sizeof(int64_t);
+
+template <class T>
+static void putRaw(std::string& out, T v) { out.append((const char*)&v, sizeof(v)); }
+
+template <class T>
+static T getRaw(const char* p) {
+    T v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// ------------------------------------------------------------ writer
+
+CorpusWriter::~CorpusWriter() {
+    if (out_.is_open()) {
+        out_.close();
+        std::remove((path_ + ".tmp").c_str());
+    }
+}
+
+bool CorpusWriter::open(const std::string& path, bool compress) {
+    path_ = path;
+    compress_ = compress;
+    out_.open(path + ".tmp", std::ios::binary | std::ios::trunc);
+    if (!out_) return false;
+    out_.write(kCorpusMagic, sizeof(kCorpusMagic));
+    off_ = sizeof(kCorpusMagic);
+    return (bool)out_;
+}
+
+void CorpusWriter::add(const CorpusRecord& r) {
+    putRaw(block_, (uint32_t)r.url.size());
+    putRaw(block_, (uint32_t)r.source.size());
+    putRaw(block_, (uint32_t)r.text.size());
+    putRaw(block_, r.fetchedAt);
+    block_.append(r.url).append(r.source).append(r.text);
+    blockDocs_++;
+    docs_++;
+    if (block_.size() >= kBlockBytes) flushBlock();
+}
+
+void CorpusWriter::flushBlock() {
+    if (block_.empty()) return;
+    Block b{off_, (uint32_t)block_.size(), (uint32_t)block_.size(), blockDocs_};
+    const std::string* payload = &block_;
+    std::string z;
+    if (compress_) {
+        thread_local std::unique_ptr<ZSTD_CCtx, size_t (*)(ZSTD_CCtx*)> cctx(ZSTD_createCCtx(), ZSTD_freeCCtx);
+        z.resize(ZSTD_compressBound(block_.size()));
+        size_t n = ZSTD_compressCCtx(cctx.get(), &z[0], z.size(), block_.data(), block_.size(), kLevel);
+        if (!ZSTD_isError(n) && n < block_.size()) {
+            z.resize(n);
+            b.zsize = (uint32_t)n;
+            payload = &z;
+        }
+    }
+    out_.write(payload->data(), (std::streamsize)payload->size());
+    off_ += payload->size();
+    rawBytes_ += block_.size();
+    blocks_.push_back(b);
+    block_.clear();
+    blockDocs_ = 0;
+}
+
+bool CorpusWriter::finish() {
+    flushBlock();
+    std::string index;
+    for (const auto& b : blocks_) {
+        putRaw(index, b.off);
+        putRaw(index, b.zsize);
+        putRaw(index, b.rawSize);
+        putRaw(index, b.docs);
+    }
+    putRaw(index, (uint64_t)docs_);
+    putRaw(index, off_);
+    putRaw(index, (uint64_t)blocks_.size());
+    index.append(kCorpusMagic, sizeof(kCorpusMagic));
+    out_.write(index.data(), (std::streamsize)index.size());
+    off_ += index.size();
+    out_.flush();
+    bool ok = (bool)out_;
+    out_.close();
+    std::string tmp = path_ + ".tmp";
+    if (!ok || std::rename(tmp.c_str(), path_.c_str()) != 0) {
+        std::remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+// ------------------------------------------------------------ reader
+
+CorpusFile::~CorpusFile() {
+    if (data_) ::munmap((void*)data_, size_);
+}
+
+bool CorpusFile::fail(const std::string& why) {
+    error_ = why;
+    return false;
+}
+
+bool CorpusFile::open(const std::string& path, const CorpusFields& fields) {
+    fields_ = fields;
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return fail("cannot open " + path + ": " + std::strerror(errno));
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || st.st_size == 0) {
+        ::close(fd);
+        return fail(path + ": empty or unreadable");
+    }
+    size_ = (size_t)st.st_size;
+    void* p = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) return fail("cannot map " + path + ": " + std::strerror(errno));
+    data_ = (const char*)p;
+    ::madvise(p, size_, MADV_SEQUENTIAL);
+
+    bson_ = size_ < sizeof(kCorpusMagic) || std::memcmp(data_, kCorpusMagic, sizeof(kCorpusMagic)) != 0;
+    if (!(bson_ ? openBson() : openCorpus())) {
+        error_ = path + ": " + error_;
+        return false;
+    }
+    return true;
+}
+
+bool CorpusFile::openCorpus() {
+    if (size_ < sizeof(kCorpusMagic) + kTrailerBytes ||
+        std::memcmp(data_ + size_ - sizeof(kCorpusMagic), kCorpusMagic, sizeof(kCorpusMagic)) != 0)
+        return fail("truncated corpus file (no block index)");
+    const char* t = data_ + size_ - kTrailerBytes;
+    docs_ = (size_t)getRaw<uint64_t>(t);
+    uint64_t indexOff = getRaw<uint64_t>(t + 8), count = getRaw<uint64_t>(t + 16);
+    const size_t entry = sizeof(uint64_t) + 3 * sizeof(uint32_t);
+    if (indexOff > size_ - kTrailerBytes || (size_ - kTrailerBytes - indexOff) / entry != count)
+        return fail("corrupt block index");
+    parts_.resize(count);
+    for (uint64_t i = 0; i < count; i++) {
+        const char* e = data_ + indexOff + i * entry;
+        Part& p = parts_[i];
+        p = {getRaw<uint64_t>(e), getRaw<uint32_t>(e + 8), getRaw<uint32_t>(e + 12), getRaw<uint32_t>(e + 16)};
+        if (p.off < sizeof(kCorpusMagic) || p.off + p.zsize > indexOff) return fail("corrupt block index");
+    }
+    return true;
+}
+
+bool CorpusFile::read(size_t i, std::vector<CorpusRecord>& out, std::string& scratch) const {
+    const Part& p = parts_[i];
+    if (bson_) return readBson(p, out);
+
+    const char* b = data_ + p.off;
+    if (p.zsize != p.rawSize) {
+        thread_local std::unique_ptr<ZSTD_DCtx, size_t (*)(ZSTD_DCtx*)> dctx(ZSTD_createDCtx(), ZSTD_freeDCtx);
+        scratch.resize(p.rawSize);
+        size_t n = ZSTD_decompressDCtx(dctx.get(), &scratch[0], scratch.size(), b, p.zsize);
+        if (ZSTD_isError(n) || n != p.rawSize) return false;
+        b = scratch.data();
+    }
+    const char* end = b + p.rawSize;
+    out.reserve(out.size() + p.docs);
+    for (uint32_t k = 0; k < p.docs; k++) {
+        if ((size_t)(end - b) < kRecordHeader) return false;
+        uint32_t urlLen = getRaw<uint32_t>(b), srcLen = getRaw<uint32_t>(b + 4), textLen = getRaw<uint32_t>(b + 8);
+        CorpusRecord r;
+        r.fetchedAt = getRaw<int64_t>(b + 12);
+        b += kRecordHeader;
+        if ((uint64_t)urlLen + srcLen + textLen > (uint64_t)(end - b)) return false;
+        r.url = std::string_view(b, urlLen);
+        r.source = std::string_view(b + urlLen, srcLen);
+        r.text = std::string_view(b + urlLen + srcLen, textLen);
+        b += (size_t)urlLen + srcLen + textLen;
+        out.push_back(r);
+    }
+    return b == end;
+}
+
+// ------------------------------------------------------------ mongodump
+
+bool CorpusFile::openBson() {
+    Part cur{0, 0, 0, 0};
+    for (uint64_t off = 0; off < size_;) {
+        if (size_ - off < 5) return fail("truncated BSON document at offset " + std::to_string(off));
+        int32_t len = getRaw<int32_t>(data_ + off);
+        if (len < 5 || (uint64_t)len > size_ - off || data_[off + len - 1] != 0)
+            return fail("bad BSON document at offset " + std::to_string(off));
+        cur.rawSize += (uint32_t)len;
+        cur.docs++;
+        docs_++;
+        off += (uint64_t)len;
+        if (cur.rawSize >= CorpusWriter::kBlockBytes || off == size_) {
+            cur.zsize = cur.rawSize;
+            parts_.push_back(cur);
+            cur = {off, 0, 0, 0};
+        }
+    }
+    return true;
+}
+
+// Size of the value of an element of type t at p, or -1 if unknown or out of bounds.
+static int64_t bsonValueSize(uint8_t t, const char* p, const char* end) {
+    auto i32 = [&](int64_t extra) -> int64_t {
+        if (end - p < 4) return -1;
+        int32_t n = getRaw<int32_t>(p);
+        return n < 0 ? -1 : n + extra;
+    };
+    switch (t) {
+        case 0x01: case 0x09: case 0x11: case 0x12: return 8;
+        case 0x02: case 0x0D: case 0x0E: return i32(4);
+        case 0x03: case 0x04: case 0x0F: return i32(0);
+        case 0x05: return i32(5);
+        case 0x06: case 0x0A: case 0xFF: case 0x7F: return 0;
+        case 0x07: return 12;
+        case 0x08: return 1;
+        case 0x0B: {
+            const char* a = (const char*)std::memchr(p, 0, (size_t)(end - p));
+            const char* b = a ? (const char*)std::memchr(a + 1, 0, (size_t)(end - a - 1)) : nullptr;
+            return b ? b + 1 - p : -1;
+        }
+        case 0x0C: return i32(16);
+        case 0x10: return 4;
+        case 0x13: return 16;
+        default: return -1;
+    }
+}
+
+bool CorpusFile::readBson(const Part& part, std::vector<CorpusRecord>& out) const {
+    const char* p = data_ + part.off;
+    out.reserve(out.size() + part.docs);
+    for (uint32_t k = 0; k < part.docs; k++) {
+        int32_t len = getRaw<int32_t>(p);
+        const char* end = p + len - 1;
+        const char* e = p + 4;
+        p += len;
+
+        CorpusRecord r;
+        bool hasUrl = false, hasText = false;
+        while (e < end) {
+            uint8_t t = (uint8_t)*e++;
+            const char* nameEnd = (const char*)std::memchr(e, 0, (size_t)(end - e));
+            if (!nameEnd) return false;
+            std::string_view name(e, (size_t)(nameEnd - e));
+            const char* v = nameEnd + 1;
+            int64_t n = bsonValueSize(t, v, end);
+            if (n < 0 || n > end - v) return false;
+            e = v + n;
+
+            auto str = [&]() { return std::string_view(v + 4, (size_t)(n - 5)); };
+            if (t == 0x02 && n >= 5 && name == fields_.url) { r.url = str(); hasUrl = true; }
+            else if (t == 0x02 && n >= 5 && name == fields_.text) { r.text = str(); hasText = true; }
+            else if (t == 0x02 && n >= 5 && name == fields_.source) r.source = str();
+            else if (name == fields_.fetched) {
+                if (t == 0x10) r.fetchedAt = getRaw<int32_t>(v);
+                else if (t == 0x12) r.fetchedAt = getRaw<int64_t>(v);
+                else if (t == 0x01) r.fetchedAt = (int64_t)getRaw<double>(v);
+            }
+        }
+        if (hasUrl && hasText) out.push_back(r);
+    }
+    return true;
+}
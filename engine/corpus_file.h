@@ -0,0 +1,103 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <fstream>
+#include <cstdint>
+
+// Offline copy of the url/text projection of the pages collection, so full
+// builds can run without MongoDB.
+//
+// File: magic | blocks | block index | docs, index offset, block count | magic
+// A block packs whole records (u32 url, source and text lengths, i64
+// fetched_at, then the three strings) up to kBlockBytes raw and is stored
+// either as is or as one zstd frame, whichever is smaller. Blocks are the unit
+// of parallel reading.
+struct CorpusRecord {
+    std::string_view url;
+    std::string_view text;
+    std::string_view source;
+    int64_t fetchedAt = 0;
+};
+
+class CorpusWriter {
+public:
+    static constexpr size_t kBlockBytes = 1 << 20;
+    static constexpr int kLevel = 3;
+
+    ~CorpusWriter();
+
+    // Writes to path.tmp; finish() moves it into place.
+    bool open(const std::string& path, bool compress);
+    void add(const CorpusRecord& r);
+    bool finish();
+
+    size_t docs() const { return docs_; }
+    uint64_t rawBytes() const { return rawBytes_; }
+    uint64_t bytes() const { return off_; }
+
+private:
+    struct Block { uint64_t off; uint32_t zsize; uint32_t rawSize; uint32_t docs; };
+
+    std::string path_;
+    std::ofstream out_;
+    bool compress_ = false;
+    std::string block_;
+    uint32_t blockDocs_ = 0;
+    std::vector<Block> blocks_;
+    size_t docs_ = 0;
+    uint64_t rawBytes_ = 0;
+    uint64_t off_ = 0;
+
+    void flushBlock();
+};
+
+// Field names looked up in mongodump documents.
+struct CorpusFields {
+    std::string url = "url";
+    std::string text = "text";
+    std::string source = "source";
+    std::string fetched = "fetched_at";
+};
+
+// Read-only mapping of a corpus file or of a raw mongodump .bson file (a
+// concatenation of BSON documents, told apart by the missing magic). A .bson
+// file is cut into parts of about kBlockBytes at open(); documents without a
+// string url and text are skipped, as the MongoDB build does.
+class CorpusFile {
+public:
+    CorpusFile() = default;
+    ~CorpusFile();
+    CorpusFile(const CorpusFile&) = delete;
+    CorpusFile& operator=(const CorpusFile&) = delete;
+
+    bool open(const std::string& path, const CorpusFields& fields = {});
+    const std::string& error() const { return error_; }
+
+    bool bson() const { return bson_; }
+    size_t parts() const { return parts_.size(); }
+    size_t docs() const { return docs_; }   // records, or BSON documents
+    size_t bytes() const { return size_; }
+
+    // Appends the records of part i to out. Views point into the mapping, or
+    // into scratch for a compressed block, and stay valid while scratch is
+    // not touched again. Safe to call from several threads with their own
+    // out and scratch. False if the part is corrupt.
+    bool read(size_t i, std::vector<CorpusRecord>& out, std::string& scratch) const;
+
+private:
+    struct Part { uint64_t off; uint32_t zsize; uint32_t rawSize; uint32_t docs; };
+
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+    bool bson_ = false;
+    CorpusFields fields_;
+    std::vector<Part> parts_;
+    size_t docs_ = 0;
+    std::string error_;
+
+    bool fail(const std::string& why);
+    bool openCorpus();
+    bool openBson();
+    bool readBson(const Part& p, std::vector<CorpusRecord>& out) const;
+};
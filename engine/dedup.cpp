@@ -0,0 +1,139 @@
+#include "dedup.h"
+#include <istream>
+#include <ostream>
+#include <algorithm>
+#include <climits>
+
+static uint64_t hashTerm(const std::string& s) {
+    uint64_t h = 1469598103934665603ull;
+    for (unsigned char c : s) { h ^= c; h *= 1099511628211ull; }
+    h ^= h >> 33; h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33; h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+// Hash i is h1 + i * h2 (mod 2^32), which is enough independence for MinHash
+// and costs one multiply-add per term and hash.
+NearDupDetector::Signature NearDupDetector::signature(const std::vector<std::string>& terms) {
+    uint32_t m[kHashes];
+    std::fill(m, m + kHashes, UINT32_MAX);
+    for (const auto& t : terms) {
+        uint64_t h = hashTerm(t);
+        uint32_t h1 = (uint32_t)h, h2 = (uint32_t)(h >> 32) | 1;
+        for (int i = 0; i < kHashes; i++) {
+            uint32_t v = h1 + (uint32_t)i * h2;
+            m[i] = v < m[i] ? v : m[i];
+        }
+    }
+    return Signature(m, m + kHashes);
+}
+
+static uint64_t bandKey(const NearDupDetector::Signature& sig, int band) {
+    uint64_t h = (uint64_t)band * 0x9e3779b97f4a7c15ull;
+    for (int r = 0; r < NearDupDetector::kRows; r++) {
+        h ^= sig[band * NearDupDetector::kRows + r];
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 32;
+    }
+    return h;
+}
+
+static constexpr uint32_t kNone = UINT32_MAX;
+
+size_t NearDupDetector::slot(uint64_t key) const {
+    size_t mask = keys_.size() - 1;
+    size_t i = (size_t)(key ^ (key >> 29)) & mask;
+    while (heads_[i] != kNone && keys_[i] != key) i = (i + 1) & mask;
+    return i;
+}
+
+void NearDupDetector::grow() {
+    std::vector<uint64_t> keys = std::move(keys_);
+    std::vector<uint32_t> heads = std::move(heads_);
+    keys_.assign(std::max<size_t>(1024, keys.size() * 2), 0);
+    heads_.assign(keys_.size(), kNone);
+    for (size_t i = 0; i < keys.size(); i++) {
+        if (heads[i] == kNone) continue;
+        size_t s = slot(keys[i]);
+        keys_[s] = keys[i];
+        heads_[s] = heads[i];
+    }
+}
+
+int NearDupDetector::findOrAdd(int id, const Signature& sig) {
+    if ((used_ + kBands) * 2 > keys_.size()) grow();
+
+    uint64_t keys[kBands];
+    int need = (int)(minSimilarity_ * kHashes + 0.5);
+    for (int b = 0; b < kBands; b++) {
+        keys[b] = bandKey(sig, b);
+        for (uint32_t pos = heads_[slot(keys[b])]; pos != kNone; pos = next_[(size_t)pos * kBands + b]) {
+            const uint16_t* other = &sigs_[(size_t)pos * kHashes];
+            int same = 0;
+            for (int i = 0; i < kHashes; i++) same += other[i] == (uint16_t)sig[i];
+            if (same >= need) return ids_[pos];
+        }
+    }
+
+    // Slots are claimed one band at a time, so a later band sees the slots of
+    // the earlier ones. Should two bands still share a key, the document is
+    // chained once: every link then points to an earlier position.
+    uint32_t pos = (uint32_t)ids_.size();
+    ids_.push_back(id);
+    for (int i = 0; i < kHashes; i++) sigs_.push_back((uint16_t)sig[i]);
+    for (int b = 0; b < kBands; b++) {
+        size_t s = slot(keys[b]);
+        if (heads_[s] == pos) { next_.push_back(kNone); continue; }
+        used_ += heads_[s] == kNone;
+        keys_[s] = keys[b];
+        next_.push_back(heads_[s]);
+        heads_[s] = pos;
+    }
+    return -1;
+}
+
+const std::vector<std::string>* DuplicateList::of(int id) const {
+    auto it = dups_.find(id);
+    return it == dups_.end() ? nullptr : &it->second;
+}
+
+template <class T>
+static void putRaw(std::ostream& out, const T& v) { out.write((const char*)&v, sizeof(T)); }
+
+template <class T>
+static bool getRaw(std::istream& in, T& v) { return (bool)in.read((char*)&v, sizeof(T)); }
+
+void DuplicateList::save(std::ostream& out) const {
+    putRaw(out, (uint64_t)dups_.size());
+    for (const auto& kv : dups_) {
+        putRaw(out, (int32_t)kv.first);
+        putRaw(out, (uint32_t)kv.second.size());
+        for (const auto& u : kv.second) {
+            putRaw(out, (uint32_t)u.size());
+            out.write(u.data(), (std::streamsize)u.size());
+        }
+    }
+}
+
+bool DuplicateList::load(std::istream& in) {
+    dups_.clear();
+    total_ = 0;
+    uint64_t n = 0;
+    if (!getRaw(in, n)) return false;
+    for (uint64_t i = 0; i < n; i++) {
+        int32_t id = 0;
+        uint32_t k = 0;
+        if (!getRaw(in, id) || !getRaw(in, k)) return false;
+        auto& lst = dups_[id];
+        lst.resize(k);
+        for (auto& u : lst) {
+            uint32_t len = 0;
+            if (!getRaw(in, len)) return false;
+            u.resize(len);
+            if (!in.read(&u[0], len)) return false;
+        }
+        total_ += k;
+    }
+    return true;
+}
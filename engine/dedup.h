@@ -0,0 +1,75 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <iosfwd>
+#include <cstdint>
+#include <unordered_map>
+
+// Near-duplicate lookup by MinHash: a signature holds the minimum of kHashes
+// hash functions over a document's (stemmed, deduplicated) term set, and the
+// fraction of equal minimums estimates the Jaccard similarity of two sets.
+// LSH banding splits signatures into kBands bands of kRows values; documents
+// sharing a whole band become candidates (probability 1 - (1 - J^kRows)^kBands,
+// ~0.9998 at J = 0.8, ~0.12 at J = 0.3) and are then checked against the
+// threshold on the full signature.
+class NearDupDetector {
+public:
+    static constexpr int kHashes = 64;
+    static constexpr int kRows = 4;
+    static constexpr int kBands = kHashes / kRows;
+    using Signature = std::vector<uint32_t>;
+
+    explicit NearDupDetector(double minSimilarity = 0.8) : minSimilarity_(minSimilarity) {}
+
+    static Signature signature(const std::vector<std::string>& terms);
+
+    // Id of an earlier document at least minSimilarity similar to sig, or -1
+    // after registering sig under id.
+    int findOrAdd(int id, const Signature& sig);
+    size_t size() const { return ids_.size(); }
+
+private:
+    double minSimilarity_;
+    std::vector<int> ids_;
+    std::vector<uint16_t> sigs_;  // low 16 bits of each minimum, kHashes per doc
+
+    // Open-addressing table of band hashes; each slot heads a chain of
+    // positions linked through next_[pos * kBands + band].
+    std::vector<uint64_t> keys_;
+    std::vector<uint32_t> heads_;
+    std::vector<uint32_t> next_;
+    size_t used_ = 0;
+
+    size_t slot(uint64_t key) const;
+    void grow();
+};
+
+// URLs of dropped near-duplicates, attached to the doc id of their canonical
+// document.
+class DuplicateList {
+public:
+    void add(int canonical, std::string url) { dups_[canonical].push_back(std::move(url)); total_++; }
+    const std::vector<std::string>* of(int id) const;
+    size_t size() const { return total_; }
+    bool empty() const { return dups_.empty(); }
+
+    template <class Keep>
+    void append(const DuplicateList& other, Keep&& keep);
+
+    void save(std::ostream& out) const;
+    bool load(std::istream& in);
+
+private:
+    std::unordered_map<int, std::vector<std::string>> dups_;
+    size_t total_ = 0;
+};
+
+template <class Keep>
+void DuplicateList::append(const DuplicateList& other, Keep&& keep) {
+    for (const auto& kv : other.dups_) {
+        if (!keep(kv.first)) continue;
+        auto& dst = dups_[kv.first];
+        dst.insert(dst.end(), kv.second.begin(), kv.second.end());
+        total_ += kv.second.size();
+    }
+}
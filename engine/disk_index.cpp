@@ -0,0 +1,322 @@
+#include "disk_index.h"
+#include "b_srch.h"
+#include "metrics.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+
+static const char kDiskMagic[8] = {'I', 'S', 'D', 'I', 'S', 'K', '0', '2'};
+static std::atomic<uint32_t> g_nextFileId{1};
+
+// ------------------------------------------------------------ block cache
+
+BlockCache::BlockCache(size_t budgetBytes, size_t shards) {
+    shards = std::max<size_t>(1, shards);
+    perShard_ = std::max<size_t>(1, budgetBytes / kBlockSize / shards);
+    for (size_t i = 0; i < shards; i++) {
+        auto s = std::make_unique<Shard>();
+        s->keys.resize(perShard_);
+        s->ref.resize(perShard_);
+        s->len.resize(perShard_);
+        s->data.resize(perShard_ * kBlockSize);
+        s->where.reserve(perShard_);
+        shards_.push_back(std::move(s));
+    }
+}
+
+bool BlockCache::lookup(uint64_t key, char* out, size_t from, size_t n) {
+    Shard& s = shardFor(key);
+    std::lock_guard<std::mutex> lk(s.mu);
+    auto it = s.where.find(key);
+    if (it == s.where.end()) return false;
+    uint32_t slot = it->second;
+    if (from + n > s.len[slot]) return false;  // cut short by the end of file
+    s.ref[slot] = 1;
+    if (out) std::memcpy(out, &s.data[(size_t)slot * kBlockSize + from], n);
+    return true;
+}
+
+void BlockCache::insert(uint64_t key, const char* src, uint32_t n) {
+    Shard& s = shardFor(key);
+    std::lock_guard<std::mutex> lk(s.mu);
+    if (s.where.count(key)) return;
+    uint32_t slot;
+    if (s.used < perShard_) {
+        slot = s.used++;
+    } else {
+        while (s.ref[s.hand]) { s.ref[s.hand] = 0; s.hand = (uint32_t)((s.hand + 1) % perShard_); }
+        slot = s.hand;
+        s.hand = (uint32_t)((s.hand + 1) % perShard_);
+        s.where.erase(s.keys[slot]);
+    }
+    s.keys[slot] = key;
+    s.ref[slot] = 0;
+    s.len[slot] = n;
+    std::memcpy(&s.data[(size_t)slot * kBlockSize], src, n);
+    s.where[key] = slot;
+}
+
+bool BlockCache::read(uint32_t fileId, int fd, uint64_t off, size_t len, char* out, DiskQueryStats& st) {
+    if (len == 0) return true;
+    uint64_t first = off / kBlockSize, last = (off + len - 1) / kBlockSize;
+    auto key = [&](uint64_t b) { return (uint64_t)fileId << 40 | b; };
+    auto part = [&](uint64_t b, size_t& from, size_t& n) {
+        uint64_t bOff = b * kBlockSize;
+        from = b == first ? (size_t)(off - bOff) : 0;
+        uint64_t end = std::min<uint64_t>(off + len, bOff + kBlockSize);
+        n = (size_t)(end - bOff - from);
+    };
+
+    std::vector<uint64_t> missing;
+    for (uint64_t b = first; b <= last; b++) {
+        size_t from, n;
+        part(b, from, n);
+        if (lookup(key(b), out ? out + (b * kBlockSize + from - off) : nullptr, from, n)) st.hits++;
+        else missing.push_back(b);
+    }
+    if (missing.empty()) return true;
+    st.misses += missing.size();
+
+    // One aligned pread per run of consecutive missing blocks (O_DIRECT-safe).
+    for (size_t i = 0; i < missing.size();) {
+        size_t j = i + 1;
+        while (j < missing.size() && missing[j] == missing[j - 1] + 1) j++;
+        size_t bytes = (j - i) * kBlockSize;
+        char* buf = (char*)std::aligned_alloc(kBlockSize, bytes);
+        if (!buf) return false;
+
+        auto t0 = std::chrono::steady_clock::now();
+        size_t got = 0;
+        while (got < bytes) {
+            ssize_t r = ::pread(fd, buf + got, bytes - got, (off_t)(missing[i] * kBlockSize + got));
+            if (r < 0 && errno == EINTR) continue;
+            if (r <= 0) break;
+            got += (size_t)r;
+        }
+        st.ioWaitMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+
+        for (size_t k = i; k < j; k++) {
+            uint64_t b = missing[k];
+            size_t at = (k - i) * kBlockSize;
+            uint32_t n = at < got ? (uint32_t)std::min(kBlockSize, got - at) : 0;
+            insert(key(b), buf + at, n);
+            size_t from, cnt;
+            part(b, from, cnt);
+            if (out) {
+                if (from + cnt > n) { std::free(buf); return false; }
+                std::memcpy(out + (b * kBlockSize + from - off), buf + at + from, cnt);
+            }
+        }
+        std::free(buf);
+        i = j;
+    }
+    return true;
+}
+
+// ------------------------------------------------------------- disk index
+
+template <class T>
+static void putRaw(std::ostream& out, const T& v) { out.write((const char*)&v, sizeof(T)); }
+
+template <class T>
+static bool getRaw(std::istream& in, T& v) { return (bool)in.read((char*)&v, sizeof(T)); }
+
+bool DiskIndex::write(const BooleanIndex& idx, const UrlStore& urls, const std::string& path) {
+    std::string tmp = path + ".tmp";
+    std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+    if (!out) return false;
+
+    // Header is patched once the section offsets are known.
+    uint64_t dictOff = 0, dictCount = 0, allOff = 0, allCount = idx.allDocs().size();
+    uint64_t docs = idx.docsCount();
+    out.write(kDiskMagic, sizeof(kDiskMagic));
+    for (int i = 0; i < 5; i++) putRaw(out, (uint64_t)0);
+
+    std::vector<std::pair<std::string, Entry>> dict;
+    idx.forEachList([&](const std::string& term, const std::vector<int>& lst) {
+        dict.push_back({term, {(uint64_t)out.tellp(), (uint32_t)lst.size()}});
+        out.write((const char*)lst.data(), (std::streamsize)(lst.size() * sizeof(int)));
+    });
+
+    dictOff = (uint64_t)out.tellp();
+    dictCount = dict.size();
+    for (const auto& d : dict) {
+        putRaw(out, (uint32_t)d.first.size());
+        out.write(d.first.data(), (std::streamsize)d.first.size());
+        putRaw(out, d.second.off);
+        putRaw(out, d.second.n);
+    }
+    allOff = (uint64_t)out.tellp();
+    out.write((const char*)idx.allDocs().data(), (std::streamsize)(allCount * sizeof(int)));
+    urls.save(out);
+    putRaw(out, idx.timeBase());
+    putRaw(out, (uint64_t)idx.times().size());
+    out.write((const char*)idx.times().data(), (std::streamsize)(idx.times().size() * sizeof(uint32_t)));
+
+    out.seekp(sizeof(kDiskMagic));
+    for (uint64_t v : {dictOff, dictCount, allOff, allCount, docs}) putRaw(out, v);
+    out.flush();
+    if (!out) return false;
+    out.close();
+    return std::rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+DiskIndex::~DiskIndex() {
+    if (fd_ >= 0) ::close(fd_);
+}
+
+bool DiskIndex::open(const std::string& path, BlockCache* cache, unsigned prefetchThreads) {
+    std::ifstream in(path, std::ios::binary);
+    char magic[sizeof(kDiskMagic)];
+    uint64_t dictOff = 0, dictCount = 0, allOff = 0, allCount = 0, docs = 0;
+    if (!in.read(magic, sizeof(magic)) || std::memcmp(magic, kDiskMagic, sizeof(magic)) != 0) return false;
+    for (uint64_t* v : {&dictOff, &dictCount, &allOff, &allCount, &docs})
+        if (!getRaw(in, *v)) return false;
+
+    in.seekg((std::streamoff)dictOff);
+    dict_.clear();
+    dict_.reserve(dictCount);
+    std::string term;
+    for (uint64_t i = 0; i < dictCount; i++) {
+        uint32_t len = 0;
+        Entry e{0, 0};
+        if (!getRaw(in, len)) return false;
+        term.resize(len);
+        if (!in.read(&term[0], len) || !getRaw(in, e.off) || !getRaw(in, e.n)) return false;
+        dict_.emplace(term, e);
+    }
+    std::vector<std::pair<std::string_view, uint32_t>> terms;
+    for (const auto& d : dict_)
+        if (!BooleanIndex::isFilterKey(d.first)) terms.push_back({d.first, d.second.n});
+    lexicon_ = TermLexicon(std::move(terms));
+
+    in.seekg((std::streamoff)(allOff + allCount * sizeof(int)));
+    if (!urls_.load(in)) return false;
+    uint64_t nt = 0;
+    if (!getRaw(in, timeBase_) || !getRaw(in, nt) || (nt != 0 && nt != allCount)) return false;
+    times_.resize(nt);
+    if (!in.read((char*)times_.data(), (std::streamsize)(nt * sizeof(uint32_t)))) return false;
+
+    // Bypass the page cache where the filesystem allows it, so the block cache
+    // budget is the real memory bound.
+    fd_ = ::open(path.c_str(), O_RDONLY | O_DIRECT);
+    if (fd_ < 0) fd_ = ::open(path.c_str(), O_RDONLY);
+    if (fd_ < 0) return false;
+
+    fileId_ = g_nextFileId++;
+    cache_ = cache;
+    prefetchThreads_ = std::max(1u, prefetchThreads);
+    all_ = {allOff, (uint32_t)allCount};
+    allCount_ = (size_t)allCount;
+    docsCount_ = (size_t)docs;
+    return true;
+}
+
+bool DiskIndex::readList(const Entry& e, std::vector<int>& out, DiskQueryStats& st) const {
+    out.resize(e.n);
+    return cache_->read(fileId_, fd_, e.off, (size_t)e.n * sizeof(int), (char*)out.data(), st);
+}
+
+std::unique_ptr<BooleanIndex> DiskIndex::slice(const std::string& query, DiskQueryStats& st) const {
+    bool needsAll = false;
+    auto keys = BooleanSearch::queryKeys(query, needsAll, &lexicon_);
+
+    std::vector<std::pair<const std::string*, Entry>> lists;
+    for (const auto& k : keys) {
+        auto it = dict_.find(k);
+        if (it != dict_.end()) lists.push_back({&k, it->second});
+    }
+
+    // Bring every block the query will touch into the cache at once.
+    std::vector<Entry> ranges;
+    for (const auto& l : lists) ranges.push_back(l.second);
+    if (needsAll) ranges.push_back(all_);
+    unsigned threads = (unsigned)std::min<size_t>(prefetchThreads_, ranges.size());
+    if (threads > 1) {
+        std::vector<DiskQueryStats> part(threads);
+        std::vector<std::thread> th;
+        for (unsigned t = 0; t < threads; t++) {
+            th.emplace_back([&, t] {
+                for (size_t i = t; i < ranges.size(); i += threads)
+                    cache_->read(fileId_, fd_, ranges[i].off, (size_t)ranges[i].n * sizeof(int), nullptr, part[t]);
+            });
+        }
+        for (auto& x : th) x.join();
+        for (const auto& p : part) st.add(p);
+    }
+    // The prefetch already counted every block; reading the lists again only
+    // counts blocks that were evicted in between and had to be read twice.
+    DiskQueryStats reread;
+    DiskQueryStats& rst = threads > 1 ? reread : st;
+
+    auto q = std::make_unique<BooleanIndex>(std::max<size_t>(8, lists.size() * 2));
+    std::vector<int> all, ids;
+    bool ok = true;
+    for (size_t i = 0; ok && i < lists.size(); i++) {
+        ok = readList(lists[i].second, ids, rst);
+        if (!needsAll) {
+            std::vector<int> merged;
+            merged.reserve(all.size() + ids.size());
+            std::set_union(all.begin(), all.end(), ids.begin(), ids.end(), std::back_inserter(merged));
+            all.swap(merged);
+        }
+        q->addList(*lists[i].first, std::move(ids));
+    }
+    // Without NOT or a time range every match lies in the union of the lists
+    // read; with them all is the whole all-docs list, which the time column
+    // lines up with.
+    if (ok && needsAll) {
+        ok = readList(all_, all, rst);
+        if (!times_.empty()) q->setTimes(timeBase_, times_);
+    }
+    st.misses += reread.misses;
+    st.ioWaitMs += reread.ioWaitMs;
+    if (!ok) return nullptr;
+    q->setAllDocs(std::move(all), docsCount_);
+    q->finalize();
+    return q;
+}
+
+static void recordCache(const DiskQueryStats& st) {
+    auto& m = Metrics::get();
+    static Counter& hits = m.counter("engine_block_cache_hits_total", "Disk index blocks served from the cache");
+    static Counter& misses = m.counter("engine_block_cache_misses_total", "Disk index blocks read from the file");
+    static Counter& ioNs = m.counter("engine_block_cache_io_wait_seconds_total", "Time spent in pread", 1e-9);
+    hits.add(st.hits);
+    misses.add(st.misses);
+    ioNs.add((uint64_t)(st.ioWaitMs * 1e6));
+}
+
+bool DiskIndex::search(const std::string& query, std::vector<int>& out, DiskQueryStats* st) const {
+    static QueryMetrics metrics("disk_search");
+    auto t0 = std::chrono::steady_clock::now();
+    DiskQueryStats local;
+    auto q = slice(query, local);
+    recordCache(local);
+    if (st) st->add(local);
+    if (!q) return false;
+    out = BooleanSearch(*q).search(query);
+    metrics.record(t0, out.size());
+    return true;
+}
+
+bool DiskIndex::count(const std::string& query, size_t& out, DiskQueryStats* st) const {
+    static QueryMetrics metrics("disk_count");
+    auto t0 = std::chrono::steady_clock::now();
+    DiskQueryStats local;
+    auto q = slice(query, local);
+    recordCache(local);
+    if (st) st->add(local);
+    if (!q) return false;
+    out = BooleanSearch(*q).count(query);
+    metrics.record(t0, out);
+    return true;
+}
@@ -0,0 +1,96 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <cstdint>
+#include "b_idx.h"
+#include "url_store.h"
+
+struct DiskQueryStats {
+    size_t hits = 0;      // blocks served from the cache
+    size_t misses = 0;    // blocks read from the file
+    double ioWaitMs = 0;  // time spent in pread, summed over threads
+
+    double hitRate() const { return hits + misses ? (double)hits / (double)(hits + misses) : 1.0; }
+    void add(const DiskQueryStats& o) { hits += o.hits; misses += o.misses; ioWaitMs += o.ioWaitMs; }
+};
+
+// Fixed-budget cache of kBlockSize file blocks, split into shards that each
+// evict by CLOCK under their own mutex. Runs of missing blocks are read with
+// one pread.
+class BlockCache {
+public:
+    static constexpr size_t kBlockSize = 4096;
+
+    explicit BlockCache(size_t budgetBytes, size_t shards = 16);
+
+    // Copies [off, off + len) of file fd (registered as fileId) into out;
+    // with out == nullptr the blocks are only brought into the cache.
+    bool read(uint32_t fileId, int fd, uint64_t off, size_t len, char* out, DiskQueryStats& st);
+
+    size_t capacityBytes() const { return shards_.size() * perShard_ * kBlockSize; }
+
+private:
+    struct Shard {
+        std::mutex mu;
+        std::unordered_map<uint64_t, uint32_t> where;  // key -> slot
+        std::vector<uint64_t> keys;
+        std::vector<uint8_t> ref;
+        std::vector<uint32_t> len;
+        std::vector<char> data;
+        uint32_t used = 0, hand = 0;
+    };
+    std::vector<std::unique_ptr<Shard>> shards_;
+    size_t perShard_;
+
+    Shard& shardFor(uint64_t key) { return *shards_[(key * 0x9e3779b97f4a7c15ull >> 40) % shards_.size()]; }
+    bool lookup(uint64_t key, char* out, size_t from, size_t n);
+    void insert(uint64_t key, const char* src, uint32_t n);
+};
+
+// Serving form of a finalized BooleanIndex: posting lists stay in the file
+// and only the term dictionary, the URL store and the time column are kept in
+// memory. Each query prefetches the blocks of all its lists in parallel, then
+// evaluates on an in-memory BooleanIndex holding just those lists.
+//
+// File: header | int32 posting lists, packed | dictionary | all-docs list | UrlStore
+//       | time base, u32 time column aligned with the all-docs list (may be empty)
+class DiskIndex {
+public:
+    DiskIndex() = default;
+    ~DiskIndex();
+    DiskIndex(const DiskIndex&) = delete;
+    DiskIndex& operator=(const DiskIndex&) = delete;
+
+    static bool write(const BooleanIndex& idx, const UrlStore& urls, const std::string& path);
+    bool open(const std::string& path, BlockCache* cache, unsigned prefetchThreads = 8);
+
+    // False if a posting list could not be read; out is then unspecified.
+    bool search(const std::string& query, std::vector<int>& out, DiskQueryStats* st = nullptr) const;
+    bool count(const std::string& query, size_t& out, DiskQueryStats* st = nullptr) const;
+    std::string url(int id) const { return urls_.get((size_t)id); }
+    std::vector<TermLexicon::Match> suggest(std::string_view prefix, size_t k) const { return lexicon_.complete(prefix, k); }
+
+    size_t termsCount() const { return dict_.size(); }
+    size_t docsCount() const { return allCount_; }
+
+private:
+    struct Entry { uint64_t off; uint32_t n; };
+
+    int fd_ = -1;
+    uint32_t fileId_ = 0;
+    BlockCache* cache_ = nullptr;
+    unsigned prefetchThreads_ = 8;
+    std::unordered_map<std::string, Entry> dict_;
+    TermLexicon lexicon_;  // for expanding term~N before lists are read
+    Entry all_{0, 0};
+    size_t allCount_ = 0, docsCount_ = 0;
+    UrlStore urls_;
+    int64_t timeBase_ = 0;
+    std::vector<uint32_t> times_;
+
+    std::unique_ptr<BooleanIndex> slice(const std::string& query, DiskQueryStats& st) const;
+    bool readList(const Entry& e, std::vector<int>& out, DiskQueryStats& st) const;
+};
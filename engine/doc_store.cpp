@@ -0,0 +1,143 @@
+#include "doc_store.h"
+#include <zstd.h>
+#include <zdict.h>
+#include <atomic>
+#include <cstring>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+
+static std::atomic<uint64_t> g_store_serial{1};
+
+DocStore::DocStore() : serial_(g_store_serial++) {}
+
+void DocStore::initDicts() {
+    cdict_.reset();
+    ddict_.reset();
+    if (dict_.empty()) return;
+    cdict_.reset(ZSTD_createCDict(dict_.data(), dict_.size(), kLevel), ZSTD_freeCDict);
+    ddict_.reset(ZSTD_createDDict(dict_.data(), dict_.size()), ZSTD_freeDDict);
+}
+
+void DocStore::trainDict() {
+    std::string samples;
+    std::vector<size_t> sizes;
+    for (const auto& t : pending_) {
+        samples += t;
+        sizes.push_back(t.size());
+    }
+    dict_.resize(kDictBytes);
+    size_t n = ZDICT_trainFromBuffer(&dict_[0], dict_.size(), samples.data(), sizes.data(), (unsigned)sizes.size());
+    if (ZDICT_isError(n)) dict_.clear();
+    else dict_.resize(n);
+    initDicts();
+}
+
+// Raw block layout: u32 count | u32 end offset per doc | texts.
+void DocStore::compressBlock(size_t from, size_t to) {
+    std::string raw;
+    uint32_t n = (uint32_t)(to - from), end = 0;
+    raw.append((const char*)&n, 4);
+    for (size_t i = from; i < to; i++) {
+        end += (uint32_t)pending_[i].size();
+        raw.append((const char*)&end, 4);
+    }
+    for (size_t i = from; i < to; i++) raw += pending_[i];
+
+    thread_local std::unique_ptr<ZSTD_CCtx, size_t (*)(ZSTD_CCtx*)> cctx(ZSTD_createCCtx(), ZSTD_freeCCtx);
+    std::string out(ZSTD_compressBound(raw.size()), '\0');
+    size_t z = cdict_ ? ZSTD_compress_usingCDict(cctx.get(), &out[0], out.size(), raw.data(), raw.size(), cdict_.get())
+                      : ZSTD_compressCCtx(cctx.get(), &out[0], out.size(), raw.data(), raw.size(), kLevel);
+    if (ZSTD_isError(z)) throw std::runtime_error(std::string("doc store: ") + ZSTD_getErrorName(z));
+
+    blocks_.push_back({data_.size(), (uint32_t)z, (uint32_t)raw.size()});
+    data_.append(out.data(), z);
+}
+
+void DocStore::add(std::string_view text) {
+    pending_.emplace_back(text);
+    count_++;
+    rawBytes_ += text.size();
+
+    // Until the dictionary is trained every text stays buffered.
+    if (dict_.empty() && blocks_.empty()) {
+        if (pending_.size() < kTrainDocs) return;
+        trainDict();
+        size_t full = pending_.size() / kBlockDocs * kBlockDocs;
+        for (size_t i = 0; i < full; i += kBlockDocs) compressBlock(i, i + kBlockDocs);
+        pending_.erase(pending_.begin(), pending_.begin() + full);
+        return;
+    }
+    if (pending_.size() == kBlockDocs) {
+        compressBlock(0, kBlockDocs);
+        pending_.clear();
+    }
+}
+
+void DocStore::finish() {
+    if (dict_.empty() && blocks_.empty() && pending_.size() >= 64) trainDict();
+    for (size_t i = 0; i < pending_.size(); i += kBlockDocs)
+        compressBlock(i, std::min(pending_.size(), i + kBlockDocs));
+    pending_.clear();
+    pending_.shrink_to_fit();
+    data_.shrink_to_fit();
+}
+
+std::string DocStore::get(size_t i) const {
+    size_t b = i / kBlockDocs;
+    if (i >= count_ || b >= blocks_.size()) return {};
+
+    // One decompressed block per thread covers consecutive hits in a block.
+    struct Cache { uint64_t serial = 0; size_t block = 0; std::string raw; };
+    thread_local Cache cache;
+    thread_local std::unique_ptr<ZSTD_DCtx, size_t (*)(ZSTD_DCtx*)> dctx(ZSTD_createDCtx(), ZSTD_freeDCtx);
+
+    if (cache.serial != serial_ || cache.block != b) {
+        const Block& blk = blocks_[b];
+        cache.raw.resize(blk.rawSize);
+        const char* src = data_.data() + blk.off;
+        size_t n = ddict_ ? ZSTD_decompress_usingDDict(dctx.get(), &cache.raw[0], blk.rawSize, src, blk.zsize, ddict_.get())
+                          : ZSTD_decompressDCtx(dctx.get(), &cache.raw[0], blk.rawSize, src, blk.zsize);
+        if (ZSTD_isError(n)) { cache.serial = 0; return {}; }
+        cache.serial = serial_;
+        cache.block = b;
+    }
+
+    const char* raw = cache.raw.data();
+    uint32_t n = 0;
+    std::memcpy(&n, raw, 4);
+    size_t k = i % kBlockDocs;
+    uint32_t begin = 0, end = 0;
+    if (k > 0) std::memcpy(&begin, raw + 4 + 4 * (k - 1), 4);
+    std::memcpy(&end, raw + 4 + 4 * k, 4);
+    return std::string(raw + 4 + 4 * n + begin, end - begin);
+}
+
+void DocStore::save(std::ostream& out) const {
+    uint64_t hdr[4] = {count_, rawBytes_, dict_.size(), blocks_.size()};
+    out.write((const char*)hdr, sizeof(hdr));
+    out.write(dict_.data(), (std::streamsize)dict_.size());
+    out.write((const char*)blocks_.data(), (std::streamsize)(blocks_.size() * sizeof(Block)));
+    uint64_t n = data_.size();
+    out.write((const char*)&n, sizeof(n));
+    out.write(data_.data(), (std::streamsize)n);
+}
+
+bool DocStore::load(std::istream& in) {
+    uint64_t hdr[4];
+    if (!in.read((char*)hdr, sizeof(hdr))) return false;
+    count_ = hdr[0];
+    rawBytes_ = hdr[1];
+    dict_.resize(hdr[2]);
+    blocks_.resize(hdr[3]);
+    uint64_t n = 0;
+    if (!in.read(&dict_[0], (std::streamsize)dict_.size()) ||
+        !in.read((char*)blocks_.data(), (std::streamsize)(blocks_.size() * sizeof(Block))) ||
+        !in.read((char*)&n, sizeof(n))) return false;
+    data_.resize(n);
+    if (!in.read(&data_[0], (std::streamsize)n)) return false;
+    pending_.clear();
+    serial_ = g_store_serial++;
+    initDicts();
+    return true;
+}
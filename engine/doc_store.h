@@ -0,0 +1,54 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <iosfwd>
+#include <cstdint>
+
+struct ZSTD_CDict_s;
+struct ZSTD_DDict_s;
+
+// Forward store of document texts, appended in doc id order. Texts are packed
+// kBlockDocs to a block and every block is a separate zstd frame, compressed
+// with a dictionary trained on the first kTrainDocs documents.
+class DocStore {
+public:
+    static constexpr size_t kBlockDocs = 32;
+    static constexpr size_t kTrainDocs = 2048;
+    static constexpr size_t kDictBytes = 112 * 1024;
+    static constexpr int kLevel = 6;
+
+    DocStore();
+
+    void add(std::string_view text);
+    void finish();
+
+    size_t size() const { return count_; }
+    bool empty() const { return count_ == 0; }
+    std::string get(size_t i) const;
+
+    size_t rawBytes() const { return rawBytes_; }
+    size_t bytes() const { return data_.size() + dict_.size() + blocks_.size() * sizeof(Block); }
+
+    void save(std::ostream& out) const;
+    bool load(std::istream& in);
+
+private:
+    struct Block { uint64_t off; uint32_t zsize; uint32_t rawSize; };
+
+    uint64_t serial_;
+    size_t count_ = 0;
+    size_t rawBytes_ = 0;
+    std::vector<std::string> pending_;
+    std::vector<Block> blocks_;
+    std::string data_;
+
+    std::string dict_;
+    std::shared_ptr<ZSTD_CDict_s> cdict_;
+    std::shared_ptr<ZSTD_DDict_s> ddict_;
+
+    void trainDict();
+    void compressBlock(size_t from, size_t to);
+    void initDicts();
+};
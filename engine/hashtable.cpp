@@ -1,4 +1,5 @@
 #include "HashTable.h"
+#include "trace.h"
 #include <algorithm>
 
 static size_t nextPow2(size_t x) { size_t p=1; while (p<x) p<<=1; return p; }
@@ -15,8 +16,7 @@ HashTable::HashTable(size_t initialCapPow2) {
     mask_ = cap - 1;
 }
 
-size_t HashTable::probeIndex(const std::string& key) const {
-    size_t idx = (size_t)hash64(key) & mask_;
+size_t HashTable::probeFrom(size_t idx, const std::string& key) const {
     while (true) {
         const auto& e = entries_[idx];
         if (e.state == State::EMPTY) return idx;
@@ -26,6 +26,9 @@ size_t HashTable::probeIndex(const std::string& key) const {
 }
 
 void HashTable::rehash(size_t newCapPow2) {
+    TraceSpan span("rehash", "index");
+    span.arg("entries", (int64_t)size_);
+    span.arg("capacity", (int64_t)newCapPow2);
     std::vector<Entry> old = std::move(entries_);
     entries_.assign(newCapPow2, Entry{});
     mask_ = newCapPow2 - 1;
@@ -64,4 +67,105 @@ const std::vector<int>* HashTable::find(const std::string& key) const {
         if (e.key == key) return &e.value;
         idx = (idx + 1) & mask_;
     }
-}
\ No newline at end of file
+}
+
+// Group prefetching: one pass hashes the group and prefetches the home slots
+// (an Entry may straddle two lines), the next prefetches the key bytes those
+// slots point to, the last probes; fn(i, slot) runs in key order.
+template <class KeyAt, class Fn>
+void HashTable::probeBatch(size_t n, KeyAt&& keyAt, Fn&& fn) const {
+    size_t home[kBatch];
+    for (size_t g = 0; g < n; g += kBatch) {
+        size_t m = std::min(kBatch, n - g);
+        for (size_t i = 0; i < m; i++) {
+            home[i] = (size_t)hash64(keyAt(g + i)) & mask_;
+            const char* e = (const char*)&entries_[home[i]];
+            __builtin_prefetch(e);
+            __builtin_prefetch(e + sizeof(Entry) - 1);
+        }
+        for (size_t i = 0; i < m; i++) {
+            const auto& e = entries_[home[i]];
+            if (e.state == State::FILLED) __builtin_prefetch(e.key.data());
+        }
+        for (size_t i = 0; i < m; i++) fn(g + i, probeFrom(home[i], keyAt(g + i)));
+    }
+}
+
+void HashTable::findBatch(const std::string* const* keys, size_t n, const std::vector<int>** out) const {
+    probeBatch(n, [&](size_t i) -> const std::string& { return *keys[i]; }, [&](size_t i, size_t idx) {
+        const auto& e = entries_[idx];
+        out[i] = e.state == State::FILLED ? &e.value : nullptr;
+    });
+}
+
+void HashTable::getOrInsertBatch(const std::string* keys, size_t n, std::vector<int>** out) {
+    size_t cap = entries_.size();
+    while ((double)(size_ + n) / (double)cap > maxLoad_) cap *= 2;
+    if (cap != entries_.size()) rehash(cap);
+    // Probes run in key order, so a key repeated later in the batch finds the
+    // slot an earlier one just filled.
+    probeBatch(n, [&](size_t i) -> const std::string& { return keys[i]; }, [&](size_t i, size_t idx) {
+        auto& e = entries_[idx];
+        if (e.state == State::EMPTY) {
+            e.state = State::FILLED;
+            e.key = keys[i];
+            e.value.clear();
+            size_++;
+        }
+        out[i] = &e.value;
+    });
+}
+
+size_t HashTable::bytes() const {
+    size_t n = entries_.capacity() * sizeof(Entry);
+    for (const auto& e : entries_)
+        if (e.key.capacity() > std::string().capacity()) n += e.key.capacity() + 1;
+    return n;
+}
+
+static void addAt(std::vector<size_t>& v, size_t k, size_t n = 1) {
+    if (v.size() <= k) v.resize(k + 1, 0);
+    v[k] += n;
+}
+
+HashTable::ProbeStats& HashTable::ProbeStats::operator+=(const ProbeStats& o) {
+    capacity += o.capacity;
+    size += o.size;
+    for (size_t k = 0; k < o.probes.size(); k++) addAt(probes, k, o.probes[k]);
+    for (size_t k = 0; k < o.clusters.size(); k++) addAt(clusters, k, o.clusters[k]);
+    for (size_t k = 0; k < o.windowLoad.size(); k++) addAt(windowLoad, k, o.windowLoad[k]);
+    return *this;
+}
+
+HashTable::ProbeStats HashTable::probeStats() const {
+    ProbeStats st;
+    st.capacity = entries_.size();
+    st.size = size_;
+    st.windowLoad.assign(11, 0);
+    size_t cap = entries_.size();
+    // A run may wrap around the end; start counting after an empty slot.
+    size_t start = 0;
+    while (start < cap && entries_[start].state == State::FILLED) start++;
+    size_t run = 0;
+    for (size_t i = 0; i < cap; i++) {
+        size_t idx = (start + i) & mask_;
+        const auto& e = entries_[idx];
+        if (e.state == State::FILLED) {
+            run++;
+            size_t home = (size_t)hash64(e.key) & mask_;
+            addAt(st.probes, ((idx - home) & mask_));
+        } else if (run) {
+            addAt(st.clusters, run - 1);
+            run = 0;
+        }
+    }
+    if (run) addAt(st.clusters, run - 1);
+
+    size_t window = std::min(kLoadWindow, cap);
+    for (size_t w = 0; w < cap; w += window) {
+        size_t filled = 0;
+        for (size_t i = w; i < w + window; i++) filled += entries_[i].state == State::FILLED;
+        st.windowLoad[filled * 10 / window]++;
+    }
+    return st;
+}
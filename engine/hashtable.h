@@ -10,13 +10,40 @@ public:
 
     const std::vector<int>* find(const std::string& key) const;
 
+    // find() and getOrInsert() for n independent keys, out[i] answering keys[i].
+    // Keys go kBatch at a time: all are hashed and their home slots and key
+    // bytes prefetched before the first is probed, so the cache misses overlap.
+    // getOrInsertBatch grows the table up front for n new keys, so no insert
+    // in the batch rehashes and every out[i] stays valid until the next insert.
+    static constexpr size_t kBatch = 16;
+    void findBatch(const std::string* const* keys, size_t n, const std::vector<int>** out) const;
+    void getOrInsertBatch(const std::string* keys, size_t n, std::vector<int>** out);
+
     size_t size() const { return size_; }
+    // Slots and heap-held keys; the value vectors' storage is not included.
+    size_t bytes() const;
+
+    // Linear-probing health: probes[k] keys are found with k+1 probes,
+    // clusters[k] runs of k+1 consecutive filled slots, windowLoad[k] windows
+    // of kLoadWindow slots filled between k*10% and (k+1)*10% (k = 10: full).
+    static constexpr size_t kLoadWindow = 1024;
+    struct ProbeStats {
+        size_t capacity = 0, size = 0;
+        std::vector<size_t> probes, clusters, windowLoad;
+        ProbeStats& operator+=(const ProbeStats& o);
+    };
+    ProbeStats probeStats() const;
 
     template <class F>
     void forEach(F&& f) {
         for (auto& e : entries_) if (e.state == State::FILLED) f(e.key, e.value);
     }
 
+    template <class F>
+    void forEach(F&& f) const {
+        for (const auto& e : entries_) if (e.state == State::FILLED) f(e.key, e.value);
+    }
+
 private:
     enum class State : uint8_t { EMPTY, FILLED };
 
@@ -32,6 +59,9 @@ private:
     double maxLoad_ = 0.70;
 
     static uint64_t hash64(const std::string& s); 
-    size_t probeIndex(const std::string& key) const;
+    size_t probeIndex(const std::string& key) const { return probeFrom((size_t)hash64(key) & mask_, key); }
+    size_t probeFrom(size_t idx, const std::string& key) const;
+    template <class KeyAt, class Fn>
+    void probeBatch(size_t n, KeyAt&& keyAt, Fn&& fn) const;
     void rehash(size_t newCapPow2);
 };
\ No newline at end of file
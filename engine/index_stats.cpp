@@ -0,0 +1,277 @@
+#include "index_stats.h"
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace {
+
+struct TermAgg {
+    size_t df = 0;
+    int first = INT_MAX;
+};
+
+// Least squares of log y = log c + b * log x; returns {c, b}.
+std::pair<double, double> fitLogLog(const std::vector<std::pair<double, double>>& pts) {
+    double n = 0, sx = 0, sy = 0;
+    for (const auto& p : pts) {
+        if (p.first <= 0 || p.second <= 0) continue;
+        n++; sx += std::log(p.first); sy += std::log(p.second);
+    }
+    if (n < 2) return {0, 0};
+    double mx = sx / n, my = sy / n, num = 0, den = 0;
+    for (const auto& p : pts) {
+        if (p.first <= 0 || p.second <= 0) continue;
+        double dx = std::log(p.first) - mx;
+        num += dx * (std::log(p.second) - my);
+        den += dx * dx;
+    }
+    if (den == 0) return {0, 0};
+    double b = num / den;
+    return {std::exp(my - b * mx), b};
+}
+
+// About `points` distinct values in [1, n], spaced evenly on a log scale.
+std::vector<size_t> logSpaced(size_t n, size_t points) {
+    std::vector<size_t> out;
+    if (n == 0) return out;
+    double step = std::pow((double)n, 1.0 / (double)std::max<size_t>(1, points - 1));
+    for (double x = 1; ; x *= step) {
+        size_t v = std::min(n, (size_t)std::llround(x));
+        if (out.empty() || v > out.back()) out.push_back(v);
+        if (v >= n || step <= 1) break;
+    }
+    if (out.back() != n) out.push_back(n);
+    return out;
+}
+
+std::string jsonStr(std::string_view s) {
+    std::string out = "\"";
+    for (unsigned char c : s) {
+        if (c == '"' || c == '\\') { out += '\\'; out += (char)c; }
+        else if (c < 0x20) { char b[8]; std::snprintf(b, sizeof(b), "\\u%04x", c); out += b; }
+        else out += (char)c;
+    }
+    return out + "\"";
+}
+
+std::string num(double v) {
+    char b[32];
+    std::snprintf(b, sizeof(b), "%.6g", v);
+    return b;
+}
+
+std::string jsonList(const std::vector<size_t>& v) {
+    std::string out = "[";
+    for (size_t i = 0; i < v.size(); i++) out += (i ? "," : "") + std::to_string(v[i]);
+    return out + "]";
+}
+
+std::string jsonPairs(const std::vector<std::pair<size_t, size_t>>& v) {
+    std::string out = "[";
+    for (size_t i = 0; i < v.size(); i++)
+        out += (i ? ",[" : "[") + std::to_string(v[i].first) + "," + std::to_string(v[i].second) + "]";
+    return out + "]";
+}
+
+std::vector<std::pair<std::string, size_t>> memoryParts(const IndexStats& s) {
+    const IndexMemory& m = s.memory;
+    return {{"postings", m.postings}, {"table", m.table}, {"bitmaps", m.bitmaps}, {"times", m.times},
+            {"lexicon", m.lexicon}, {"sample", m.sample}, {"urls", s.urlBytes}, {"docs", s.docBytes}};
+}
+
+} // namespace
+
+IndexStats computeIndexStats(const std::vector<const BooleanIndex*>& segments, const IndexStatsOptions& opt) {
+    IndexStats st;
+    int lo = INT_MAX, hi = INT_MIN;
+    for (const BooleanIndex* idx : segments) {
+        st.docs += idx->allDocs().size();
+        if (!idx->allDocs().empty()) {
+            lo = std::min(lo, idx->allDocs().front());
+            hi = std::max(hi, idx->allDocs().back());
+        }
+        st.table += idx->tableStats();
+        IndexMemory m = idx->memory();
+        st.memory.postings += m.postings;
+        st.memory.table += m.table;
+        st.memory.bitmaps += m.bitmaps;
+        st.memory.times += m.times;
+        st.memory.lexicon += m.lexicon;
+        st.memory.sample += m.sample;
+    }
+    if (lo > hi) return st;
+
+    // Keys point into the segments' tables, which outlive this function's use of them.
+    std::unordered_map<std::string_view, TermAgg> agg;
+    std::unordered_set<std::string_view> filterKeys;
+    std::vector<uint32_t> docLen((size_t)(hi - lo) + 1, 0);
+    for (const BooleanIndex* idx : segments) {
+        idx->forEachList([&](const std::string& term, const std::vector<int>& lst) {
+            if (lst.empty()) return;
+            if (BooleanIndex::isFilterKey(term)) { filterKeys.insert(term); return; }
+            TermAgg& a = agg[term];
+            a.df += lst.size();
+            a.first = std::min(a.first, lst.front());
+            for (int id : lst) docLen[(size_t)(id - lo)]++;
+        });
+    }
+    st.filterKeys = filterKeys.size();
+
+    std::vector<std::pair<size_t, std::string_view>> byDf;
+    byDf.reserve(agg.size());
+    std::vector<uint32_t> firstAt(docLen.size(), 0);
+    for (const auto& kv : agg) {
+        byDf.push_back({kv.second.df, kv.first});
+        firstAt[(size_t)(kv.second.first - lo)]++;
+        st.postings += kv.second.df;
+        size_t k = 0;
+        while ((kv.second.df >> (k + 1)) != 0) k++;
+        if (st.postingHist.size() <= k) st.postingHist.resize(k + 1, 0);
+        st.postingHist[k]++;
+    }
+    st.terms = byDf.size();
+    if (byDf.empty()) return st;
+    st.avgPosting = (double)st.postings / (double)st.terms;
+    std::sort(byDf.begin(), byDf.end(), [](const auto& a, const auto& b) {
+        return a.first != b.first ? a.first > b.first : a.second < b.second;
+    });
+    st.maxPosting = byDf.front().first;
+    st.maxPostingTerm = std::string(byDf.front().second);
+    for (size_t i = 0; i < byDf.size() && i < opt.top; i++) st.top.push_back({std::string(byDf[i].second), byDf[i].first});
+    for (size_t r : logSpaced(byDf.size(), opt.curvePoints)) st.rankDf.push_back({r, byDf[r - 1].first});
+
+    st.zipfRMin = std::min(opt.zipfRMin, byDf.size());
+    st.zipfRMax = std::min(opt.zipfRMax, byDf.size());
+    std::vector<std::pair<double, double>> pts;
+    for (size_t r = std::max<size_t>(1, st.zipfRMin); r <= st.zipfRMax; r++) pts.push_back({(double)r, (double)byDf[r - 1].first});
+    auto zipf = fitLogLog(pts);
+    st.zipfC = zipf.first;
+    st.zipfS = -zipf.second;
+
+    // Vocabulary growth in doc-id order: a term is new at its first posting.
+    std::vector<size_t> marks = logSpaced(st.docs, opt.curvePoints);
+    size_t seen = 0, tokens = 0, vocab = 0, next = 0;
+    double sumLog = 0, sumLog2 = 0;
+    for (size_t i = 0; i < docLen.size(); i++) {
+        if (!docLen[i]) continue;
+        seen++;
+        tokens += docLen[i];
+        vocab += firstAt[i];
+        double l = std::log((double)docLen[i]);
+        sumLog += l;
+        sumLog2 += l * l;
+        if (next < marks.size() && seen == marks[next]) { st.growth.push_back({tokens, vocab}); next++; }
+    }
+    // Docs without terms are not on the curve, so the last mark may be missed.
+    if (seen && (st.growth.empty() || st.growth.back().first != tokens)) st.growth.push_back({tokens, vocab});
+    pts.clear();
+    for (const auto& g : st.growth) pts.push_back({(double)g.first, (double)g.second});
+    auto heaps = fitLogLog(pts);
+    st.heapsK = heaps.first;
+    st.heapsBeta = heaps.second;
+    if (seen) {
+        st.lenMu = sumLog / (double)seen;
+        st.lenSigma = std::sqrt(std::max(0.0, sumLog2 / (double)seen - st.lenMu * st.lenMu));
+    }
+    return st;
+}
+
+std::string IndexStats::text() const {
+    char buf[256];
+    std::string out;
+    std::snprintf(buf, sizeof(buf), "docs %zu, terms %zu, filter keys %zu, postings %zu\n", docs, terms, filterKeys, postings);
+    out += buf;
+    std::snprintf(buf, sizeof(buf), "posting list: avg %.2f, max %zu (%s)\n", avgPosting, maxPosting, maxPostingTerm.c_str());
+    out += buf;
+    std::snprintf(buf, sizeof(buf), "Zipf: df(r) = %.3g * r^-%.3f (ranks %zu-%zu)\n", zipfC, zipfS, zipfRMin, zipfRMax);
+    out += buf;
+    std::snprintf(buf, sizeof(buf), "Heaps: V(n) = %.3g * n^%.3f (n = postings)\n", heapsK, heapsBeta);
+    out += buf;
+    std::snprintf(buf, sizeof(buf), "doc length (distinct terms): log-normal mu=%.3f sigma=%.3f\n", lenMu, lenSigma);
+    out += buf;
+
+    size_t probes = 0, maxProbe = 0;
+    for (size_t k = 0; k < table.probes.size(); k++) {
+        probes += table.probes[k] * (k + 1);
+        if (table.probes[k]) maxProbe = k + 1;
+    }
+    size_t maxCluster = table.clusters.empty() ? 0 : table.clusters.size();
+    std::snprintf(buf, sizeof(buf), "hash table: %zu of %zu slots (load %.3f), probes avg %.3f max %zu, longest run %zu\n",
+                  table.size, table.capacity, table.capacity ? (double)table.size / table.capacity : 0.0,
+                  table.size ? (double)probes / table.size : 0.0, maxProbe, maxCluster);
+    out += buf;
+
+    out += "memory:";
+    size_t total = 0;
+    for (const auto& p : memoryParts(*this)) {
+        if (!p.second) continue;
+        out += " " + p.first + "=" + num((double)p.second / (1 << 20)) + "MB";
+        total += p.second;
+    }
+    out += " total=" + num((double)total / (1 << 20)) + "MB\n";
+
+    out += "top terms:";
+    for (size_t i = 0; i < top.size() && i < 20; i++) out += " " + top[i].first + "(" + std::to_string(top[i].second) + ")";
+    return out + "\n";
+}
+
+std::string IndexStats::json() const {
+    std::string out = "{\"docs\":" + std::to_string(docs) + ",\"terms\":" + std::to_string(terms) +
+        ",\"filter_keys\":" + std::to_string(filterKeys) + ",\"postings\":" + std::to_string(postings) +
+        ",\"avg_posting\":" + num(avgPosting) + ",\"max_posting\":" + std::to_string(maxPosting) +
+        ",\"max_posting_term\":" + jsonStr(maxPostingTerm) + ",\"posting_hist_log2\":" + jsonList(postingHist);
+    out += ",\"top\":[";
+    for (size_t i = 0; i < top.size(); i++) out += (i ? ",[" : "[") + jsonStr(top[i].first) + "," + std::to_string(top[i].second) + "]";
+    out += "],\"rank_df\":" + jsonPairs(rankDf) + ",\"growth\":" + jsonPairs(growth);
+    out += ",\"zipf\":{\"c\":" + num(zipfC) + ",\"s\":" + num(zipfS) + ",\"r_min\":" + std::to_string(zipfRMin) +
+           ",\"r_max\":" + std::to_string(zipfRMax) + "},\"heaps\":{\"k\":" + num(heapsK) + ",\"beta\":" + num(heapsBeta) +
+           "},\"doc_length\":{\"mu\":" + num(lenMu) + ",\"sigma\":" + num(lenSigma) + "}";
+    out += ",\"hash_table\":{\"capacity\":" + std::to_string(table.capacity) + ",\"size\":" + std::to_string(table.size) +
+           ",\"load\":" + num(table.capacity ? (double)table.size / table.capacity : 0.0) +
+           ",\"probes\":" + jsonList(table.probes) + ",\"clusters\":" + jsonList(table.clusters) +
+           ",\"window_load\":" + jsonList(table.windowLoad) + "}";
+    out += ",\"memory\":{";
+    size_t total = 0;
+    for (const auto& p : memoryParts(*this)) {
+        out += jsonStr(p.first) + ":" + std::to_string(p.second) + ",";
+        total += p.second;
+    }
+    return out + "\"total\":" + std::to_string(total) + "}}";
+}
+
+std::vector<std::pair<std::string, std::string>> IndexStats::csv() const {
+    std::vector<std::pair<std::string, std::string>> out;
+    auto pairs = [&](const char* name, const char* header, const std::vector<std::pair<size_t, size_t>>& v) {
+        std::string s = std::string(header) + "\n";
+        for (const auto& p : v) s += std::to_string(p.first) + "," + std::to_string(p.second) + "\n";
+        out.push_back({name, s});
+    };
+    auto list = [&](const char* name, const char* header, const std::vector<size_t>& v, size_t offset) {
+        std::string s = std::string(header) + "\n";
+        for (size_t k = 0; k < v.size(); k++) s += std::to_string(k + offset) + "," + std::to_string(v[k]) + "\n";
+        out.push_back({name, s});
+    };
+    pairs("rank_df", "rank,df", rankDf);
+    std::string t = "rank,term,df\n";
+    for (size_t i = 0; i < top.size(); i++) t += std::to_string(i + 1) + "," + jsonStr(top[i].first) + "," + std::to_string(top[i].second) + "\n";
+    out.push_back({"top", t});
+    std::string h = "df_from,df_to,terms\n";
+    for (size_t k = 0; k < postingHist.size(); k++)
+        h += std::to_string((size_t)1 << k) + "," + std::to_string(((size_t)2 << k) - 1) + "," + std::to_string(postingHist[k]) + "\n";
+    out.push_back({"posting_hist", h});
+    pairs("growth", "postings,terms", growth);
+    list("probes", "probes,keys", table.probes, 1);
+    list("clusters", "run_length,runs", table.clusters, 1);
+    std::string w = "load_from,load_to,windows\n";
+    for (size_t k = 0; k < table.windowLoad.size(); k++)
+        w += num(k / 10.0) + "," + num(std::min(1.0, (k + 1) / 10.0)) + "," + std::to_string(table.windowLoad[k]) + "\n";
+    out.push_back({"window_load", w});
+    std::string m = "structure,bytes\n";
+    for (const auto& p : memoryParts(*this)) m += p.first + "," + std::to_string(p.second) + "\n";
+    out.push_back({"memory", m});
+    return out;
+}
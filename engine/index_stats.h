@@ -0,0 +1,48 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <utility>
+#include "b_idx.h"
+
+// Corpus and structure statistics read straight from built indexes (one per
+// segment), for plotting and for fitting bench/gen_corpus parameters. The
+// index keeps distinct terms per document, not token counts, so frequencies
+// are document frequencies and a document's length is its distinct terms.
+struct IndexStats {
+    size_t docs = 0;
+    size_t terms = 0;        // distinct stems, filter keys excluded
+    size_t filterKeys = 0;
+    size_t postings = 0;     // of those terms
+    size_t maxPosting = 0;
+    std::string maxPostingTerm;
+    double avgPosting = 0;
+    std::vector<size_t> postingHist;                   // [k]: terms with df in [2^k, 2^(k+1))
+    std::vector<std::pair<std::string, size_t>> top;   // by df
+    std::vector<std::pair<size_t, size_t>> rankDf;     // (rank, df) at log-spaced ranks
+    std::vector<std::pair<size_t, size_t>> growth;     // (postings, distinct terms) over doc-id prefixes
+
+    // f(r) = zipfC * r^-zipfS over ranks [zipfRMin, zipfRMax]; V(n) = heapsK * n^heapsBeta.
+    double zipfC = 0, zipfS = 0;
+    size_t zipfRMin = 0, zipfRMax = 0;
+    double heapsK = 0, heapsBeta = 0;
+    double lenMu = 0, lenSigma = 0;                    // of log(distinct terms per doc)
+
+    HashTable::ProbeStats table;
+    IndexMemory memory;
+    size_t urlBytes = 0, docBytes = 0;                 // filled in by callers that have the stores
+
+    std::string text() const;
+    std::string json() const;
+    // Tables for plotting, as (name, CSV with a header line): rank_df, top,
+    // posting_hist, growth, probes, clusters, window_load, memory.
+    std::vector<std::pair<std::string, std::string>> csv() const;
+};
+
+struct IndexStatsOptions {
+    size_t top = 50;
+    size_t zipfRMin = 50, zipfRMax = 20000;  // the fit range of tests/zipf.py
+    size_t curvePoints = 200;
+};
+
+// Postings of docs deleted from a segment but not merged away yet still count.
+IndexStats computeIndexStats(const std::vector<const BooleanIndex*>& segments, const IndexStatsOptions& opt = {});
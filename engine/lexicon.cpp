@@ -0,0 +1,400 @@
+#include "lexicon.h"
+#include <algorithm>
+#include <cctype>
+#include <unordered_map>
+#include <regex>
+
+// Next code point of s at pos; malformed bytes are taken one at a time.
+static size_t nextCodePoint(std::string_view s, size_t pos, uint32_t& cp) {
+    unsigned char c = (unsigned char)s[pos];
+    size_t len = c < 0x80 ? 1 : (c >> 5) == 0x6 ? 2 : (c >> 4) == 0xE ? 3 : (c >> 3) == 0x1E ? 4 : 1;
+    if (pos + len > s.size()) len = 1;
+    cp = len == 1 ? c : c & (0x7F >> len);
+    for (size_t i = 1; i < len; i++) cp = cp << 6 | ((unsigned char)s[pos + i] & 0x3F);
+    return pos + len;
+}
+
+static std::vector<uint32_t> codePoints(std::string_view s) {
+    std::vector<uint32_t> out;
+    for (size_t pos = 0; pos < s.size();) {
+        uint32_t cp;
+        pos = nextCodePoint(s, pos, cp);
+        out.push_back(cp);
+    }
+    return out;
+}
+
+static uint64_t trigram(const uint32_t* cp) {
+    return (uint64_t)cp[0] << 42 | (uint64_t)cp[1] << 21 | cp[2];
+}
+
+TermLexicon::TermLexicon(std::vector<std::pair<std::string_view, uint32_t>> terms) {
+    std::sort(terms.begin(), terms.end());
+    size_t bytes = 0;
+    for (const auto& t : terms) bytes += t.first.size();
+    blob_.reserve(bytes);
+    offs_.reserve(terms.size() + 1);
+    df_.reserve(terms.size());
+    for (const auto& t : terms) {
+        offs_.push_back((uint32_t)blob_.size());
+        blob_.append(t.first);
+        df_.push_back(t.second);
+    }
+    offs_.push_back((uint32_t)blob_.size());
+    buildTrigrams();
+    if (size()) buildCompletions(0, size(), 0);
+    // Recorded children first; order the prefixes (and their slots) by text.
+    std::vector<uint32_t> order(heavy_.size());
+    for (uint32_t h = 0; h < order.size(); h++) order[h] = h;
+    auto text = [&](const std::pair<uint32_t, uint32_t>& p) { return term(p.first).substr(0, p.second); };
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return text(heavy_[a]) < text(heavy_[b]); });
+    std::vector<std::pair<uint32_t, uint32_t>> keys(heavy_.size());
+    std::vector<uint32_t> top(top_.size());
+    for (size_t h = 0; h < order.size(); h++) {
+        keys[h] = heavy_[order[h]];
+        std::copy_n(&top_[order[h] * kCompletions], kCompletions, &top[h * kCompletions]);
+    }
+    heavy_.swap(keys);
+    top_.swap(top);
+}
+
+// Counting sort into the flat layout: trigrams get dense ids on first sight,
+// and filling lists in term order leaves every list sorted.
+void TermLexicon::buildTrigrams() {
+    std::unordered_map<uint64_t, uint32_t> dense;
+    std::vector<uint64_t> keys;
+    std::vector<uint32_t> seq, ends, counts, cps;
+    seq.reserve(blob_.size() / 2);
+    ends.reserve(size());
+    for (uint32_t i = 0; i < size(); i++) {
+        std::string_view t = term(i);
+        cps.clear();
+        for (size_t pos = 0; pos < t.size();) {
+            uint32_t cp;
+            pos = nextCodePoint(t, pos, cp);
+            cps.push_back(cp);
+        }
+        size_t start = seq.size();
+        for (size_t k = 0; k + 3 <= cps.size(); k++) {
+            uint64_t g = trigram(&cps[k]);
+            auto it = dense.emplace(g, (uint32_t)keys.size()).first;
+            if (it->second == keys.size()) { keys.push_back(g); counts.push_back(0); }
+            if (std::find(seq.begin() + start, seq.end(), it->second) != seq.end()) continue;
+            seq.push_back(it->second);
+            counts[it->second]++;
+        }
+        ends.push_back((uint32_t)seq.size());
+    }
+
+    std::vector<uint32_t> order(keys.size()), rank(keys.size());
+    for (uint32_t k = 0; k < order.size(); k++) order[k] = k;
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return keys[a] < keys[b]; });
+    gramKeys_.resize(keys.size());
+    gramOffs_.assign(keys.size() + 1, 0);
+    for (uint32_t r = 0; r < order.size(); r++) {
+        rank[order[r]] = r;
+        gramKeys_[r] = keys[order[r]];
+        gramOffs_[r + 1] = gramOffs_[r] + counts[order[r]];
+    }
+    std::vector<uint32_t> fill(gramOffs_.begin(), gramOffs_.end() - 1);
+    gramIds_.resize(seq.size());
+    for (uint32_t i = 0, k = 0; i < size(); i++)
+        for (; k < ends[i]; k++) gramIds_[fill[rank[seq[k]]]++] = i;
+}
+
+// Fills row from prev for one more code point c of the candidate; returns the row minimum.
+static int stepRow(const std::vector<uint32_t>& q, const int* prev, int* row, uint32_t c) {
+    row[0] = prev[0] + 1;
+    int best = row[0];
+    for (size_t j = 1; j <= q.size(); j++) {
+        row[j] = std::min({prev[j] + 1, row[j - 1] + 1, prev[j - 1] + (q[j - 1] != c)});
+        best = std::min(best, row[j]);
+    }
+    return best;
+}
+
+static void selectBest(std::vector<TermLexicon::Match>& out, size_t limit) {
+    auto better = [](const TermLexicon::Match& a, const TermLexicon::Match& b) {
+        if (a.dist != b.dist) return a.dist < b.dist;
+        if (a.df != b.df) return a.df > b.df;
+        return a.term < b.term;
+    };
+    if (out.size() > limit) {
+        std::partial_sort(out.begin(), out.begin() + limit, out.end(), better);
+        out.resize(limit);
+    } else {
+        std::sort(out.begin(), out.end(), better);
+    }
+}
+
+size_t TermLexicon::lowerBound(std::string_view prefix) const {
+    size_t lo = 0, hi = size();
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (term(mid) < prefix) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+size_t TermLexicon::bytes() const {
+    return blob_.capacity() + (offs_.capacity() + df_.capacity() + gramOffs_.capacity() + gramIds_.capacity() +
+                               top_.capacity()) * 4 + gramKeys_.capacity() * 8 + heavy_.capacity() * 8;
+}
+
+size_t TermLexicon::prefixEnd(size_t from, std::string_view prefix) const {
+    size_t lo = from, hi = size();
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (term(mid).substr(0, prefix.size()) == prefix) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+std::vector<TermLexicon::Match> TermLexicon::fuzzy(std::string_view word, int maxDist, size_t limit,
+                                                   size_t* visited) const {
+    auto q = codePoints(word);
+    size_t w = q.size() + 1;
+    std::vector<int> rows(w);            // one DP row per code point of the current prefix
+    for (size_t j = 0; j < w; j++) rows[j] = (int)j;
+    std::vector<size_t> ends{0};         // byte length of the prefix at each row
+    std::string_view path;               // the current prefix itself
+
+    std::vector<Match> out;
+    size_t seen = 0;
+    for (size_t i = 0; i < size();) {
+        std::string_view t = term(i);
+        seen++;
+
+        size_t lcp = 0;
+        while (lcp < path.size() && lcp < t.size() && path[lcp] == t[lcp]) lcp++;
+        while (ends.back() > lcp) ends.pop_back();
+        rows.resize(ends.size() * w);
+
+        bool dead = false;
+        for (size_t pos = ends.back(); pos < t.size();) {
+            uint32_t cp;
+            pos = nextCodePoint(t, pos, cp);
+            rows.resize(rows.size() + w);
+            int best = stepRow(q, &rows[rows.size() - 2 * w], &rows[rows.size() - w], cp);
+            ends.push_back(pos);
+            if (best > maxDist) { dead = true; break; }
+        }
+        path = t.substr(0, ends.back());
+        if (dead) {
+            i = prefixEnd(i + 1, path);
+            continue;
+        }
+        int d = rows.back();
+        if (d <= maxDist) out.push_back({std::string(t), d, df_[i]});
+        i++;
+    }
+    if (visited) *visited = seen;
+    selectBest(out, limit);
+    return out;
+}
+
+std::vector<TermLexicon::Match> TermLexicon::fuzzyScan(std::string_view word, int maxDist, size_t limit) const {
+    auto q = codePoints(word);
+    size_t w = q.size() + 1;
+    std::vector<int> prev(w), row(w);
+    std::vector<Match> out;
+    for (size_t i = 0; i < size(); i++) {
+        std::string_view t = term(i);
+        for (size_t j = 0; j < w; j++) prev[j] = (int)j;
+        for (size_t pos = 0; pos < t.size();) {
+            uint32_t cp;
+            pos = nextCodePoint(t, pos, cp);
+            stepRow(q, prev.data(), row.data(), cp);
+            prev.swap(row);
+        }
+        if (prev[w - 1] <= maxDist) out.push_back({std::string(t), prev[w - 1], df_[i]});
+    }
+    selectBest(out, limit);
+    return out;
+}
+
+std::vector<uint32_t> TermLexicon::candidates(const std::vector<std::vector<uint32_t>>& literals) const {
+    struct List { const uint32_t* b; const uint32_t* e; size_t size() const { return (size_t)(e - b); } };
+    std::vector<List> lists;
+    for (const auto& lit : literals) {
+        for (size_t k = 0; k + 3 <= lit.size(); k++) {
+            uint64_t g = trigram(&lit[k]);
+            auto it = std::lower_bound(gramKeys_.begin(), gramKeys_.end(), g);
+            if (it == gramKeys_.end() || *it != g) return {};
+            size_t at = (size_t)(it - gramKeys_.begin());
+            lists.push_back({&gramIds_[gramOffs_[at]], gramIds_.data() + gramOffs_[at + 1]});
+        }
+    }
+    if (lists.empty()) {
+        std::vector<uint32_t> all(size());
+        for (uint32_t i = 0; i < all.size(); i++) all[i] = i;
+        return all;
+    }
+    std::sort(lists.begin(), lists.end(), [](const List& a, const List& b) { return a.size() < b.size(); });
+    std::vector<uint32_t> out(lists[0].b, lists[0].e), next;
+    for (size_t i = 1; i < lists.size() && !out.empty(); i++) {
+        next.clear();
+        std::set_intersection(out.begin(), out.end(), lists[i].b, lists[i].e, std::back_inserter(next));
+        out.swap(next);
+    }
+    return out;
+}
+
+template <class Pred>
+std::vector<TermLexicon::Match> TermLexicon::verify(const std::vector<uint32_t>& ids, size_t limit, Pred&& pred) const {
+    std::vector<Match> out;
+    for (uint32_t i : ids)
+        if (pred(term(i))) out.push_back({std::string(term(i)), 0, df_[i]});
+    selectBest(out, limit);
+    return out;
+}
+
+std::vector<TermLexicon::Match> TermLexicon::containing(std::string_view infix, size_t limit) const {
+    if (infix.empty()) return {};
+    return verify(candidates({codePoints(infix)}), limit,
+                  [&](std::string_view t) { return t.find(infix) != std::string_view::npos; });
+}
+
+// Literal runs every full match of the regex contains. Conservative: anything
+// that is not a plain character ends a run, a quantifier that allows zero
+// repetitions also drops the character before it, and a top-level alternation
+// gives up.
+static std::vector<std::vector<uint32_t>> requiredLiterals(const std::vector<uint32_t>& p) {
+    auto skipClass = [&](size_t i) {  // p[i] == '[' -> index of its ']'
+        size_t j = i + 1;
+        if (j < p.size() && p[j] == '^') j++;
+        if (j < p.size() && p[j] == ']') j++;
+        for (; j < p.size() && p[j] != ']'; j++) if (p[j] == '\\') j++;
+        return j;
+    };
+    int depth = 0;
+    for (size_t i = 0; i < p.size(); i++) {
+        if (p[i] == '\\') i++;
+        else if (p[i] == '[') i = skipClass(i);
+        else if (p[i] == '(') depth++;
+        else if (p[i] == ')') depth--;
+        else if (p[i] == '|' && depth == 0) return {};
+    }
+
+    std::vector<std::vector<uint32_t>> out;
+    std::vector<uint32_t> run;
+    auto cut = [&] {
+        if (run.size() >= 3) out.push_back(run);
+        run.clear();
+    };
+    for (size_t i = 0; i < p.size(); i++) {
+        uint32_t c = p[i];
+        bool literal = false;
+        if (c == '\\' && i + 1 < p.size()) {
+            c = p[++i];
+            literal = !(c < 128 && std::isalnum((int)c));  // \d, \w, \b ... are classes
+            // \xHH, \uHHHH, \cX and backreferences \N: the operand is not text either.
+            size_t arg = c == 'x' ? 2 : c == 'u' ? 4 : c == 'c' ? 1 : c >= '1' && c <= '9' ? SIZE_MAX : 0;
+            for (; arg > 0 && i + 1 < p.size() && p[i + 1] < 128; arg--) {
+                int a = (int)p[i + 1];
+                if (c == 'c' ? !std::isalpha(a) : c == 'x' || c == 'u' ? !std::isxdigit(a) : !std::isdigit(a)) break;
+                i++;
+            }
+        } else if (c == '[') {
+            i = skipClass(i);
+        } else if (c == '(') {
+            for (int d = 0; i < p.size(); i++) {
+                if (p[i] == '\\') i++;
+                else if (p[i] == '[') i = skipClass(i);
+                else if (p[i] == '(') d++;
+                else if (p[i] == ')' && --d == 0) break;
+            }
+        } else if (c == '{') {
+            while (i < p.size() && p[i] != '}') i++;
+        } else {
+            literal = std::string_view(".^$*+?|)").find(c < 128 ? (char)c : 'x') == std::string_view::npos;
+        }
+        if (!literal) { cut(); continue; }
+
+        uint32_t q = i + 1 < p.size() ? p[i + 1] : 0;
+        if (q == '*' || q == '?' || q == '{') {
+            cut();
+        } else if (q == '+') {
+            run.push_back(c);
+            cut();
+            run.push_back(c);
+            i++;
+        } else {
+            run.push_back(c);
+        }
+    }
+    cut();
+    return out;
+}
+
+std::vector<TermLexicon::Match> TermLexicon::matching(std::string_view regex, size_t limit) const {
+    auto p = codePoints(regex);
+    std::wregex re;
+    try {
+        re.assign(std::wstring(p.begin(), p.end()));
+    } catch (const std::regex_error&) {
+        return {};
+    }
+    std::wstring w;
+    return verify(candidates(requiredLiterals(p)), limit, [&](std::string_view t) {
+        auto cps = codePoints(t);
+        w.assign(cps.begin(), cps.end());
+        return std::regex_match(w, re);
+    });
+}
+
+std::vector<uint32_t> TermLexicon::topOfRange(size_t lo, size_t hi) const {
+    std::vector<uint32_t> ids;
+    for (size_t i = lo; i < hi; i++) ids.push_back((uint32_t)i);
+    auto more = [&](uint32_t a, uint32_t b) { return df_[a] != df_[b] ? df_[a] > df_[b] : a < b; };
+    size_t k = std::min(ids.size(), kCompletions);
+    std::partial_sort(ids.begin(), ids.begin() + k, ids.end(), more);
+    ids.resize(k);
+    return ids;
+}
+
+// Top completions of the terms [lo, hi), which share their first depth bytes.
+// Children split at the next code point; every range larger than kScanRange
+// records its merged top list under its prefix.
+std::vector<uint32_t> TermLexicon::buildCompletions(size_t lo, size_t hi, size_t depth) {
+    if (hi - lo <= kScanRange) return topOfRange(lo, hi);
+
+    std::vector<uint32_t> best;
+    size_t i = lo;
+    if (term(i).size() == depth) best.push_back((uint32_t)i++);
+    while (i < hi) {
+        uint32_t cp;
+        size_t next = nextCodePoint(term(i), depth, cp);
+        size_t end = prefixEnd(i + 1, term(i).substr(0, next));
+        auto sub = buildCompletions(i, end, next);
+        best.insert(best.end(), sub.begin(), sub.end());
+        i = end;
+    }
+    auto more = [&](uint32_t a, uint32_t b) { return df_[a] != df_[b] ? df_[a] > df_[b] : a < b; };
+    size_t k = std::min(best.size(), kCompletions);
+    std::partial_sort(best.begin(), best.begin() + k, best.end(), more);
+    best.resize(k);
+
+    heavy_.push_back({(uint32_t)lo, (uint32_t)depth});
+    top_.insert(top_.end(), best.begin(), best.end());
+    top_.resize(top_.size() + kCompletions - k, UINT32_MAX);
+    return best;
+}
+
+std::vector<TermLexicon::Match> TermLexicon::complete(std::string_view prefix, size_t k) const {
+    std::vector<uint32_t> ids;
+    auto it = std::lower_bound(heavy_.begin(), heavy_.end(), prefix,
+        [&](const std::pair<uint32_t, uint32_t>& h, std::string_view p) { return term(h.first).substr(0, h.second) < p; });
+    if (it != heavy_.end() && term(it->first).substr(0, it->second) == prefix) {
+        const uint32_t* slots = &top_[(size_t)(it - heavy_.begin()) * kCompletions];
+        for (size_t j = 0; j < kCompletions && slots[j] != UINT32_MAX; j++) ids.push_back(slots[j]);
+    } else {
+        size_t lo = lowerBound(prefix);
+        ids = topOfRange(lo, prefixEnd(lo, prefix));
+    }
+    std::vector<Match> out;
+    for (size_t j = 0; j < ids.size() && j < k; j++) out.push_back({std::string(term(ids[j])), 0, df_[ids[j]]});
+    return out;
+}
@@ -0,0 +1,77 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+
+// Sorted, packed term dictionary with document frequencies. Sorted order makes
+// it an implicit trie: terms sharing a prefix are contiguous, so a search can
+// drop a whole prefix range with one binary search. A code point trigram index
+// over the terms narrows infix and regex lookups to a candidate set, and the
+// most frequent completions of every large prefix are precomputed.
+class TermLexicon {
+public:
+    struct Match {
+        std::string term;
+        int dist;
+        uint32_t df;
+    };
+
+    TermLexicon() = default;
+    explicit TermLexicon(std::vector<std::pair<std::string_view, uint32_t>> terms);
+
+    size_t size() const { return df_.size(); }
+    std::string_view term(size_t i) const { return std::string_view(blob_).substr(offs_[i], offs_[i + 1] - offs_[i]); }
+    uint32_t df(size_t i) const { return df_[i]; }
+    size_t bytes() const;
+
+    // Terms within maxDist Levenshtein edits (counted in code points) of word,
+    // closest first and most frequent first among equals, at most limit of them.
+    // Simulates the word's Levenshtein automaton one DP row per trie level and
+    // skips every prefix whose row already exceeds maxDist; visited, when given,
+    // receives the number of terms actually looked at.
+    std::vector<Match> fuzzy(std::string_view word, int maxDist, size_t limit, size_t* visited = nullptr) const;
+    // Same result by computing the distance to every term; baseline for tests.
+    std::vector<Match> fuzzyScan(std::string_view word, int maxDist, size_t limit) const;
+
+    // Terms containing infix, most frequent first. Infixes shorter than three
+    // code points have no trigram and fall back to checking every term.
+    std::vector<Match> containing(std::string_view infix, size_t limit) const;
+    // Terms the ECMAScript regex matches in full (`.` is one code point), most
+    // frequent first. Candidates come from trigrams of the literal runs every
+    // match must contain; nothing is returned for an invalid pattern.
+    std::vector<Match> matching(std::string_view regex, size_t limit) const;
+
+    // Up to min(k, kCompletions) terms starting with prefix, most frequent
+    // first. Prefixes covering more than kScanRange terms are answered from a
+    // table built with the lexicon, smaller ones by scanning their range.
+    static constexpr size_t kCompletions = 8;
+    static constexpr size_t kScanRange = 64;
+    std::vector<Match> complete(std::string_view prefix, size_t k = kCompletions) const;
+
+private:
+    std::string blob_;
+    std::vector<uint32_t> offs_;
+    std::vector<uint32_t> df_;
+    // Trigram -> term indexes, flattened: the terms of gramKeys_[k] are
+    // gramIds_[gramOffs_[k] .. gramOffs_[k + 1]).
+    std::vector<uint64_t> gramKeys_;
+    std::vector<uint32_t> gramOffs_;
+    std::vector<uint32_t> gramIds_;
+    // Prefixes larger than kScanRange, sorted, each as (term index, byte length);
+    // heavy_[h] owns the kCompletions slots of top_ from h * kCompletions,
+    // padded with UINT32_MAX.
+    std::vector<std::pair<uint32_t, uint32_t>> heavy_;
+    std::vector<uint32_t> top_;
+
+    size_t prefixEnd(size_t from, std::string_view prefix) const;
+    size_t lowerBound(std::string_view prefix) const;
+    // Indexes of terms holding every trigram of every literal, or of all terms
+    // when no literal has one.
+    std::vector<uint32_t> candidates(const std::vector<std::vector<uint32_t>>& literals) const;
+    void buildTrigrams();
+    std::vector<uint32_t> buildCompletions(size_t lo, size_t hi, size_t depth);
+    std::vector<uint32_t> topOfRange(size_t lo, size_t hi) const;
+    template <class Pred>
+    std::vector<Match> verify(const std::vector<uint32_t>& ids, size_t limit, Pred&& pred) const;
+};
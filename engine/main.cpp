@@ -2,12 +2,37 @@
 #include <string>
 #include <vector>
 #include <chrono>
+#include <csignal>
+#include <atomic>
+#include <thread>
+#include <unordered_set>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <ctime>
+#include <fstream>
+#include <algorithm>
+#include <stdexcept>
 
 #include "b_idx.h"
 #include "b_srch.h"
+#include "reload.h"
+#include "segments.h"
+#include "wal.h"
+#include "snippet.h"
+#include "dedup.h"
+#include "shard.h"
+#include "disk_index.h"
+#include "metrics.h"
+#include "trace.h"
+#include "index_stats.h"
+#include "corpus_file.h"
 
 #include <mongocxx/client.hpp>
 #include <mongocxx/instance.hpp>
+#include <mongocxx/pool.hpp>
+#include <mongocxx/pipeline.hpp>
 #include <mongocxx/uri.hpp>
 #include <mongocxx/options/find.hpp>
 #include <bsoncxx/builder/basic/document.hpp>
@@ -24,119 +49,1160 @@ struct MongoConfig {
     std::string collection; 
     std::string urlField = "url";
     std::string textField = "text";
+    std::string fetchedField = "fetched_at";
+    std::string sourceField = "source";
+    bool timeOrder = false;  // assign doc ids in fetchedField order
+    double dedupSimilarity = 0; // > 0: drop docs at least this Jaccard-similar to an earlier one
+    uint32_t shard = 0, shards = 1; // index only URLs with shardOf(url, shards) == shard
     int64_t limit = 0;      
+    std::string corpus;     // read this corpus file or mongodump .bson instead of the collection
+    unsigned corpusThreads = 0; // term extraction workers for corpus, 0: one per core
+    unsigned readers = 1;   // > 1: parallel cursors over _id ranges
+    int32_t batchSize = 0;  // cursor batch size, 0: server default
+    bool noCursorTimeout = false;
+};
+
+static int64_t asInt64(const bsoncxx::document::element& e) {
+    switch (e.type()) {
+        case bsoncxx::type::k_int32: return e.get_int32().value;
+        case bsoncxx::type::k_int64: return e.get_int64().value;
+        case bsoncxx::type::k_double: return (int64_t)e.get_double().value;
+        default: return 0;
+    }
+}
+
+static Counter& buildStage(const std::string& stage) {
+    return Metrics::get().counter("engine_build_stage_seconds_total{stage=\"" + stage + "\"}",
+                                  "Time spent per index build stage", 1e-9);
+}
+
+// Dedup and insert stages of a full build, shared by the MongoDB and corpus
+// file readers. Documents arrive with their terms already extracted and get
+// consecutive ids in arrival order.
+class BuildSink {
+public:
+    BuildSink(const MongoConfig& cfg, BooleanIndex& index, std::vector<std::string>& urls,
+              DocStore* docs, DuplicateList* dups, std::vector<uint64_t>* textHashes)
+        : index_(index), urls_(urls), docs_(docs), dups_(dups), textHashes_(textHashes) {
+        if (dups && cfg.dedupSimilarity > 0) dedup_ = std::make_unique<NearDupDetector>(cfg.dedupSimilarity);
+    }
+
+    void add(const CorpusRecord& r, const std::vector<std::string>& terms, bool traced) {
+        static Counter& dedupNs = buildStage("dedup");
+        static Counter& insertNs = buildStage("insert");
+        static Counter& dropped = Metrics::get().counter("engine_near_duplicates_total", "Documents dropped as near-duplicates");
+
+        postings_ += terms.size();
+        if (dedup_ && terms.size() >= kDedupMinTerms) {
+            TraceSpan dedupSpan("dedup", "build", traced);
+            auto t0 = std::chrono::steady_clock::now();
+            int canonical = dedup_->findOrAdd(docId_, NearDupDetector::signature(terms));
+            auto dt = std::chrono::steady_clock::now() - t0;
+            dedupSec_ += std::chrono::duration<double>(dt).count();
+            dedupNs.add((uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(dt).count());
+            if (canonical >= 0) {
+                dropped.add();
+                dups_->add(canonical, std::string(r.url));
+                dupPostings_ += terms.size();
+                return;
+            }
+        }
+
+        {
+            ScopedTimer insert(insertNs);
+            TraceSpan insertSpan("insert", "build", traced);
+            urls_.emplace_back(r.url);
+            index_.addTerms(docId_, terms);
+            index_.addAttributes(docId_, r.url, r.source);
+            if (r.fetchedAt) index_.setTime(docId_, r.fetchedAt);
+            if (docs_) docs_->add(r.text);
+            if (textHashes_) textHashes_->push_back(SegmentedIndex::textHash(r.text));
+        }
+        docId_++;
+
+        if (docId_ % 2000 == 0) {
+            std::cerr << "Indexed docs: " << docId_ << "\r" << std::flush;
+        }
+    }
+
+    int finish() {
+        if (dedup_) {
+            std::cerr << "\nNear-duplicates: " << dups_->size() << " of " << (docId_ + dups_->size())
+                      << " docs dropped, " << dupPostings_ << " of " << postings_ << " postings ("
+                      << (postings_ ? 100.0 * dupPostings_ / postings_ : 0.0) << "%) saved, dedup stage "
+                      << dedupSec_ << " sec";
+        }
+        std::cerr << "\nFinalize index...\n";
+        index_.finalize();
+        if (docs_) docs_->finish();
+        return docId_;
+    }
+
+private:
+    // Very short pages (error stubs, paywalls) look alike without being duplicates.
+    static constexpr size_t kDedupMinTerms = 16;
+
+    BooleanIndex& index_;
+    std::vector<std::string>& urls_;
+    DocStore* docs_;
+    DuplicateList* dups_;
+    std::vector<uint64_t>* textHashes_;
+    std::unique_ptr<NearDupDetector> dedup_;
+    int docId_ = 0;
+    size_t postings_ = 0, dupPostings_ = 0;
+    double dedupSec_ = 0;
+};
+
+static mongocxx::options::find findOptions(const MongoConfig& cfg) {
+    mongocxx::options::find opts;
+    opts.projection(make_document(
+        kvp(cfg.urlField, 1),
+        kvp(cfg.textField, 1),
+        kvp(cfg.sourceField, 1),
+        kvp(cfg.fetchedField, 1),
+        kvp("_id", 0)
+    ));
+    // _id order matches the parallel readers, so doc ids do not depend on --readers.
+    opts.sort(make_document(kvp(cfg.timeOrder ? cfg.fetchedField : std::string("_id"), 1)));
+    if (cfg.limit > 0) opts.limit(cfg.limit);
+    if (cfg.batchSize > 0) opts.batch_size(cfg.batchSize);
+    if (cfg.noCursorTimeout) opts.no_cursor_timeout(true);
+    return opts;
 }
 
-static int loadAndIndexMongo(const MongoConfig& cfg, BooleanIndex& index, std::vector<std::string>& urls) {
+// False unless the page has a string url and text; the views borrow from d.
+static bool pageRecord(const MongoConfig& cfg, bsoncxx::document::view d, CorpusRecord& r) {
+    auto itUrl = d.find(cfg.urlField);
+    auto itTxt = d.find(cfg.textField);
+    if (itUrl == d.end() || itTxt == d.end()) return false;
+    if (itUrl->type() != bsoncxx::type::k_utf8) return false;
+    if (itTxt->type() != bsoncxx::type::k_utf8) return false;
+
+    auto url = itUrl->get_utf8().value;
+    auto text = itTxt->get_utf8().value;
+    r.url = std::string_view(url.data(), url.size());
+    r.text = std::string_view(text.data(), text.size());
+    auto itSrc = d.find(cfg.sourceField);
+    if (itSrc != d.end() && itSrc->type() == bsoncxx::type::k_utf8) {
+        auto s = itSrc->get_utf8().value;
+        r.source = std::string_view(s.data(), s.size());
+    }
+    auto itTs = d.find(cfg.fetchedField);
+    if (itTs != d.end()) r.fetchedAt = asInt64(*itTs);
+    return true;
+}
+
+static bool skipPage(const MongoConfig& cfg, const CorpusRecord& r) {
+    return r.text.empty() || (cfg.shards > 1 && shardOf(r.url, cfg.shards) != cfg.shard);
+}
+
+struct FetchStats {
+    unsigned readers = 1;
+    size_t ranges = 1;
+    double fetchSec = 0;    // in MongoDB cursors, summed over readers
+    double extractSec = 0;  // tokenizing and stemming, summed over readers
+    double waitSec = 0;     // the build thread blocked on input
+};
+
+// Receives every page to index, with its terms when they were asked for.
+using PageFn = std::function<void(const CorpusRecord&, const std::vector<std::string>& terms, bool traced)>;
+
+static uint64_t sinceNs(std::chrono::steady_clock::time_point t0) {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - t0).count();
+}
+
+static bsoncxx::document::value pageFilter(const MongoConfig& cfg) {
+    return make_document(
+        kvp(cfg.textField, make_document(kvp("$type", "string"))),
+        kvp(cfg.urlField,  make_document(kvp("$type", "string")))
+    );
+}
+
+// One cursor over the whole collection; fn runs between its round trips.
+static FetchStats scanMongo(const MongoConfig& cfg, bool extract, const PageFn& fn) {
     mongocxx::client client{ mongocxx::uri{cfg.uri} };
     auto coll = client[cfg.database][cfg.collection];
+    auto cursor = coll.find(pageFilter(cfg).view(), findOptions(cfg));
+
+    static Counter& readNs = buildStage("read");
+    FetchStats st;
+    uint64_t fetchNs = 0, extractNs = 0;
+    std::vector<std::string> terms;
+    // Time between iterations is spent in the cursor, reading from MongoDB.
+    auto idle = std::chrono::steady_clock::now();
+    for (auto&& d : cursor) {
+        uint64_t readDt = sinceNs(idle);
+        readNs.add(readDt);
+        fetchNs += readDt;
+        bool traced = Tracer::sample();
+        if (traced) {
+            uint64_t now = Tracer::nowNs();
+            Tracer::complete("mongoRead", "build", now - readDt, now);
+        }
+        struct Rearm {
+            std::chrono::steady_clock::time_point& t;
+            ~Rearm() { t = std::chrono::steady_clock::now(); }
+        } rearm{idle};
+        CorpusRecord r;
+        if (!pageRecord(cfg, d, r) || skipPage(cfg, r)) continue;
+        if (extract) {
+            auto t0 = std::chrono::steady_clock::now();
+            terms = BooleanIndex::extractTerms(r.text);
+            extractNs += sinceNs(t0);
+        }
+        fn(r, terms, traced);
+    }
+    st.fetchSec = st.waitSec = fetchNs * 1e-9;
+    st.extractSec = extractNs * 1e-9;
+    return st;
+}
+
+// Range boundaries at quantiles of a random sample of _id values, sorted by the
+// server, so any _id type works; fewer than ranges - 1 if the sample repeats.
+static std::vector<bsoncxx::document::value> sampleIdBounds(mongocxx::collection& coll, size_t ranges) {
+    const int64_t kSamplesPerRange = 16;
+    std::vector<bsoncxx::document::value> sample, bounds;
+    int64_t n = coll.estimated_document_count();
+    if (n < 2 || ranges < 2) return bounds;
+    mongocxx::pipeline p;
+    p.sample((int32_t)std::min<int64_t>(n, (int64_t)ranges * kSamplesPerRange));
+    p.project(make_document(kvp("_id", 1)));
+    p.sort(make_document(kvp("_id", 1)));
+    for (auto&& d : coll.aggregate(p)) sample.emplace_back(d);
+    for (size_t i = 1; i < ranges && !sample.empty(); i++) {
+        auto& b = sample[i * sample.size() / ranges];
+        if (!bounds.empty() && bounds.back().view()["_id"].get_value() == b.view()["_id"].get_value()) continue;
+        bounds.push_back(b);
+    }
+    return bounds;
+}
+
+// Splits the collection into _id ranges of about kRangeDocs pages. Reader
+// threads, each with a client from one pool, fetch ranges (sorted by _id) and
+// extract terms, at most kWindow ranges ahead of the build thread; fn sees the
+// ranges in _id order, so doc ids do not depend on the number of readers.
+static FetchStats scanMongoParallel(const MongoConfig& cfg, bool extract, const PageFn& fn) {
+    const int64_t kRangeDocs = 2048;
+    const size_t kWindow = 2;  // ranges in flight per reader
+
+    mongocxx::pool pool{ mongocxx::uri{cfg.uri} };
+    std::vector<bsoncxx::document::value> bounds;
+    {
+        auto client = pool.acquire();
+        auto coll = (*client)[cfg.database][cfg.collection];
+        int64_t n = coll.estimated_document_count();
+        size_t ranges = (size_t)std::max<int64_t>((int64_t)cfg.readers * 4, n / kRangeDocs);
+        bounds = sampleIdBounds(coll, ranges);
+    }
+
+    struct Range {
+        std::vector<bsoncxx::document::value> docs;
+        std::vector<CorpusRecord> recs;
+        std::vector<char> pages;  // recs[k] is a page to index
+        std::vector<std::vector<std::string>> terms;
+        std::string error;
+        bool ready = false;
+    };
+    std::vector<Range> ranges(bounds.size() + 1);
+    std::mutex mu;
+    std::condition_variable cv;
+    size_t next = 0, consumed = 0;
+    bool stop = false;
+    const size_t window = (size_t)cfg.readers * kWindow;
+
+    auto& m = Metrics::get();
+    const char* help = "Time MongoDB reader threads spend per activity";
+    static Counter& fetchNs = m.counter("engine_mongo_reader_seconds_total{activity=\"fetch\"}", help, 1e-9);
+    static Counter& extractNs = m.counter("engine_mongo_reader_seconds_total{activity=\"extract\"}", help, 1e-9);
+    std::atomic<uint64_t> fetched{0}, extracted{0};
+
+    auto fetch = [&](mongocxx::collection& coll, size_t i, Range& r) {
+        TraceSpan span("mongoRange", "build");
+        bsoncxx::builder::basic::document filter, range;
+        filter.append(kvp(cfg.textField, make_document(kvp("$type", "string"))),
+                      kvp(cfg.urlField,  make_document(kvp("$type", "string"))));
+        if (i > 0) range.append(kvp("$gte", bounds[i - 1].view()["_id"].get_value()));
+        if (i < bounds.size()) range.append(kvp("$lt", bounds[i].view()["_id"].get_value()));
+        if (!bounds.empty()) filter.append(kvp("_id", range.extract()));
+        auto opts = findOptions(cfg);
+
+        auto t0 = std::chrono::steady_clock::now();
+        for (auto&& d : coll.find(filter.view(), opts)) r.docs.emplace_back(d);
+        uint64_t dt = sinceNs(t0);
+        fetchNs.add(dt);
+        fetched += dt;
+
+        t0 = std::chrono::steady_clock::now();
+        r.recs.resize(r.docs.size());
+        r.pages.resize(r.docs.size());
+        r.terms.resize(r.docs.size());
+        for (size_t k = 0; k < r.docs.size(); k++) {
+            r.pages[k] = pageRecord(cfg, r.docs[k].view(), r.recs[k]) && !skipPage(cfg, r.recs[k]);
+            if (extract && r.pages[k]) r.terms[k] = BooleanIndex::extractTerms(r.recs[k].text);
+        }
+        dt = sinceNs(t0);
+        extractNs.add(dt);
+        extracted += dt;
+        span.arg("docs", (int64_t)r.docs.size());
+    };
+
+    auto reader = [&] {
+        auto client = pool.acquire();
+        auto coll = (*client)[cfg.database][cfg.collection];
+        for (;;) {
+            size_t i;
+            {
+                std::unique_lock<std::mutex> lk(mu);
+                cv.wait(lk, [&] { return stop || next >= ranges.size() || next < consumed + window; });
+                if (stop || next >= ranges.size()) return;
+                i = next++;
+            }
+            try {
+                fetch(coll, i, ranges[i]);
+            } catch (const std::exception& e) {
+                ranges[i].error = e.what();
+            }
+            {
+                std::lock_guard<std::mutex> lk(mu);
+                ranges[i].ready = true;
+            }
+            cv.notify_all();
+        }
+    };
+
+    // Stops and joins the readers however the build thread leaves.
+    struct Readers {
+        std::vector<std::thread> ts;
+        std::mutex& mu;
+        std::condition_variable& cv;
+        bool& stop;
+        ~Readers() {
+            { std::lock_guard<std::mutex> lk(mu); stop = true; }
+            cv.notify_all();
+            for (auto& t : ts) t.join();
+        }
+    } readers{{}, mu, cv, stop};
+    for (unsigned t = 0; t < cfg.readers; t++) readers.ts.emplace_back(reader);
+
+    static Counter& readNs = buildStage("read");
+    uint64_t waitNs = 0;
+    int64_t seen = 0;
+    for (size_t i = 0; i < ranges.size() && (cfg.limit <= 0 || seen < cfg.limit); i++) {
+        Range& r = ranges[i];
+        {
+            auto t0 = std::chrono::steady_clock::now();
+            std::unique_lock<std::mutex> lk(mu);
+            cv.wait(lk, [&] { return r.ready; });
+            uint64_t dt = sinceNs(t0);
+            readNs.add(dt);
+            waitNs += dt;
+        }
+        if (!r.error.empty()) throw std::runtime_error(r.error);
+        for (size_t k = 0; k < r.recs.size() && (cfg.limit <= 0 || seen < cfg.limit); k++, seen++)
+            if (r.pages[k]) fn(r.recs[k], r.terms[k], Tracer::sample());
+        r = Range();
+        {
+            std::lock_guard<std::mutex> lk(mu);
+            consumed = i + 1;
+        }
+        cv.notify_all();
+    }
+
+    FetchStats st;
+    st.readers = cfg.readers;
+    st.ranges = ranges.size();
+    st.fetchSec = fetched * 1e-9;
+    st.extractSec = extracted * 1e-9;
+    st.waitSec = waitNs * 1e-9;
+    return st;
+}
+
+// --time-order needs one cursor sorted by fetched_at, so it reads serially.
+static FetchStats fetchPages(const MongoConfig& cfg, bool extract, const PageFn& fn) {
+    if (cfg.readers > 1 && !cfg.timeOrder) return scanMongoParallel(cfg, extract, fn);
+    return scanMongo(cfg, extract, fn);
+}
+
+static void printFetchStats(const FetchStats& st) {
+    std::cerr << "MongoDB: " << st.readers << (st.readers > 1 ? " readers over " : " reader over ") << st.ranges
+              << (st.ranges > 1 ? " _id ranges" : " cursor") << ", fetch " << st.fetchSec << " sec, term extraction "
+              << st.extractSec << " sec; build thread waited " << st.waitSec << " sec for input\n";
+}
+
+static int loadAndIndexMongo(const MongoConfig& cfg, BooleanIndex& index, std::vector<std::string>& urls,
+                             DocStore* docs = nullptr, DuplicateList* dups = nullptr,
+                             std::vector<uint64_t>* textHashes = nullptr) {
+    TraceSpan span("loadAndIndexMongo", "build");
+    BuildSink sink(cfg, index, urls, docs, dups, textHashes);
+    FetchStats st = fetchPages(cfg, true, [&](const CorpusRecord& r, const std::vector<std::string>& terms, bool traced) {
+        sink.add(r, terms, traced);
+    });
+    int n = sink.finish();
+    printFetchStats(st);
+    span.arg("docs", n);
+    span.arg("readers", (int64_t)st.readers);
+    return n;
+}
+
+// Builds from a corpus file or a mongodump .bson through a read-only mapping.
+// Worker threads take the file's parts a batch at a time and extract terms
+// while this thread dedups and inserts the previous batch, in file order, so
+// doc ids do not depend on the number of workers.
+static int loadAndIndexCorpus(const MongoConfig& cfg, BooleanIndex& index, std::vector<std::string>& urls,
+                              DocStore* docs = nullptr, DuplicateList* dups = nullptr,
+                              std::vector<uint64_t>* textHashes = nullptr) {
+    CorpusFile file;
+    if (!file.open(cfg.corpus, {cfg.urlField, cfg.textField, cfg.sourceField, cfg.fetchedField}))
+        throw std::runtime_error(file.error());
+    TraceSpan span("loadAndIndexCorpus", "build");
+
+    struct Part {
+        std::string scratch;
+        std::vector<CorpusRecord> recs;
+        std::vector<std::vector<std::string>> terms;
+        bool ok = true;
+    };
+    auto extract = [&](Part& p, size_t i) {
+        p.recs.clear();
+        p.ok = file.read(i, p.recs, p.scratch);
+        p.terms.assign(p.recs.size(), {});
+        for (size_t k = 0; k < p.recs.size(); k++)
+            if (!skipPage(cfg, p.recs[k])) p.terms[k] = BooleanIndex::extractTerms(p.recs[k].text);
+    };
+    size_t threads = cfg.corpusThreads ? cfg.corpusThreads : std::max(1u, std::thread::hardware_concurrency());
+    std::vector<Part> cur(threads), next(threads);
+    auto launch = [&](std::vector<Part>& batch, size_t first) {
+        std::vector<std::thread> ts;
+        for (size_t w = 0; w < threads && first + w < file.parts(); w++)
+            ts.emplace_back(extract, std::ref(batch[w]), first + w);
+        return ts;
+    };
+
+    // Waiting for the workers is this build's read stage.
+    static Counter& readNs = buildStage("read");
+    BuildSink sink(cfg, index, urls, docs, dups, textHashes);
+    int64_t seen = 0;
+    std::string bad;
+    auto pending = launch(cur, 0);
+    for (size_t first = 0; first < file.parts(); first += threads) {
+        {
+            ScopedTimer wait(readNs);
+            for (auto& t : pending) t.join();
+        }
+        pending = launch(next, first + threads);
+        for (size_t w = 0; w < threads && first + w < file.parts() && bad.empty(); w++) {
+            Part& p = cur[w];
+            if (!p.ok) bad = "corrupt part " + std::to_string(first + w);
+            for (size_t k = 0; k < p.recs.size() && (cfg.limit <= 0 || seen < cfg.limit); k++, seen++)
+                if (!skipPage(cfg, p.recs[k])) sink.add(p.recs[k], p.terms[k], Tracer::sample());
+        }
+        if (!bad.empty() || (cfg.limit > 0 && seen >= cfg.limit)) break;
+        std::swap(cur, next);
+    }
+    for (auto& t : pending) t.join();
+    if (!bad.empty()) throw std::runtime_error(cfg.corpus + ": " + bad);
+
+    int n = sink.finish();
+    span.arg("docs", n);
+    span.arg("threads", (int64_t)threads);
+    return n;
+}
+
+static int loadAndIndex(const MongoConfig& cfg, BooleanIndex& index, std::vector<std::string>& urls,
+                        DocStore* docs = nullptr, DuplicateList* dups = nullptr,
+                        std::vector<uint64_t>* textHashes = nullptr) {
+    if (!cfg.corpus.empty()) return loadAndIndexCorpus(cfg, index, urls, docs, dups, textHashes);
+    return loadAndIndexMongo(cfg, index, urls, docs, dups, textHashes);
+}
+
+// Writes the projection the build reads (same filter, order, limit and shard)
+// to a corpus file, so later builds can run with --corpus and no MongoDB.
+static int exportCorpus(const MongoConfig& cfg, const std::string& path, bool compress) {
+    CorpusWriter out;
+    if (!out.open(path, compress)) {
+        std::cerr << "cannot write " << path << "\n";
+        return 1;
+    }
+    auto t0 = std::chrono::steady_clock::now();
+    FetchStats st = fetchPages(cfg, false, [&](const CorpusRecord& r, const std::vector<std::string>&, bool) {
+        out.add(r);
+        if (out.docs() % 10000 == 0) std::cerr << "Exported docs: " << out.docs() << "\r" << std::flush;
+    });
+    if (!out.finish()) {
+        std::cerr << "\ncannot write " << path << "\n";
+        return 1;
+    }
+    double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    std::cerr << "\nExported " << out.docs() << " docs to " << path << ": " << out.bytes() << " of "
+              << out.rawBytes() << " raw bytes in " << sec << " sec\n";
+    printFetchStats(st);
+    return 0;
+}
+
+struct PollState {
+    std::atomic<int64_t> watermark{0};
+    int64_t markSecond = -1;
+    std::unordered_set<std::string> atMark;
+};
+
+// Picks up pages upserted by the robot since the watermark and applies them as
+// one new segment. fetched_at has second resolution, so pages already seen at
+// the watermark second are remembered and skipped. apply returns how many
+// documents it indexed.
+using ApplyFn = std::function<size_t(std::vector<Document>, int64_t mark)>;
+
+static size_t pollMongo(const MongoConfig& cfg, mongocxx::client& client, PollState& st, const ApplyFn& apply) {
+    auto coll = client[cfg.database][cfg.collection];
+    int64_t since = st.watermark.load();
 
     auto filter = make_document(
         kvp(cfg.textField, make_document(kvp("$type", "string"))),
-        kvp(cfg.urlField,  make_document(kvp("$type", "string")))
+        kvp(cfg.urlField,  make_document(kvp("$type", "string"))),
+        kvp(cfg.fetchedField, make_document(kvp("$gte", since)))
     );
 
     mongocxx::options::find opts;
     opts.projection(make_document(
         kvp(cfg.urlField, 1),
         kvp(cfg.textField, 1),
+        kvp(cfg.fetchedField, 1),
+        kvp(cfg.sourceField, 1),
         kvp("_id", 0)
     ));
-    if (cfg.limit > 0) opts.limit(cfg.limit);
-
-    int docId = 0;
-    auto cursor = coll.find(filter.view(), opts);
 
-    for (auto&& d : cursor) {
+    std::vector<Document> upserts;
+    int64_t mark = since;
+    std::unordered_set<std::string> atMark;
+    for (auto&& d : coll.find(filter.view(), opts)) {
         auto itUrl = d.find(cfg.urlField);
         auto itTxt = d.find(cfg.textField);
-        if (itUrl == d.end() || itTxt == d.end()) continue;
-        if (itUrl->type() != bsoncxx::type::k_utf8) continue;
-        if (itTxt->type() != bsoncxx::type::k_utf8) continue;
+        auto itTs  = d.find(cfg.fetchedField);
+        if (itUrl == d.end() || itTxt == d.end() || itTs == d.end()) continue;
 
         std::string url = itUrl->get_utf8().value.to_string();
-        std::string text = itTxt->get_utf8().value.to_string();
-        if (text.empty()) continue;
+        int64_t ts = asInt64(*itTs);
+        if (ts == st.markSecond && st.atMark.count(url)) continue;
 
-        urls.push_back(url);
+        if (ts > mark) { mark = ts; atMark.clear(); }
+        if (ts == mark) atMark.insert(url);
+        if (cfg.shards > 1 && shardOf(url, cfg.shards) != cfg.shard) continue;
 
         Document doc;
-        doc.id = docId;
-        doc.key = url;
-        doc.text = text;
+        doc.id = 0;
+        doc.key = std::move(url);
+        doc.text = itTxt->get_utf8().value.to_string();
+        doc.fetchedAt = ts;
+        if (doc.text.empty()) continue;
+        auto itSrc = d.find(cfg.sourceField);
+        if (itSrc != d.end() && itSrc->type() == bsoncxx::type::k_utf8)
+            doc.source = itSrc->get_utf8().value.to_string();
+        upserts.push_back(std::move(doc));
+    }
+    if (upserts.empty()) return 0;
 
-        index.addDocument(doc);
-        docId++;
+    size_t n = apply(std::move(upserts), mark);
 
-        if (docId % 2000 == 0) {
-            std::cerr << "Indexed docs: " << docId << "\r" << std::flush;
-        }
+    // A concurrent full reload rewinds the watermark; don't move it forward past that.
+    if (st.watermark.compare_exchange_strong(since, mark)) {
+        if (st.markSecond != mark) { st.markSecond = mark; st.atMark.clear(); }
+        st.atMark.insert(atMark.begin(), atMark.end());
     }
-
-    std::cerr << "\nFinalize index...\n";
-    index.finalize();
-    return docId;
+    return n;
 }
 
 static void usage(const char* prog) {
     std::cerr
         << "Usage:\n"
-        << "  " << prog << " <mongo_uri> <db> <collection> [limit]\n\n"
+        << "  " << prog << " <mongo_uri> <db> <collection> [limit] [--reload-every SEC]\n"
+        << "      [--incremental SEC] [--wal DIR] [--checkpoint-every SEC]\n"
+        << "      [--snippets] [--time-order] [--dedup SIM] [--shard K/N]\n"
+        << "      [--serve PORT [--serve-bind ADDR]] [--disk-index FILE [--cache-mb N]] [--batch]\n"
+        << "      [--metrics-port PORT] [--metrics-file FILE [--metrics-every SEC]]\n"
+        << "      [--trace FILE [--trace-sample N]]\n"
+        << "      [--readers N] [--batch-size N] [--no-cursor-timeout]\n"
+        << "      [--export-corpus FILE [--compress]]\n"
+        << "  " << prog << " --corpus FILE [limit] [--corpus-threads N] [options above]\n"
+        << "  " << prog << " --coordinator HOST:PORT[,HOST:PORT...] [--shard-timeout MS]\n\n"
         << "Examples:\n"
         << "  " << prog << " mongodb://mongo:27017 crawler pages\n"
-        << "  " << prog << " mongodb://localhost:27017 crawler pages 50000\n";
+        << "  " << prog << " mongodb://localhost:27017 crawler pages 50000\n"
+        << "  " << prog << " mongodb://mongo:27017 crawler pages --reload-every 3600\n\n"
+        << "The index is rebuilt in the background on SIGHUP, on the :reload command\n"
+        << "and every SEC seconds when --reload-every is set.\n"
+        << "--incremental polls the collection every SEC seconds and indexes new or\n"
+        << "changed pages into small in-memory segments.\n"
+        << "--wal logs those updates to DIR and checkpoints the index there every\n"
+        << "--checkpoint-every seconds (default 300); on restart the engine loads the\n"
+        << "checkpoint and replays the log tail instead of rescanning MongoDB.\n"
+        << "--snippets keeps compressed document texts and prints highlighted fragments.\n"
+        << "--time-order reads the collection sorted by fetched_at so doc ids follow\n"
+        << "fetch time; after:/before: then resolve to id ranges and :newest stops early.\n"
+        << "--dedup indexes one page per cluster of near-duplicates (estimated Jaccard\n"
+        << "similarity of term sets >= SIM, e.g. 0.8) and lists the others under it.\n"
+        << "--shard K/N indexes only the URLs hashed to shard K of N; --serve answers\n"
+        << "coordinator queries on PORT instead of reading the console; it listens on\n"
+        << "127.0.0.1 unless --serve-bind gives another IPv4 address (0.0.0.0 for all).\n"
+        << "--coordinator sends every query to all shards in parallel and merges the\n"
+        << "answers; shards slower than --shard-timeout (default 500 ms) are skipped.\n"
+        << "--disk-index serves from FILE, building it from MongoDB first if it does not\n"
+        << "exist; posting lists are read on demand through an N MB block cache (default 64).\n"
+        << "--batch reads queries and :commands from stdin without banner or prompts.\n"
+        << "--metrics-port serves Prometheus metrics on 127.0.0.1:PORT/metrics;\n"
+        << "--metrics-file rewrites FILE with them every --metrics-every seconds (default 10).\n"
+        << "--trace FILE writes a Chrome trace-event timeline of the build and queries at\n"
+        << "exit, keeping 1 of --trace-sample N (default 64) per-document spans; the same as\n"
+        << "ENGINE_TRACE=FILE and ENGINE_TRACE_SAMPLE=N in the environment.\n"
+        << "--readers N fetches the collection over N connections, one _id range at a\n"
+        << "time each, and tokenizes on those threads; doc ids follow _id order whatever N\n"
+        << "is (with --time-order they follow fetched_at, read over one cursor).\n"
+        << "--batch-size sets the cursor batch size; --no-cursor-timeout keeps idle\n"
+        << "cursors open on the server.\n"
+        << "--export-corpus writes the pages the build would index to FILE and exits;\n"
+        << "--compress stores it as zstd blocks. --corpus builds from such a file, or from\n"
+        << "a mongodump .bson, without MongoDB: the file is mapped and --corpus-threads N\n"
+        << "workers (default one per core) tokenize its blocks in parallel.\n";
+}
+
+struct MetricsOptions {
+    int port = -1;
+    std::string file;
+    int every = 10;
+};
+
+// Holds the exporters; declare it after everything its gauges read.
+struct MetricsExport {
+    std::unique_ptr<MetricsServer> server;
+    std::unique_ptr<MetricsDumper> dumper;
+};
+
+static bool startMetrics(const MetricsOptions& o, MetricsExport& x) {
+    if (o.port >= 0) {
+        x.server = std::make_unique<MetricsServer>((uint16_t)o.port);
+        if (!x.server->start()) {
+            std::cerr << "cannot listen on metrics port " << o.port << "\n";
+            return false;
+        }
+        std::cerr << "Metrics on http://127.0.0.1:" << x.server->port() << "/metrics\n";
+    }
+    if (!o.file.empty()) {
+        x.dumper = std::make_unique<MetricsDumper>(o.file, o.every);
+        x.dumper->start();
+    }
+    return true;
+}
+
+// Size gauges, computed over the current segment set at every scrape.
+static void registerIndexMetrics(const SegmentedIndex& segs) {
+    auto& m = Metrics::get();
+    m.gauge("engine_index_docs", "Live documents", [&segs] { return (double)segs.acquire()->liveDocs(); });
+    m.gauge("engine_index_segments", "Index segments", [&segs] { return (double)segs.segmentCount(); });
+    auto sum = [&segs](std::function<size_t(const IndexSnapshot&)> f) {
+        return [&segs, f] {
+            double v = 0;
+            for (const auto& s : segs.acquire()->segs) v += (double)f(*s.seg);
+            return v;
+        };
+    };
+    m.gauge("engine_index_terms", "Distinct terms, summed over segments",
+            sum([](const IndexSnapshot& s) { return s.index.termsCount(); }));
+    m.gauge("engine_index_postings", "Postings, summed over segments",
+            sum([](const IndexSnapshot& s) { return s.index.postingsCount(); }));
+
+    const char* help = "Approximate heap bytes by structure";
+    auto mem = [&](const char* name, size_t IndexMemory::*field) {
+        m.gauge(std::string("engine_memory_bytes{structure=\"") + name + "\"}", help,
+                sum([field](const IndexSnapshot& s) { return s.index.memory().*field; }));
+    };
+    mem("postings", &IndexMemory::postings);
+    mem("table", &IndexMemory::table);
+    mem("bitmaps", &IndexMemory::bitmaps);
+    mem("times", &IndexMemory::times);
+    mem("lexicon", &IndexMemory::lexicon);
+    mem("sample", &IndexMemory::sample);
+    m.gauge("engine_memory_bytes{structure=\"urls\"}", help,
+            sum([](const IndexSnapshot& s) { return s.urls.bytes(); }));
+    m.gauge("engine_memory_bytes{structure=\"docs\"}", help,
+            sum([](const IndexSnapshot& s) { return s.docs.bytes(); }));
+}
+
+static volatile std::sig_atomic_t g_stop = 0;
+static void onStopSignal(int) { g_stop = 1; }
+
+static void printShardResult(const ShardResult& r, const char* what) {
+    std::cout << what << ": " << r.total;
+    if (r.partial()) std::cout << " (partial: " << r.shardsFailed << " of " << (r.shardsOk + r.shardsFailed) << " shards missing)";
+    std::cout << "\n";
+    for (const auto& h : r.hits) std::cout << "  " << h.url << "\n";
+}
+
+static int runCoordinator(const std::string& list, int timeoutMs) {
+    std::vector<ShardCoordinator::Endpoint> eps;
+    if (!ShardCoordinator::parseEndpoints(list, eps)) {
+        std::cerr << "bad shard list: " << list << "\n";
+        return 1;
+    }
+    ShardCoordinator coord(eps, std::chrono::milliseconds(timeoutMs));
+    std::cout << "Coordinator over " << eps.size() << " shards ready.\n";
+
+    std::string q;
+    while (std::cout << "> " && std::getline(std::cin, q)) {
+        auto t0 = std::chrono::steady_clock::now();
+        if (q.rfind(":count ", 0) == 0) printShardResult(coord.count(q.substr(7)), "count");
+        else if (q.rfind(":newest ", 0) == 0) printShardResult(coord.newest(q.substr(8), 20), "hits");
+        else printShardResult(coord.search(q, 20), "hits");
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+        std::cerr << "query: " << ms << " ms\n";
+    }
+    return 0;
+}
+
+// ":suggest <text>": completions of the word being typed, by document frequency.
+template <class Index>
+static void printSuggestions(const Index& idx, const std::string& text) {
+    auto t0 = std::chrono::steady_clock::now();
+    auto prefix = BooleanSearch::completionPrefix(text);
+    auto found = prefix.empty() ? std::vector<TermLexicon::Match>() : idx.suggest(prefix, TermLexicon::kCompletions);
+    double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count();
+    std::string head = text.substr(0, text.find_last_of(" \t(") + 1);
+    if (head.size() > text.size()) head.clear();
+    for (const auto& m : found) std::cout << "  " << head << m.term << "  (" << m.df << ")\n";
+    std::cout << "suggest: " << found.size() << " (" << us << " us)\n";
+}
+
+// ":stats [FILE]": summary of the current segments, JSON to FILE.
+static void printStats(const SegmentSet& set, const std::string& path) {
+    auto t0 = std::chrono::steady_clock::now();
+    std::vector<const BooleanIndex*> indexes;
+    size_t urlBytes = 0, docBytes = 0;
+    for (const auto& s : set.segs) {
+        indexes.push_back(&s.seg->index);
+        urlBytes += s.seg->urls.bytes();
+        docBytes += s.seg->docs.bytes();
+    }
+    IndexStats st = computeIndexStats(indexes);
+    st.urlBytes = urlBytes;
+    st.docBytes = docBytes;
+    double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    std::cout << st.text() << "(" << sec << " s)\n";
+    if (path.empty()) return;
+    std::ofstream out(path);
+    out << st.json() << "\n";
+    std::cout << (out.flush() ? "written to " : "cannot write ") << path << "\n";
+}
+
+// "EXPLAIN [JSON] <query>" / "PROFILE [JSON] <query>": the plan on every
+// segment, without or with running it; false if q is neither command.
+static bool printProfile(const SegmentSet& set, const std::string& q) {
+    bool run = q.rfind("PROFILE ", 0) == 0;
+    if (!run && q.rfind("EXPLAIN ", 0) != 0) return false;
+    std::string query = q.substr(8);
+    bool json = query.rfind("JSON ", 0) == 0;
+    if (json) query = query.substr(5);
+    auto profiles = set.profile(query, run);
+    if (json) {
+        std::cout << "[";
+        for (size_t i = 0; i < profiles.size(); i++) std::cout << (i ? "," : "") << profiles[i].json();
+        std::cout << "]\n";
+        return true;
+    }
+    for (size_t i = 0; i < profiles.size(); i++) {
+        if (profiles.size() > 1) std::cout << "segment " << i << ":\n";
+        std::cout << profiles[i].text();
+    }
+    return true;
+}
+
+static int runDiskIndex(const MongoConfig& cfg, const std::string& path, size_t cacheMb, bool batch) {
+    if (!std::ifstream(path)) {
+        BooleanIndex index;
+        std::vector<std::string> urls;
+        int n = loadAndIndex(cfg, index, urls);
+        if (!DiskIndex::write(index, UrlStore(urls), path)) {
+            std::cerr << "cannot write " << path << "\n";
+            return 1;
+        }
+        std::cerr << "Disk index: " << n << " docs written to " << path << "\n";
+    }
+
+    BlockCache cache(cacheMb << 20);
+    DiskIndex disk;
+    if (!disk.open(path, &cache)) {
+        std::cerr << "cannot open disk index " << path << "\n";
+        return 1;
+    }
+    if (!batch) {
+        std::cout << "Disk index ready: " << disk.docsCount() << " docs, " << disk.termsCount()
+                  << " terms, " << (cache.capacityBytes() >> 20) << " MB block cache.\n";
+        std::cout << ":count <query> reports the number of matches only. Ctrl+D to exit.\n";
+    }
+
+    std::string q;
+    while ((batch || std::cout << "> ") && std::getline(std::cin, q)) {
+        if (q.rfind(":suggest ", 0) == 0) {
+            printSuggestions(disk, q.substr(9));
+            continue;
+        }
+        DiskQueryStats st;
+        auto t0 = std::chrono::steady_clock::now();
+        bool isCount = q.rfind(":count ", 0) == 0;
+        std::vector<int> hits;
+        size_t n = 0;
+        if (!(isCount ? disk.count(q.substr(7), n, &st) : disk.search(q, hits, &st))) {
+            std::cout << "error: cannot read posting lists from " << path << "\n";
+        } else if (isCount) {
+            std::cout << "count: " << n << "\n";
+        } else {
+            std::cout << "hits: " << hits.size() << "\n";
+            size_t k = hits.size() < 20 ? hits.size() : 20;
+            for (size_t i = 0; i < k; i++) std::cout << "  " << disk.url(hits[i]) << "\n";
+            if (hits.size() > k) std::cout << "  ... (" << (hits.size() - k) << " more)\n";
+        }
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+        std::cerr << "query: " << ms << " ms, cache hit rate " << (100.0 * st.hitRate())
+                  << "%, I/O wait " << st.ioWaitMs << " ms\n";
+    }
+    return 0;
 }
 
 int main(int argc, char** argv) {
-    if (argc < 4) {
+    if (argc >= 3 && std::string(argv[1]) == "--coordinator") {
+        int timeoutMs = 500;
+        for (int i = 3; i + 1 < argc; i += 2) {
+            if (std::string(argv[i]) == "--shard-timeout") timeoutMs = std::stoi(argv[i + 1]);
+        }
+        return runCoordinator(argv[2], timeoutMs);
+    }
+    MongoConfig cfg;
+    int first = 4;
+    if (argc >= 3 && std::string(argv[1]) == "--corpus") {
+        cfg.corpus = argv[2];
+        first = 3;
+    } else if (argc >= 4) {
+        cfg.uri = argv[1];
+        cfg.database = argv[2];
+        cfg.collection = argv[3];
+    } else {
         usage(argv[0]);
         return 1;
     }
+    int reloadEvery = 0;
+    int pollEvery = 0;
+    int checkpointEvery = 300;
+    std::string walDir;
+    bool snippets = false;
+    int servePort = -1;
+    std::string serveHost = "127.0.0.1";
+    std::string diskPath;
+    size_t cacheMb = 64;
+    bool batch = false;
+    MetricsOptions metrics;
+    std::string tracePath;
+    uint32_t traceSample = 64;
+    std::string exportPath;
+    bool compress = false;
+    for (int i = first; i < argc; i++) {
+        std::string a = argv[i];
+        if (a == "--reload-every" && i + 1 < argc) reloadEvery = std::stoi(argv[++i]);
+        else if (a == "--incremental" && i + 1 < argc) pollEvery = std::stoi(argv[++i]);
+        else if (a == "--wal" && i + 1 < argc) walDir = argv[++i];
+        else if (a == "--checkpoint-every" && i + 1 < argc) checkpointEvery = std::stoi(argv[++i]);
+        else if (a == "--snippets") snippets = true;
+        else if (a == "--time-order") cfg.timeOrder = true;
+        else if (a == "--shard" && i + 1 < argc) {
+            std::string v = argv[++i];
+            size_t slash = v.find('/');
+            if (slash == std::string::npos) { usage(argv[0]); return 1; }
+            cfg.shard = (uint32_t)std::stoul(v.substr(0, slash));
+            cfg.shards = (uint32_t)std::stoul(v.substr(slash + 1));
+            if (cfg.shards == 0 || cfg.shard >= cfg.shards) { usage(argv[0]); return 1; }
+        }
+        else if (a == "--serve" && i + 1 < argc) servePort = std::stoi(argv[++i]);
+        else if (a == "--serve-bind" && i + 1 < argc) serveHost = argv[++i];
+        else if (a == "--dedup" && i + 1 < argc) cfg.dedupSimilarity = std::stod(argv[++i]);
+        else if (a == "--disk-index" && i + 1 < argc) diskPath = argv[++i];
+        else if (a == "--cache-mb" && i + 1 < argc) cacheMb = std::stoul(argv[++i]);
+        else if (a == "--batch") batch = true;
+        else if (a == "--metrics-port" && i + 1 < argc) metrics.port = std::stoi(argv[++i]);
+        else if (a == "--metrics-file" && i + 1 < argc) metrics.file = argv[++i];
+        else if (a == "--metrics-every" && i + 1 < argc) metrics.every = std::stoi(argv[++i]);
+        else if (a == "--trace" && i + 1 < argc) tracePath = argv[++i];
+        else if (a == "--trace-sample" && i + 1 < argc) traceSample = (uint32_t)std::stoul(argv[++i]);
+        else if (a == "--export-corpus" && i + 1 < argc) exportPath = argv[++i];
+        else if (a == "--compress") compress = true;
+        else if (a == "--readers" && i + 1 < argc) cfg.readers = std::max(1, std::stoi(argv[++i]));
+        else if (a == "--batch-size" && i + 1 < argc) cfg.batchSize = std::stoi(argv[++i]);
+        else if (a == "--no-cursor-timeout") cfg.noCursorTimeout = true;
+        else if (a == "--corpus-threads" && i + 1 < argc) cfg.corpusThreads = (unsigned)std::stoul(argv[++i]);
+        else if (a.rfind("--", 0) != 0) cfg.limit = std::stoll(a);
+        else { usage(argv[0]); return 1; }
+    }
 
-    MongoConfig cfg;
-    cfg.uri = argv[1];
-    cfg.database = argv[2];
-    cfg.collection = argv[3];
-    if (argc >= 5) cfg.limit = std::stoll(argv[4]);
+    if (!tracePath.empty()) Tracer::start(tracePath, traceSample);
+    else Tracer::startFromEnv();
 
-    BooleanIndex index;
-    std::vector<std::string> urls;
-    urls.reserve(cfg.limit > 0 ? (size_t)cfg.limit : 50000);
+    if (!exportPath.empty()) {
+        if (!cfg.corpus.empty()) { usage(argv[0]); return 1; }
+        return exportCorpus(cfg, exportPath, compress);
+    }
+    if (!cfg.corpus.empty() && (pollEvery > 0 || cfg.timeOrder)) {
+        std::cerr << "--incremental and --time-order read MongoDB; export the corpus with --time-order instead\n";
+        return 1;
+    }
 
-    auto t0 = std::chrono::steady_clock::now();
-    int n = loadAndIndexMongo(cfg, index, urls);
-    auto t1 = std::chrono::steady_clock::now();
+    if (!diskPath.empty()) {
+        MetricsExport exporter;
+        if (!startMetrics(metrics, exporter)) return 1;
+        return runDiskIndex(cfg, diskPath, cacheMb, batch);
+    }
 
-    double sec = std::chrono::duration<double>(t1 - t0).count();
-    std::cerr << "Indexed: " << n << " docs\n";
-    std::cerr << "Index build time: " << sec << " sec\n";
-    if (sec > 0) std::cerr << "Speed: " << (n / sec) << " docs/sec\n";
+    PollState poll;
+    std::atomic<int64_t> buildStart{0};
+    // Text hashes of the last build, handed to segs by publish (both run under
+    // the reloader's build lock), so polling can tell unchanged pages.
+    std::vector<uint64_t> buildHashes;
 
-    BooleanSearch search(index);
+    auto build = [cfg, snippets, pollEvery, &buildStart, &buildHashes](IndexSnapshot& snap) {
+        buildStart = std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count() - 5;
+        std::vector<std::string> urls;
+        urls.reserve(cfg.limit > 0 ? (size_t)cfg.limit : 50000);
+
+        auto t0 = std::chrono::steady_clock::now();
+        buildHashes.clear();
+        int n = loadAndIndex(cfg, snap.index, urls, snippets ? &snap.docs : nullptr, &snap.dups,
+                             pollEvery > 0 ? &buildHashes : nullptr);
+        snap.urls = UrlStore(urls);
+        auto t1 = std::chrono::steady_clock::now();
+
+        double sec = std::chrono::duration<double>(t1 - t0).count();
+        static Gauge& lastDocs = Metrics::get().gauge("engine_last_build_docs", "Documents in the last full build");
+        static Gauge& lastSec = Metrics::get().gauge("engine_last_build_seconds", "Duration of the last full build");
+        lastDocs.set(n);
+        lastSec.set(sec);
+        std::cerr << "Indexed: " << n << " docs\n";
+        std::cerr << "URL store: " << snap.urls.bytes() << " bytes\n";
+        if (snippets) {
+            std::cerr << "Doc store: " << snap.docs.bytes() << " of " << snap.docs.rawBytes() << " raw bytes\n";
+        }
+        std::cerr << "Index build time: " << sec << " sec\n";
+        if (sec > 0) std::cerr << "Speed: " << (n / sec) << " docs/sec\n";
+        return true;
+    };
+
+    SegmentedIndex segs;
+    segs.setStoreDocs(snippets);
+    registerIndexMetrics(segs);
+    MetricsExport exporter;
+    if (!startMetrics(metrics, exporter)) return 1;
+    std::unique_ptr<WriteAheadLog> wal;
+    std::mutex ingestMu;
+    int64_t appliedMark = 0;
+    std::mutex checkpointMu;
+    uint64_t checkpointSeq = 0, checkpointWritten = 0;
+
+    // seq is taken under ingestMu, so a slow writer can't overwrite a newer state.
+    auto checkpoint = [&](std::shared_ptr<const SegmentSet> set, uint64_t lsn, int64_t mark, uint64_t seq) {
+        std::lock_guard<std::mutex> lk(checkpointMu);
+        if (seq <= checkpointWritten) return;
+        checkpointWritten = seq;
+        auto t0 = std::chrono::steady_clock::now();
+        if (!writeCheckpoint(walDir, *set, lsn, mark)) {
+            std::cerr << "[wal] checkpoint failed\n";
+            return;
+        }
+        wal->truncate(lsn);
+        double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        std::cerr << "[wal] checkpoint at lsn " << lsn << " in " << sec << " sec\n";
+    };
 
-    std::cout << "Boolean search ready.\n";
-    std::cout << "Syntax: AND OR NOT, parentheses. Implicit AND between terms.\n";
-    std::cout << "Examples:\n";
-    std::cout << "  нефть AND газ\n";
-    std::cout << "  (нефть OR газ) AND NOT европа\n";
-    std::cout << "Ctrl+D to exit.\n";
+    auto publish = [&](std::shared_ptr<const IndexSnapshot> base) {
+        std::unique_lock<std::mutex> lk(ingestMu);
+        segs.reset(std::move(base), std::move(buildHashes));
+        buildHashes.clear();
+        poll.watermark = appliedMark = buildStart.load();
+        if (!wal) return;
+        auto set = segs.acquire();
+        uint64_t lsn = wal->lastLsn();
+        uint64_t seq = ++checkpointSeq;
+        lk.unlock();
+        checkpoint(set, lsn, buildStart.load(), seq);
+    };
+
+    auto apply = [&](std::vector<Document> upserts, int64_t mark) {
+        static Counter& unchanged = Metrics::get().counter("engine_poll_unchanged_total",
+                                                           "Re-fetched pages skipped as their text did not change");
+        std::lock_guard<std::mutex> lk(ingestMu);
+        unchanged.add(segs.dropUnchanged(upserts));
+        size_t n = upserts.size();
+        if (n && wal) logAndApply(*wal, segs, std::move(upserts), {}, mark);
+        else if (n) segs.apply(std::move(upserts));
+        appliedMark = mark;
+        return n;
+    };
+
+    bool recovered = false;
+    if (!walDir.empty()) {
+        auto t0 = std::chrono::steady_clock::now();
+        wal = std::make_unique<WriteAheadLog>(walDir);
+        auto rec = recoverIndex(walDir, *wal, segs);
+        double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        if (rec.fromCheckpoint) {
+            recovered = true;
+            poll.watermark = appliedMark = rec.mark;
+            std::cerr << "[wal] recovered to lsn " << rec.lsn << " (" << rec.replayed
+                      << " log records) in " << sec << " sec\n";
+        }
+    }
+
+    IndexReloader reloader(publish, build, reloadEvery);
+    if (!recovered && !reloader.rebuildNow("startup")) return 1;
+    IndexReloader::installSignal(SIGHUP);
+    reloader.start();
+
+    std::atomic<bool> stopPoll{false};
+    std::thread poller;
+    if (pollEvery > 0) {
+        segs.startMerger();
+        poller = std::thread([&] {
+            mongocxx::client client{ mongocxx::uri{cfg.uri} };
+            auto lastCheckpoint = std::chrono::steady_clock::now();
+            while (!stopPoll) {
+                for (int i = 0; i < pollEvery * 10 && !stopPoll; i++)
+                    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                try {
+                    size_t n = pollMongo(cfg, client, poll, apply);
+                    if (n) std::cerr << "[segments] +" << n << " docs, " << segs.segmentCount() << " segments\n";
+                } catch (const std::exception& e) {
+                    std::cerr << "[segments] poll failed: " << e.what() << "\n";
+                }
+
+                auto now = std::chrono::steady_clock::now();
+                if (wal && now - lastCheckpoint >= std::chrono::seconds(checkpointEvery)) {
+                    std::unique_lock<std::mutex> lk(ingestMu);
+                    auto set = segs.acquire();
+                    uint64_t lsn = wal->lastLsn();
+                    int64_t mark = appliedMark;
+                    uint64_t seq = ++checkpointSeq;
+                    lk.unlock();
+                    checkpoint(set, lsn, mark, seq);
+                    lastCheckpoint = now;
+                }
+            }
+        });
+    }
+
+    if (servePort >= 0) {
+        ShardServer server((uint16_t)servePort, [&segs] { return segs.acquire(); }, serveHost);
+        if (!server.start()) {
+            std::cerr << "cannot listen on " << serveHost << ":" << servePort << "\n";
+            stopPoll = true;
+            if (poller.joinable()) poller.join();
+            return 1;
+        }
+        std::cerr << "Shard " << cfg.shard << "/" << cfg.shards << " serving on port " << server.port() << "\n";
+        std::signal(SIGINT, onStopSignal);
+        std::signal(SIGTERM, onStopSignal);
+        while (!g_stop) std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        server.stop();
+        stopPoll = true;
+        if (poller.joinable()) poller.join();
+        return 0;
+    }
+
+    if (!batch) {
+        std::cout << "Boolean search ready.\n";
+        std::cout << "Syntax: AND OR NOT, parentheses. Implicit AND between terms.\n";
+        std::cout << "Examples:\n";
+        std::cout << "  нефть AND газ\n";
+        std::cout << "  (нефть OR газ) AND NOT европа\n";
+        std::cout << ":count <query> / :estimate <query> report the number of matches only.\n";
+        std::cout << ":newest <query> lists the 20 most recently fetched matches.\n";
+        std::cout << "Filters: source:X host:X section:X after:YYYY-MM-DD before:YYYY-MM-DD\n";
+        std::cout << "Typos: нефьт~1, гозпром~2 match terms within 1 or 2 edits.\n";
+        std::cout << "Patterns: *газ* (infix), /нефт.*/ (regex over stems).\n";
+        std::cout << ":suggest <text> completes the last word.\n";
+        std::cout << "EXPLAIN <query> / PROFILE <query> show the plan (PROFILE also runs it);\n";
+        std::cout << "  EXPLAIN JSON / PROFILE JSON print it as JSON.\n";
+        std::cout << ":stats [FILE] summarizes terms, postings, hash table and memory (JSON to FILE).\n";
+        std::cout << ":reload rebuilds the index in the background.\n";
+        std::cout << "Ctrl+D to exit.\n";
+    }
 
     std::string q;
-    while (std::cout << "> " && std::getline(std::cin, q)) {
-        auto hits = search.search(q);
+    while ((batch || std::cout << "> ") && std::getline(std::cin, q)) {
+        if (q == ":reload") {
+            if (reloader.busy()) std::cout << "reload already in progress\n";
+            else { reloader.request(); std::cout << "reload scheduled\n"; }
+            continue;
+        }
+        if (q.rfind(":count ", 0) == 0) {
+            auto t0 = std::chrono::steady_clock::now();
+            size_t n = segs.acquire()->count(q.substr(7));
+            double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count();
+            std::cout << "count: " << n << " (" << us << " us)\n";
+            continue;
+        }
+        if (q.rfind(":suggest ", 0) == 0) {
+            printSuggestions(*segs.acquire(), q.substr(9));
+            continue;
+        }
+        if (q == ":stats" || q.rfind(":stats ", 0) == 0) {
+            printStats(*segs.acquire(), q.size() > 7 ? q.substr(7) : std::string());
+            continue;
+        }
+        if (printProfile(*segs.acquire(), q)) continue;
+        if (q.rfind(":estimate ", 0) == 0) {
+            auto t0 = std::chrono::steady_clock::now();
+            auto e = segs.acquire()->estimate(q.substr(10));
+            double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count();
+            std::cout << "estimate: " << (size_t)e.value;
+            if (!e.exact) std::cout << " [" << (size_t)e.lo << ", " << (size_t)e.hi << "]";
+            std::cout << " (" << us << " us)\n";
+            continue;
+        }
+
+        auto snap = segs.acquire();
+        if (q.rfind(":newest ", 0) == 0) {
+            auto t0 = std::chrono::steady_clock::now();
+            auto hits = snap->searchNewest(q.substr(8), 20);
+            double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count();
+            for (int id : hits) {
+                std::time_t t = (std::time_t)snap->fetchedAt(id);
+                char when[32] = "-";
+                if (t >= 0) std::strftime(when, sizeof(when), "%Y-%m-%d %H:%M", std::gmtime(&t));
+                std::cout << "  " << when << "  " << snap->url(id) << "\n";
+            }
+            std::cout << "newest: " << hits.size() << " (" << us << " us)\n";
+            continue;
+        }
+        auto hits = snap->search(q);
         std::cout << "hits: " << hits.size() << "\n";
 
+        static Counter& snippetNs = Metrics::get().counter("engine_snippet_seconds_total",
+                                                           "Time spent building result snippets", 1e-9);
+        SnippetGenerator snip(BooleanSearch::queryTerms(q), "\033[1m", "\033[0m");
         size_t k = hits.size() < 20 ? hits.size() : 20;
         for (size_t i = 0; i < k; i++) {
-            int id = hits[i];
-            if (id >= 0 && (size_t)id < urls.size()) {
-                std::cout << "  " << urls[id] << "\n";
+            auto url = snap->url(hits[i]);
+            if (!url.empty()) std::cout << "  " << url << "\n";
+            if (auto d = snap->duplicates(hits[i])) std::cout << "    (+" << d->size() << " near-duplicates)\n";
+            if (!snippets) continue;
+            std::string line;
+            {
+                ScopedTimer timer(snippetNs);
+                TraceSpan span("snippet", "query");
+                auto text = snap->text(hits[i]);
+                if (!text.empty()) line = snip.make(text);
             }
+            if (!line.empty()) std::cout << "    " << line << "\n";
         }
         if (hits.size() > k) {
             std::cout << "  ... (" << (hits.size() - k) << " more)\n";
         }
     }
 
+    stopPoll = true;
+    if (poller.joinable()) poller.join();
     return 0;
-}
\ No newline at end of file
+}
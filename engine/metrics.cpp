@@ -0,0 +1,266 @@
+#include "metrics.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+
+size_t metricShard() {
+    static std::atomic<size_t> next{0};
+    thread_local size_t shard = next.fetch_add(1, std::memory_order_relaxed) % kMetricShards;
+    return shard;
+}
+
+uint64_t Counter::value() const {
+    uint64_t n = 0;
+    for (const auto& c : cells_) n += c.v.load(std::memory_order_relaxed);
+    return n;
+}
+
+Histogram::Histogram(std::vector<double> bounds) : bounds_(std::move(bounds)), shards_(new Shard[kMetricShards]) {
+    std::sort(bounds_.begin(), bounds_.end());
+    for (size_t s = 0; s < kMetricShards; s++) {
+        shards_[s].counts.reset(new std::atomic<uint64_t>[bounds_.size() + 1]);
+        for (size_t b = 0; b <= bounds_.size(); b++) shards_[s].counts[b].store(0, std::memory_order_relaxed);
+    }
+}
+
+void Histogram::observe(double v) {
+    size_t b = (size_t)(std::lower_bound(bounds_.begin(), bounds_.end(), v) - bounds_.begin());
+    Shard& s = shards_[metricShard()];
+    s.counts[b].fetch_add(1, std::memory_order_relaxed);
+    double cur = s.sum.load(std::memory_order_relaxed);
+    while (!s.sum.compare_exchange_weak(cur, cur + v, std::memory_order_relaxed)) {}
+}
+
+std::vector<uint64_t> Histogram::counts(double* sum) const {
+    std::vector<uint64_t> out(bounds_.size() + 1, 0);
+    double total = 0;
+    for (size_t s = 0; s < kMetricShards; s++) {
+        for (size_t b = 0; b < out.size(); b++) out[b] += shards_[s].counts[b].load(std::memory_order_relaxed);
+        total += shards_[s].sum.load(std::memory_order_relaxed);
+    }
+    if (sum) *sum = total;
+    return out;
+}
+
+std::vector<double> Histogram::exponential(double start, double factor, size_t n) {
+    std::vector<double> out;
+    for (double v = start; out.size() < n; v *= factor) out.push_back(v);
+    return out;
+}
+
+const std::vector<double>& latencyBuckets() {
+    static const std::vector<double> b = Histogram::exponential(50e-6, 2, 19);
+    return b;
+}
+
+// ---------------------------------------------------------------- registry
+
+Metrics& Metrics::get() {
+    static Metrics m;
+    return m;
+}
+
+Metrics::Entry& Metrics::entry(const std::string& name, const std::string& help, Kind kind) {
+    for (auto& e : entries_)
+        if (e->name == name && e->kind == kind) return *e;
+    entries_.push_back(std::make_unique<Entry>());
+    Entry& e = *entries_.back();
+    e.name = name;
+    e.help = help;
+    e.kind = kind;
+    return e;
+}
+
+Counter& Metrics::counter(const std::string& name, const std::string& help, double scale) {
+    std::lock_guard<std::mutex> lk(mu_);
+    Entry& e = entry(name, help, Kind::COUNTER);
+    if (!e.counter) { e.counter = std::make_unique<Counter>(); e.scale = scale; }
+    return *e.counter;
+}
+
+Gauge& Metrics::gauge(const std::string& name, const std::string& help) {
+    std::lock_guard<std::mutex> lk(mu_);
+    Entry& e = entry(name, help, Kind::GAUGE);
+    if (!e.gauge) e.gauge = std::make_unique<Gauge>();
+    return *e.gauge;
+}
+
+Gauge& Metrics::gauge(const std::string& name, const std::string& help, std::function<double()> fn) {
+    std::lock_guard<std::mutex> lk(mu_);
+    Entry& e = entry(name, help, Kind::GAUGE);
+    if (!e.gauge) e.gauge = std::make_unique<Gauge>();
+    e.gauge->fn_ = std::move(fn);
+    return *e.gauge;
+}
+
+Histogram& Metrics::histogram(const std::string& name, const std::string& help, const std::vector<double>& bounds) {
+    std::lock_guard<std::mutex> lk(mu_);
+    Entry& e = entry(name, help, Kind::HISTOGRAM);
+    if (!e.histogram) e.histogram = std::make_unique<Histogram>(bounds);
+    return *e.histogram;
+}
+
+static std::string num(double v) {
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%.9g", v);
+    return buf;
+}
+
+// name{a="1"} + le="0.5" -> name_bucket{a="1",le="0.5"}
+static std::string withSuffix(const std::string& name, const char* suffix, const std::string& label = {}) {
+    size_t brace = name.find('{');
+    std::string base = name.substr(0, brace) + suffix;
+    std::string labels = brace == std::string::npos ? std::string() : name.substr(brace + 1, name.size() - brace - 2);
+    if (!label.empty()) labels += (labels.empty() ? "" : ",") + label;
+    return labels.empty() ? base : base + "{" + labels + "}";
+}
+
+std::string Metrics::render() const {
+    // Gauge callbacks may walk a whole index, so they run on copies taken
+    // under the lock once it is released; entries are never removed.
+    struct Sample { const Entry* e; std::function<double()> fn; };
+    // Samples of one family (same name before the labels) must be contiguous.
+    std::map<std::string, std::vector<Sample>> families;
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        for (const auto& e : entries_)
+            families[e->name.substr(0, e->name.find('{'))].push_back({e.get(), e->gauge ? e->gauge->fn_ : nullptr});
+    }
+
+    static const char* kType[] = {"counter", "gauge", "histogram"};
+    std::string out;
+    for (const auto& f : families) {
+        const Entry& first = *f.second.front().e;
+        out += "# HELP " + f.first + " " + first.help + "\n";
+        out += "# TYPE " + f.first + " " + kType[(int)first.kind] + "\n";
+        for (const Sample& s : f.second) {
+            const Entry* e = s.e;
+            if (e->kind == Kind::COUNTER) {
+                out += e->name + " " + num((double)e->counter->value() * e->scale) + "\n";
+            } else if (e->kind == Kind::GAUGE) {
+                out += e->name + " " + num(s.fn ? s.fn() : e->gauge->v_.load(std::memory_order_relaxed)) + "\n";
+            } else {
+                double sum = 0;
+                auto counts = e->histogram->counts(&sum);
+                const auto& bounds = e->histogram->bounds();
+                uint64_t cum = 0;
+                for (size_t b = 0; b < counts.size(); b++) {
+                    cum += counts[b];
+                    std::string le = b < bounds.size() ? num(bounds[b]) : "+Inf";
+                    out += withSuffix(e->name, "_bucket", "le=\"" + le + "\"") + " " + std::to_string(cum) + "\n";
+                }
+                out += withSuffix(e->name, "_sum") + " " + num(sum) + "\n";
+                out += withSuffix(e->name, "_count") + " " + std::to_string(cum) + "\n";
+            }
+        }
+    }
+    return out;
+}
+
+static std::string kindLabel(const std::string& name, const std::string& kind) {
+    return name + "{kind=\"" + kind + "\"}";
+}
+
+QueryMetrics::QueryMetrics(const std::string& kind)
+    : total_(Metrics::get().counter(kindLabel("engine_queries_total", kind), "Queries answered")),
+      seconds_(Metrics::get().histogram(kindLabel("engine_query_seconds", kind), "Query latency", latencyBuckets())),
+      hits_(Metrics::get().histogram(kindLabel("engine_query_hits", kind), "Matches per query",
+                                     Histogram::exponential(1, 10, 8))) {}
+
+// ---------------------------------------------------------------- exposure
+
+bool MetricsServer::start() {
+    listenFd_ = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (listenFd_ < 0) return false;
+    int one = 1;
+    ::setsockopt(listenFd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port_);
+    socklen_t len = sizeof(addr);
+    if (::bind(listenFd_, (sockaddr*)&addr, sizeof(addr)) != 0 || ::listen(listenFd_, 16) != 0 ||
+        ::getsockname(listenFd_, (sockaddr*)&addr, &len) != 0) {
+        ::close(listenFd_);
+        listenFd_ = -1;
+        return false;
+    }
+    port_ = ntohs(addr.sin_port);
+    thread_ = std::thread([this] { loop(); });
+    return true;
+}
+
+void MetricsServer::stop() {
+    if (listenFd_ < 0) return;
+    stop_ = true;
+    ::shutdown(listenFd_, SHUT_RDWR);
+    if (thread_.joinable()) thread_.join();
+    ::close(listenFd_);
+    listenFd_ = -1;
+}
+
+// Scrapes are rare and small: one connection at a time, request ignored.
+void MetricsServer::loop() {
+    while (!stop_) {
+        int fd = ::accept(listenFd_, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            break;
+        }
+        char buf[2048];
+        std::string req;
+        pollfd p{fd, POLLIN, 0};
+        while (req.find("\r\n\r\n") == std::string::npos && ::poll(&p, 1, 1000) > 0) {
+            ssize_t n = ::recv(fd, buf, sizeof(buf), 0);
+            if (n <= 0) break;
+            req.append(buf, (size_t)n);
+        }
+        std::string body = Metrics::get().render();
+        std::string resp = "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " +
+                           std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+        for (size_t off = 0; off < resp.size();) {
+            ssize_t n = ::send(fd, resp.data() + off, resp.size() - off, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            off += (size_t)n;
+        }
+        ::close(fd);
+    }
+}
+
+bool MetricsDumper::dump() const {
+    std::string tmp = path_ + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::trunc);
+        out << Metrics::get().render();
+        if (!out.flush()) return false;
+    }
+    return std::rename(tmp.c_str(), path_.c_str()) == 0;
+}
+
+void MetricsDumper::start() {
+    thread_ = std::thread([this] {
+        std::unique_lock<std::mutex> lk(mu_);
+        for (bool last = false; !last;) {
+            last = cv_.wait_for(lk, std::chrono::seconds(std::max(1, periodSec_)), [this] { return stop_; });
+            dump();
+        }
+    });
+}
+
+void MetricsDumper::stop() {
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        if (stop_) return;
+        stop_ = true;
+    }
+    cv_.notify_all();
+    if (thread_.joinable()) thread_.join();
+}
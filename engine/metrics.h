@@ -0,0 +1,165 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
+#include <functional>
+#include <cstdint>
+
+// Process-wide metrics in the Prometheus text format. Counters and histograms
+// are sharded per thread, so an update is one relaxed add on a cache line the
+// thread rarely shares; rendering sums the shards. Metrics live until exit,
+// so call sites keep a reference:
+//   static Counter& docs = Metrics::get().counter("engine_docs_indexed_total", "...");
+// A name may carry labels: engine_queries_total{kind="search"}.
+
+constexpr size_t kMetricShards = 16;
+size_t metricShard();
+
+class Counter {
+public:
+    void add(uint64_t n = 1) { cells_[metricShard()].v.fetch_add(n, std::memory_order_relaxed); }
+    uint64_t value() const;
+
+private:
+    struct alignas(64) Cell { std::atomic<uint64_t> v{0}; };
+    Cell cells_[kMetricShards];
+};
+
+// Set directly, or computed by a callback when rendered.
+class Gauge {
+public:
+    void set(double v) { v_.store(v, std::memory_order_relaxed); }
+    double value() const { return fn_ ? fn_() : v_.load(std::memory_order_relaxed); }
+
+private:
+    friend class Metrics;
+    std::atomic<double> v_{0};
+    std::function<double()> fn_;
+};
+
+// Fixed upper bounds; values above the last one land in +Inf.
+class Histogram {
+public:
+    explicit Histogram(std::vector<double> bounds);
+    void observe(double v);
+
+    const std::vector<double>& bounds() const { return bounds_; }
+    // Per-bucket (not cumulative) counts, the +Inf bucket last.
+    std::vector<uint64_t> counts(double* sum) const;
+
+    static std::vector<double> exponential(double start, double factor, size_t n);
+
+private:
+    struct alignas(64) Shard {
+        std::unique_ptr<std::atomic<uint64_t>[]> counts;
+        std::atomic<double> sum{0};
+    };
+    std::vector<double> bounds_;
+    std::unique_ptr<Shard[]> shards_;
+};
+
+class Metrics {
+public:
+    static Metrics& get();
+
+    // Registering a name again returns the existing metric. For counters,
+    // scale converts the stored integer on output (1e-9 for nanoseconds).
+    Counter& counter(const std::string& name, const std::string& help, double scale = 1);
+    Gauge& gauge(const std::string& name, const std::string& help);
+    // Replaces the callback of an existing gauge of that name.
+    Gauge& gauge(const std::string& name, const std::string& help, std::function<double()> fn);
+    Histogram& histogram(const std::string& name, const std::string& help, const std::vector<double>& bounds);
+
+    std::string render() const;
+
+private:
+    enum class Kind { COUNTER, GAUGE, HISTOGRAM };
+    struct Entry {
+        std::string name, help;
+        Kind kind;
+        double scale = 1;
+        std::unique_ptr<Counter> counter;
+        std::unique_ptr<Gauge> gauge;
+        std::unique_ptr<Histogram> histogram;
+    };
+    mutable std::mutex mu_;
+    std::vector<std::unique_ptr<Entry>> entries_;
+
+    Entry& entry(const std::string& name, const std::string& help, Kind kind);
+};
+
+// Latency buckets in seconds, 50 us to ~13 s.
+const std::vector<double>& latencyBuckets();
+
+// Adds the nanoseconds elapsed in its scope to a counter.
+class ScopedTimer {
+public:
+    explicit ScopedTimer(Counter& c) : c_(c), t0_(std::chrono::steady_clock::now()) {}
+    ~ScopedTimer() {
+        c_.add((uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t0_).count());
+    }
+
+private:
+    Counter& c_;
+    std::chrono::steady_clock::time_point t0_;
+};
+
+// Count, latency and result size of one kind of query, labelled kind="...".
+class QueryMetrics {
+public:
+    explicit QueryMetrics(const std::string& kind);
+    void record(std::chrono::steady_clock::time_point start, size_t hits) {
+        total_.add();
+        seconds_.observe(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+        hits_.observe((double)hits);
+    }
+
+private:
+    Counter& total_;
+    Histogram& seconds_;
+    Histogram& hits_;
+};
+
+// Answers every HTTP request on 127.0.0.1:port with Metrics::get().render().
+class MetricsServer {
+public:
+    explicit MetricsServer(uint16_t port) : port_(port) {}
+    ~MetricsServer() { stop(); }
+
+    bool start();
+    void stop();
+    uint16_t port() const { return port_; }
+
+private:
+    uint16_t port_;
+    int listenFd_ = -1;
+    std::atomic<bool> stop_{false};
+    std::thread thread_;
+
+    void loop();
+};
+
+// Rewrites path (write to path.tmp, then rename) every periodSec seconds and
+// once more on stop.
+class MetricsDumper {
+public:
+    MetricsDumper(std::string path, int periodSec) : path_(std::move(path)), periodSec_(periodSec) {}
+    ~MetricsDumper() { stop(); }
+
+    void start();
+    void stop();
+    bool dump() const;
+
+private:
+    std::string path_;
+    int periodSec_;
+    std::mutex mu_;
+    std::condition_variable cv_;
+    bool stop_ = false;
+    std::thread thread_;
+};
@@ -0,0 +1,149 @@
+#include "perf_counters.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+const char* PerfSample::name(int k) {
+    static const char* kNames[] = {"cycles", "instructions", "llc_misses", "branch_misses"};
+    return kNames[k];
+}
+
+PerfSample PerfSample::operator-(const PerfSample& o) const {
+    PerfSample d;
+    for (int k = 0; k < N; k++) {
+        d.has[k] = has[k] && o.has[k];
+        d.v[k] = d.has[k] && v[k] > o.v[k] ? v[k] - o.v[k] : 0;
+    }
+    return d;
+}
+
+PerfSample& PerfSample::operator+=(const PerfSample& o) {
+    for (int k = 0; k < N; k++) {
+        v[k] += o.v[k];
+        has[k] = has[k] || o.has[k];
+    }
+    return *this;
+}
+
+std::string PerfSample::text(double per) const {
+    std::string out;
+    char num[64];
+    for (int k = 0; k < N; k++) {
+        if (!has[k]) continue;
+        std::snprintf(num, sizeof(num), "%s%s=%.4g", out.empty() ? "" : " ", name(k), v[k] / per);
+        out += num;
+        if (k == INSTRUCTIONS && has[CYCLES]) {
+            std::snprintf(num, sizeof(num), " ipc=%.2f", ipc());
+            out += num;
+        }
+    }
+    return out;
+}
+
+std::string PerfSample::json(double per) const {
+    if (!any()) return "null";
+    std::string out = "{";
+    char num[64];
+    for (int k = 0; k < N; k++) {
+        if (!has[k]) continue;
+        std::snprintf(num, sizeof(num), "%s\"%s\":%.6g", out.size() > 1 ? "," : "", name(k), v[k] / per);
+        out += num;
+    }
+    if (has[CYCLES] && has[INSTRUCTIONS]) {
+        std::snprintf(num, sizeof(num), ",\"ipc\":%.4g", ipc());
+        out += num;
+    }
+    return out + "}";
+}
+
+// ---------------------------------------------------------------- counters
+
+static int openCounter(uint32_t type, uint64_t config) {
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int)::syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+}
+
+PerfCounters::PerfCounters() {
+    static const std::pair<uint32_t, uint64_t> kEvents[PerfSample::N] = {
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    };
+    for (int k = 0; k < PerfSample::N; k++) {
+        fd_[k] = openCounter(kEvents[k].first, kEvents[k].second);
+        if (fd_[k] >= 0) available_ = true;
+        else if (k == PerfSample::CYCLES) error_ = std::string("perf_event_open: ") + std::strerror(errno);
+    }
+}
+
+PerfCounters::~PerfCounters() {
+    for (int fd : fd_)
+        if (fd >= 0) ::close(fd);
+}
+
+PerfCounters& PerfCounters::thread() {
+    thread_local PerfCounters c;
+    return c;
+}
+
+// Counters multiplexed with others (more events than PMU slots) are scaled
+// by enabled/running time, as perf stat does.
+PerfSample PerfCounters::read() const {
+    PerfSample s;
+    for (int k = 0; k < PerfSample::N; k++) {
+        if (fd_[k] < 0) continue;
+        uint64_t buf[3];
+        if (::read(fd_[k], buf, sizeof(buf)) != (ssize_t)sizeof(buf) || buf[2] == 0) continue;
+        s.v[k] = buf[2] == buf[1] ? buf[0] : (uint64_t)((double)buf[0] * buf[1] / buf[2]);
+        s.has[k] = true;
+    }
+    return s;
+}
+
+// ---------------------------------------------------------------- stages
+
+std::atomic<bool> PerfStages::on_{false};
+
+namespace {
+std::mutex g_stagesMu;
+PerfSample g_stages[(int)PerfStage::COUNT];
+uint64_t g_calls[(int)PerfStage::COUNT];
+}
+
+void PerfStages::reset() {
+    std::lock_guard<std::mutex> lk(g_stagesMu);
+    for (int s = 0; s < (int)PerfStage::COUNT; s++) {
+        g_stages[s] = PerfSample();
+        g_calls[s] = 0;
+    }
+}
+
+void PerfStages::add(PerfStage s, const PerfSample& d) {
+    std::lock_guard<std::mutex> lk(g_stagesMu);
+    g_stages[(int)s] += d;
+    g_calls[(int)s]++;
+}
+
+PerfSample PerfStages::total(PerfStage s, uint64_t* calls) {
+    std::lock_guard<std::mutex> lk(g_stagesMu);
+    if (calls) *calls = g_calls[(int)s];
+    return g_stages[(int)s];
+}
+
+const char* PerfStages::name(PerfStage s) {
+    static const char* kNames[] = {"tokenize", "stem", "insert", "finalize", "query"};
+    return kNames[(int)s];
+}
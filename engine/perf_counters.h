@@ -0,0 +1,76 @@
+#pragma once
+#include <string>
+#include <atomic>
+#include <cstdint>
+
+// Hardware counters of the calling thread through perf_event_open(2), user
+// space only. Where the syscall is refused (containers without CAP_PERFMON,
+// perf_event_paranoid > 2, VMs without a PMU) a counter is simply missing:
+// has[] stays false and reports fall back to wall time.
+
+struct PerfSample {
+    enum { CYCLES, INSTRUCTIONS, LLC_MISSES, BRANCH_MISSES, N };
+    static const char* name(int k);
+
+    uint64_t v[N] = {};
+    bool has[N] = {};
+
+    bool any() const { return has[CYCLES] || has[INSTRUCTIONS] || has[LLC_MISSES] || has[BRANCH_MISSES]; }
+    double ipc() const { return has[CYCLES] && has[INSTRUCTIONS] && v[CYCLES] ? (double)v[INSTRUCTIONS] / v[CYCLES] : 0; }
+    PerfSample operator-(const PerfSample& o) const;
+    PerfSample& operator+=(const PerfSample& o);
+    // "cycles=... instructions=... ipc=... llc_misses=... branch_misses=...", each divided by per.
+    std::string text(double per = 1) const;
+    // JSON object with the same fields, or null without counters.
+    std::string json(double per = 1) const;
+};
+
+// The calling thread's counters, opened on first use and kept for the
+// thread's lifetime. read() costs one syscall per available counter.
+class PerfCounters {
+public:
+    static PerfCounters& thread();
+    ~PerfCounters();
+
+    bool available() const { return available_; }
+    const std::string& error() const { return error_; }  // why the cycles counter failed
+    PerfSample read() const;
+
+private:
+    PerfCounters();
+    int fd_[PerfSample::N];
+    bool available_ = false;
+    std::string error_;
+};
+
+// Per-stage totals over all threads, collected only after enable() so that
+// a disabled scope costs one relaxed load.
+enum class PerfStage { TOKENIZE, STEM, INSERT, FINALIZE, QUERY, COUNT };
+
+class PerfStages {
+public:
+    static bool on() { return on_.load(std::memory_order_relaxed); }
+    static void enable(bool on = true) { on_.store(on, std::memory_order_relaxed); }
+    static void reset();
+    static void add(PerfStage s, const PerfSample& d);
+    static PerfSample total(PerfStage s, uint64_t* calls = nullptr);
+    static const char* name(PerfStage s);
+
+private:
+    static std::atomic<bool> on_;
+};
+
+class PerfScope {
+public:
+    explicit PerfScope(PerfStage s) : stage_(s), on_(PerfStages::on()) {
+        if (on_) start_ = PerfCounters::thread().read();
+    }
+    ~PerfScope() {
+        if (on_) PerfStages::add(stage_, PerfCounters::thread().read() - start_);
+    }
+
+private:
+    PerfStage stage_;
+    bool on_;
+    PerfSample start_;
+};
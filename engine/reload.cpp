@@ -0,0 +1,99 @@
+#include "reload.h"
+#include <csignal>
+#include <chrono>
+#include <iostream>
+#include <exception>
+
+static volatile std::sig_atomic_t g_reload_signal = 0;
+
+static void onReloadSignal(int) { g_reload_signal = 1; }
+
+void IndexHolder::publish(std::shared_ptr<const IndexSnapshot> next) {
+    std::atomic_store(&cur_, std::move(next));
+}
+
+IndexReloader::IndexReloader(IndexHolder& holder, Builder build, int periodSec)
+    : IndexReloader([&holder](std::shared_ptr<const IndexSnapshot> s) { holder.publish(std::move(s)); },
+                    std::move(build), periodSec) {
+    if (auto cur = holder.acquire()) generation_ = cur->generation;
+}
+
+IndexReloader::IndexReloader(Publish publish, Builder build, int periodSec)
+    : publish_(std::move(publish)), build_(std::move(build)), periodSec_(periodSec) {}
+
+void IndexReloader::start() {
+    if (!th_.joinable()) th_ = std::thread([this] { loop(); });
+}
+
+IndexReloader::~IndexReloader() {
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+    if (th_.joinable()) th_.join();
+}
+
+void IndexReloader::installSignal(int sig) {
+    std::signal(sig, onReloadSignal);
+}
+
+void IndexReloader::request() {
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        pending_ = true;
+    }
+    cv_.notify_all();
+}
+
+void IndexReloader::loop() {
+    using clock = std::chrono::steady_clock;
+    auto nextTimer = clock::now() + std::chrono::seconds(periodSec_);
+
+    while (true) {
+        const char* reason = nullptr;
+        {
+            std::unique_lock<std::mutex> lk(mu_);
+            cv_.wait_for(lk, std::chrono::milliseconds(200));
+            if (stop_) return;
+            if (pending_) { pending_ = false; reason = "command"; }
+        }
+        if (!reason && g_reload_signal) { g_reload_signal = 0; reason = "signal"; }
+        if (!reason && periodSec_ > 0 && clock::now() >= nextTimer) reason = "timer";
+        if (!reason) continue;
+
+        rebuildNow(reason);
+        nextTimer = clock::now() + std::chrono::seconds(periodSec_);
+    }
+}
+
+bool IndexReloader::rebuildNow(const char* reason) {
+    std::lock_guard<std::mutex> build(buildMu_);
+    busy_ = true;
+    std::cerr << "[reload] rebuilding index (" << reason << ")\n";
+    auto t0 = std::chrono::steady_clock::now();
+
+    auto next = std::make_unique<IndexSnapshot>();
+    next->generation = generation_ + 1;
+
+    bool ok = false;
+    try {
+        ok = build_(*next);
+    } catch (const std::exception& e) {
+        std::cerr << "[reload] build failed: " << e.what() << "\n";
+    }
+
+    if (ok) {
+        uint64_t gen = ++generation_;
+        publish_(std::shared_ptr<const IndexSnapshot>(next.release(), [](const IndexSnapshot* s) {
+            std::cerr << "[reload] released generation " << s->generation << "\n";
+            delete s;
+        }));
+        double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        std::cerr << "[reload] generation " << gen << " live after " << sec << " sec\n";
+    } else {
+        std::cerr << "[reload] keeping previous generation\n";
+    }
+    busy_ = false;
+    return ok;
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdint>
+#include "b_idx.h"
+#include "url_store.h"
+#include "doc_store.h"
+#include "dedup.h"
+
+struct IndexSnapshot {
+    IndexSnapshot() = default;
+    explicit IndexSnapshot(size_t tableCap) : index(tableCap) {}
+
+    uint64_t generation = 0;
+    int baseId = 0;
+    BooleanIndex index;
+    UrlStore urls;
+    DocStore docs;   // empty unless texts are kept for snippets
+    DuplicateList dups; // near-duplicates dropped at build time
+};
+
+// Readers take a reference with acquire() and keep it for the whole query;
+// the previous snapshot is destroyed when its last reference goes away.
+class IndexHolder {
+public:
+    std::shared_ptr<const IndexSnapshot> acquire() const { return std::atomic_load(&cur_); }
+    void publish(std::shared_ptr<const IndexSnapshot> next);
+
+private:
+    std::shared_ptr<const IndexSnapshot> cur_;
+};
+
+class IndexReloader {
+public:
+    using Builder = std::function<bool(IndexSnapshot&)>;
+    using Publish = std::function<void(std::shared_ptr<const IndexSnapshot>)>;
+
+    IndexReloader(IndexHolder& holder, Builder build, int periodSec = 0);
+    IndexReloader(Publish publish, Builder build, int periodSec = 0);
+    ~IndexReloader();
+
+    void start();
+    void request();
+    bool rebuildNow(const char* reason);
+    bool busy() const { return busy_; }
+
+    static void installSignal(int sig);
+
+private:
+    Publish publish_;
+    Builder build_;
+    int periodSec_;
+    uint64_t generation_ = 0;
+
+    std::thread th_;
+    std::mutex mu_;
+    std::mutex buildMu_;
+    std::condition_variable cv_;
+    bool pending_ = false;
+    bool stop_ = false;
+    std::atomic<bool> busy_{false};
+
+    void loop();
+};
@@ -0,0 +1,410 @@
+#include "segments.h"
+#include "metrics.h"
+#include "trace.h"
+#include <algorithm>
+#include <cmath>
+#include <chrono>
+#include <iostream>
+
+bool SegmentRef::isDeleted(int id) const {
+    size_t i = (size_t)(id - seg->baseId);
+    return deleted && ((*deleted)[i >> 6] >> (i & 63)) & 1;
+}
+
+std::vector<int> SegmentSet::search(const std::string& query) const {
+    static QueryMetrics metrics("search");
+    auto t0 = std::chrono::steady_clock::now();
+    TraceSpan span("search", "query");
+    span.arg("query", query);
+    span.arg("segments", (int64_t)segs.size());
+    std::vector<int> out;
+    for (const auto& s : segs) {
+        auto hits = BooleanSearch(s.seg->index).search(query);
+        for (int id : hits) if (!s.isDeleted(id)) out.push_back(id);
+    }
+    metrics.record(t0, out.size());
+    return out;
+}
+
+std::vector<int> SegmentSet::searchNewest(const std::string& query, size_t n) const {
+    static QueryMetrics metrics("newest");
+    auto t0 = std::chrono::steady_clock::now();
+    TraceSpan span("searchNewest", "query");
+    span.arg("query", query);
+    span.arg("segments", (int64_t)segs.size());
+    std::vector<int> out;
+    for (auto it = segs.rbegin(); it != segs.rend() && out.size() < n; ++it) {
+        const auto& s = *it;
+        auto hits = BooleanSearch(s.seg->index).searchNewest(query, n - out.size(),
+            [&](int id) { return !s.isDeleted(id); });
+        out.insert(out.end(), hits.begin(), hits.end());
+    }
+    metrics.record(t0, out.size());
+    return out;
+}
+
+// Deleted docs are dropped after evaluation, so results count only live ones.
+std::vector<QueryProfile> SegmentSet::profile(const std::string& query, bool run) const {
+    std::vector<QueryProfile> out;
+    for (const auto& s : segs) {
+        BooleanSearch bs(s.seg->index);
+        if (!run) { out.push_back(bs.explain(query)); continue; }
+        out.emplace_back();
+        auto hits = bs.profile(query, out.back());
+        out.back().results = 0;
+        for (int id : hits) out.back().results += !s.isDeleted(id);
+    }
+    return out;
+}
+
+size_t SegmentSet::count(const std::string& query) const {
+    static QueryMetrics metrics("count");
+    auto t0 = std::chrono::steady_clock::now();
+    TraceSpan span("count", "query");
+    span.arg("query", query);
+    span.arg("segments", (int64_t)segs.size());
+    size_t n = 0;
+    for (const auto& s : segs) {
+        BooleanSearch bs(s.seg->index);
+        if (!s.deleted) { n += bs.count(query); continue; }
+        for (int id : bs.search(query)) n += !s.isDeleted(id);
+    }
+    metrics.record(t0, n);
+    return n;
+}
+
+// Deleted docs still in a segment's sample are not subtracted, so the estimate
+// is slightly high until the segment is merged away.
+CountEstimate SegmentSet::estimate(const std::string& query) const {
+    static QueryMetrics metrics("estimate");
+    auto t0 = std::chrono::steady_clock::now();
+    TraceSpan span("estimate", "query");
+    span.arg("query", query);
+    span.arg("segments", (int64_t)segs.size());
+    CountEstimate e;
+    e.exact = true;
+    double var = 0;
+    for (const auto& s : segs) {
+        auto part = BooleanSearch(s.seg->index).estimate(query);
+        e.value += part.value;
+        e.exact = e.exact && part.exact;
+        double half = (part.hi - part.lo) / 2;
+        var += half * half;
+    }
+    double half = std::sqrt(var);
+    e.lo = std::max(0.0, e.value - half);
+    e.hi = e.value + half;
+    metrics.record(t0, (size_t)e.value);
+    return e;
+}
+
+std::string SegmentSet::url(int id) const {
+    auto it = std::upper_bound(segs.begin(), segs.end(), id,
+        [](int v, const SegmentRef& s) { return v < s.seg->baseId; });
+    if (it == segs.begin()) return {};
+    --it;
+    size_t i = (size_t)(id - it->seg->baseId);
+    if (i >= it->span() || it->isDeleted(id)) return {};
+    return it->seg->urls.get(i);
+}
+
+std::string SegmentSet::text(int id) const {
+    auto it = std::upper_bound(segs.begin(), segs.end(), id,
+        [](int v, const SegmentRef& s) { return v < s.seg->baseId; });
+    if (it == segs.begin()) return {};
+    --it;
+    size_t i = (size_t)(id - it->seg->baseId);
+    if (i >= it->span() || it->isDeleted(id)) return {};
+    return it->seg->docs.get(i);
+}
+
+const std::vector<std::string>* SegmentSet::duplicates(int id) const {
+    auto it = std::upper_bound(segs.begin(), segs.end(), id,
+        [](int v, const SegmentRef& s) { return v < s.seg->baseId; });
+    if (it == segs.begin() || std::prev(it)->isDeleted(id)) return nullptr;
+    return std::prev(it)->seg->dups.of(id);
+}
+
+int64_t SegmentSet::fetchedAt(int id) const {
+    auto it = std::upper_bound(segs.begin(), segs.end(), id,
+        [](int v, const SegmentRef& s) { return v < s.seg->baseId; });
+    if (it == segs.begin()) return -1;
+    return std::prev(it)->seg->index.timeOf(id);
+}
+
+size_t SegmentSet::liveDocs() const {
+    size_t n = 0;
+    for (const auto& s : segs) {
+        n += s.seg->index.allDocs().size();
+        if (!s.deleted) continue;
+        for (int id : s.seg->index.allDocs()) n -= s.isDeleted(id);
+    }
+    return n;
+}
+
+std::vector<TermLexicon::Match> SegmentSet::suggest(std::string_view prefix, size_t k) const {
+    std::vector<TermLexicon::Match> out;
+    for (const auto& s : segs) {
+        if (!s.seg->index.lexicon()) continue;
+        for (auto& m : s.seg->index.lexicon()->complete(prefix, k)) {
+            auto it = std::find_if(out.begin(), out.end(), [&](const TermLexicon::Match& o) { return o.term == m.term; });
+            if (it != out.end()) it->df += m.df;
+            else out.push_back(std::move(m));
+        }
+    }
+    std::sort(out.begin(), out.end(), [](const TermLexicon::Match& a, const TermLexicon::Match& b) {
+        return a.df != b.df ? a.df > b.df : a.term < b.term;
+    });
+    if (out.size() > k) out.resize(k);
+    return out;
+}
+
+SegmentedIndex::SegmentedIndex(SegmentMergePolicy policy)
+    : policy_(policy), cur_(std::make_shared<SegmentSet>()) {}
+
+SegmentedIndex::~SegmentedIndex() {
+    {
+        std::lock_guard<std::mutex> lk(mergeMu_);
+        stop_ = true;
+    }
+    mergeCv_.notify_all();
+    if (merger_.joinable()) merger_.join();
+}
+
+void SegmentedIndex::reset(std::shared_ptr<const IndexSnapshot> base, std::vector<uint64_t> textHashes) {
+    std::lock_guard<std::mutex> lk(writeMu_);
+    live_.clear();
+    live_.reserve(base->urls.size());
+    bool hashed = textHashes.size() == base->urls.size();
+    for (size_t i = 0; i < base->urls.size(); i++)
+        live_[base->urls.get(i)] = {base->baseId + (int)i, hashed ? textHashes[i] : 0};
+    nextId_ = base->baseId + (int)base->urls.size();
+    epoch_++;
+
+    auto set = std::make_shared<SegmentSet>();
+    set->segs.push_back({std::move(base), nullptr});
+    publish(std::move(set));
+}
+
+void SegmentedIndex::restore(std::shared_ptr<const SegmentSet> set) {
+    std::lock_guard<std::mutex> lk(writeMu_);
+    live_.clear();
+    nextId_ = 0;
+    for (const auto& s : set->segs) {
+        for (size_t i = 0; i < s.span(); i++) {
+            int id = s.seg->baseId + (int)i;
+            if (s.isDeleted(id)) continue;
+            auto u = s.seg->urls.get(i);
+            if (!u.empty()) live_[std::move(u)] = {id, 0};
+        }
+        nextId_ = s.seg->baseId + (int)s.span();
+    }
+    epoch_++;
+    publish(std::move(set));
+}
+
+void SegmentedIndex::markDeleted(SegmentSet& set, int id) const {
+    auto it = std::upper_bound(set.segs.begin(), set.segs.end(), id,
+        [](int v, const SegmentRef& s) { return v < s.seg->baseId; });
+    if (it == set.segs.begin()) return;
+    --it;
+    size_t i = (size_t)(id - it->seg->baseId);
+    if (i >= it->span()) return;
+
+    // The bitmap may still be shared with published sets; copy before writing.
+    auto bits = it->deleted ? std::make_shared<std::vector<uint64_t>>(*it->deleted)
+                            : std::make_shared<std::vector<uint64_t>>((it->span() + 63) / 64, 0);
+    (*bits)[i >> 6] |= 1ull << (i & 63);
+    it->deleted = std::move(bits);
+}
+
+void SegmentedIndex::apply(std::vector<Document> upserts, const std::vector<std::string>& deletes) {
+    if (upserts.empty() && deletes.empty()) return;
+    std::lock_guard<std::mutex> lk(writeMu_);
+
+    auto set = std::make_shared<SegmentSet>(*acquire());
+
+    for (const auto& url : deletes) {
+        auto it = live_.find(url);
+        if (it == live_.end()) continue;
+        markDeleted(*set, it->second.id);
+        live_.erase(it);
+    }
+
+    if (!upserts.empty()) {
+        std::stable_sort(upserts.begin(), upserts.end(),
+            [](const Document& a, const Document& b) { return a.fetchedAt < b.fetchedAt; });
+        auto seg = std::make_shared<IndexSnapshot>(4096);
+        seg->baseId = nextId_;
+        std::vector<std::string> urls;
+        urls.reserve(upserts.size());
+
+        std::vector<int> superseded;
+        for (auto& d : upserts) {
+            auto it = live_.find(d.key);
+            if (it != live_.end()) {
+                if (it->second.id >= seg->baseId) {
+                    // Same URL twice in one batch: keep the later text.
+                    urls[it->second.id - seg->baseId].clear();
+                    superseded.push_back(it->second.id);
+                } else {
+                    markDeleted(*set, it->second.id);
+                }
+            }
+            d.id = nextId_++;
+            live_[d.key] = {d.id, textHash(d.text)};
+            urls.push_back(d.key);
+            seg->index.addDocument(d);
+            if (storeDocs_) seg->docs.add(d.text);
+        }
+        seg->index.finalize();
+        seg->docs.finish();
+        seg->urls = UrlStore(urls);
+
+        SegmentRef ref{std::move(seg), nullptr};
+        if (!superseded.empty()) {
+            auto bits = std::make_shared<std::vector<uint64_t>>((ref.span() + 63) / 64, 0);
+            for (int id : superseded) {
+                size_t i = (size_t)(id - ref.seg->baseId);
+                (*bits)[i >> 6] |= 1ull << (i & 63);
+            }
+            ref.deleted = std::move(bits);
+        }
+        set->segs.push_back(std::move(ref));
+    }
+
+    publish(std::move(set));
+    mergeCv_.notify_all();
+}
+
+uint64_t SegmentedIndex::textHash(std::string_view text) {
+    uint64_t h = std::hash<std::string_view>()(text);
+    return h ? h : 1;
+}
+
+size_t SegmentedIndex::dropUnchanged(std::vector<Document>& upserts) {
+    std::lock_guard<std::mutex> lk(writeMu_);
+    std::stable_sort(upserts.begin(), upserts.end(),
+        [](const Document& a, const Document& b) { return a.fetchedAt < b.fetchedAt; });
+    std::unordered_map<std::string_view, size_t> last;
+    for (size_t i = 0; i < upserts.size(); i++) last[upserts[i].key] = i;
+
+    std::vector<char> keep(upserts.size());
+    for (size_t i = 0; i < upserts.size(); i++) {
+        const Document& d = upserts[i];
+        auto it = live_.find(d.key);
+        keep[i] = last[d.key] == i && (it == live_.end() || it->second.textHash != textHash(d.text));
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < upserts.size(); i++)
+        if (keep[i]) upserts[n++] = std::move(upserts[i]);
+    size_t dropped = upserts.size() - n;
+    upserts.resize(n);
+    return dropped;
+}
+
+size_t SegmentedIndex::tier(size_t docs) const {
+    size_t t = 0, cap = policy_.minSegmentDocs;
+    while (docs > cap) { cap *= policy_.mergeFactor; t++; }
+    return t;
+}
+
+bool SegmentedIndex::mergeOnce() {
+    auto snap = acquire();
+    uint64_t epoch;
+    {
+        std::lock_guard<std::mutex> lk(writeMu_);
+        epoch = epoch_;
+    }
+
+    // Newest segments are the smallest; look for a run of adjacent segments in
+    // the same tier, starting from the tail.
+    const auto& segs = snap->segs;
+    size_t end = segs.size(), begin = end;
+    while (end > 0) {
+        size_t t = tier(segs[end - 1].span());
+        begin = end - 1;
+        size_t total = segs[begin].span();
+        while (begin > 0 && tier(segs[begin - 1].span()) == t &&
+               total + segs[begin - 1].span() <= policy_.maxSegmentDocs) {
+            begin--;
+            total += segs[begin].span();
+        }
+        if (end - begin >= policy_.mergeFactor) break;
+        end = begin;
+    }
+    if (end == 0 || end - begin < 2) return false;
+
+    auto t0 = std::chrono::steady_clock::now();
+    size_t terms = 0;
+    for (size_t k = begin; k < end; k++) terms += segs[k].seg->index.termsCount();
+    auto merged = std::make_shared<IndexSnapshot>(terms * 2);
+    merged->baseId = segs[begin].seg->baseId;
+    std::vector<std::string> urls;
+    for (size_t k = begin; k < end; k++) {
+        const auto& s = segs[k];
+        for (size_t i = 0; i < s.span(); i++) {
+            bool dead = s.isDeleted(s.seg->baseId + (int)i);
+            urls.push_back(dead ? std::string() : s.seg->urls.get(i));
+            if (storeDocs_) merged->docs.add(dead ? std::string() : s.seg->docs.get(i));
+        }
+        merged->index.append(s.seg->index, [&](int id) { return !s.isDeleted(id); });
+        merged->dups.append(s.seg->dups, [&](int id) { return !s.isDeleted(id); });
+    }
+    merged->index.finalize();
+    merged->urls = UrlStore(urls);
+    merged->docs.finish();
+
+    std::lock_guard<std::mutex> lk(writeMu_);
+    if (epoch != epoch_) return false;
+
+    auto cur = acquire();
+    auto first = std::find_if(cur->segs.begin(), cur->segs.end(),
+        [&](const SegmentRef& r) { return r.seg == segs[begin].seg; });
+    if ((size_t)(cur->segs.end() - first) < end - begin) return false;
+    for (size_t k = 0; k < end - begin; k++) {
+        if (first[k].seg != segs[begin + k].seg) return false;
+    }
+
+    // Deletions that landed while we were merging are carried over as the
+    // merged segment's bitmap.
+    std::shared_ptr<std::vector<uint64_t>> bits;
+    for (size_t k = 0; k < end - begin; k++) {
+        const auto& was = segs[begin + k];
+        const auto& now = first[k];
+        if (now.deleted == was.deleted) continue;
+        if (!bits) bits = std::make_shared<std::vector<uint64_t>>((merged->urls.size() + 63) / 64, 0);
+        for (size_t i = 0; i < now.span(); i++) {
+            int id = now.seg->baseId + (int)i;
+            if (!now.isDeleted(id) || was.isDeleted(id)) continue;
+            size_t j = (size_t)(id - merged->baseId);
+            (*bits)[j >> 6] |= 1ull << (j & 63);
+        }
+    }
+    SegmentRef ref{merged, std::move(bits)};
+
+    auto next = std::make_shared<SegmentSet>();
+    next->segs.assign(cur->segs.begin(), first);
+    next->segs.push_back(std::move(ref));
+    next->segs.insert(next->segs.end(), first + (end - begin), cur->segs.end());
+    publish(std::move(next));
+
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+    std::cerr << "[segments] merged " << (end - begin) << " segments (" << merged->urls.size()
+              << " docs) in " << ms << " ms\n";
+    return true;
+}
+
+void SegmentedIndex::startMerger() {
+    if (merger_.joinable()) return;
+    merger_ = std::thread([this] {
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lk(mergeMu_);
+                mergeCv_.wait_for(lk, std::chrono::seconds(1));
+                if (stop_) return;
+            }
+            while (mergeOnce()) {}
+        }
+    });
+}
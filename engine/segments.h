@@ -0,0 +1,101 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <unordered_map>
+#include <cstdint>
+#include "b_idx.h"
+#include "reload.h"
+#include "b_srch.h"
+
+// One immutable segment plus the deletion bitmap that was current when the
+// SegmentSet was published. Bit i masks doc id seg->baseId + i.
+struct SegmentRef {
+    std::shared_ptr<const IndexSnapshot> seg;
+    std::shared_ptr<const std::vector<uint64_t>> deleted;
+
+    size_t span() const { return seg->urls.size(); }
+    bool isDeleted(int id) const;
+};
+
+// Segments are ordered by baseId and cover disjoint id ranges, so per-segment
+// results concatenate into a sorted list.
+struct SegmentSet {
+    std::vector<SegmentRef> segs;
+
+    std::vector<int> search(const std::string& query) const;
+    // Newer segments hold newer ids, so they are searched first.
+    std::vector<int> searchNewest(const std::string& query, size_t n) const;
+    size_t count(const std::string& query) const;
+    CountEstimate estimate(const std::string& query) const;
+    // One EXPLAIN (run = false) or PROFILE per segment, oldest first.
+    std::vector<QueryProfile> profile(const std::string& query, bool run) const;
+    std::string url(int id) const;  // empty if unknown or deleted
+    std::string text(int id) const; // empty unless the segment keeps texts
+    int64_t fetchedAt(int id) const; // -1 if unknown
+    const std::vector<std::string>* duplicates(int id) const;
+    size_t liveDocs() const;
+    // Completions of prefix over every segment's lexicon, df summed per term.
+    std::vector<TermLexicon::Match> suggest(std::string_view prefix, size_t k) const;
+};
+
+struct SegmentMergePolicy {
+    size_t mergeFactor = 8;     // merge once a tier holds this many segments
+    size_t minSegmentDocs = 64; // tier 0 upper bound
+    size_t maxSegmentDocs = 1u << 20;
+};
+
+class SegmentedIndex {
+public:
+    explicit SegmentedIndex(SegmentMergePolicy policy = {});
+    ~SegmentedIndex();
+
+    std::shared_ptr<const SegmentSet> acquire() const { return std::atomic_load(&cur_); }
+
+    // Replaces every segment with a freshly built base; textHashes, if given,
+    // holds textHash() of each base doc's text, aligned with its urls.
+    void reset(std::shared_ptr<const IndexSnapshot> base, std::vector<uint64_t> textHashes = {});
+    void restore(std::shared_ptr<const SegmentSet> set);
+
+    // Indexes upserted documents into one new segment; earlier versions of the
+    // same URLs and explicitly deleted URLs are masked. Document ids are assigned
+    // here, in fetchedAt order.
+    void apply(std::vector<Document> upserts, const std::vector<std::string>& deletes = {});
+
+    // Removes upserts whose URL is live with the same text (the robot moves
+    // fetched_at on every re-fetch), and earlier copies of a URL repeated in
+    // the batch. Texts of docs restored from a checkpoint are not known, so
+    // those are kept once. Returns how many were removed.
+    size_t dropUnchanged(std::vector<Document>& upserts);
+    static uint64_t textHash(std::string_view text);
+
+    void setStoreDocs(bool on) { storeDocs_ = on; }
+
+    bool mergeOnce();
+    void startMerger();
+
+    size_t segmentCount() const { return acquire()->segs.size(); }
+
+private:
+    SegmentMergePolicy policy_;
+    std::shared_ptr<const SegmentSet> cur_;
+
+    std::mutex writeMu_;
+    struct Live { int id; uint64_t textHash; };  // textHash 0 if not known
+    std::unordered_map<std::string, Live> live_;
+    int nextId_ = 0;
+    uint64_t epoch_ = 0;
+    bool storeDocs_ = false;
+
+    std::thread merger_;
+    std::mutex mergeMu_;
+    std::condition_variable mergeCv_;
+    bool stop_ = false;
+
+    size_t tier(size_t docs) const;
+    void markDeleted(SegmentSet& set, int id) const;
+    void publish(std::shared_ptr<const SegmentSet> next) { std::atomic_store(&cur_, std::move(next)); }
+};
@@ -0,0 +1,304 @@
+#include "shard.h"
+#include <algorithm>
+#include <charconv>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+uint32_t shardOf(std::string_view url, uint32_t shards) {
+    uint32_t h = 2166136261u;
+    for (unsigned char c : url) { h ^= c; h *= 16777619u; }
+    return shards ? h % shards : 0;
+}
+
+using Clock = std::chrono::steady_clock;
+
+static bool waitFd(int fd, short events, Clock::time_point deadline) {
+    while (true) {
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now()).count();
+        if (left <= 0) return false;
+        pollfd p{fd, events, 0};
+        int r = ::poll(&p, 1, (int)left);
+        if (r > 0) return true;
+        if (r == 0 || errno != EINTR) return false;
+    }
+}
+
+static bool sendAll(int fd, const std::string& s, Clock::time_point deadline) {
+    size_t off = 0;
+    while (off < s.size()) {
+        ssize_t n = ::send(fd, s.data() + off, s.size() - off, MSG_NOSIGNAL);
+        if (n > 0) { off += (size_t)n; continue; }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) && waitFd(fd, POLLOUT, deadline)) continue;
+        return false;
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------- server
+
+ShardServer::ShardServer(uint16_t port, Acquire acquire, std::string host)
+    : port_(port), acquire_(std::move(acquire)), host_(std::move(host)) {}
+
+ShardServer::~ShardServer() { stop(); }
+
+bool ShardServer::start() {
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port_);
+    if (::inet_pton(AF_INET, host_.c_str(), &addr.sin_addr) != 1) return false;
+
+    listenFd_ = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (listenFd_ < 0) return false;
+    int one = 1;
+    ::setsockopt(listenFd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    socklen_t len = sizeof(addr);
+    if (::bind(listenFd_, (sockaddr*)&addr, sizeof(addr)) != 0 || ::listen(listenFd_, 64) != 0 ||
+        ::getsockname(listenFd_, (sockaddr*)&addr, &len) != 0) {
+        ::close(listenFd_);
+        listenFd_ = -1;
+        return false;
+    }
+    port_ = ntohs(addr.sin_port);
+    acceptor_ = std::thread([this] { acceptLoop(); });
+    return true;
+}
+
+void ShardServer::stop() {
+    if (listenFd_ < 0) return;
+    stop_ = true;
+    ::shutdown(listenFd_, SHUT_RDWR);
+    if (acceptor_.joinable()) acceptor_.join();
+    ::close(listenFd_);
+    listenFd_ = -1;
+
+    std::unique_lock<std::mutex> lk(connMu_);
+    for (int fd : connFds_) ::shutdown(fd, SHUT_RDWR);
+    connCv_.wait(lk, [&] { return connFds_.empty(); });
+}
+
+void ShardServer::acceptLoop() {
+    while (!stop_) {
+        int fd = ::accept(listenFd_, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            break;
+        }
+        int one = 1;
+        ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        std::lock_guard<std::mutex> lk(connMu_);
+        if (stop_) { ::close(fd); break; }
+        connFds_.push_back(fd);
+        std::thread([this, fd] { serve(fd); }).detach();
+    }
+}
+
+void ShardServer::serve(int fd) {
+    std::string buf;
+    char chunk[4096];
+    while (!stop_) {
+        size_t nl = buf.find('\n');
+        if (nl == std::string::npos) {
+            ssize_t n = ::recv(fd, chunk, sizeof(chunk), 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            buf.append(chunk, (size_t)n);
+            continue;
+        }
+        std::string line = buf.substr(0, nl);
+        buf.erase(0, nl + 1);
+        std::string reply;
+        try {
+            reply = handle(line);
+        } catch (const std::exception& e) {
+            reply = std::string("ERR\t") + e.what() + "\n";
+        }
+        if (!sendAll(fd, reply, Clock::now() + std::chrono::seconds(30))) break;
+    }
+
+    std::lock_guard<std::mutex> lk(connMu_);
+    connFds_.erase(std::find(connFds_.begin(), connFds_.end(), fd));
+    ::close(fd);
+    connCv_.notify_all();
+}
+
+std::string ShardServer::handle(const std::string& line) const {
+    size_t t1 = line.find('\t'), t2 = t1 == std::string::npos ? t1 : line.find('\t', t1 + 1);
+    if (t2 == std::string::npos) return "ERR\tmalformed request\n";
+    std::string cmd = line.substr(0, t1);
+    size_t limit = std::stoul(line.substr(t1 + 1, t2 - t1 - 1));
+    std::string query = line.substr(t2 + 1);
+
+    auto set = acquire_();
+    if (!set) return "ERR\tno index\n";
+
+    std::vector<int> hits;
+    size_t total = 0;
+    if (cmd == "COUNT") {
+        total = set->count(query);
+    } else if (cmd == "SEARCH") {
+        hits = set->search(query);
+        total = hits.size();
+        if (hits.size() > limit) hits.resize(limit);
+    } else if (cmd == "NEWEST") {
+        hits = set->searchNewest(query, limit);
+        total = set->count(query);
+    } else {
+        return "ERR\tunknown command\n";
+    }
+
+    std::string out = "OK\t" + std::to_string(total) + "\t" + std::to_string(hits.size()) + "\n";
+    for (int id : hits) {
+        out += std::to_string(set->fetchedAt(id));
+        out += '\t';
+        out += set->url(id);
+        out += '\n';
+    }
+    return out;
+}
+
+// ----------------------------------------------------------- coordinator
+
+ShardCoordinator::ShardCoordinator(std::vector<Endpoint> shards, std::chrono::milliseconds timeout)
+    : shards_(std::move(shards)), timeout_(timeout) {}
+
+bool ShardCoordinator::parseEndpoints(const std::string& list, std::vector<Endpoint>& out) {
+    std::stringstream ss(list);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        size_t c = item.rfind(':');
+        if (c == std::string::npos || c == 0) return false;
+        int port = std::atoi(item.c_str() + c + 1);
+        if (port <= 0 || port > 65535) return false;
+        out.push_back({item.substr(0, c), (uint16_t)port});
+    }
+    return !out.empty();
+}
+
+static int connectTo(const ShardCoordinator::Endpoint& ep, Clock::time_point deadline) {
+    addrinfo hints{}, *res = nullptr;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (::getaddrinfo(ep.host.c_str(), std::to_string(ep.port).c_str(), &hints, &res) != 0 || !res) return -1;
+
+    int fd = ::socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (fd >= 0) {
+        ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+        int one = 1;
+        ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        int r = ::connect(fd, res->ai_addr, res->ai_addrlen);
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (r != 0 && (errno != EINPROGRESS || !waitFd(fd, POLLOUT, deadline) ||
+                       ::getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) != 0 || err != 0)) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+    ::freeaddrinfo(res);
+    return fd;
+}
+
+// The whole of s as a decimal number; replies come off the network, so
+// anything else is a failed shard rather than an exception.
+template <class T>
+static bool parseNum(std::string_view s, T& v) {
+    auto r = std::from_chars(s.data(), s.data() + s.size(), v);
+    return !s.empty() && r.ec == std::errc() && r.ptr == s.data() + s.size();
+}
+
+static bool ask(const ShardCoordinator::Endpoint& ep, const std::string& req, Clock::time_point deadline,
+                ShardResult& out) {
+    int fd = connectTo(ep, deadline);
+    if (fd < 0) return false;
+
+    bool ok = sendAll(fd, req, deadline);
+    std::string buf;
+    size_t want = std::string::npos, lines = 0, pos = 0;
+    char chunk[16384];
+    while (ok) {
+        // Count complete lines; the header says how many follow.
+        size_t nl;
+        while ((nl = buf.find('\n', pos)) != std::string::npos) {
+            if (lines == 0) {
+                std::string_view line(buf.data(), nl);
+                size_t t = line.find('\t', 3), n = 0;
+                if (line.compare(0, 3, "OK\t") != 0 || t == std::string_view::npos ||
+                    !parseNum(line.substr(3, t - 3), out.total) ||
+                    !parseNum(line.substr(t + 1), n)) { ok = false; break; }
+                want = n + 1;
+            } else {
+                size_t t = buf.find('\t', pos);
+                ShardHit h;
+                if (t == std::string::npos || t > nl ||
+                    !parseNum(std::string_view(buf.data() + pos, t - pos), h.fetchedAt)) { ok = false; break; }
+                h.url = buf.substr(t + 1, nl - t - 1);
+                out.hits.push_back(std::move(h));
+            }
+            lines++;
+            pos = nl + 1;
+        }
+        if (!ok || lines == want) break;
+        if (!waitFd(fd, POLLIN, deadline)) { ok = false; break; }
+        ssize_t n = ::recv(fd, chunk, sizeof(chunk), 0);
+        if (n < 0 && (errno == EINTR || errno == EAGAIN)) continue;
+        if (n <= 0) { ok = false; break; }
+        buf.append(chunk, (size_t)n);
+    }
+    ::close(fd);
+    return ok;
+}
+
+ShardResult ShardCoordinator::scatter(const char* cmd, const std::string& query, size_t limit) const {
+    std::string q = query;
+    std::replace(q.begin(), q.end(), '\t', ' ');
+    std::replace(q.begin(), q.end(), '\n', ' ');
+    std::string req = std::string(cmd) + "\t" + std::to_string(limit) + "\t" + q + "\n";
+    auto deadline = Clock::now() + timeout_;
+
+    std::vector<ShardResult> part(shards_.size());
+    std::vector<char> ok(shards_.size(), 0);
+    std::vector<std::thread> th;
+    for (size_t i = 1; i < shards_.size(); i++)
+        th.emplace_back([&, i] { ok[i] = ask(shards_[i], req, deadline, part[i]); });
+    if (!shards_.empty()) ok[0] = ask(shards_[0], req, deadline, part[0]);
+    for (auto& t : th) t.join();
+
+    ShardResult r;
+    for (size_t i = 0; i < shards_.size(); i++) {
+        if (!ok[i]) { r.shardsFailed++; continue; }
+        r.shardsOk++;
+        r.total += part[i].total;
+        for (auto& h : part[i].hits) r.hits.push_back(std::move(h));
+    }
+    return r;
+}
+
+ShardResult ShardCoordinator::search(const std::string& query, size_t limit) const {
+    auto r = scatter("SEARCH", query, limit);
+    if (r.hits.size() > limit) r.hits.resize(limit);
+    return r;
+}
+
+ShardResult ShardCoordinator::newest(const std::string& query, size_t limit) const {
+    auto r = scatter("NEWEST", query, limit);
+    std::stable_sort(r.hits.begin(), r.hits.end(),
+        [](const ShardHit& a, const ShardHit& b) { return a.fetchedAt > b.fetchedAt; });
+    if (r.hits.size() > limit) r.hits.resize(limit);
+    return r;
+}
+
+ShardResult ShardCoordinator::count(const std::string& query) const {
+    return scatter("COUNT", query, 0);
+}
@@ -0,0 +1,86 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include "segments.h"
+
+// Shard that owns url when the corpus is split across `shards` engines.
+uint32_t shardOf(std::string_view url, uint32_t shards);
+
+// Line protocol between coordinator and shards, one request per line:
+//   SEARCH|NEWEST|COUNT \t limit \t query \n
+// answered by
+//   OK \t total \t n \n  followed by n lines  fetched_at \t url \n
+// or ERR \t message \n. A connection may carry any number of requests.
+class ShardServer {
+public:
+    using Acquire = std::function<std::shared_ptr<const SegmentSet>()>;
+
+    // port 0 binds an ephemeral port; see port(). host is an IPv4 address,
+    // loopback by default; "0.0.0.0" listens on every interface.
+    ShardServer(uint16_t port, Acquire acquire, std::string host = "127.0.0.1");
+    ~ShardServer();
+
+    bool start();
+    void stop();
+    uint16_t port() const { return port_; }
+
+private:
+    uint16_t port_;
+    Acquire acquire_;
+    std::string host_;
+    int listenFd_ = -1;
+    std::atomic<bool> stop_{false};
+    std::thread acceptor_;
+    std::mutex connMu_;
+    std::condition_variable connCv_;
+    std::vector<int> connFds_;  // open connections, each served by a detached thread
+
+    void acceptLoop();
+    void serve(int fd);
+    std::string handle(const std::string& line) const;
+};
+
+struct ShardHit {
+    int64_t fetchedAt = -1;
+    std::string url;
+};
+
+struct ShardResult {
+    size_t total = 0;             // matches on the shards that answered
+    std::vector<ShardHit> hits;
+    size_t shardsOk = 0;
+    size_t shardsFailed = 0;      // timed out, refused or errored
+    bool partial() const { return shardsFailed > 0; }
+};
+
+// Fans a query out to every shard in parallel and merges what arrives before
+// the deadline; shards that miss it are left out of the result.
+class ShardCoordinator {
+public:
+    struct Endpoint { std::string host; uint16_t port; };
+
+    ShardCoordinator(std::vector<Endpoint> shards, std::chrono::milliseconds timeout);
+
+    // First `limit` hits of each shard, concatenated in shard order.
+    ShardResult search(const std::string& query, size_t limit) const;
+    // Newest `limit` hits overall, merged by fetched_at.
+    ShardResult newest(const std::string& query, size_t limit) const;
+    ShardResult count(const std::string& query) const;
+
+    static bool parseEndpoints(const std::string& list, std::vector<Endpoint>& out);
+
+private:
+    std::vector<Endpoint> shards_;
+    std::chrono::milliseconds timeout_;
+
+    ShardResult scatter(const char* cmd, const std::string& query, size_t limit) const;
+};
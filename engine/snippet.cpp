@@ -0,0 +1,131 @@
+#include "snippet.h"
+#include "Tokenizer.h"
+#include "Stemmer.h"
+#include <algorithm>
+#include <cctype>
+
+SnippetGenerator::SnippetGenerator(std::vector<std::string> stems, std::string open, std::string close)
+    : stems_(std::move(stems)), open_(std::move(open)), close_(std::move(close)) {
+    std::sort(stems_.begin(), stems_.end());
+    stems_.erase(std::unique(stems_.begin(), stems_.end()), stems_.end());
+}
+
+static bool isWordByte(const std::string_view& s, size_t i, size_t& len) {
+    unsigned char c = (unsigned char)s[i];
+    if (c < 128) { len = 1; return std::isalnum(c) || c == '-'; }
+    if ((c == 0xD0 || c == 0xD1) && i + 1 < s.size()) { len = 2; return true; }
+    len = 1;
+    while (i + len < s.size() && ((unsigned char)s[i + len] & 0xC0) == 0x80) len++;
+    return false;
+}
+
+// First character of a word, lowercased the way the Tokenizer does it.
+static std::string_view firstChar(std::string_view w, char* buf) {
+    if (w.empty()) return {};
+    unsigned char c = (unsigned char)w[0];
+    if (c < 128) { buf[0] = (char)std::tolower(c); return {buf, 1}; }
+    if (w.size() < 2) return {};
+    unsigned char t = (unsigned char)w[1];
+    if ((c == 0xD0 && t == 0x81) || (c == 0xD1 && t == 0x91)) { buf[0] = (char)0xD0; buf[1] = (char)0xB5; }
+    else if (c == 0xD0 && t >= 0x90 && t <= 0xAF) { buf[0] = (char)0xD0; buf[1] = (char)(t + 0x20); }
+    else { buf[0] = (char)c; buf[1] = (char)t; }
+    return {buf, 2};
+}
+
+// A stem is a prefix of its normalized word, so most words are rejected on
+// their first character, and the rest by a prefix check before the stemmer runs.
+int SnippetGenerator::match(std::string_view word) const {
+    char buf[2];
+    auto fc = firstChar(word, buf);
+    bool any = false;
+    for (const auto& st : stems_) any = any || st.compare(0, fc.size(), fc.data(), fc.size()) == 0;
+    if (!any || fc.empty()) return -1;
+
+    for (const auto& tok : Tokenizer::tokenize(word)) {
+        for (size_t k = 0; k < stems_.size(); k++) {
+            const auto& st = stems_[k];
+            if (tok.compare(0, st.size(), st) != 0) continue;
+            if (Stemmer::stem(tok) == st) return (int)k;
+        }
+    }
+    return -1;
+}
+
+std::vector<SnippetGenerator::Hit> SnippetGenerator::locate(std::string_view text) const {
+    std::vector<Hit> hits;
+    size_t i = 0, len = 0;
+    while (i < text.size()) {
+        if (!isWordByte(text, i, len)) { i += len; continue; }
+        size_t b = i;
+        while (i < text.size() && isWordByte(text, i, len)) i += len;
+        int t = match(text.substr(b, i - b));
+        if (t >= 0) hits.push_back({b, i, t});
+    }
+    return hits;
+}
+
+static size_t charStart(std::string_view s, size_t i) {
+    while (i > 0 && i < s.size() && ((unsigned char)s[i] & 0xC0) == 0x80) i--;
+    return i;
+}
+
+std::string SnippetGenerator::make(std::string_view text, size_t width, size_t maxFragments) const {
+    auto hits = locate(text);
+    if (hits.empty()) {
+        size_t e = charStart(text, std::min(text.size(), width));
+        return std::string(text.substr(0, e)) + (e < text.size() ? " ..." : "");
+    }
+
+    // Greedy: take the window with the most distinct terms (then most hits),
+    // drop the hits it covers, repeat.
+    std::vector<std::pair<size_t, size_t>> windows;
+    std::vector<bool> used(hits.size(), false);
+    for (size_t f = 0; f < maxFragments; f++) {
+        int bestScore = 0;
+        size_t bestI = 0, bestJ = 0;
+        for (size_t i = 0; i < hits.size(); i++) {
+            if (used[i]) continue;
+            uint64_t seen = 0;
+            int n = 0;
+            size_t j = i;
+            for (; j < hits.size() && hits[j].e - hits[i].b <= width; j++) {
+                if (used[j]) break;
+                seen |= 1ull << (hits[j].term & 63);
+                n++;
+            }
+            int score = __builtin_popcountll(seen) * 64 + n;
+            if (score > bestScore) { bestScore = score; bestI = i; bestJ = j; }
+        }
+        if (bestScore == 0) break;
+        for (size_t k = bestI; k < bestJ; k++) used[k] = true;
+
+        size_t span = hits[bestJ - 1].e - hits[bestI].b;
+        size_t pad = (width - std::min(width, span)) / 2;
+        size_t b = hits[bestI].b > pad ? hits[bestI].b - pad : 0;
+        size_t e = std::min(text.size(), hits[bestJ - 1].e + pad);
+        while (b > 0 && b < hits[bestI].b && text[b - 1] != ' ') b++;
+        while (e < text.size() && e > hits[bestJ - 1].e && text[e] != ' ') e--;
+        windows.push_back({charStart(text, b), charStart(text, e)});
+    }
+    std::sort(windows.begin(), windows.end());
+
+    std::string out;
+    size_t h = 0;
+    for (size_t w = 0; w < windows.size(); w++) {
+        size_t b = windows[w].first, e = windows[w].second;
+        if (w > 0 && b < windows[w - 1].second) b = windows[w - 1].second;
+        if (b > 0 || w > 0) out += "... ";
+        while (h < hits.size() && hits[h].b < b) h++;
+        size_t pos = b;
+        for (; h < hits.size() && hits[h].e <= e; h++) {
+            out.append(text.data() + pos, hits[h].b - pos);
+            out += open_;
+            out.append(text.data() + hits[h].b, hits[h].e - hits[h].b);
+            out += close_;
+            pos = hits[h].e;
+        }
+        out.append(text.data() + pos, e - pos);
+    }
+    if (!windows.empty() && windows.back().second < text.size()) out += " ...";
+    return out;
+}
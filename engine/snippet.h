@@ -0,0 +1,23 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+
+class SnippetGenerator {
+public:
+    // stems: query terms as produced by the Tokenizer -> Stemmer pipeline.
+    explicit SnippetGenerator(std::vector<std::string> stems,
+                              std::string open = "[", std::string close = "]");
+
+    // Up to maxFragments windows of ~width bytes, chosen to cover the most
+    // distinct query terms, with matching words wrapped in open/close.
+    std::string make(std::string_view text, size_t width = 200, size_t maxFragments = 2) const;
+
+private:
+    std::vector<std::string> stems_;
+    std::string open_, close_;
+
+    struct Hit { size_t b, e; int term; };
+    std::vector<Hit> locate(std::string_view text) const;
+    int match(std::string_view word) const;
+};
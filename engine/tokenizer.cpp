@@ -10,7 +10,7 @@ bool Tokenizer::isAsciiWord(unsigned char c) {
     return std::isalnum(c) != 0;
 }
 
-bool Tokenizer::startsWith(const std::string& s, size_t i, const char* lit) {
+bool Tokenizer::startsWith(std::string_view s, size_t i, const char* lit) {
     for (size_t k = 0; lit[k]; k++) {
         if (i + k >= s.size()) return false;
         if (s[i + k] != lit[k]) return false;
@@ -18,15 +18,15 @@ bool Tokenizer::startsWith(const std::string& s, size_t i, const char* lit) {
     return true;
 }
 
-bool Tokenizer::isUrlStart(const std::string& s, size_t i) {
+bool Tokenizer::isUrlStart(std::string_view s, size_t i) {
     return startsWith(s, i, "http://") || startsWith(s, i, "https://") || startsWith(s, i, "www.");
 }
 
-bool Tokenizer::isEmailStartOrInside(const std::string& s, size_t i) {
+bool Tokenizer::isEmailStartOrInside(std::string_view s, size_t i) {
     return s[i] == '@';
 }
 
-size_t Tokenizer::skipUntilWhitespace(const std::string& s, size_t i) {
+size_t Tokenizer::skipUntilWhitespace(std::string_view s, size_t i) {
     while (i < s.size() && !std::isspace((unsigned char)s[i])) i++;
     return i;
 }
@@ -53,7 +53,7 @@ bool Tokenizer::normalizeCyr2(unsigned char lead, unsigned char trail,
     return false;
 }
 
-Tokenizer::Cp Tokenizer::readCp(const std::string& s, size_t i) {
+Tokenizer::Cp Tokenizer::readCp(std::string_view s, size_t i) {
     Cp cp;
 
     unsigned char c = (unsigned char)s[i];
@@ -126,7 +126,7 @@ Tokenizer::Cp Tokenizer::readCp(const std::string& s, size_t i) {
     return cp;
 }
 
-std::vector<std::string> Tokenizer::tokenize(const std::string& utf8) {
+std::vector<std::string> Tokenizer::tokenize(std::string_view utf8) {
     std::vector<std::string> out;
     out.reserve(256);
 
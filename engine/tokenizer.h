@@ -1,16 +1,17 @@
 #pragma once
 #include <string>
 #include <vector>
+#include <string_view>
 
 class Tokenizer {
 public:
-    static std::vector<std::string> tokenize(const std::string& utf8);
+    static std::vector<std::string> tokenize(std::string_view utf8);
 
 private:
-    static bool startsWith(const std::string& s, size_t i, const char* lit);
-    static bool isUrlStart(const std::string& s, size_t i);
-    static bool isEmailStartOrInside(const std::string& s, size_t i); // '@'
-    static size_t skipUntilWhitespace(const std::string& s, size_t i);
+    static bool startsWith(std::string_view s, size_t i, const char* lit);
+    static bool isUrlStart(std::string_view s, size_t i);
+    static bool isEmailStartOrInside(std::string_view s, size_t i); // '@'
+    static size_t skipUntilWhitespace(std::string_view s, size_t i);
     enum class CpType { Word, Joiner, Other };
 
     struct Cp {
@@ -25,7 +26,7 @@ private:
         bool isJoinerApos = false;
     };
 
-    static Cp readCp(const std::string& s, size_t i);
+    static Cp readCp(std::string_view s, size_t i);
 
     static unsigned char asciiLower(unsigned char c);
 
@@ -0,0 +1,196 @@
+#include "trace.h"
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <unistd.h>
+
+std::atomic<bool> Tracer::on_{false};
+std::atomic<uint32_t> Tracer::rate_{64};
+
+namespace {
+
+struct Event {
+    const char* name;
+    const char* cat;
+    uint64_t ts, dur;
+    std::string args;
+};
+
+// One per thread; the lock is only contended while stop() drains it.
+struct ThreadBuf {
+    std::mutex mu;
+    std::vector<Event> events;
+    uint32_t tid = 0;
+    size_t dropped = 0;
+    bool exited = false; // under Registry::mu; dropped once its events are written
+};
+
+constexpr size_t kMaxEventsPerThread = 1 << 20;
+
+struct Registry {
+    std::mutex mu;
+    std::vector<std::shared_ptr<ThreadBuf>> bufs;
+    std::string path;
+    uint64_t originNs = 0;
+    uint32_t nextTid = 1;
+};
+
+Registry& registry() {
+    static Registry* r = new Registry; // outlives threads still tracing at exit
+    return *r;
+}
+
+// Drops exited threads' buffers that hold nothing left to write; r.mu held.
+void pruneExited(Registry& r) {
+    auto& v = r.bufs;
+    v.erase(std::remove_if(v.begin(), v.end(), [](const std::shared_ptr<ThreadBuf>& b) {
+        std::lock_guard<std::mutex> bl(b->mu);
+        return b->exited && b->events.empty();
+    }), v.end());
+}
+
+// Unregisters the thread's buffer when it exits, so short-lived threads (one
+// per shard connection) do not pile up; events not yet written stay until stop().
+struct ThreadBufHolder {
+    std::shared_ptr<ThreadBuf> buf;
+    ~ThreadBufHolder() {
+        if (!buf) return;
+        Registry& r = registry();
+        std::lock_guard<std::mutex> lk(r.mu);
+        buf->exited = true;
+        pruneExited(r);
+    }
+};
+
+ThreadBuf& threadBuf() {
+    thread_local ThreadBufHolder h;
+    if (!h.buf) {
+        h.buf = std::make_shared<ThreadBuf>();
+        Registry& r = registry();
+        std::lock_guard<std::mutex> lk(r.mu);
+        h.buf->tid = r.nextTid++;
+        r.bufs.push_back(h.buf);
+    }
+    return *h.buf;
+}
+
+void appendJson(std::string& out, const std::string& s) {
+    out += '"';
+    for (char c : s) {
+        if (c == '"' || c == '\\') { out += '\\'; out += c; }
+        else if ((unsigned char)c < 0x20) {
+            char buf[8];
+            std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out += buf;
+        } else out += c;
+    }
+    out += '"';
+}
+
+} // namespace
+
+bool Tracer::sample() {
+    if (!on()) return false;
+    thread_local uint64_t x = 0x9e3779b97f4a7c15ull ^ (uint64_t)(uintptr_t)&x;
+    x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+    uint32_t rate = rate_.load(std::memory_order_relaxed);
+    return rate <= 1 || x % rate == 0;
+}
+
+bool Tracer::start(const std::string& path, uint32_t sampleRate) {
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lk(r.mu);
+    if (on()) return false;
+    for (auto& b : r.bufs) {
+        std::lock_guard<std::mutex> bl(b->mu);
+        b->events.clear();
+        b->dropped = 0;
+    }
+    pruneExited(r);
+    r.path = path;
+    r.originNs = nowNs();
+    rate_.store(sampleRate ? sampleRate : 1, std::memory_order_relaxed);
+    on_.store(true, std::memory_order_relaxed);
+    static bool atExit = false;
+    if (!atExit) { atExit = true; std::atexit([] { stop(); }); }
+    return true;
+}
+
+bool Tracer::startFromEnv(const std::string& suffix) {
+    const char* path = std::getenv("ENGINE_TRACE");
+    if (!path || !*path) return false;
+    const char* rate = std::getenv("ENGINE_TRACE_SAMPLE");
+    return start(path + suffix, rate ? (uint32_t)std::strtoul(rate, nullptr, 10) : 64);
+}
+
+void Tracer::complete(const char* name, const char* cat, uint64_t startNs, uint64_t endNs, std::string args) {
+    if (!on()) return;
+    ThreadBuf& b = threadBuf();
+    std::lock_guard<std::mutex> lk(b.mu);
+    if (b.events.size() >= kMaxEventsPerThread) { b.dropped++; return; }
+    b.events.push_back({name, cat, startNs, endNs - startNs, std::move(args)});
+}
+
+bool Tracer::stop() {
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lk(r.mu);
+    if (!on()) return false;
+    on_.store(false, std::memory_order_relaxed);
+
+    std::ofstream out(r.path, std::ios::trunc);
+    if (!out) return false;
+    int pid = (int)::getpid();
+    size_t dropped = 0;
+    out << "{\"traceEvents\":[\n"
+        << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"args\":{\"name\":\"engine\"}}";
+    std::string line;
+    char num[64];
+    for (auto& b : r.bufs) {
+        std::lock_guard<std::mutex> bl(b->mu);
+        dropped += b->dropped;
+        for (const Event& e : b->events) {
+            if (e.ts < r.originNs) continue;
+            line = ",\n{\"name\":";
+            appendJson(line, e.name);
+            line += ",\"cat\":";
+            appendJson(line, e.cat);
+            std::snprintf(num, sizeof(num), ",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f", (e.ts - r.originNs) / 1e3, e.dur / 1e3);
+            line += num;
+            line += ",\"pid\":" + std::to_string(pid) + ",\"tid\":" + std::to_string(b->tid);
+            if (!e.args.empty()) line += ",\"args\":{" + e.args + "}";
+            line += "}";
+            out << line;
+        }
+        b->events.clear();
+        b->events.shrink_to_fit();
+    }
+    pruneExited(r);
+    out << "\n],\"displayTimeUnit\":\"ms\",\"otherData\":{\"sample_rate\":" << rate_.load()
+        << ",\"dropped_events\":" << dropped << "}}\n";
+    return (bool)out.flush();
+}
+
+size_t Tracer::threadBuffers() {
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lk(r.mu);
+    return r.bufs.size();
+}
+
+void TraceSpan::arg(const char* key, int64_t v) {
+    if (!active()) return;
+    if (!args_.empty()) args_ += ',';
+    appendJson(args_, key);
+    args_ += ':' + std::to_string(v);
+}
+
+void TraceSpan::arg(const char* key, const std::string& v) {
+    if (!active()) return;
+    if (!args_.empty()) args_ += ',';
+    appendJson(args_, key);
+    args_ += ':';
+    appendJson(args_, v);
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include <string>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+// Timeline of the build and of queries as Chrome trace-event JSON (open in
+// chrome://tracing or ui.perfetto.dev). Off, a span costs one relaxed load.
+// Switched on by Tracer::start() (engine --trace FILE) or by the environment:
+//   ENGINE_TRACE=FILE          trace to FILE
+//   ENGINE_TRACE_SAMPLE=N      keep 1 of N per-document spans (default 64)
+// Events are buffered per thread and written by stop(), or at exit.
+
+class Tracer {
+public:
+    static bool on() { return on_.load(std::memory_order_relaxed); }
+    // For high-volume spans: on() and a 1-in-sampleRate coin flip.
+    static bool sample();
+
+    static bool start(const std::string& path, uint32_t sampleRate = 64);
+    // suffix is appended to the ENGINE_TRACE path, e.g. one file per child process.
+    static bool startFromEnv(const std::string& suffix = {});
+    // Writes the trace and switches tracing off; false if the file failed.
+    static bool stop();
+    static uint32_t sampleRate() { return rate_.load(std::memory_order_relaxed); }
+    // Per-thread event buffers still registered; those of exited threads go
+    // once their events are written.
+    static size_t threadBuffers();
+
+    static uint64_t nowNs() {
+        return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+    // name and cat must be string literals; args is a JSON object body or empty.
+    static void complete(const char* name, const char* cat, uint64_t startNs, uint64_t endNs, std::string args = {});
+
+private:
+    static std::atomic<bool> on_;
+    static std::atomic<uint32_t> rate_;
+};
+
+// Records [construction, destruction) as one complete event.
+class TraceSpan {
+public:
+    TraceSpan(const char* name, const char* cat) : TraceSpan(name, cat, Tracer::on()) {}
+    // Recorded only when on: pass Tracer::sample() for per-document spans, or
+    // a parent's active() to keep children with a sampled parent.
+    TraceSpan(const char* name, const char* cat, bool on)
+        : name_(name), cat_(cat), t0_(on ? Tracer::nowNs() : 0) {}
+    ~TraceSpan() { if (t0_) Tracer::complete(name_, cat_, t0_, Tracer::nowNs(), std::move(args_)); }
+
+    bool active() const { return t0_ != 0; }
+    void arg(const char* key, int64_t v);
+    void arg(const char* key, const std::string& v);
+
+private:
+    const char* name_;
+    const char* cat_;
+    uint64_t t0_;
+    std::string args_;
+};
@@ -0,0 +1,94 @@
+#include "url_store.h"
+#include <algorithm>
+#include <numeric>
+#include <istream>
+#include <ostream>
+
+static void putVarint(std::string& out, uint32_t v) {
+    while (v >= 0x80) { out.push_back((char)(v | 0x80)); v >>= 7; }
+    out.push_back((char)v);
+}
+
+static uint32_t getVarint(const char*& p) {
+    uint32_t v = 0;
+    for (int shift = 0;; shift += 7) {
+        unsigned char b = (unsigned char)*p++;
+        v |= (uint32_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) return v;
+    }
+}
+
+UrlStore::UrlStore(const std::vector<std::string>& urls) {
+    std::vector<uint32_t> order(urls.size());
+    std::iota(order.begin(), order.end(), 0u);
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return urls[a] < urls[b]; });
+
+    rank_.resize(urls.size());
+    const std::string* prev = nullptr;
+    for (size_t pos = 0; pos < order.size(); pos++) {
+        const std::string& u = urls[order[pos]];
+        rank_[order[pos]] = (uint32_t)pos;
+
+        if (pos % kBlock == 0) {
+            blockOff_.push_back((uint32_t)data_.size());
+            putVarint(data_, (uint32_t)u.size());
+            data_ += u;
+        } else {
+            size_t shared = 0, lim = std::min(prev->size(), u.size());
+            while (shared < lim && (*prev)[shared] == u[shared]) shared++;
+            putVarint(data_, (uint32_t)shared);
+            putVarint(data_, (uint32_t)(u.size() - shared));
+            data_.append(u, shared, std::string::npos);
+        }
+        prev = &u;
+    }
+    data_.shrink_to_fit();
+}
+
+std::string UrlStore::get(size_t id) const {
+    if (id >= rank_.size()) return {};
+    uint32_t pos = rank_[id];
+    const char* p = data_.data() + blockOff_[pos / kBlock];
+
+    uint32_t len = getVarint(p);
+    std::string u(p, len);
+    p += len;
+    for (uint32_t k = 0; k < pos % kBlock; k++) {
+        uint32_t shared = getVarint(p);
+        uint32_t suffix = getVarint(p);
+        u.resize(shared);
+        u.append(p, suffix);
+        p += suffix;
+    }
+    return u;
+}
+
+template <class T>
+static void putVec(std::ostream& out, const std::vector<T>& v) {
+    uint64_t n = v.size();
+    out.write((const char*)&n, sizeof(n));
+    out.write((const char*)v.data(), (std::streamsize)(n * sizeof(T)));
+}
+
+template <class T>
+static bool getVec(std::istream& in, std::vector<T>& v) {
+    uint64_t n = 0;
+    if (!in.read((char*)&n, sizeof(n))) return false;
+    v.resize(n);
+    return (bool)in.read((char*)v.data(), (std::streamsize)(n * sizeof(T)));
+}
+
+void UrlStore::save(std::ostream& out) const {
+    putVec(out, rank_);
+    putVec(out, blockOff_);
+    uint64_t n = data_.size();
+    out.write((const char*)&n, sizeof(n));
+    out.write(data_.data(), (std::streamsize)n);
+}
+
+bool UrlStore::load(std::istream& in) {
+    uint64_t n = 0;
+    if (!getVec(in, rank_) || !getVec(in, blockOff_) || !in.read((char*)&n, sizeof(n))) return false;
+    data_.resize(n);
+    return (bool)in.read(&data_[0], (std::streamsize)n);
+}
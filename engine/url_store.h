@@ -0,0 +1,28 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <iosfwd>
+#include <cstdint>
+
+// Immutable id -> URL map. URLs are sorted and front-coded in blocks of
+// kBlock: the block head is stored whole, every following URL as
+// (shared prefix length, suffix). rank_ maps a doc id to its sorted position.
+class UrlStore {
+public:
+    static constexpr size_t kBlock = 16;
+
+    UrlStore() = default;
+    explicit UrlStore(const std::vector<std::string>& urls);
+
+    size_t size() const { return rank_.size(); }
+    std::string get(size_t id) const;
+    size_t bytes() const { return data_.size() + rank_.size() * 4 + blockOff_.size() * 4; }
+
+    void save(std::ostream& out) const;
+    bool load(std::istream& in);
+
+private:
+    std::vector<uint32_t> rank_;
+    std::vector<uint32_t> blockOff_;
+    std::string data_;
+};
@@ -0,0 +1,381 @@
+#include "wal.h"
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <stdexcept>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+uint32_t crc32(const void* data, size_t n) {
+    static uint32_t table[256];
+    static bool init = [] {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+        return true;
+    }();
+    (void)init;
+
+    uint32_t c = 0xFFFFFFFFu;
+    auto p = (const unsigned char*)data;
+    for (size_t i = 0; i < n; i++) c = table[(c ^ p[i]) & 0xFF] ^ (c >> 8);
+    return c ^ 0xFFFFFFFFu;
+}
+
+template <class T>
+static void put(std::string& out, const T& v) { out.append((const char*)&v, sizeof(T)); }
+
+static void putStr(std::string& out, const std::string& s) {
+    put(out, (uint32_t)s.size());
+    out += s;
+}
+
+template <class T>
+static bool get(const char*& p, const char* end, T& v) {
+    if ((size_t)(end - p) < sizeof(T)) return false;
+    std::memcpy(&v, p, sizeof(T));
+    p += sizeof(T);
+    return true;
+}
+
+static bool getStr(const char*& p, const char* end, std::string& s) {
+    uint32_t n = 0;
+    if (!get(p, end, n) || (size_t)(end - p) < n) return false;
+    s.assign(p, n);
+    p += n;
+    return true;
+}
+
+static void encode(std::string& out, const WalRecord& r) {
+    std::string payload;
+    put(payload, r.lsn);
+    put(payload, (uint8_t)r.op);
+    put(payload, r.mark);
+    putStr(payload, r.url);
+    putStr(payload, r.text);
+    putStr(payload, r.source);
+    put(payload, r.fetchedAt);
+
+    put(out, (uint32_t)payload.size());
+    put(out, crc32(payload.data(), payload.size()));
+    out += payload;
+}
+
+static bool decode(const char* p, const char* end, WalRecord& r) {
+    uint8_t op = 0;
+    if (!get(p, end, r.lsn) || !get(p, end, op) || !get(p, end, r.mark)) return false;
+    r.op = (WalOp)op;
+    if (!getStr(p, end, r.url) || !getStr(p, end, r.text)) return false;
+    // Records written by older versions end early.
+    return (p == end || (getStr(p, end, r.source) && (p == end || get(p, end, r.fetchedAt)))) && p == end;
+}
+
+static std::string segmentName(uint64_t firstLsn) {
+    char buf[48];
+    std::snprintf(buf, sizeof(buf), "wal-%020llu.log", (unsigned long long)firstLsn);
+    return buf;
+}
+
+WriteAheadLog::WriteAheadLog(std::string dir, uint64_t segmentBytes)
+    : dir_(std::move(dir)), segmentBytes_(segmentBytes) {
+    ::mkdir(dir_.c_str(), 0755);
+}
+
+WriteAheadLog::~WriteAheadLog() {
+    if (fd_ >= 0) ::close(fd_);
+}
+
+std::vector<std::pair<uint64_t, std::string>> WriteAheadLog::segments() const {
+    std::vector<std::pair<uint64_t, std::string>> out;
+    if (DIR* d = ::opendir(dir_.c_str())) {
+        while (dirent* e = ::readdir(d)) {
+            unsigned long long lsn = 0;
+            if (std::sscanf(e->d_name, "wal-%20llu.log", &lsn) == 1) out.push_back({lsn, dir_ + "/" + e->d_name});
+        }
+        ::closedir(d);
+    }
+    std::sort(out.begin(), out.end());
+    return out;
+}
+
+uint64_t WriteAheadLog::recover(uint64_t fromLsn, const std::function<void(const WalRecord&)>& fn) {
+    std::lock_guard<std::mutex> lk(mu_);
+    uint64_t last = fromLsn;
+    auto segs = segments();
+
+    for (size_t k = 0; k < segs.size(); k++) {
+        std::ifstream in(segs[k].second, std::ios::binary);
+        std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+        size_t pos = 0;
+        bool torn = false;
+        WalRecord r;
+        while (pos < data.size()) {
+            uint32_t len = 0, crc = 0;
+            const char* p = data.data() + pos;
+            const char* end = data.data() + data.size();
+            if (!get(p, end, len) || !get(p, end, crc) || (size_t)(end - p) < len ||
+                crc32(p, len) != crc || !decode(p, p + len, r)) {
+                torn = true;
+                break;
+            }
+            pos += 8 + len;
+            last = std::max(last, r.lsn);
+            if (r.lsn > fromLsn) fn(r);
+        }
+
+        if (torn) {
+            std::cerr << "[wal] dropping torn tail of " << segs[k].second << " at byte " << pos << "\n";
+            if (::truncate(segs[k].second.c_str(), (off_t)pos) != 0) throw std::runtime_error("wal: truncate failed");
+            for (size_t j = k + 1; j < segs.size(); j++) std::remove(segs[j].second.c_str());
+            segs.resize(k + 1);
+            break;
+        }
+    }
+
+    nextLsn_ = last + 1;
+    durable_ = pendingLast_ = last;
+    if (segs.empty()) openSegment(nextLsn_);
+    else {
+        fd_ = ::open(segs.back().second.c_str(), O_WRONLY | O_APPEND);
+        if (fd_ < 0) throw std::runtime_error("wal: cannot open " + segs.back().second);
+        struct stat st {};
+        ::fstat(fd_, &st);
+        fileBytes_ = (uint64_t)st.st_size;
+    }
+    return last;
+}
+
+void WriteAheadLog::openSegment(uint64_t firstLsn) {
+    if (fd_ >= 0) ::close(fd_);
+    std::string path = dir_ + "/" + segmentName(firstLsn);
+    fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd_ < 0) throw std::runtime_error("wal: cannot create " + path);
+    fileBytes_ = 0;
+}
+
+void WriteAheadLog::writeAll(const std::string& buf) {
+    size_t len = buf.size();
+    bool crash = false;
+    if (crashAfter_ > 0 && len >= crashAfter_) { len = (size_t)crashAfter_; crash = true; }
+    else if (crashAfter_ > 0) crashAfter_ -= len;
+
+    size_t off = 0;
+    while (off < len) {
+        ssize_t w = ::write(fd_, buf.data() + off, len - off);
+        if (w < 0) throw std::runtime_error("wal: write failed");
+        off += (size_t)w;
+    }
+    if (crash) std::_Exit(42);
+    fileBytes_ += len;
+}
+
+uint64_t WriteAheadLog::append(std::vector<WalRecord>& recs) {
+    std::unique_lock<std::mutex> lk(mu_);
+    for (auto& r : recs) {
+        r.lsn = nextLsn_++;
+        encode(pending_, r);
+    }
+    uint64_t mine = nextLsn_ - 1;
+    pendingLast_ = mine;
+
+    while (durable_ < mine) {
+        if (!error_.empty()) throw std::runtime_error(error_);
+        if (flushing_) { cv_.wait(lk); continue; }
+
+        // Become the leader: write everything queued so far with one sync.
+        flushing_ = true;
+        std::string buf;
+        buf.swap(pending_);
+        uint64_t upTo = pendingLast_;
+        uint64_t firstLsn = durable_ + 1;
+        lk.unlock();
+
+        std::string err;
+        try {
+            if (fileBytes_ >= segmentBytes_) openSegment(firstLsn);
+            writeAll(buf);
+            if (::fdatasync(fd_) != 0) err = "wal: fdatasync failed";
+        } catch (const std::exception& e) {
+            err = e.what();
+        }
+
+        lk.lock();
+        flushing_ = false;
+        cv_.notify_all();
+        // What reached the file after a failed write or sync is unknown, so the
+        // log takes nothing more: this batch and every later one fail.
+        if (!err.empty()) {
+            error_ = err;
+            throw std::runtime_error(err);
+        }
+        durable_ = upTo;
+        syncs_++;
+    }
+    return mine;
+}
+
+void WriteAheadLog::truncate(uint64_t lsn) {
+    std::lock_guard<std::mutex> lk(mu_);
+    auto segs = segments();
+    // A file can go once the next file starts at or before lsn + 1.
+    for (size_t k = 0; k + 1 < segs.size(); k++) {
+        if (segs[k + 1].first <= lsn + 1) std::remove(segs[k].second.c_str());
+    }
+}
+
+uint64_t WriteAheadLog::lastLsn() const {
+    std::lock_guard<std::mutex> lk(mu_);
+    return nextLsn_ - 1;
+}
+
+static const char kCheckpointMagic[8] = {'I', 'S', 'C', 'K', 'P', 'T', '0', '4'};
+
+bool writeCheckpoint(const std::string& dir, const SegmentSet& set, uint64_t lsn, int64_t mark) {
+    std::string path = dir + "/checkpoint.bin";
+    std::string tmp = path + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        if (!out) return false;
+        out.write(kCheckpointMagic, sizeof(kCheckpointMagic));
+        out.write((const char*)&lsn, sizeof(lsn));
+        out.write((const char*)&mark, sizeof(mark));
+        uint64_t n = set.segs.size();
+        out.write((const char*)&n, sizeof(n));
+
+        for (const auto& s : set.segs) {
+            int32_t base = s.seg->baseId;
+            uint64_t span = s.span();
+            out.write((const char*)&base, sizeof(base));
+            out.write((const char*)&span, sizeof(span));
+            s.seg->urls.save(out);
+            uint8_t hasDocs = s.seg->docs.empty() ? 0 : 1;
+            out.write((const char*)&hasDocs, 1);
+            if (hasDocs) s.seg->docs.save(out);
+            s.seg->dups.save(out);
+            uint8_t hasDel = s.deleted ? 1 : 0;
+            out.write((const char*)&hasDel, 1);
+            if (hasDel) out.write((const char*)s.deleted->data(), (std::streamsize)(s.deleted->size() * 8));
+            s.seg->index.save(out);
+        }
+        out.flush();
+        if (!out) return false;
+    }
+
+    int fd = ::open(tmp.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    bool synced = ::fsync(fd) == 0;
+    ::close(fd);
+    if (!synced || std::rename(tmp.c_str(), path.c_str()) != 0) return false;
+    int dfd = ::open(dir.c_str(), O_RDONLY);
+    if (dfd < 0) return false;
+    synced = ::fsync(dfd) == 0;
+    ::close(dfd);
+    return synced;
+}
+
+bool loadCheckpoint(const std::string& dir, std::shared_ptr<SegmentSet>& set, uint64_t& lsn, int64_t& mark) {
+    std::ifstream in(dir + "/checkpoint.bin", std::ios::binary);
+    if (!in) return false;
+
+    char magic[sizeof(kCheckpointMagic)];
+    uint64_t n = 0;
+    if (!in.read(magic, sizeof(magic)) || std::memcmp(magic, kCheckpointMagic, sizeof(magic)) != 0) return false;
+    if (!in.read((char*)&lsn, sizeof(lsn)) || !in.read((char*)&mark, sizeof(mark)) ||
+        !in.read((char*)&n, sizeof(n))) return false;
+
+    auto out = std::make_shared<SegmentSet>();
+    for (uint64_t k = 0; k < n; k++) {
+        auto seg = std::make_shared<IndexSnapshot>(8);
+        int32_t base = 0;
+        uint64_t span = 0;
+        if (!in.read((char*)&base, sizeof(base)) || !in.read((char*)&span, sizeof(span))) return false;
+        seg->baseId = base;
+        if (!seg->urls.load(in) || seg->urls.size() != span) return false;
+        uint8_t hasDocs = 0;
+        if (!in.read((char*)&hasDocs, 1)) return false;
+        if (hasDocs && !seg->docs.load(in)) return false;
+        if (!seg->dups.load(in)) return false;
+
+        SegmentRef ref{nullptr, nullptr};
+        uint8_t hasDel = 0;
+        if (!in.read((char*)&hasDel, 1)) return false;
+        if (hasDel) {
+            auto bits = std::make_shared<std::vector<uint64_t>>((span + 63) / 64);
+            if (!in.read((char*)bits->data(), (std::streamsize)(bits->size() * 8))) return false;
+            ref.deleted = std::move(bits);
+        }
+        if (!seg->index.load(in)) return false;
+        ref.seg = std::move(seg);
+        out->segs.push_back(std::move(ref));
+    }
+    set = std::move(out);
+    return true;
+}
+
+WalRecovery recoverIndex(const std::string& dir, WriteAheadLog& wal, SegmentedIndex& segs) {
+    WalRecovery rec;
+    std::shared_ptr<SegmentSet> set;
+    if (loadCheckpoint(dir, set, rec.lsn, rec.mark)) {
+        segs.restore(std::move(set));
+        rec.fromCheckpoint = true;
+    }
+
+    std::vector<Document> upserts;
+    std::vector<std::string> deletes;
+    auto flush = [&] {
+        segs.apply(std::move(upserts), deletes);
+        upserts.clear();
+        deletes.clear();
+    };
+
+    rec.lsn = wal.recover(rec.lsn, [&](const WalRecord& r) {
+        rec.replayed++;
+        if (r.op == WalOp::Upsert) {
+            upserts.push_back({0, r.url, r.text, r.source, r.fetchedAt});
+        } else if (r.op == WalOp::Delete) {
+            if (!upserts.empty()) flush();
+            deletes.push_back(r.url);
+        } else if (r.op == WalOp::Mark) {
+            rec.mark = r.mark;
+        }
+    });
+    flush();
+    return rec;
+}
+
+uint64_t logAndApply(WriteAheadLog& wal, SegmentedIndex& segs, std::vector<Document> upserts,
+                     const std::vector<std::string>& deletes, int64_t mark) {
+    std::vector<WalRecord> recs;
+    recs.reserve(deletes.size() + upserts.size() + 1);
+    for (const auto& u : deletes) {
+        WalRecord r;
+        r.op = WalOp::Delete;
+        r.url = u;
+        recs.push_back(std::move(r));
+    }
+    for (const auto& d : upserts) {
+        WalRecord r;
+        r.op = WalOp::Upsert;
+        r.url = d.key;
+        r.text = d.text;
+        r.source = d.source;
+        r.fetchedAt = d.fetchedAt;
+        recs.push_back(std::move(r));
+    }
+    WalRecord m;
+    m.op = WalOp::Mark;
+    m.mark = mark;
+    recs.push_back(std::move(m));
+
+    uint64_t lsn = wal.append(recs);
+    segs.apply(std::move(upserts), deletes);
+    return lsn;
+}
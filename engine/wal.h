@@ -0,0 +1,91 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+#include "segments.h"
+
+enum class WalOp : uint8_t { Upsert = 1, Delete = 2, Mark = 3 };
+
+struct WalRecord {
+    uint64_t lsn = 0;
+    WalOp op = WalOp::Upsert;
+    std::string url;
+    std::string text;
+    std::string source;
+    int64_t fetchedAt = 0;
+    int64_t mark = 0;   // Mark: ingest watermark (fetched_at of the last applied batch)
+};
+
+// Append-only log split into files named wal-<first lsn>.log. Each record is
+//   u32 payload length | u32 crc32(payload) | payload
+// and recovery stops at the first short or corrupt record, truncating the tail.
+class WriteAheadLog {
+public:
+    explicit WriteAheadLog(std::string dir, uint64_t segmentBytes = 64ull << 20);
+    ~WriteAheadLog();
+
+    // Must be called once before append(). Calls fn for every intact record
+    // with lsn > fromLsn and returns the last lsn found in the log.
+    uint64_t recover(uint64_t fromLsn, const std::function<void(const WalRecord&)>& fn);
+
+    // Assigns lsns and returns once the records are on disk. Concurrent callers
+    // share one write+fdatasync (group commit). Throws if the write or sync
+    // fails; after that every append throws.
+    uint64_t append(std::vector<WalRecord>& recs);
+
+    // Removes log files whose records are all <= lsn.
+    void truncate(uint64_t lsn);
+
+    uint64_t lastLsn() const;
+    uint64_t syncCount() const { return syncs_; }
+
+    // Test hook: the process exits after this many more bytes hit the log,
+    // possibly in the middle of a record.
+    void setCrashPoint(uint64_t bytes) { crashAfter_ = bytes; }
+
+private:
+    std::string dir_;
+    uint64_t segmentBytes_;
+    int fd_ = -1;
+    uint64_t fileBytes_ = 0;
+
+    mutable std::mutex mu_;
+    std::condition_variable cv_;
+    std::string pending_;
+    uint64_t nextLsn_ = 1;
+    uint64_t pendingLast_ = 0;
+    uint64_t durable_ = 0;
+    bool flushing_ = false;
+    std::string error_;  // first write/sync failure; the log is unusable after it
+    uint64_t syncs_ = 0;
+    uint64_t crashAfter_ = 0;
+
+    std::vector<std::pair<uint64_t, std::string>> segments() const;
+    void openSegment(uint64_t firstLsn);
+    void writeAll(const std::string& buf);
+};
+
+// A checkpoint is a full copy of the segment set tagged with the lsn of the
+// last mutation it contains; written to a temp file and renamed into place.
+bool writeCheckpoint(const std::string& dir, const SegmentSet& set, uint64_t lsn, int64_t mark);
+bool loadCheckpoint(const std::string& dir, std::shared_ptr<SegmentSet>& set, uint64_t& lsn, int64_t& mark);
+
+struct WalRecovery {
+    bool fromCheckpoint = false;
+    uint64_t lsn = 0;       // last lsn applied
+    int64_t mark = 0;       // last ingest watermark seen
+    size_t replayed = 0;    // log records applied on top of the checkpoint
+};
+
+// Loads the latest checkpoint (if any) into segs and replays the log tail.
+WalRecovery recoverIndex(const std::string& dir, WriteAheadLog& wal, SegmentedIndex& segs);
+
+// Logs the mutations durably, then applies them to segs.
+uint64_t logAndApply(WriteAheadLog& wal, SegmentedIndex& segs, std::vector<Document> upserts,
+                     const std::vector<std::string>& deletes, int64_t mark);
+
+uint32_t crc32(const void* data, size_t n);
@@ -0,0 +1,269 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <unistd.h>
+
+#include "../engine/disk_index.h"
+#include "../engine/b_srch.h"
+#include "../engine/corpus_file.h"
+
+static int g_failed = 0;
+
+#define ASSERT_TRUE(cond) do { \
+    if (!(cond)) { \
+        std::cerr << "[FAIL] " << __FILE__ << ":" << __LINE__ << " ASSERT_TRUE(" #cond ")\n"; \
+        g_failed++; return; \
+    } \
+} while(0)
+
+#define ASSERT_EQ(a,b) do { \
+    auto _a = (a); auto _b = (b); \
+    if (!(_a == _b)) { \
+        std::cerr << "[FAIL] " << __FILE__ << ":" << __LINE__ << " ASSERT_EQ\n"; \
+        std::cerr << "  left:  " << _a << "\n"; \
+        std::cerr << "  right: " << _b << "\n"; \
+        g_failed++; return; \
+    } \
+} while(0)
+
+static void run(const char* name, void(*fn)()) {
+    int before = g_failed;
+    fn();
+    if (g_failed == before) std::cerr << "[OK]   " << name << "\n";
+}
+
+static const char* g_words[] = {"нефть", "газ", "рубль", "европа", "санкции", "биржа", "курс"};
+
+struct Corpus {
+    BooleanIndex idx;
+    UrlStore urls;
+    std::string path = "/tmp/disk_tests_index.bin";
+
+    explicit Corpus(int n) {
+        std::vector<std::string> u;
+        for (int i = 0; i < n; i++) {
+            std::string text;
+            for (int w = 0; w < 7; w++) if ((i * 7 + w * 3) % (w + 2) == 0) text += std::string(g_words[w]) + " ";
+            u.push_back("https://" + std::string(i % 3 ? "news.ru" : "lenta.ru") + "/" + std::to_string(i));
+            // Fetch times out of id order, spread over four days from 2023-11-14 22:13 UTC.
+            idx.addDocument({i, u.back(), text, i % 2 ? "rss" : "web", 1700000000 + (int64_t)(i * 7919 % n) * 345600 / n});
+        }
+        idx.finalize();
+        urls = UrlStore(u);
+    }
+    ~Corpus() { std::remove(path.c_str()); }
+};
+
+static void test_disk_index_matches_memory() {
+    Corpus c(5000);
+    ASSERT_TRUE(DiskIndex::write(c.idx, c.urls, c.path));
+
+    BlockCache cache(1 << 20);
+    DiskIndex disk;
+    ASSERT_TRUE(disk.open(c.path, &cache, 4));
+    ASSERT_EQ(disk.docsCount(), (size_t)5000);
+    ASSERT_EQ(disk.termsCount(), c.idx.termsCount());
+    ASSERT_EQ(disk.url(4321), c.urls.get(4321));
+
+    BooleanSearch mem(c.idx);
+    const char* queries[] = {"нефть", "газ OR рубль", "(нефть OR газ) AND NOT европа", "NOT курс",
+                             "санкции биржа source:rss", "host:lenta.ru нефть", "несуществующее"};
+    for (auto q : queries) {
+        std::vector<int> hits;
+        size_t n = 0;
+        ASSERT_TRUE(disk.search(q, hits));
+        ASSERT_TRUE(hits == mem.search(q));
+        ASSERT_TRUE(disk.count(q, n));
+        ASSERT_EQ(n, mem.count(q));
+    }
+}
+
+static void test_disk_index_time_ranges() {
+    Corpus c(5000);
+    ASSERT_TRUE(DiskIndex::write(c.idx, c.urls, c.path));
+    BlockCache cache(1 << 20);
+    DiskIndex disk;
+    ASSERT_TRUE(disk.open(c.path, &cache, 4));
+
+    BooleanSearch mem(c.idx);
+    const char* queries[] = {"нефть after:2023-11-16", "газ before:2023-11-15", "after:2023-11-17 AND NOT курс",
+                             "(нефть OR рубль) after:2023-11-15 before:2023-11-16", "before:2023-11-15 OR биржа"};
+    for (auto q : queries) {
+        std::vector<int> hits;
+        size_t n = 0;
+        auto expect = mem.search(q);
+        ASSERT_TRUE(!expect.empty() && expect.size() < 5000);
+        ASSERT_TRUE(disk.search(q, hits));
+        ASSERT_TRUE(hits == expect);
+        ASSERT_TRUE(disk.count(q, n));
+        ASSERT_EQ(n, expect.size());
+    }
+}
+
+static void test_block_cache_hits_and_eviction() {
+    Corpus c(20000);
+    ASSERT_TRUE(DiskIndex::write(c.idx, c.urls, c.path));
+
+    BlockCache cache(1 << 20);
+    DiskIndex disk;
+    ASSERT_TRUE(disk.open(c.path, &cache));
+
+    DiskQueryStats cold, warm;
+    std::vector<int> hits;
+    ASSERT_TRUE(disk.search("нефть OR газ", hits, &cold));
+    ASSERT_TRUE(disk.search("нефть OR газ", hits, &warm));
+    ASSERT_TRUE(cold.misses > 0);
+    // Each block counts once per query: reading a prefetched list is no hit.
+    ASSERT_TRUE(cold.hits < cold.misses);
+    ASSERT_EQ(cold.hits + cold.misses, warm.hits);
+    ASSERT_EQ(warm.misses, (size_t)0);
+    ASSERT_TRUE(warm.hitRate() == 1.0);
+
+    // Four blocks cannot hold the lists; results stay exact while blocks churn.
+    BlockCache tiny(4 * BlockCache::kBlockSize, 1);
+    DiskIndex small;
+    ASSERT_TRUE(small.open(c.path, &tiny));
+    DiskQueryStats a, b;
+    ASSERT_TRUE(small.search("нефть OR газ", hits, &a));
+    ASSERT_TRUE(hits == BooleanSearch(c.idx).search("нефть OR газ"));
+    ASSERT_TRUE(small.search("нефть OR газ", hits, &b));
+    ASSERT_TRUE(b.misses > 0);
+}
+
+static void test_disk_index_read_error_fails_query() {
+    Corpus c(5000);
+    ASSERT_TRUE(DiskIndex::write(c.idx, c.urls, c.path));
+    BlockCache cache(1 << 20);
+    DiskIndex disk;
+    ASSERT_TRUE(disk.open(c.path, &cache));
+
+    // Lists past the end of a file cut short after open() cannot be read.
+    ASSERT_EQ(::truncate(c.path.c_str(), 64), 0);
+    std::vector<int> hits;
+    size_t n = 0;
+    ASSERT_TRUE(!disk.search("нефть", hits));
+    ASSERT_TRUE(!disk.count("газ OR рубль", n));
+}
+
+static void test_corpus_file_roundtrip() {
+    const std::string path = "/tmp/disk_tests_corpus.bin";
+    std::vector<std::string> texts;
+    for (int i = 0; i < 3000; i++) {
+        std::string t;
+        for (int k = 0; k < 150; k++) t += std::string(g_words[(i * 7 + k) % 7]) + " ";
+        texts.push_back(t + std::to_string(i));
+    }
+    for (bool compress : {false, true}) {
+        CorpusWriter w;
+        ASSERT_TRUE(w.open(path, compress));
+        for (int i = 0; i < 3000; i++)
+            w.add({"https://example.com/" + std::to_string(i), texts[i], i % 2 ? "ria" : "", 1700000000 + i});
+        ASSERT_TRUE(w.finish());
+        ASSERT_TRUE(compress ? w.bytes() < w.rawBytes() / 4 : w.bytes() > w.rawBytes());
+
+        CorpusFile f;
+        ASSERT_TRUE(f.open(path));
+        ASSERT_TRUE(!f.bson());
+        ASSERT_EQ(f.docs(), (size_t)3000);
+        ASSERT_TRUE(f.parts() > 1);
+        std::vector<CorpusRecord> all;
+        std::vector<std::string> scratch(f.parts());
+        for (size_t p = 0; p < f.parts(); p++) ASSERT_TRUE(f.read(p, all, scratch[p]));
+        ASSERT_EQ(all.size(), (size_t)3000);
+        for (int i = 0; i < 3000; i += 499) {
+            ASSERT_EQ(all[i].url, "https://example.com/" + std::to_string(i));
+            ASSERT_EQ(all[i].text, texts[i]);
+            ASSERT_EQ(all[i].source, std::string(i % 2 ? "ria" : ""));
+            ASSERT_EQ(all[i].fetchedAt, (int64_t)1700000000 + i);
+        }
+    }
+
+    // A file cut short has no block index and is refused, not read partially.
+    std::FILE* in = std::fopen(path.c_str(), "rb");
+    std::string bytes(1 << 24, '\0');
+    bytes.resize(std::fread(&bytes[0], 1, bytes.size(), in));
+    std::fclose(in);
+    std::FILE* out = std::fopen(path.c_str(), "wb");
+    std::fwrite(bytes.data(), 1, bytes.size() / 2, out);
+    std::fclose(out);
+    CorpusFile cut;
+    ASSERT_TRUE(!cut.open(path));
+    ASSERT_TRUE(cut.error().find("truncated") != std::string::npos);
+    std::remove(path.c_str());
+}
+
+static void bsonElement(std::string& d, char type, const std::string& name, const std::string& value) {
+    d += type;
+    d += name;
+    d += '\0';
+    d += value;
+}
+
+static std::string bsonString(const std::string& s) {
+    int32_t n = (int32_t)s.size() + 1;
+    return std::string((const char*)&n, 4) + s + '\0';
+}
+
+static std::string bsonDocument(const std::string& body) {
+    int32_t n = (int32_t)body.size() + 5;
+    return std::string((const char*)&n, 4) + body + '\0';
+}
+
+static void test_mongodump_bson_fields() {
+    const std::string path = "/tmp/disk_tests_pages.bson";
+    std::string file;
+    for (int i = 0; i < 5; i++) {
+        std::string d;
+        bsonElement(d, '\x07', "_id", std::string(12, (char)i));
+        bsonElement(d, '\x02', "url", bsonString("https://example.com/" + std::to_string(i)));
+        std::string nested;
+        bsonElement(nested, '\x02', "text", bsonString("не то"));
+        bsonElement(d, '\x03', "meta", bsonDocument(nested));
+        if (i != 3) bsonElement(d, '\x02', "text", bsonString("нефть газ " + std::to_string(i)));
+        int64_t t = 1700000000 + i;
+        bsonElement(d, '\x12', "fetched_at", std::string((const char*)&t, 8));
+        bsonElement(d, '\x08', "ok", std::string(1, '\1'));
+        file += bsonDocument(d);
+    }
+    std::FILE* out = std::fopen(path.c_str(), "wb");
+    std::fwrite(file.data(), 1, file.size(), out);
+    std::fclose(out);
+
+    CorpusFile f;
+    ASSERT_TRUE(f.open(path));
+    ASSERT_TRUE(f.bson());
+    ASSERT_EQ(f.docs(), (size_t)5);
+    ASSERT_EQ(f.parts(), (size_t)1);
+    std::vector<CorpusRecord> recs;
+    std::string scratch;
+    ASSERT_TRUE(f.read(0, recs, scratch));
+    ASSERT_EQ(recs.size(), (size_t)4);  // the page without text is skipped
+    ASSERT_EQ(recs[3].url, std::string("https://example.com/4"));
+    ASSERT_EQ(recs[3].text, std::string("нефть газ 4"));
+    ASSERT_EQ(recs[3].fetchedAt, (int64_t)1700000004);
+    ASSERT_TRUE(recs[0].source.empty());
+
+    out = std::fopen(path.c_str(), "wb");
+    std::fwrite(file.data(), 1, file.size() - 3, out);
+    std::fclose(out);
+    CorpusFile cut;
+    ASSERT_TRUE(!cut.open(path));
+    std::remove(path.c_str());
+}
+
+int main() {
+    run("disk_index_matches_memory", test_disk_index_matches_memory);
+    run("disk_index_time_ranges", test_disk_index_time_ranges);
+    run("block_cache_hits_and_eviction", test_block_cache_hits_and_eviction);
+    run("disk_index_read_error_fails_query", test_disk_index_read_error_fails_query);
+    run("corpus_file_roundtrip", test_corpus_file_roundtrip);
+    run("mongodump_bson_fields", test_mongodump_bson_fields);
+
+    if (g_failed) {
+        std::cerr << "\nFAILED: " << g_failed << "\n";
+        return 1;
+    }
+    std::cerr << "\nALL TESTS PASSED\n";
+    return 0;
+}
@@ -1,12 +1,28 @@
 #include <iostream>
 #include <string>
 #include <vector>
+#include <algorithm>
+#include <regex>
+#include <cstring>
 
 #include "../engine/tokenizer.h"
 #include "../engine/stemmer.h"
 #include "../engine/hashTable.h"
 #include "../engine/b_idx.h"
 #include "../engine/b_srch.h"
+#include "../engine/reload.h"
+#include "../engine/segments.h"
+#include "../engine/url_store.h"
+#include "../engine/doc_store.h"
+#include "../engine/snippet.h"
+#include "../engine/dedup.h"
+#include "../engine/metrics.h"
+#include "../engine/trace.h"
+#include "../engine/perf_counters.h"
+#include "../engine/index_stats.h"
+#include <fstream>
+#include <thread>
+#include <sstream>
 
 static int g_failed = 0;
 
@@ -129,6 +145,32 @@ static void test_hashtable_rehash() {
     }
 }
 
+static void test_hashtable_batch_matches_single() {
+    // Batches larger than the table force growth, with repeats inside a batch.
+    HashTable batched(8), single(8);
+    std::vector<std::string> keys;
+    for (int i = 0; i < 100; i++) keys.push_back("k" + std::to_string(i % 70));
+    std::vector<std::vector<int>*> out(keys.size());
+    batched.getOrInsertBatch(keys.data(), keys.size(), out.data());
+    for (size_t i = 0; i < keys.size(); i++) {
+        out[i]->push_back((int)i);
+        single.getOrInsert(keys[i]).push_back((int)i);
+    }
+    ASSERT_EQ(batched.size(), (size_t)70);
+    ASSERT_TRUE(out[5] == out[75]);
+
+    std::vector<std::string> probes = {"k0", "k69", "k70", "", "k5"};
+    std::vector<const std::string*> ptrs;
+    for (auto& k : probes) ptrs.push_back(&k);
+    std::vector<const std::vector<int>*> found(probes.size());
+    batched.findBatch(ptrs.data(), ptrs.size(), found.data());
+    for (size_t i = 0; i < probes.size(); i++) {
+        auto* p = single.find(probes[i]);
+        ASSERT_EQ(found[i] != nullptr, p != nullptr);
+        if (p) ASSERT_TRUE(*found[i] == *p);
+    }
+}
+
 static BooleanIndex buildSmallIndex(std::vector<std::string>& urls) {
     std::vector<Document> docs;
     docs.push_back({0, "u0", "нефть и газ европа"});
@@ -174,6 +216,623 @@ static void test_boolean_search_implicit_and() {
     ASSERT_TRUE(hits[1] == 2);
 }
 
+static void test_boolean_search_source_host_filters() {
+    const char* hosts[] = {"https://www.rbc.ru/economics/", "https://lenta.ru/news/", "http://tass.ru/politika/"};
+    const char* sources[] = {"rbc", "lenta", "tass"};
+    BooleanIndex idx;
+    std::vector<int> oilRbc, rbc, notTass;
+    unsigned seed = 11;
+    for (int id = 0; id < 3000; id++) {
+        seed = seed * 1103515245u + 12345u;
+        int h = (int)((seed >> 16) % 3);
+        bool oil = (seed >> 8) % 2 == 0;
+        idx.addDocument({id, std::string(hosts[h]) + std::to_string(id), oil ? "нефть рубль" : "рубль", sources[h]});
+        if (h == 0) rbc.push_back(id);
+        if (h == 0 && oil) oilRbc.push_back(id);
+        if (h != 2 && oil) notTass.push_back(id);
+    }
+    // One page per section: sparse keys stay posting lists.
+    for (int id = 3000; id < 3010; id++) {
+        idx.addDocument({id, "https://blog.example/s" + std::to_string(id) + "/", "нефть", "blog"});
+        notTass.push_back(id);
+    }
+    idx.finalize();
+    ASSERT_TRUE(idx.bitmap(BooleanIndex::normalizeFilter("source", "rbc")) != nullptr);
+    ASSERT_TRUE(idx.bitmap(BooleanIndex::normalizeFilter("section", "s3004")) == nullptr);
+    BooleanSearch bs(idx);
+    bs.setParallel(4, 0);
+
+    ASSERT_TRUE(bs.search("нефть source:rbc") == oilRbc);
+    ASSERT_TRUE(bs.search("host:WWW.RBC.RU AND нефть") == oilRbc);
+    ASSERT_TRUE(bs.search("section:economics") == rbc);
+    ASSERT_TRUE(bs.search("нефть NOT host:tass.ru") == notTass);
+    ASSERT_EQ(bs.count("source:rbc нефть"), oilRbc.size());
+    ASSERT_EQ(bs.count("section:economics"), rbc.size());
+    ASSERT_EQ(bs.search("source:rbc OR source:lenta").size() + bs.search("source:tass").size(), (size_t)3000);
+    ASSERT_TRUE(bs.search("нефть section:s3004") == std::vector<int>{3004});
+    ASSERT_EQ(bs.count("section:s3004 OR section:s3007"), (size_t)2);
+    ASSERT_TRUE(bs.search("нефть source:nosuch").empty());
+}
+
+static void test_explain_and_profile() {
+    BooleanIndex idx;
+    for (int id = 0; id < 400; id++) {
+        std::string text = id % 2 ? "нефть" : "газ";
+        if (id % 5 == 0) text += " рубль";
+        idx.addDocument({id, "https://rbc.ru/economics/" + std::to_string(id), text, id % 4 ? "rbc" : "tass"});
+    }
+    idx.finalize();
+    BooleanSearch bs(idx);
+    const std::string q = "(нефти OR газ) AND NOT рубль source:rbc";
+
+    auto ex = bs.explain(q);
+    ASSERT_TRUE(!ex.executed);
+    ASSERT_TRUE(ex.masked);
+    ASSERT_EQ(ex.maskDocs, (size_t)300);
+    ASSERT_EQ(ex.steps.size(), (size_t)6);  // нефт газ OR рубл NOT AND
+    ASSERT_EQ(ex.steps[0].term, std::string("нефт"));
+    ASSERT_EQ(ex.steps[0].text, std::string("нефти"));
+    ASSERT_EQ(ex.steps[0].postings, (size_t)200);
+    ASSERT_EQ(ex.steps.back().op, std::string("AND"));
+    ASSERT_EQ(ex.steps.back().kernel, std::string("merge-and"));
+    ASSERT_EQ(ex.steps.back().args.size(), (size_t)2);
+
+    QueryProfile prof;
+    auto hits = bs.profile(q, prof);
+    ASSERT_TRUE(hits == bs.search(q));
+    ASSERT_EQ(prof.results, hits.size());
+    ASSERT_EQ(prof.steps.back().out, hits.size());
+    ASSERT_EQ(prof.steps[2].op, std::string("OR"));
+    ASSERT_EQ(prof.steps[2].out, (size_t)300);
+    ASSERT_EQ(prof.steps[2].in.size(), (size_t)2);
+    ASSERT_TRUE(prof.steps[2].bytes >= 300 * sizeof(int));
+    ASSERT_TRUE(prof.text().find("merge-not") != std::string::npos);
+    auto json = prof.json();
+    ASSERT_TRUE(json.front() == '{' && json.back() == '}');
+    ASSERT_TRUE(json.find("\"term\":\"нефт\"") != std::string::npos);
+}
+
+static void test_boolean_search_time_ranges_and_newest() {
+    const int64_t day = 86400, t0 = 1704067200; // 2024-01-01
+    for (bool ordered : {true, false}) {
+        BooleanIndex idx;
+        std::vector<int> oil;
+        for (int id = 0; id < 1000; id++) {
+            int64_t t = ordered ? t0 + id * day / 10 : t0 + (int64_t)((id * 7919) % 1000) * day / 10;
+            bool o = id % 3 == 0;
+            idx.addDocument({id, "u", o ? "нефть" : "газ", "", t});
+            if (o) oil.push_back(id);
+        }
+        idx.finalize();
+        ASSERT_TRUE(idx.timeOrdered() == ordered);
+        BooleanSearch bs(idx);
+
+        // 2024-02-01 .. 2024-03-01: days 31..59
+        std::vector<int> expect;
+        for (int id : oil) {
+            int64_t t = idx.timeOf(id);
+            if (t >= t0 + 31 * day && t < t0 + 60 * day) expect.push_back(id);
+        }
+        ASSERT_TRUE(!expect.empty());
+        ASSERT_TRUE(bs.search("нефть after:2024-02-01 before:2024-03-01") == expect);
+        ASSERT_EQ(bs.count("after:2024-02-01 нефть before:2024-03-01"), expect.size());
+        ASSERT_EQ(bs.search("(нефть OR газ) after:1706745600").size() + bs.search("NOT after:1706745600").size(), (size_t)1000);
+        // Out of int64 range: a plain term, not an exception.
+        ASSERT_TRUE(bs.search("нефть after:99999999999999999999").empty());
+
+        auto newest = bs.searchNewest("нефть", 5);
+        ASSERT_EQ(newest.size(), (size_t)5);
+        std::vector<int> byTime = oil;
+        std::sort(byTime.begin(), byTime.end(), [&](int a, int b) { return idx.timeOf(a) > idx.timeOf(b); });
+        for (size_t i = 0; i < 5; i++) ASSERT_EQ(newest[i], byTime[i]);
+    }
+}
+
+static void test_fuzzy_terms_levenshtein() {
+    std::vector<std::string> words;
+    const char* letters[] = {"а", "б", "в", "г", "д", "е", "з", "к", "н", "о", "п", "р", "т", "ф", "ь"};
+    for (int i = 0; i < 3000; i++) {
+        std::string w;
+        for (int k = 0, x = i * 7919 + 13; k < 3 + i % 6; k++, x = x * 31 + 7) w += letters[(unsigned)x % 15];
+        words.push_back(w);
+    }
+    std::vector<std::pair<std::string_view, uint32_t>> terms;
+    for (size_t i = 0; i < words.size(); i++) terms.push_back({words[i], (uint32_t)(i % 17)});
+    TermLexicon lex(terms);
+
+    for (int d = 1; d <= 2; d++) {
+        for (size_t i = 0; i < words.size(); i += 97) {
+            size_t visited = 0;
+            auto fast = lex.fuzzy(words[i], d, 1000, &visited);
+            auto slow = lex.fuzzyScan(words[i], d, 1000);
+            ASSERT_EQ(fast.size(), slow.size());
+            for (size_t k = 0; k < fast.size(); k++) ASSERT_EQ(fast[k].term, slow[k].term);
+            ASSERT_TRUE(visited < lex.size());
+        }
+    }
+
+    BooleanIndex idx;
+    idx.addDocument({0, "u0", "газпром и нефть"});
+    idx.addDocument({1, "u1", "нефтью торгуют"});
+    idx.addDocument({2, "u2", "газ"});
+    idx.finalize();
+    BooleanSearch s(idx);
+    ASSERT_TRUE(s.search("нефьт~1") == std::vector<int>({0, 1}));
+    ASSERT_TRUE(s.search("гозпром~1") == std::vector<int>({0}));
+    ASSERT_TRUE(s.search("гозпром~1 AND NOT нефть").empty());
+    ASSERT_TRUE(s.search("гозпрм~1").empty());
+    ASSERT_TRUE(s.search("гозпрм~2") == std::vector<int>({0}));
+    ASSERT_EQ(s.count("нефьт~ OR газ"), (size_t)3);
+}
+
+static void test_infix_and_regex_terms() {
+    // Trigram candidates plus verification must equal checking every term.
+    std::vector<std::string> words;
+    for (int i = 0; i < 2000; i++) {
+        std::string w;
+        for (int k = 0, x = i * 7919 + 13; k < 3 + i % 7; k++, x = x * 31 + 7) w += "abcdegkmor"[(unsigned)x % 10];
+        words.push_back(w);
+    }
+    std::vector<std::pair<std::string_view, uint32_t>> terms;
+    for (const auto& w : words) terms.push_back({w, 1});
+    TermLexicon lex(terms);
+    const char* patterns[] = {"abc.*", ".*gko.*", "ro(ad|c)ka.*", "[a-d]+mor", "ab?cd.*", "(abc|ddd)",
+                              "k+ora.*", "o{2}.*", "c\\w*", "...", "a.*b.*c"};
+    for (auto p : patterns) {
+        std::regex re(p);
+        size_t expect = 0;
+        for (size_t i = 0; i < lex.size(); i++) expect += std::regex_match(std::string(lex.term(i)), re);
+        ASSERT_EQ(lex.matching(p, 100000).size(), expect);
+    }
+    for (auto in : {"abc", "gk", "ddmo", "zzz"}) {
+        size_t expect = 0;
+        for (size_t i = 0; i < lex.size(); i++) expect += lex.term(i).find(in) != std::string_view::npos;
+        ASSERT_EQ(lex.containing(in, 100000).size(), expect);
+    }
+
+    BooleanIndex idx;
+    idx.addDocument({0, "u0", "газпром и нефть"});
+    idx.addDocument({1, "u1", "нефтегаз растёт"});
+    idx.addDocument({2, "u2", "газ дорожает"});
+    idx.addDocument({3, "u3", "уголь"});
+    idx.finalize();
+    BooleanSearch s(idx);
+    ASSERT_TRUE(s.search("*газ*") == std::vector<int>({0, 1, 2}));
+    ASSERT_TRUE(s.search("*газ* AND NOT нефть") == std::vector<int>({1, 2}));
+    ASSERT_TRUE(s.search("/нефт.*/") == std::vector<int>({0, 1}));
+    ASSERT_TRUE(s.search("/(газ|угол)/") == std::vector<int>({2, 3}));
+    ASSERT_TRUE(s.search("/г.з/") == std::vector<int>({2}));
+    ASSERT_TRUE(s.search("/\\u0433аз/") == std::vector<int>({2}));
+    ASSERT_TRUE(s.search("/уг\\u043eл/") == std::vector<int>({3}));
+    ASSERT_TRUE(s.search("/[/").empty());
+}
+
+static void test_completions_top_k_by_df() {
+    std::vector<std::string> words;
+    for (int i = 0; i < 3000; i++) {
+        std::string w = "газ";
+        for (int k = 0, x = i * 7919 + 13; k < 1 + i % 5; k++, x = x * 31 + 7) w += "abcdeklmno"[(unsigned)x % 10];
+        words.push_back(w);
+    }
+    std::vector<std::pair<std::string_view, uint32_t>> terms;
+    for (size_t i = 0; i < words.size(); i++) terms.push_back({words[i], (uint32_t)((i * 2654435761u) % 1000)});
+    std::sort(terms.begin(), terms.end());
+    terms.erase(std::unique(terms.begin(), terms.end(),
+        [](const auto& a, const auto& b) { return a.first == b.first; }), terms.end());
+    TermLexicon lex(terms);
+
+    for (auto prefix : {"", "г", "газ", "газa", "газab", "газklm", "газz"}) {
+        std::vector<std::pair<uint32_t, std::string>> expect;
+        for (size_t i = 0; i < lex.size(); i++)
+            if (lex.term(i).substr(0, std::strlen(prefix)) == prefix) expect.push_back({lex.df(i), std::string(lex.term(i))});
+        std::sort(expect.begin(), expect.end(), [](const auto& a, const auto& b) {
+            return a.first != b.first ? a.first > b.first : a.second < b.second;
+        });
+        auto got = lex.complete(prefix, 5);
+        ASSERT_EQ(got.size(), std::min<size_t>(5, expect.size()));
+        for (size_t i = 0; i < got.size(); i++) ASSERT_EQ(got[i].term, expect[i].second);
+    }
+
+    SegmentedIndex segs;
+    segs.apply({{0, "u0", "газпром газета"}, {0, "u1", "газета"}});
+    segs.apply({{0, "u2", "газета газон"}});
+    auto sugg = segs.acquire()->suggest(BooleanSearch::completionPrefix("нефть AND Газе"), 3);
+    ASSERT_EQ(sugg.size(), (size_t)1);
+    ASSERT_EQ(sugg[0].df, (uint32_t)3);
+    ASSERT_EQ(BooleanSearch::completionPrefix("нефть "), std::string());
+}
+
+static void test_near_duplicate_minhash_lsh() {
+    std::string base;
+    for (int i = 0; i < 80; i++) base += "слово" + std::to_string(i) + " ";
+    std::string edited = base + "добавлено";
+    std::string other;
+    for (int i = 0; i < 80; i++) other += "термин" + std::to_string(i) + " ";
+
+    auto sig = [](const std::string& t) { return NearDupDetector::signature(BooleanIndex::extractTerms(t)); };
+    NearDupDetector det(0.8);
+    ASSERT_EQ(det.findOrAdd(0, sig(base)), -1);
+    ASSERT_EQ(det.findOrAdd(1, sig(other)), -1);
+    ASSERT_EQ(det.findOrAdd(2, sig(edited)), 0);
+    ASSERT_EQ(det.size(), (size_t)2);
+
+    DuplicateList dups, back;
+    dups.add(0, "https://rbc.ru/a");
+    dups.add(0, "https://lenta.ru/a");
+    std::stringstream ss;
+    dups.save(ss);
+    ASSERT_TRUE(back.load(ss));
+    ASSERT_EQ(back.size(), (size_t)2);
+    ASSERT_TRUE(back.of(0) && (*back.of(0))[1] == "https://lenta.ru/a");
+    ASSERT_TRUE(back.of(1) == nullptr);
+}
+
+static void test_near_duplicate_bands_sharing_a_slot() {
+    // Random signatures fill the band table until some document has two bands
+    // probing to one slot; a probe sharing a single band with each document
+    // then walks every chain.
+    uint64_t x = 88172645463325252ull;
+    auto rnd = [&]() { x ^= x << 13; x ^= x >> 7; x ^= x << 17; return (uint32_t)x; };
+    const int n = 5000;
+    std::vector<NearDupDetector::Signature> sigs(n, NearDupDetector::Signature(NearDupDetector::kHashes));
+    NearDupDetector det(0.8);
+    for (int i = 0; i < n; i++) {
+        for (auto& v : sigs[i]) v = rnd();
+        ASSERT_EQ(det.findOrAdd(i, sigs[i]), -1);
+    }
+    for (int i = 0; i < n; i++) {
+        NearDupDetector::Signature probe(NearDupDetector::kHashes);
+        for (auto& v : probe) v = rnd();
+        int b = i % NearDupDetector::kBands;
+        for (int r = 0; r < NearDupDetector::kRows; r++)
+            probe[b * NearDupDetector::kRows + r] = sigs[i][b * NearDupDetector::kRows + r];
+        ASSERT_EQ(det.findOrAdd(n + i, probe), -1);
+    }
+    ASSERT_EQ(det.findOrAdd(-1, sigs[42]), 42);
+}
+
+static void test_reload_swap_keeps_old_snapshot_for_readers() {
+    IndexHolder holder;
+    int builds = 0;
+    IndexReloader reloader(holder, [&](IndexSnapshot& snap) {
+        builds++;
+        snap.index.addDocument({0, "u0", builds == 1 ? "нефть" : "газ"});
+        snap.index.finalize();
+        snap.urls = UrlStore({"u0"});
+        return true;
+    });
+
+    ASSERT_TRUE(reloader.rebuildNow("test"));
+    auto old = holder.acquire();
+    ASSERT_TRUE(old->generation == 1);
+
+    ASSERT_TRUE(reloader.rebuildNow("test"));
+    auto cur = holder.acquire();
+    ASSERT_TRUE(cur->generation == 2);
+
+    ASSERT_TRUE(BooleanSearch(old->index).search("нефть").size() == 1);
+    ASSERT_TRUE(BooleanSearch(cur->index).search("нефть").empty());
+    ASSERT_TRUE(BooleanSearch(cur->index).search("газ").size() == 1);
+}
+
+static void test_segments_upsert_delete_merge() {
+    SegmentMergePolicy policy;
+    policy.mergeFactor = 2;
+    policy.minSegmentDocs = 4;
+    SegmentedIndex segs(policy);
+
+    auto base = std::make_shared<IndexSnapshot>();
+    base->index.addDocument({0, "u0", "нефть европа"});
+    base->index.addDocument({1, "u1", "газ россия"});
+    base->index.finalize();
+    base->urls = UrlStore({"u0", "u1"});
+    segs.reset(base);
+
+    segs.apply({{0, "u2", "нефть санкции"}});
+    auto hits = segs.acquire()->search("нефть");
+    ASSERT_TRUE(vecEq(hits, {0, 2}));
+
+    segs.apply({{0, "u0", "газ европа"}});
+    auto set = segs.acquire();
+    ASSERT_TRUE(vecEq(set->search("нефть"), {2}));
+    ASSERT_TRUE(vecEq(set->search("газ"), {1, 3}));
+    ASSERT_TRUE(set->url(0).empty());
+    ASSERT_TRUE(set->url(3) == "u0");
+
+    segs.apply({}, {"u1"});
+    ASSERT_TRUE(vecEq(segs.acquire()->search("газ"), {3}));
+    ASSERT_TRUE(segs.segmentCount() == 3);
+
+    ASSERT_TRUE(segs.mergeOnce());
+    ASSERT_TRUE(segs.segmentCount() == 1);
+    set = segs.acquire();
+    ASSERT_TRUE(vecEq(set->search("нефть OR газ"), {2, 3}));
+    ASSERT_TRUE(vecEq(set->search("NOT газ"), {2}));
+    ASSERT_TRUE(set->liveDocs() == 2);
+}
+
+static void test_segments_skip_unchanged_refetch() {
+    SegmentedIndex segs;
+    auto base = std::make_shared<IndexSnapshot>();
+    base->index.addDocument({0, "u0", "нефть европа"});
+    base->index.addDocument({1, "u1", "газ россия"});
+    base->index.finalize();
+    base->urls = UrlStore({"u0", "u1"});
+    segs.reset(base, {SegmentedIndex::textHash("нефть европа"), SegmentedIndex::textHash("газ россия")});
+
+    std::vector<Document> batch = {{0, "u0", "нефть европа", "", 10}, {0, "u1", "газ сибирь", "", 10},
+                                   {0, "u2", "уголь", "", 10}};
+    ASSERT_EQ(segs.dropUnchanged(batch), (size_t)1);
+    ASSERT_EQ(batch.size(), (size_t)2);
+    segs.apply(batch);
+    ASSERT_TRUE(vecEq(segs.acquire()->search("нефть"), {0}));
+
+    // Unchanged since the last poll, and an older copy of a URL in the batch.
+    batch = {{0, "u1", "газ сибирь", "", 20}, {0, "u2", "уголь кокс", "", 30}, {0, "u2", "уголь", "", 20}};
+    ASSERT_EQ(segs.dropUnchanged(batch), (size_t)2);
+    ASSERT_EQ(batch.size(), (size_t)1);
+    ASSERT_EQ(batch[0].text, std::string("уголь кокс"));
+    ASSERT_EQ(segs.segmentCount(), (size_t)2);
+}
+
+static const char* g_words[] = {"нефть", "газ", "европа", "россия", "санкции", "уголь", "рубль"};
+
+// Word w appears in a doc with probability 1/(w+2), so lists range from
+// bitmap-dense to sparse.
+static BooleanIndex buildRandomIndex(int docs) {
+    BooleanIndex idx;
+    unsigned seed = 7;
+    for (int id = 0; id < docs; id++) {
+        std::string text;
+        for (int w = 0; w < 7; w++) {
+            seed = seed * 1103515245u + 12345u;
+            if ((seed >> 16) % (w + 2) == 0) text += std::string(g_words[w]) + " ";
+        }
+        idx.addDocument({id, "u", text});
+    }
+    idx.finalize();
+    return idx;
+}
+
+static void test_boolean_search_parallel_matches_serial() {
+    auto idx = buildRandomIndex(3000);
+    BooleanSearch serial(idx), parallel(idx);
+    serial.setParallel(1, 0);
+    parallel.setParallel(4, 0);
+    const char* queries[] = {
+        "нефть OR газ OR уголь",
+        "(нефть OR газ) AND NOT европа",
+        "NOT (рубль OR санкции) россия",
+        "нефть газ европа россия",
+    };
+    for (auto q : queries) {
+        ASSERT_TRUE(vecEq(serial.search(q), parallel.search(q)));
+    }
+}
+
+static void test_boolean_count_and_estimate() {
+    auto idx = buildRandomIndex(20000);
+    BooleanSearch bs(idx);
+    const char* queries[] = {
+        "нефть", "рубль", "нефть OR газ OR уголь", "(нефть OR газ) AND NOT европа",
+        "NOT (рубль OR санкции)", "нефть газ европа россия", "нефть AND рубль", "NOT нефть",
+    };
+    for (auto q : queries) {
+        size_t exact = bs.search(q).size();
+        ASSERT_EQ(bs.count(q), exact);
+        auto e = bs.estimate(q);
+        ASSERT_TRUE(!e.exact);
+        ASSERT_TRUE(e.lo <= (double)exact && (double)exact <= e.hi);
+    }
+}
+
+static void test_boolean_count_sparse_lists() {
+    // Short lists, so count() merges instead of using bitmaps; lists of very
+    // different lengths take the galloping intersection.
+    BooleanIndex idx;
+    for (int id = 0; id < 50000; id++) {
+        std::string text = "редкий" + std::to_string(id % 101) + " редкий" + std::to_string(id % 103);
+        if (id % 5000 == 0) text += " единичный";
+        idx.addDocument({id, "u", text});
+    }
+    idx.finalize();
+    BooleanSearch bs(idx);
+    const char* queries[] = {
+        "редкий3 AND редкий5", "редкий3 OR редкий5", "редкий3 AND NOT редкий5", "NOT редкий3 AND редкий5",
+        "редкий3 OR NOT редкий5", "единичный AND редкий0", "редкий0 AND единичный", "NOT NOT редкий7",
+        "(редкий1 OR редкий2) AND (редкий4 OR единичный)", "NOT редкий1 AND NOT редкий2", "нет AND редкий1",
+    };
+    for (auto q : queries) ASSERT_EQ(bs.count(q), bs.search(q).size());
+}
+
+static void test_url_store_front_coding_roundtrip() {
+    std::vector<std::string> urls;
+    for (int i = 0; i < 100; i++) {
+        urls.push_back("https://lenta.ru/news/2024/01/" + std::to_string(i % 30) + "/story" + std::to_string(i));
+        urls.push_back("https://www.rbc.ru/economics/" + std::to_string(i) + "/x");
+    }
+    urls.push_back("");
+    UrlStore st(urls);
+    ASSERT_TRUE(st.size() == urls.size());
+    size_t raw = 0;
+    for (size_t i = 0; i < urls.size(); i++) {
+        ASSERT_EQ(st.get(i), urls[i]);
+        raw += urls[i].size();
+    }
+    ASSERT_TRUE(st.bytes() < raw);
+
+    std::stringstream buf;
+    st.save(buf);
+    UrlStore back;
+    ASSERT_TRUE(back.load(buf));
+    for (size_t i = 0; i < urls.size(); i++) ASSERT_EQ(back.get(i), urls[i]);
+}
+
+static void test_doc_store_compressed_random_access() {
+    DocStore st;
+    std::vector<std::string> texts;
+    size_t raw = 0;
+    for (int i = 0; i < 3000; i++) {
+        texts.push_back("Новости " + std::to_string(i) + ": цены на нефть и газ выросли после заседания ОПЕК, "
+                        "сообщает агентство. Министр энергетики прокомментировал решение номер " +
+                        std::to_string(i * 7) + ".");
+        st.add(texts.back());
+        raw += texts.back().size();
+    }
+    st.finish();
+    ASSERT_TRUE(st.size() == texts.size());
+    ASSERT_TRUE(st.bytes() * 4 < raw);
+    ASSERT_EQ(st.get(0), texts[0]);
+    ASSERT_EQ(st.get(1777), texts[1777]);
+    ASSERT_EQ(st.get(2999), texts[2999]);
+    ASSERT_EQ(st.get(5), texts[5]);
+
+    std::stringstream buf;
+    st.save(buf);
+    DocStore back;
+    ASSERT_TRUE(back.load(buf));
+    ASSERT_EQ(back.get(1234), texts[1234]);
+}
+
+static void test_snippet_highlights_stemmed_terms() {
+    SnippetGenerator gen(BooleanSearch::queryTerms("нефть AND NOT газ"), "[", "]");
+    std::string text = "В понедельник рынок был спокоен. Цены на нефти выросли, а газ подешевел.";
+    auto snip = gen.make(text, 60, 1);
+    ASSERT_TRUE(snip.find("[нефти]") != std::string::npos);
+    ASSERT_TRUE(snip.find("[газ]") != std::string::npos);
+}
+
+static void test_metrics_counters_histograms_render() {
+    auto& m = Metrics::get();
+    Counter& c = m.counter("test_events_total{k=\"a\"}", "Test events");
+    ASSERT_TRUE(&c == &m.counter("test_events_total{k=\"a\"}", "Test events"));
+    std::vector<std::thread> ts;
+    for (int t = 0; t < 8; t++) ts.emplace_back([&c] { for (int i = 0; i < 10000; i++) c.add(); });
+    for (auto& t : ts) t.join();
+    ASSERT_EQ(c.value(), (uint64_t)80000);
+
+    Histogram& h = m.histogram("test_sizes", "Test sizes", {1, 10, 100});
+    for (double v : {0.5, 1.0, 5.0, 50.0, 500.0, 5000.0}) h.observe(v);
+    double sum = 0;
+    auto counts = h.counts(&sum);
+    ASSERT_EQ(counts.size(), (size_t)4);
+    ASSERT_EQ(counts[0], (uint64_t)2);
+    ASSERT_EQ(counts[3], (uint64_t)2);
+    ASSERT_TRUE(sum > 5556 && sum < 5557);
+
+    int calls = 0;
+    // Callbacks run outside the registry lock, so they may register metrics.
+    m.gauge("test_live", "Test gauge", [&calls, &m] {
+        m.counter("test_gauge_reads_total", "Test gauge reads").add();
+        return (double)++calls;
+    });
+    std::string text = m.render();
+    ASSERT_TRUE(text.find("# TYPE test_events_total counter\ntest_events_total{k=\"a\"} 80000\n") != std::string::npos);
+    ASSERT_TRUE(text.find("test_sizes_bucket{le=\"10\"} 3\n") != std::string::npos);
+    ASSERT_TRUE(text.find("test_sizes_bucket{le=\"+Inf\"} 6\n") != std::string::npos);
+    ASSERT_TRUE(text.find("test_sizes_count 6\n") != std::string::npos);
+    ASSERT_TRUE(text.find("test_live 1\n") != std::string::npos);
+    m.gauge("test_live", "Test gauge", [] { return 0.0; });
+}
+
+static void test_trace_spans_chrome_json() {
+    std::string path = "/tmp/general_tests_trace.json";
+    ASSERT_TRUE(Tracer::start(path, 1));
+    size_t buffers = Tracer::threadBuffers();
+    for (int t = 0; t < 20; t++) std::thread([] { TraceSpan span("short_thread", "test"); }).join();
+    ASSERT_EQ(Tracer::threadBuffers(), buffers + 20);
+    BooleanIndex idx(16);
+    for (int id = 0; id < 50; id++) idx.addDocument(id, "нефть газ " + std::to_string(id) + " рубль");
+    idx.finalize();
+    BooleanSearch s(idx);
+    ASSERT_EQ(s.search("нефть AND газ").size(), (size_t)50);
+    ASSERT_TRUE(Tracer::stop());
+    ASSERT_TRUE(!Tracer::on());
+    { TraceSpan off("after_stop", "test"); ASSERT_TRUE(!off.active()); }
+
+    std::ifstream in(path);
+    std::stringstream buf;
+    buf << in.rdbuf();
+    std::string json = buf.str();
+    ASSERT_TRUE(json.rfind("{\"traceEvents\":[", 0) == 0);
+    for (const char* name : {"extractTerms", "tokenize", "stem", "addTerms", "rehash", "finalize",
+                             "buildBitmaps", "plan", "evalRpn", "evalRange"})
+        ASSERT_TRUE(json.find("{\"name\":\"" + std::string(name) + "\",") != std::string::npos);
+    ASSERT_TRUE(json.find("\"ph\":\"X\"") != std::string::npos);
+    ASSERT_TRUE(json.find("after_stop") == std::string::npos);
+    ASSERT_TRUE(json.find("\"sample_rate\":1,") != std::string::npos);
+    // Exited threads' events were written, then their buffers released.
+    ASSERT_TRUE(json.find("short_thread") != std::string::npos);
+    ASSERT_TRUE(Tracer::threadBuffers() <= buffers + 1);
+}
+
+static void test_perf_counters_stages() {
+    PerfStages::reset();
+    PerfStages::enable();
+    BooleanIndex idx;
+    for (int id = 0; id < 20; id++) idx.addDocument(id, "цены на нефть выросли " + std::to_string(id));
+    idx.finalize();
+    PerfStages::enable(false);
+    idx.addDocument(20, "после выключения");
+
+    uint64_t calls = 0;
+    PerfSample insert = PerfStages::total(PerfStage::INSERT, &calls);
+    ASSERT_EQ(calls, (uint64_t)20);
+    PerfStages::total(PerfStage::FINALIZE, &calls);
+    ASSERT_EQ(calls, (uint64_t)1);
+
+    const PerfCounters& pc = PerfCounters::thread();
+    if (!pc.available()) {
+        // Containers usually refuse perf_event_open: everything reads as missing.
+        ASSERT_TRUE(!pc.error().empty());
+        ASSERT_TRUE(!insert.any());
+        ASSERT_EQ(insert.json(), std::string("null"));
+        ASSERT_TRUE(insert.text().empty());
+        return;
+    }
+    PerfSample a = pc.read();
+    volatile uint64_t x = 0;
+    for (int i = 0; i < 100000; i++) x = x + (uint64_t)i;
+    PerfSample d = pc.read() - a;
+    if (d.has[PerfSample::INSTRUCTIONS]) ASSERT_TRUE(d.v[PerfSample::INSTRUCTIONS] > 100000);
+    ASSERT_TRUE(insert.json().find("cycles") != std::string::npos || !insert.has[PerfSample::CYCLES]);
+}
+
+static void test_index_stats_over_segments() {
+    BooleanIndex a, b;
+    for (int id = 0; id < 100; id++) {
+        std::string text = "нефть";
+        if (id % 2 == 0) text += " газ";
+        if (id % 10 == 0) text += " уголь";
+        (id < 60 ? a : b).addDocument(id, text);
+        (id < 60 ? a : b).addAttributes(id, "https://example.com/news/" + std::to_string(id), "ria");
+    }
+    a.finalize();
+    b.finalize();
+
+    IndexStats st = computeIndexStats({&a, &b});
+    ASSERT_EQ(st.docs, (size_t)100);
+    ASSERT_EQ(st.terms, (size_t)3);
+    ASSERT_EQ(st.filterKeys, (size_t)3);
+    ASSERT_EQ(st.postings, (size_t)160);
+    ASSERT_EQ(st.maxPosting, (size_t)100);
+    ASSERT_EQ(st.top.size(), (size_t)3);
+    ASSERT_EQ(st.top[0].first, Stemmer::stem("нефть"));
+    ASSERT_EQ(st.top[1].second, (size_t)50);
+    ASSERT_EQ(st.top[2].second, (size_t)10);
+    ASSERT_EQ(st.postingHist.size(), (size_t)7);  // 10 -> [8,16), 50 -> [32,64), 100 -> [64,128)
+    ASSERT_EQ(st.growth.back().first, (size_t)160);
+    ASSERT_EQ(st.growth.back().second, (size_t)3);
+
+    size_t keys = 0;
+    for (size_t n : st.table.probes) keys += n;
+    ASSERT_EQ(keys, a.termsCount() + b.termsCount());
+    ASSERT_EQ(st.table.size, keys);
+    ASSERT_TRUE(st.memory.total() > 0);
+    ASSERT_TRUE(st.json().find("\"hash_table\":{\"capacity\":") != std::string::npos);
+    ASSERT_EQ(st.csv().size(), (size_t)8);
+}
+
 static void run(const char* name, void(*fn)()) {
     int before = g_failed;
     fn();
@@ -191,10 +850,33 @@ int main() {
 
     run("hashtable_insert_find", test_hashtable_insert_find);
     run("hashtable_rehash", test_hashtable_rehash);
+    run("hashtable_batch_matches_single", test_hashtable_batch_matches_single);
 
     run("boolean_index_postings", test_boolean_index_postings);
     run("boolean_search_and_or_not_parentheses", test_boolean_search_and_or_not_parentheses);
     run("boolean_search_implicit_and", test_boolean_search_implicit_and);
+    run("boolean_search_parallel_matches_serial", test_boolean_search_parallel_matches_serial);
+    run("boolean_count_and_estimate", test_boolean_count_and_estimate);
+    run("boolean_count_sparse_lists", test_boolean_count_sparse_lists);
+    run("boolean_search_source_host_filters", test_boolean_search_source_host_filters);
+    run("explain_and_profile", test_explain_and_profile);
+    run("boolean_search_time_ranges_and_newest", test_boolean_search_time_ranges_and_newest);
+
+    run("reload_swap_keeps_old_snapshot_for_readers", test_reload_swap_keeps_old_snapshot_for_readers);
+    run("segments_upsert_delete_merge", test_segments_upsert_delete_merge);
+    run("segments_skip_unchanged_refetch", test_segments_skip_unchanged_refetch);
+    run("fuzzy_terms_levenshtein", test_fuzzy_terms_levenshtein);
+    run("infix_and_regex_terms", test_infix_and_regex_terms);
+    run("completions_top_k_by_df", test_completions_top_k_by_df);
+    run("near_duplicate_minhash_lsh", test_near_duplicate_minhash_lsh);
+    run("near_duplicate_bands_sharing_a_slot", test_near_duplicate_bands_sharing_a_slot);
+    run("url_store_front_coding_roundtrip", test_url_store_front_coding_roundtrip);
+    run("doc_store_compressed_random_access", test_doc_store_compressed_random_access);
+    run("snippet_highlights_stemmed_terms", test_snippet_highlights_stemmed_terms);
+    run("metrics_counters_histograms_render", test_metrics_counters_histograms_render);
+    run("trace_spans_chrome_json", test_trace_spans_chrome_json);
+    run("perf_counters_stages", test_perf_counters_stages);
+    run("index_stats_over_segments", test_index_stats_over_segments);
 
     if (g_failed) {
         std::cerr << "\nFAILED: " << g_failed << "\n";
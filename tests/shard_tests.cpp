@@ -0,0 +1,199 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <memory>
+#include <algorithm>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include "../engine/shard.h"
+#include "../engine/segments.h"
+
+static int g_failed = 0;
+
+#define ASSERT_TRUE(cond) do { \
+    if (!(cond)) { \
+        std::cerr << "[FAIL] " << __FILE__ << ":" << __LINE__ << " ASSERT_TRUE(" #cond ")\n"; \
+        g_failed++; return; \
+    } \
+} while(0)
+
+#define ASSERT_EQ(a,b) do { \
+    auto _a = (a); auto _b = (b); \
+    if (!(_a == _b)) { \
+        std::cerr << "[FAIL] " << __FILE__ << ":" << __LINE__ << " ASSERT_EQ\n"; \
+        std::cerr << "  left:  " << _a << "\n"; \
+        std::cerr << "  right: " << _b << "\n"; \
+        g_failed++; return; \
+    } \
+} while(0)
+
+static void run(const char* name, void(*fn)()) {
+    int before = g_failed;
+    fn();
+    if (g_failed == before) std::cerr << "[OK]   " << name << "\n";
+}
+
+static const char* g_words[] = {"нефть", "газ", "рубль", "европа", "санкции"};
+
+static std::vector<Document> corpus(int n) {
+    std::vector<Document> docs;
+    for (int i = 0; i < n; i++) {
+        std::string text;
+        for (int w = 0; w < 5; w++) if ((i * 7 + w * 3) % (w + 2) == 0) text += std::string(g_words[w]) + " ";
+        docs.push_back({0, "https://news.ru/" + std::to_string(i), text, "", 1700000000 + i});
+    }
+    return docs;
+}
+
+struct LocalCluster {
+    std::vector<std::unique_ptr<SegmentedIndex>> segs;
+    std::vector<std::unique_ptr<ShardServer>> servers;
+    std::vector<ShardCoordinator::Endpoint> endpoints;
+
+    LocalCluster(const std::vector<Document>& docs, uint32_t shards) {
+        for (uint32_t s = 0; s < shards; s++) {
+            segs.push_back(std::make_unique<SegmentedIndex>());
+            std::vector<Document> mine;
+            for (const auto& d : docs) if (shardOf(d.key, shards) == s) mine.push_back(d);
+            segs.back()->apply(std::move(mine));
+            auto* idx = segs.back().get();
+            servers.push_back(std::make_unique<ShardServer>(0, [idx] { return idx->acquire(); }));
+            servers.back()->start();
+            endpoints.push_back({"127.0.0.1", servers.back()->port()});
+        }
+    }
+};
+
+static void test_scatter_gather_matches_single_index() {
+    auto docs = corpus(600);
+    SegmentedIndex single;
+    single.apply(docs);
+    auto all = single.acquire();
+
+    LocalCluster cluster(docs, 3);
+    ShardCoordinator coord(cluster.endpoints, std::chrono::milliseconds(2000));
+
+    const char* queries[] = {"нефть", "газ OR рубль", "(нефть OR газ) AND NOT европа", "санкции рубль"};
+    for (auto q : queries) {
+        auto r = coord.count(q);
+        ASSERT_TRUE(!r.partial());
+        ASSERT_EQ(r.shardsOk, (size_t)3);
+        ASSERT_EQ(r.total, all->count(q));
+
+        auto s = coord.search(q, 10000);
+        ASSERT_EQ(s.total, all->search(q).size());
+        ASSERT_EQ(s.hits.size(), s.total);
+
+        auto n = coord.newest(q, 5);
+        auto expect = all->searchNewest(q, 5);
+        ASSERT_EQ(n.hits.size(), expect.size());
+        for (size_t i = 0; i < expect.size(); i++) ASSERT_EQ(n.hits[i].url, all->url(expect[i]));
+    }
+}
+
+static void test_slow_shard_gives_partial_result() {
+    auto docs = corpus(200);
+    LocalCluster cluster(docs, 2);
+
+    SegmentedIndex slowIdx;
+    slowIdx.apply(docs);
+    ShardServer slow(0, [&slowIdx] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(400));
+        return slowIdx.acquire();
+    });
+    ASSERT_TRUE(slow.start());
+
+    auto eps = cluster.endpoints;
+    eps.push_back({"127.0.0.1", slow.port()});
+    eps.push_back({"127.0.0.1", 1}); // nothing listens there
+    ShardCoordinator coord(eps, std::chrono::milliseconds(150));
+
+    auto t0 = std::chrono::steady_clock::now();
+    auto r = coord.count("нефть");
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+    ASSERT_TRUE(ms < 350);
+    ASSERT_EQ(r.shardsOk, (size_t)2);
+    ASSERT_EQ(r.shardsFailed, (size_t)2);
+    ASSERT_TRUE(r.partial());
+
+    size_t expect = 0;
+    for (auto& s : cluster.segs) expect += s->acquire()->count("нефть");
+    ASSERT_EQ(r.total, expect);
+}
+
+static void test_server_binds_loopback_by_default() {
+    SegmentedIndex idx;
+    ShardServer local(0, [&idx] { return idx.acquire(); });
+    ASSERT_TRUE(local.start());
+    ShardCoordinator coord({{"127.0.0.1", local.port()}}, std::chrono::milliseconds(500));
+    ASSERT_EQ(coord.count("нефть").shardsOk, (size_t)1);
+
+    ShardServer bad(0, [&idx] { return idx.acquire(); }, "not-an-address");
+    ASSERT_TRUE(!bad.start());
+}
+
+// Answers every connection with a fixed reply, as a broken shard would.
+struct FakeShard {
+    int fd = -1;
+    uint16_t port = 0;
+    std::thread th;
+
+    explicit FakeShard(std::string reply) {
+        fd = ::socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in a{};
+        a.sin_family = AF_INET;
+        a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t len = sizeof(a);
+        ::bind(fd, (sockaddr*)&a, sizeof(a));
+        ::listen(fd, 8);
+        ::getsockname(fd, (sockaddr*)&a, &len);
+        port = ntohs(a.sin_port);
+        th = std::thread([this, reply] {
+            int c;
+            while ((c = ::accept(fd, nullptr, nullptr)) >= 0) {
+                char buf[256];
+                ::recv(c, buf, sizeof(buf), 0);
+                ::send(c, reply.data(), reply.size(), MSG_NOSIGNAL);
+                ::close(c);
+            }
+        });
+    }
+    ~FakeShard() {
+        ::shutdown(fd, SHUT_RDWR);
+        ::close(fd);
+        th.join();
+    }
+};
+
+static void test_malformed_reply_fails_shard() {
+    auto docs = corpus(200);
+    LocalCluster cluster(docs, 1);
+    FakeShard badTotal("OK\t12x\t0\n"), badCount("OK\t5\n"), badHit("OK\t1\t1\nsoon\thttps://x.ru/\n"),
+              huge("OK\t99999999999999999999999\t0\n");
+    auto eps = cluster.endpoints;
+    for (auto* f : {&badTotal, &badCount, &badHit, &huge}) eps.push_back({"127.0.0.1", f->port});
+    ShardCoordinator coord(eps, std::chrono::milliseconds(1000));
+
+    auto r = coord.search("нефть", 10);
+    ASSERT_EQ(r.shardsOk, (size_t)1);
+    ASSERT_EQ(r.shardsFailed, (size_t)4);
+    ASSERT_EQ(r.total, cluster.segs[0]->acquire()->search("нефть").size());
+}
+
+int main() {
+    run("scatter_gather_matches_single_index", test_scatter_gather_matches_single_index);
+    run("slow_shard_gives_partial_result", test_slow_shard_gives_partial_result);
+    run("server_binds_loopback_by_default", test_server_binds_loopback_by_default);
+    run("malformed_reply_fails_shard", test_malformed_reply_fails_shard);
+
+    if (g_failed) {
+        std::cerr << "\nFAILED: " << g_failed << "\n";
+        return 1;
+    }
+    std::cerr << "\nALL TESTS PASSED\n";
+    return 0;
+}
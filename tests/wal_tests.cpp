@@ -0,0 +1,250 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <fstream>
+#include <cstdlib>
+#include <cstdio>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+
+#include "../engine/wal.h"
+#include "../engine/b_srch.h"
+
+static int g_failed = 0;
+
+#define ASSERT_TRUE(cond) do { \
+    if (!(cond)) { \
+        std::cerr << "[FAIL] " << __FILE__ << ":" << __LINE__ << " ASSERT_TRUE(" #cond ")\n"; \
+        g_failed++; return; \
+    } \
+} while(0)
+
+#define ASSERT_EQ(a,b) do { \
+    auto _a = (a); auto _b = (b); \
+    if (!(_a == _b)) { \
+        std::cerr << "[FAIL] " << __FILE__ << ":" << __LINE__ << " ASSERT_EQ\n"; \
+        std::cerr << "  left:  " << _a << "\n"; \
+        std::cerr << "  right: " << _b << "\n"; \
+        g_failed++; return; \
+    } \
+} while(0)
+
+static void run(const char* name, void(*fn)()) {
+    int before = g_failed;
+    fn();
+    if (g_failed == before) std::cerr << "[OK]   " << name << "\n";
+}
+
+static std::string tempDir() {
+    char tmpl[] = "/tmp/wal_testXXXXXX";
+    return mkdtemp(tmpl);
+}
+
+static WalRecord upsert(const std::string& url, const std::string& text) {
+    WalRecord r;
+    r.op = WalOp::Upsert;
+    r.url = url;
+    r.text = text;
+    return r;
+}
+
+// Runs fn in a child process and returns its exit code; the WAL crash point
+// makes the child die in the middle of a write.
+template <class F>
+static int inChild(F&& fn) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        fn();
+        std::_Exit(0);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+static std::shared_ptr<IndexSnapshot> smallBase() {
+    auto base = std::make_shared<IndexSnapshot>(64);
+    base->index.addDocument({0, "u0", "нефть европа"});
+    base->index.addDocument({1, "u1", "газ россия"});
+    base->index.finalize();
+    base->urls = UrlStore({"u0", "u1"});
+    return base;
+}
+
+static void test_append_and_recover() {
+    auto dir = tempDir();
+    {
+        WriteAheadLog wal(dir);
+        wal.recover(0, [](const WalRecord&) {});
+        std::vector<WalRecord> recs = {upsert("a", "нефть"), upsert("b", "газ")};
+        ASSERT_EQ(wal.append(recs), (uint64_t)2);
+        std::vector<WalRecord> more = {upsert("c", "уголь")};
+        ASSERT_EQ(wal.append(more), (uint64_t)3);
+    }
+    WriteAheadLog wal(dir);
+    std::vector<std::string> urls;
+    uint64_t last = wal.recover(1, [&](const WalRecord& r) { urls.push_back(r.url); });
+    ASSERT_EQ(last, (uint64_t)3);
+    ASSERT_TRUE(urls.size() == 2);
+    ASSERT_EQ(urls[0], std::string("b"));
+    ASSERT_EQ(urls[1], std::string("c"));
+}
+
+static void test_crash_mid_record_drops_torn_tail() {
+    auto dir = tempDir();
+    int code = inChild([&] {
+        WriteAheadLog wal(dir);
+        wal.recover(0, [](const WalRecord&) {});
+        for (int i = 0; i < 5; i++) {
+            std::vector<WalRecord> r = {upsert("u" + std::to_string(i), "текст")};
+            wal.append(r);
+        }
+        wal.setCrashPoint(10);
+        std::vector<WalRecord> r = {upsert("torn", "не должен появиться")};
+        wal.append(r);
+    });
+    ASSERT_EQ(code, 42);
+
+    WriteAheadLog wal(dir);
+    size_t n = 0;
+    bool sawTorn = false;
+    uint64_t last = wal.recover(0, [&](const WalRecord& r) { n++; sawTorn |= r.url == "torn"; });
+    ASSERT_EQ(n, (size_t)5);
+    ASSERT_TRUE(!sawTorn);
+    ASSERT_EQ(last, (uint64_t)5);
+
+    std::vector<WalRecord> r = {upsert("after", "газ")};
+    ASSERT_EQ(wal.append(r), (uint64_t)6);
+}
+
+static void test_corrupt_record_stops_replay() {
+    auto dir = tempDir();
+    {
+        WriteAheadLog wal(dir);
+        wal.recover(0, [](const WalRecord&) {});
+        std::vector<WalRecord> recs = {upsert("a", "нефть"), upsert("b", "газ"), upsert("c", "уголь")};
+        wal.append(recs);
+    }
+    std::string path = dir + "/wal-00000000000000000001.log";
+    std::fstream f(path, std::ios::in | std::ios::out | std::ios::binary);
+    std::string data((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+    size_t pos = data.find("газ");
+    ASSERT_TRUE(pos != std::string::npos);
+    f.seekp((std::streamoff)pos);
+    f.put('X');
+    f.close();
+
+    WriteAheadLog wal(dir);
+    size_t n = 0;
+    wal.recover(0, [&](const WalRecord&) { n++; });
+    ASSERT_EQ(n, (size_t)1);
+}
+
+static void test_group_commit_shares_syncs() {
+    auto dir = tempDir();
+    WriteAheadLog wal(dir);
+    wal.recover(0, [](const WalRecord&) {});
+
+    std::vector<std::thread> th;
+    for (int t = 0; t < 8; t++) {
+        th.emplace_back([&, t] {
+            for (int i = 0; i < 50; i++) {
+                std::vector<WalRecord> r = {upsert("t" + std::to_string(t) + "_" + std::to_string(i), "x")};
+                wal.append(r);
+            }
+        });
+    }
+    for (auto& x : th) x.join();
+    ASSERT_EQ(wal.lastLsn(), (uint64_t)400);
+    ASSERT_TRUE(wal.syncCount() <= 400);
+
+    WriteAheadLog re(dir);
+    size_t n = 0;
+    re.recover(0, [&](const WalRecord&) { n++; });
+    ASSERT_EQ(n, (size_t)400);
+}
+
+static void test_failed_write_fails_every_later_append() {
+    auto dir = tempDir();
+    WriteAheadLog wal(dir, 1);
+    wal.recover(0, [](const WalRecord&) {});
+    std::vector<WalRecord> r = {upsert("a", "нефть")};
+    wal.append(r);
+
+    // The next append rolls to a new file, which can't be created any more.
+    std::remove((dir + "/wal-00000000000000000001.log").c_str());
+    ::rmdir(dir.c_str());
+    std::vector<std::thread> th;
+    int failed = 0;
+    std::mutex mu;
+    for (int t = 0; t < 4; t++) {
+        th.emplace_back([&] {
+            std::vector<WalRecord> x = {upsert("b", "газ")};
+            try { wal.append(x); } catch (const std::exception&) { std::lock_guard<std::mutex> lk(mu); failed++; }
+        });
+    }
+    for (auto& x : th) x.join();
+    ASSERT_EQ(failed, 4);
+
+    ::mkdir(dir.c_str(), 0755);
+    bool threw = false;
+    try { wal.append(r); } catch (const std::exception&) { threw = true; }
+    ASSERT_TRUE(threw);
+    ASSERT_EQ(wal.syncCount(), (uint64_t)1);
+}
+
+static void test_checkpoint_then_crash_replays_only_tail() {
+    auto dir = tempDir();
+    int code = inChild([&] {
+        WriteAheadLog wal(dir, 256);
+        SegmentedIndex segs;
+        recoverIndex(dir, wal, segs);
+        segs.reset(smallBase());
+
+        logAndApply(wal, segs, {{0, "u2", "нефть санкции"}}, {}, 100);
+        logAndApply(wal, segs, {{0, "u3", "уголь"}}, {}, 101);
+        uint64_t lsn = wal.lastLsn();
+        writeCheckpoint(dir, *segs.acquire(), lsn, 101);
+        wal.truncate(lsn);
+
+        logAndApply(wal, segs, {{0, "u0", "газ европа"}}, {}, 102);
+        logAndApply(wal, segs, {}, {"u3"}, 103);
+        wal.setCrashPoint(7);
+        logAndApply(wal, segs, {{0, "u4", "нефть"}}, {}, 104);
+    });
+    ASSERT_EQ(code, 42);
+
+    WriteAheadLog wal(dir, 256);
+    SegmentedIndex segs;
+    auto rec = recoverIndex(dir, wal, segs);
+    ASSERT_TRUE(rec.fromCheckpoint);
+    ASSERT_EQ(rec.replayed, (size_t)4);
+    ASSERT_EQ(rec.mark, (int64_t)103);
+
+    auto set = segs.acquire();
+    auto hits = set->search("нефть");
+    ASSERT_TRUE(hits.size() == 1);
+    ASSERT_EQ(set->url(hits[0]), std::string("u2"));
+    ASSERT_TRUE(set->search("уголь").empty());
+    ASSERT_EQ(set->search("газ").size(), (size_t)2);
+    ASSERT_EQ(set->liveDocs(), (size_t)3);
+}
+
+int main() {
+    run("append_and_recover", test_append_and_recover);
+    run("crash_mid_record_drops_torn_tail", test_crash_mid_record_drops_torn_tail);
+    run("corrupt_record_stops_replay", test_corrupt_record_stops_replay);
+    run("group_commit_shares_syncs", test_group_commit_shares_syncs);
+    run("failed_write_fails_every_later_append", test_failed_write_fails_every_later_append);
+    run("checkpoint_then_crash_replays_only_tail", test_checkpoint_then_crash_replays_only_tail);
+
+    if (g_failed) {
+        std::cerr << "\nFAILED: " << g_failed << "\n";
+        return 1;
+    }
+    std::cerr << "\nALL TESTS PASSED\n";
+    return 0;
+}
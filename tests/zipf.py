@@ -1,4 +1,5 @@
 import argparse
+import json
 import math
 import re
 from collections import Counter
@@ -60,11 +61,69 @@ def fit_zipf(rank, freq, r_min=1, r_max=50000):
     return C, s
 
 
+def fit_heaps(points):
+    """Least squares of log V = log K + beta * log n over (tokens, distinct terms) points."""
+    pts = [(math.log(n), math.log(v)) for n, v in points if n > 0 and v > 0]
+    if len(pts) < 2:
+        return None
+    x_mean = sum(x for x, _ in pts) / len(pts)
+    y_mean = sum(y for _, y in pts) / len(pts)
+    den = sum((x - x_mean) ** 2 for x, _ in pts)
+    if den == 0:
+        return None
+    beta = sum((x - x_mean) * (y - y_mean) for x, y in pts) / den
+    return math.exp(y_mean - beta * x_mean), beta
+
+
+def fit_lengths(lengths):
+    """Mean and standard deviation of log document length (tokens)."""
+    logs = [math.log(n) for n in lengths if n > 0]
+    if not logs:
+        return None
+    mu = sum(logs) / len(logs)
+    return mu, math.sqrt(sum((x - mu) ** 2 for x in logs) / len(logs))
+
+
+def plot_stats(path, out):
+    """Rank/df curve and fits computed by the engine from a built index (document frequencies of stems)."""
+    with open(path, encoding="utf-8") as f:
+        st = json.load(f)
+    z, h, l = st["zipf"], st["heaps"], st["doc_length"]
+    print(f"Docs: {st['docs']}, terms: {st['terms']}, postings: {st['postings']}")
+    print(f"Fitted Zipf: df(r) = {z['c']:.3g} * r^(-{z['s']:.3f})  (fit ranks {z['r_min']}-{z['r_max']})")
+    print(f"Fitted Heaps: V(n) = {h['k']:.3g} * n^{h['beta']:.3f}  (n = postings)")
+    print(f"Doc length (distinct terms): log-normal mu={l['mu']:.3f} sigma={l['sigma']:.3f}")
+
+    ranks = [r for r, _ in st["rank_df"]]
+    dfs = [d for _, d in st["rank_df"]]
+    fig, (a1, a2) = plt.subplots(1, 2, figsize=(14, 6))
+    a1.loglog(ranks, dfs, label="Index document frequencies", linewidth=2)
+    a1.loglog(ranks, [z["c"] * r ** (-z["s"]) for r in ranks], "--", label=f"Fit: C*r^(-s), s={z['s']:.3f}")
+    a1.set_title("Zipf's law: rank-df (log-log)")
+    a1.set_xlabel("Rank r")
+    a1.set_ylabel("df(r)")
+    a1.legend()
+    ns = [n for n, _ in st["growth"]]
+    a2.loglog(ns, [v for _, v in st["growth"]], label="Distinct terms", linewidth=2)
+    a2.loglog(ns, [h["k"] * n ** h["beta"] for n in ns], "--", label=f"Fit: K*n^beta, beta={h['beta']:.3f}")
+    a2.set_title("Heaps' law: vocabulary growth (log-log)")
+    a2.set_xlabel("Postings n")
+    a2.set_ylabel("V(n)")
+    a2.legend()
+    for a in (a1, a2):
+        a.grid(True, which="both", linestyle=":", linewidth=0.5)
+    fig.tight_layout()
+    fig.savefig(out, dpi=200)
+    print(f"Saved plot to {out}")
+
+
 def main():
     ap = argparse.ArgumentParser()
-    ap.add_argument("--uri", required=True, help="Mongo URI, e.g. mongodb://localhost:27017 or mongodb://mongo:27017")
-    ap.add_argument("--db", required=True)
-    ap.add_argument("--coll", required=True)
+    ap.add_argument("--stats", help="JSON from bench/index_stats or the engine's :stats FILE; "
+                                    "plots the index's own statistics instead of re-tokenizing MongoDB")
+    ap.add_argument("--uri", help="Mongo URI, e.g. mongodb://localhost:27017 or mongodb://mongo:27017")
+    ap.add_argument("--db")
+    ap.add_argument("--coll")
     ap.add_argument("--field", default="text")
     ap.add_argument("--limit_docs", type=int, default=0, help="0 = all")
     ap.add_argument("--max_terms_plot", type=int, default=50000, help="max ranks to plot")
@@ -72,13 +131,25 @@ def main():
     ap.add_argument("--fit_r_max", type=int, default=20000)
     ap.add_argument("--out", default="zipf.png")
     args = ap.parse_args()
+    if args.stats:
+        plot_stats(args.stats, args.out)
+        return
+    if not (args.uri and args.db and args.coll):
+        ap.error("--uri, --db and --coll are required without --stats")
 
     cnt = Counter()
     docs = 0
+    tokens = 0
+    lengths = []
+    growth = []
 
     for text in load_terms_from_mongo(args.uri, args.db, args.coll, args.field, args.limit_docs):
         docs += 1
-        cnt.update(tokenize(text))
+        toks = tokenize(text)
+        cnt.update(toks)
+        tokens += len(toks)
+        lengths.append(len(toks))
+        growth.append((tokens, len(cnt)))
         if docs % 1000 == 0:
             print(f"processed docs: {docs}, unique terms: {len(cnt)}")
 
@@ -105,6 +176,14 @@ def main():
         zipf_fit = None
         print("Not enough data to fit Zipf.")
 
+    heaps = fit_heaps(growth)
+    lens = fit_lengths(lengths)
+    if fit and heaps and lens:
+        print(f"Fitted Heaps: V(n) = {heaps[0]:.3g} * n^{heaps[1]:.3f}")
+        print(f"Doc length: log-normal mu={lens[0]:.3f} sigma={lens[1]:.3f}")
+        print(f"bench/gen_corpus and bench/e2e parameters: --zipf-s {s:.3f} --heaps-k {heaps[0]:.3g} "
+              f"--heaps-beta {heaps[1]:.3f} --len-mu {lens[0]:.3f} --len-sigma {lens[1]:.3f}")
+
     plt.figure(figsize=(10, 7))
     plt.loglog(ranks, y, label="Corpus term frequencies", linewidth=2)
     plt.loglog(ranks, zipf1, "--", label="Zipf f(r)=f(1)/r", linewidth=2)